@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <cstdio>
 // pico
+#include "hardware/flash.h"
 #include "pico/stdio.h"
 #include "pico/stdio_usb.h"
 #include "pico/stdlib.h"
@@ -17,8 +18,15 @@
 #include "dcc_bitstream.h"
 #include "dcc_command.h"
 #include "dcc_cv.h"
+#include "dcc_cv_async.h"
+#include "dcc_cv_cache.h"
 #include "dcc_gpio_cfg.h"
+#include "dcc_latency.h"
+#include "dcc_ops_queue.h"
 #include "dcc_pkt.h"
+#include "dcc_program.h"
+#include "dcc_ramp.h"
+#include "dcc_roster.h"
 #include "dcc_throttle.h"
 #include "railcom.h"
 
@@ -32,10 +40,13 @@ typedef bool(loop_func)();
 
 static bool loop_nop();
 static bool loop_ops_cv_read();
+static bool loop_ops_cvs_read();
+static bool loop_svc_cvs_read();
 static bool loop_svc_cv_read();
 static bool loop_svc_cv_write();
-static bool loop_svc_address_read();
-static bool loop_svc_address_write();
+static bool loop_ops_cv_write();
+static bool loop_program();
+static bool loop_svc_address();
 
 static loop_func *active = &loop_nop;
 
@@ -52,26 +63,53 @@ static Argv argv;
 static bool cmd_try();
 static bool loco_try();
 static bool speed_try();
+static bool momentum_try();
 static bool function_try();
 static bool track_try();
+static bool estop_try();
+static bool acc_try();
+static bool consist_try();
+static bool roster_try();
+static bool trip_try();
+static bool profile_try();
 static bool cv_try();
+static bool cv_indexed_try();
+static bool cv_block_try();
+static bool queue_try();
+static bool cache_try();
+static bool program_try();
 static bool verbosity_try();
 static bool address_try();
+static bool railcom_try();
 static bool debug_try();
 
 static void cmd_help(bool verbose = false);
 static void loco_help(bool verbose = false);
 static void speed_help(bool verbose = false);
+static void momentum_help(bool verbose = false);
 static void function_help(bool verbose = false);
 static void track_help(bool verbose = false);
+static void estop_help(bool verbose = false);
+static void acc_help(bool verbose = false);
+static void consist_help(bool verbose = false);
+static void roster_help(bool verbose = false);
 static void cv_help(bool verbose = false);
+static void cv_block_help(bool verbose = false);
+static void queue_help(bool verbose = false);
+static void cache_help(bool verbose = false);
+static void program_help(bool verbose = false);
 static void verbosity_help(bool verbose = false);
 static void address_help(bool verbose = false);
+static void railcom_help(bool verbose = false);
 static void debug_help(bool verbose = false);
 static void param_help();
 static void print_help(bool verbose, const char *help_short,
                        const char *help_long);
 
+static bool cache_on();
+static void cache_set(int cv_num, uint8_t cv_val, DccCvCache::Trust trust);
+static void cache_forget(int cv_num);
+
 // Verbosity
 static bool cmd_show = true;
 
@@ -81,6 +119,11 @@ static DccAdc adc(dcc_adc_gpio);
 static DccCommand command(dcc_sig_gpio, dcc_pwr_gpio, -1, adc, dcc_rcom_uart,
                           dcc_rcom_gpio);
 static DccThrottle *throttle = nullptr;
+static DccAckMatched ack_matched(adc);
+static DccOpsQueue ops_queue(command);
+static DccCvAsync cv_async(command, ops_queue);
+static DccRamp ramp;
+static DccRoster roster;
 
 // When reading/writing CVs, the cv_num_g is set in one command and the read or
 // write command is in the next. Global statics are used to save them.
@@ -91,6 +134,35 @@ static int cv_val_g = DccPkt::cv_val_inv;
 
 static int address_g = DccPkt::address_inv;
 
+// Block read (B command); separate from cv_num_g so a block read doesn't
+// change the CV a single read or write is still using
+static int cv_blk_num_g = DccPkt::cv_num_inv;
+static int cv_cnt_g = 0;
+static uint8_t cv_vals_g[DccThrottle::read_cvs_max];
+static bool cv_oks_g[DccThrottle::read_cvs_max];
+static int cv_idx_g = 0;           // service mode: cv being read
+static uint64_t cv_op_us = 0;      // service mode: start of current cv
+static uint32_t cv_op_max_ms = 0;  // service mode: slowest cv
+
+// Service mode session (T SVC): ops done and when it started
+static int svc_ops_g = 0;
+static uint64_t svc_start_us = 0;
+
+// CV cache, kept in the last two sectors of flash. It is used for the decoder
+// selected with the K command (cache_address_g, cache_mfg_g); in ops mode,
+// only when that is the current loco.
+static DccCvStoreFlash cv_store(PICO_FLASH_SIZE_BYTES - 2 * FLASH_SECTOR_SIZE,
+                                2);
+static DccCvCache cv_cache(&cv_store);
+static int cache_address_g = -1;
+static int cache_mfg_g = -1;
+
+// Delta programming (P command) target list
+static DccProgram program(command, &cv_cache);
+static DccProgram::Item prog_items_g[DccProgram::item_max];
+static int prog_cnt_g = 0;
+static bool prog_run_g = false; // list has been run since it last changed
+
 // Throttle that issued the last ops mode cv read/write command
 static DccThrottle *ops_throttle_g = nullptr;
 
@@ -138,8 +210,13 @@ int main()
 
     adc.log_reset(); // logging must be enabled by calling adc.log_init()
 
+    cv_cache.load();
+
     throttle = command.create_throttle(); // default address 3
 
+    command.roster(&roster);
+    command.cv_async(&cv_async); // advanced consist CV19 writes
+
     if (cmd_show) {
         printf("\n");
         cmd_help(true);
@@ -178,6 +255,34 @@ int main()
             }
         }
 
+        // Queued ops mode cv operations run in the background; print each
+        // one as it completes. Operations with a callback (e.g. address read
+        // and write) are handled there instead.
+        cv_async.loop();
+        DccCvEvent ev;
+        while (cv_async.get_event(ev)) {
+            printf("Q %d %d ", ev.address, ev.cv_num);
+            if (ev.status == DccCvEvent::Status::OK)
+                printf("%u", uint(ev.value));
+            else
+                printf("ERROR");
+            if (cmd_show)
+                printf(" in %lu ms", usec_to_msec(ev.done_us - ev.queued_us));
+            printf("\n");
+        }
+
+        // Cache changes are written to flash when nothing else is going on
+        // and the track is off (writing flash stops the bit interrupt).
+        if (active == &loop_nop && command.mode() == DccCommand::Mode::OFF &&
+            cv_cache.dirty())
+            cv_cache.flush();
+
+        // move ramping locos toward their target speeds
+        ramp.loop();
+
+        // attribute track current samples to locos (if enabled)
+        command.profile().loop();
+
         // print anything that might have been logged
         BufLog::loop();
 
@@ -195,16 +300,36 @@ static bool cmd_try()
         return loco_try();
     else if (strcasecmp(argv[0], "S") == 0)
         return speed_try();
+    else if (strcasecmp(argv[0], "M") == 0)
+        return momentum_try();
     else if (strcasecmp(argv[0], "F") == 0)
         return function_try();
     else if (strcasecmp(argv[0], "T") == 0)
         return track_try();
+    else if (strcasecmp(argv[0], "E") == 0)
+        return estop_try();
+    else if (strcasecmp(argv[0], "W") == 0)
+        return acc_try();
+    else if (strcasecmp(argv[0], "N") == 0)
+        return consist_try();
+    else if (strcasecmp(argv[0], "O") == 0)
+        return roster_try();
     else if (strcasecmp(argv[0], "C") == 0)
         return cv_try();
+    else if (strcasecmp(argv[0], "B") == 0)
+        return cv_block_try();
+    else if (strcasecmp(argv[0], "Q") == 0)
+        return queue_try();
+    else if (strcasecmp(argv[0], "K") == 0)
+        return cache_try();
+    else if (strcasecmp(argv[0], "P") == 0)
+        return program_try();
     else if (strcasecmp(argv[0], "V") == 0)
         return verbosity_try();
     else if (strcasecmp(argv[0], "A") == 0)
         return address_try();
+    else if (strcasecmp(argv[0], "R") == 0)
+        return railcom_try();
     else if (strcasecmp(argv[0], "D") == 0)
         return debug_try();
     else
@@ -217,10 +342,20 @@ static void cmd_help(bool verbose)
     printf("Commands:\n");
     loco_help(verbose);
     speed_help(verbose);
+    momentum_help(verbose);
     function_help(verbose);
     track_help(verbose);
+    estop_help(verbose);
+    acc_help(verbose);
+    consist_help(verbose);
+    roster_help(verbose);
     cv_help(verbose);
+    cv_block_help(verbose);
+    queue_help(verbose);
+    cache_help(verbose);
+    program_help(verbose);
     address_help(verbose);
+    railcom_help(verbose);
     verbosity_help(verbose);
     debug_help(verbose);
     printf("\n");
@@ -280,6 +415,7 @@ static bool loco_try()
             }
 
             if (strcmp(argv[1], "-") == 0) {
+                ramp.remove(command.find_throttle(loco));
                 throttle = command.delete_throttle(loco);
                 printf("OK\n");
                 command.show();
@@ -318,7 +454,9 @@ static bool speed_try()
         return false;
     if (speed < DccPkt::speed_min || speed > DccPkt::speed_max)
         return false;
-    throttle->set_speed(speed);
+    // with momentum (M command), ramp to it
+    if (!ramp.set_target(throttle, speed))
+        throttle->set_speed(speed);
     printf("OK\n");
     return true;
 }
@@ -331,6 +469,66 @@ static void speed_help(bool verbose)
 }
 
 
+/*
+Momentum
+
+The command station ramps the current loco's speed toward what it is set to
+with "S <s>", instead of jumping to it. Rates are like decoder CV3/CV4: stop
+to full speed takes <n> * 0.896 seconds. "S ?" returns the speed being sent
+now, which lags the speed set while ramping.
+
+Commands:
+M <a> <d>      ramp current loco with accel <a> and decel <d> (0-255)
+M 0 0          no momentum for current loco
+M ?            show locos with momentum and ramp statistics
+*/
+
+static bool momentum_try()
+{
+    int num_args = argv.argc();
+
+    if (num_args == 2) {
+        if (strcmp(argv[1], "?") == 0) {
+            ramp.show();
+            return true;
+        }
+        return false;
+    }
+
+    if (num_args != 3)
+        return false;
+
+    int accel, decel;
+    if (!str_to_int(argv[1], &accel) || !str_to_int(argv[2], &decel))
+        return false;
+
+    if (accel < DccPkt::cv_val_min || accel > DccPkt::cv_val_max ||
+        decel < DccPkt::cv_val_min || decel > DccPkt::cv_val_max)
+        return false;
+
+    if (accel == 0 && decel == 0) {
+        // jump to wherever it was going
+        int target = ramp.get_target(throttle);
+        ramp.remove(throttle);
+        if (target != DccPkt::speed_inv)
+            throttle->set_speed(target);
+    } else if (!ramp.add(throttle, accel, decel)) {
+        return false;
+    }
+
+    printf("OK\n");
+    return true;
+}
+
+
+static void momentum_help(bool verbose)
+{
+    print_help(verbose, "M <a> <d>",
+               "ramp speed for current loco (0 0 for none)");
+    print_help(verbose, "M ?", "show momentum for all locos");
+}
+
+
 static bool function_try()
 {
     if (argv.argc() == 2) {
@@ -371,6 +569,24 @@ static bool function_try()
         throttle->set_function(func, setting);
         printf("OK\n");
         return true;
+    } else if (argv.argc() == 4 && strcasecmp(argv[1], "B") == 0) {
+        // binary state, sent as a burst (not refreshed)
+        int num;
+        if (!str_to_int(argv[2], &num))
+            return false;
+        if (num < DccPktBinState::num_min || num > DccPktBinState::num_max)
+            return false;
+        bool setting;
+        if (strcasecmp(argv[3], "ON") == 0)
+            setting = true;
+        else if (strcasecmp(argv[3], "OFF") == 0)
+            setting = false;
+        else
+            return false;
+        if (!throttle->set_binstate(num, setting))
+            return false;
+        printf("OK\n");
+        return true;
     } else {
         return false;
     }
@@ -383,189 +599,1186 @@ static void function_help(bool verbose)
     print_help(verbose, "F <f> ?", "get status of function f for current loco");
     print_help(verbose, "F <f> ON|OFF",
                "set a function for current loco on/off");
+    print_help(verbose, "F B <n> ON|OFF",
+               "set binary state n (0...32767) for current loco on/off");
 }
 
 
 static bool track_try()
 {
+    if (argv.argc() >= 3 && strcasecmp(argv[1], "TRIP") == 0)
+        return trip_try();
+
+    if (argv.argc() == 3 && strcasecmp(argv[1], "PROF") == 0)
+        return profile_try();
+
     if (argv.argc() != 2)
         return false;
 
     if (strcmp(argv[1], "?") == 0) {
-        printf("%s\n", command.mode() != DccCommand::Mode::OFF ? "ON" : "OFF");
+        if (command.svc_session())
+            printf("SVC\n");
+        else if (command.mode() != DccCommand::Mode::OFF)
+            printf("ON\n");
+        else
+            printf("OFF\n");
         return true;
     } else if (strcasecmp(argv[1], "ON") == 0) {
-        if (command.mode() == DccCommand::Mode::OFF)
+        if (command.mode() == DccCommand::Mode::OFF || command.svc_session())
             command.set_mode_ops();
         printf("OK\n");
         return true;
-    } else if (strcasecmp(argv[1], "OFF") == 0) {
+    } else if (strcasecmp(argv[1], "SVC") == 0) {
         if (command.mode() == DccCommand::Mode::OPS)
             command.set_mode_off();
+        if (!command.svc_session()) {
+            adc.log_reset();
+            command.svc_session_start();
+            svc_ops_g = 0;
+            svc_start_us = time_us_64();
+        }
         printf("OK\n");
         return true;
+    } else if (strcasecmp(argv[1], "OFF") == 0) {
+        bool session = command.svc_session();
+        if (command.mode() != DccCommand::Mode::OFF)
+            command.set_mode_off();
+        printf("OK");
+        if (session && cmd_show) {
+            printf(" (%d ops in %lu ms)", svc_ops_g,
+                   usec_to_msec(time_us_64() - svc_start_us));
+        }
+        printf("\n");
+        return true;
     } else {
         return false;
     }
 }
 
 
+// T TRIP ?          show overcurrent protection settings and recent trips
+// T TRIP ON|OFF     enable/disable overcurrent protection
+// T TRIP <m> <u>    trip when current is at least <m> ma for <u> usec
+
+static bool trip_try()
+{
+    DccProtect &protect = command.protect();
+
+    if (argv.argc() == 3) {
+        if (strcmp(argv[2], "?") == 0) {
+            protect.show();
+            return true;
+        } else if (strcasecmp(argv[2], "ON") == 0) {
+            protect.enable(true);
+            printf("OK\n");
+            return true;
+        } else if (strcasecmp(argv[2], "OFF") == 0) {
+            protect.enable(false);
+            printf("OK\n");
+            return true;
+        }
+        return false;
+    }
+
+    if (argv.argc() != 4)
+        return false;
+
+    int trip_ma;
+    if (!str_to_int(argv[2], &trip_ma))
+        return false;
+    if (trip_ma < 1 || trip_ma > UINT16_MAX)
+        return false;
+
+    int trip_us;
+    if (!str_to_int(argv[3], &trip_us))
+        return false;
+    if (trip_us < 0 || trip_us > 1000000)
+        return false;
+
+    protect.config(trip_ma, trip_us);
+    printf("OK\n");
+    return true;
+}
+
+
+// T PROF ?          show track current by loco address
+// T PROF ON|OFF     enable/disable track current profiling
+// T PROF 0          clear track current profile
+
+static bool profile_try()
+{
+    DccProfile &profile = command.profile();
+
+    if (strcmp(argv[2], "?") == 0) {
+        profile.show();
+        return true;
+    } else if (strcasecmp(argv[2], "ON") == 0) {
+        profile.enable(true);
+        printf("OK\n");
+        return true;
+    } else if (strcasecmp(argv[2], "OFF") == 0) {
+        profile.enable(false);
+        printf("OK\n");
+        return true;
+    } else if (strcmp(argv[2], "0") == 0) {
+        profile.reset();
+        printf("OK\n");
+        return true;
+    }
+
+    return false;
+}
+
+
 static void track_help(bool verbose)
 {
     print_help(verbose, "T ?", "get track power status");
     print_help(verbose, "T ON|OFF", "turn track power on/off");
+    print_help(verbose, "T SVC",
+               "power on for a series of service mode operations");
+    print_help(verbose, "T TRIP ?", "show overcurrent settings and trips");
+    print_help(verbose, "T TRIP ON|OFF", "enable/disable overcurrent trip");
+    print_help(verbose, "T TRIP <m> <u>",
+               "trip at <m> ma for <u> usec (ops mode)");
+    print_help(verbose, "T PROF ?", "show track current by loco");
+    print_help(verbose, "T PROF ON|OFF", "enable/disable current profiling");
+    print_help(verbose, "T PROF 0", "clear current profile");
 }
 
 
 /*
-CV Access
+Emergency Stop
 
-CV access can be done in either service mode or operations mode. The mode
-used depends on the current command station mode (set with the "T" command).
-If the command station is powered off, service mode is used. If the command
-station is powered on, operations mode is used.
+Stop all locos now with broadcast e-stop packets, which go out ahead of
+anything else (at most one packet later). All throttles are left at speed 0.
+Optionally, track power is cut a while after the e-stop.
 
 Commands:
-C <c> ?        read CV <c>
-C <c> <b> ?    read CV <c> bit <b>
-C <c> <v>      write CV <c> = <v>
-C <c> <b> <v>  write CV <c> bit <b> = <v>
-Parameters:
-1 <= c <= 1024
-0 <= b <= 7
--127 <= v <= +255 for byte writes
-0 <= v <= 1 for bit writes
+E              emergency stop
+E OFF          end emergency stop (power back on if it was cut)
+E ?            show e-stop state, count, and latency (last/max/bound)
+E PWR <m>      cut track power <m> ms after an e-stop
+E PWR OFF      leave track power on after an e-stop
 */
 
-static bool cv_try()
+static bool estop_try()
 {
     int num_args = argv.argc();
 
-    if (num_args != 3 && num_args != 4)
-        return false;
+    if (num_args == 1) {
+        command.estop(); // ramps see it and stop
+        printf("OK\n");
+        return true;
+    }
 
-    if (!str_to_int(argv[1], &cv_num_g))
+    if (num_args == 2) {
+        if (strcmp(argv[1], "?") == 0) {
+            printf("%s", command.estop_active() ? "ON" : "OFF");
+            if (cmd_show) {
+                printf(" (%lu e-stops, latency %lu us, max %lu us, "
+                       "bound %lu us; power off ",
+                       command.estop_cnt(), command.estop_latency_us(),
+                       command.estop_latency_max_us(),
+                       DccCommand::estop_latency_bound_us);
+                if (command.estop_power_off_ms() < 0)
+                    printf("never)");
+                else
+                    printf("after %d ms)", command.estop_power_off_ms());
+            }
+            printf("\n");
+            return true;
+        } else if (strcasecmp(argv[1], "OFF") == 0) {
+            command.estop_clear();
+            printf("OK\n");
+            return true;
+        }
         return false;
+    }
 
-    if (cv_num_g < DccPkt::cv_num_min || cv_num_g > DccPkt::cv_num_max)
+    if (num_args != 3 || strcasecmp(argv[1], "PWR") != 0)
         return false;
 
-    if (strcmp(argv[num_args - 1], "?") == 0) {
-        // read byte or bit
-        if (command.mode() == DccCommand::Mode::OPS) {
-            // ops mode read using railcom
-            if (num_args != 3)
-                return false; // there is no ops read-bit command
-            // read byte
-            throttle->read_cv(cv_num_g);
-            ops_throttle_g = throttle;
-            active = &loop_ops_cv_read;
-        } else if (command.mode() == DccCommand::Mode::OFF) {
-            // service mode, read the old-timey way
-            adc.log_reset();
-            if (num_args == 3) {
-                // read byte
-                cv_bit_g = -1;
-                command.read_cv(cv_num_g);
-            } else {
-                assert(num_args == 4);
-                // read bit
-                if (!str_to_int(argv[2], &cv_bit_g))
-                    return false;
-                if (cv_bit_g < 0 || cv_bit_g > 7)
-                    return false;
-                command.read_bit(cv_num_g, cv_bit_g);
-            }
-            active = &loop_svc_cv_read;
-        }
-        start_us = time_us_64();
-        // print OK/ERROR when done
-        return true;
+    if (strcasecmp(argv[2], "OFF") == 0) {
+        command.estop_power_off_ms(-1);
     } else {
-        // write byte or bit
-        if (num_args == 3) {
-            // write byte
-            if (!str_to_int(argv[2], &cv_val_g))
-                return false;
-            if (cv_val_g < DccPkt::cv_val_min ||
-                cv_val_g > DccPkt::cv_val_max) {
-                return false;
-            }
-            cv_bit_g = -1;
-            // use svc mode if not already in ops mode
-            if (command.mode() == DccCommand::Mode::OPS) {
-                // ops mode
-                throttle->write_cv(cv_num_g, cv_val_g);
-                printf("OK\n");
-            } else {
-                // service mode
-                assert(command.mode() == DccCommand::Mode::OFF);
-                // print OK/ERROR when done
-                adc.log_reset();
-                command.write_cv(cv_num_g, cv_val_g);
-                active = &loop_svc_cv_write;
-                start_us = time_us_64();
-            }
-            return true;
-
-        } else {
-            // write bit
-            assert(num_args == 4);
-            if (!str_to_int(argv[2], &cv_bit_g))
-                return false;
-            if (cv_bit_g < 0 || cv_bit_g > 7)
-                return false;
-            if (!str_to_int(argv[3], &cv_val_g))
-                return false;
-            if (cv_val_g != 0 && cv_val_g != 1)
-                return false;
-
-            // use svc mode if not already in ops mode
-            if (command.mode() == DccCommand::Mode::OPS) {
-                // ops mode
-                throttle->write_bit(cv_num_g, cv_bit_g, cv_val_g);
-                printf("OK\n");
-            } else {
-                // service mode
-                assert(command.mode() == DccCommand::Mode::OFF);
-                // print OK/ERROR when done
-                adc.log_reset();
-                command.write_bit(cv_num_g, cv_bit_g, cv_val_g);
-                active = &loop_svc_cv_write;
-                start_us = time_us_64();
-            }
-            return true;
-        }
+        int ms;
+        if (!str_to_int(argv[2], &ms) || ms < 0 || ms > 60000)
+            return false;
+        command.estop_power_off_ms(ms);
     }
+
+    printf("OK\n");
+    return true;
 }
 
 
-static void cv_help(bool verbose)
+static void estop_help(bool verbose)
 {
-    print_help(verbose, "C <c> ?", "read cv number <c>");
-    print_help(verbose, "C <c> <b> ?", "read cv number <c> bit <b>");
-    print_help(verbose, "C <c> <v>", "write cv number <c> with value <v>");
-    print_help(verbose, "C <c> <b> 0|1",
-               "write cv number <n> bit <b> with 0/1");
+    print_help(verbose, "E", "emergency stop all locos");
+    print_help(verbose, "E OFF", "end emergency stop");
+    print_help(verbose, "E ?", "show emergency stop state and latency");
+    print_help(verbose, "E PWR <m>|OFF",
+               "cut track power <m> ms after e-stop, or not");
 }
 
 
-static bool verbosity_try()
+/*
+Accessories
+
+Turnout (basic) and signal (extended) accessory commands. Each is sent a few
+times and then stops; queued commands go out interleaved with loco packets.
+A command for an output already queued replaces it. Addresses are RCN-213
+accessory addresses (1-2040).
+
+Commands:
+W <a> <o>      set accessory <a> output <o> (0 or 1) on
+W <a> <o> OFF  set accessory <a> output <o> off
+W X <a> <x>    set extended accessory <a> to aspect <x> (0-255)
+W REP <n>      send each command <n> times
+W GAP <n>      send at least <n> loco packets between accessory packets
+W ?            show queue and statistics (and reset statistics)
+*/
+
+static bool acc_try()
 {
-    if (argv.argc() != 3) {
-        // wrong number of arguments
-        return false;
+    int num_args = argv.argc();
+
+    if (num_args == 2 && strcmp(argv[1], "?") == 0) {
+        printf("%d", command.acc_pending());
+        if (cmd_show) {
+            printf(" (%lu commands, %lu replaced, %lu packets, %lu done, "
+                   "latency %lu us, max %lu us; repeat %d, gap %d)",
+                   command.acc_cmd_cnt(), command.acc_coalesce_cnt(),
+                   command.acc_pkt_cnt(), command.acc_done_cnt(),
+                   command.acc_latency_us(), command.acc_latency_max_us(),
+                   command.acc_repeat(), command.acc_gap());
+        }
+        printf("\n");
+        command.acc_reset_stats();
+        return true;
     }
 
-    if (strcasecmp(argv[1], "C") == 0) {
-        if (strcasecmp(argv[2], "ON") == 0) {
-            cmd_show = true;
-            argv.verbosity(1);
-            printf("OK\n");
-            return true;
-        } else if (strcasecmp(argv[2], "OFF") == 0) {
-            cmd_show = false;
-            argv.verbosity(0);
+    if (num_args == 3 && (strcasecmp(argv[1], "REP") == 0 ||
+                          strcasecmp(argv[1], "GAP") == 0)) {
+        int n;
+        if (!str_to_int(argv[2], &n) || n < 0 || n > 255)
+            return false;
+        if (strcasecmp(argv[1], "REP") == 0) {
+            if (n == 0)
+                return false;
+            command.acc_repeat(n);
+        } else {
+            command.acc_gap(n);
+        }
+        printf("OK\n");
+        return true;
+    }
+
+    if (num_args == 4 && strcasecmp(argv[1], "X") == 0) {
+        int adrs, aspect;
+        if (!str_to_int(argv[2], &adrs) || !str_to_int(argv[3], &aspect))
+            return false;
+        if (!command.acc_aspect(adrs, aspect))
+            return false;
+        printf("OK\n");
+        return true;
+    }
+
+    if (num_args != 3 && num_args != 4)
+        return false;
+
+    int adrs, out;
+    if (!str_to_int(argv[1], &adrs) || !str_to_int(argv[2], &out))
+        return false;
+
+    bool on = true;
+    if (num_args == 4) {
+        if (strcasecmp(argv[3], "OFF") != 0)
+            return false;
+        on = false;
+    }
+
+    if (!command.acc_set(adrs, out, on))
+        return false;
+
+    printf("OK\n");
+    return true;
+}
+
+
+static void acc_help(bool verbose)
+{
+    print_help(verbose, "W <a> <o> [OFF]",
+               "set accessory <a> output <o> (0|1) on (or off)");
+    print_help(verbose, "W X <a> <x>", "set extended accessory aspect");
+    print_help(verbose, "W REP|GAP <n>",
+               "accessory repeats, or loco packets between");
+    print_help(verbose, "W ?", "show accessory queue and statistics");
+}
+
+
+/*
+Consists
+
+A consist is named by its address. An advanced consist's address (1-127) is
+programmed into each member's CV19 and carries the speed for all of them. A
+station consist's address is its first member's, and setting its speed sets
+each member's (reversed members run the other way). Members get throttles
+if they don't have them. CV19 writes are queued like Q commands, and each
+one's result is printed the same way ("Q <a> 19 <v>" or "Q <a> 19 ERROR").
+
+Commands:
+N A <c>        create advanced consist <c>
+N S <c>        create station consist, first member <c>
+N - <c>        delete consist <c> (advanced members' CV19 set back to 0)
+N <c> + <a> [R] add loco <a> to consist <c>, reversed or not
+N <c> - <a>    remove loco <a> from consist <c>
+N <c> <s>      set consist <c> speed
+N ?            show consists
+*/
+
+static bool consist_try()
+{
+    int num_args = argv.argc();
+
+    if (num_args == 2) {
+        if (strcmp(argv[1], "?") == 0) {
+            command.consist_show();
+            return true;
+        }
+        return false;
+    }
+
+    int c;
+
+    if (num_args == 3 && (strcasecmp(argv[1], "A") == 0 ||
+                          strcasecmp(argv[1], "S") == 0 ||
+                          strcmp(argv[1], "-") == 0)) {
+        if (!str_to_int(argv[2], &c))
+            return false;
+        bool ok;
+        if (strcmp(argv[1], "-") == 0)
+            ok = command.consist_delete(c);
+        else
+            ok = command.consist_create(c, strcasecmp(argv[1], "A") == 0);
+        if (!ok)
+            return false;
+        printf("OK\n");
+        return true;
+    }
+
+    if (!str_to_int(argv[1], &c))
+        return false;
+
+    if (num_args == 3) {
+        int speed;
+        if (!str_to_int(argv[2], &speed) || !command.consist_speed(c, speed))
+            return false;
+        printf("OK\n");
+        return true;
+    }
+
+    if (num_args != 4 && num_args != 5)
+        return false;
+
+    int loco;
+    if (!str_to_int(argv[3], &loco))
+        return false;
+
+    bool ok;
+    if (strcmp(argv[2], "+") == 0) {
+        bool reversed = false;
+        if (num_args == 5) {
+            if (strcasecmp(argv[4], "R") != 0)
+                return false;
+            reversed = true;
+        }
+        ok = command.consist_add(c, loco, reversed);
+    } else if (strcmp(argv[2], "-") == 0 && num_args == 4) {
+        ok = command.consist_remove(c, loco);
+    } else {
+        return false;
+    }
+
+    if (!ok)
+        return false;
+
+    printf("OK\n");
+    return true;
+}
+
+
+static void consist_help(bool verbose)
+{
+    print_help(verbose, "N A|S <c>", "create advanced or station consist");
+    print_help(verbose, "N - <c>", "delete consist");
+    print_help(verbose, "N <c> + <a> [R]", "add loco to consist (reversed)");
+    print_help(verbose, "N <c> - <a>", "remove loco from consist");
+    print_help(verbose, "N <c> <s>", "set consist speed");
+    print_help(verbose, "N ?", "show consists");
+}
+
+
+/*
+Roster
+
+Locos kept in the roster (DccRoster) instead of having throttles. They only
+get speed and f0-f31, with no railcom or CV access, but take a few bytes each
+and a parked one is refreshed now and then, so there can be a lot of them.
+
+Commands:
+O <a> <s>          set roster loco <a> speed (added if not there)
+O <a> F <f> ON|OFF set roster loco <a> function <f> on or off
+O - <a>            remove loco <a> from roster
+O ?                show roster
+*/
+
+static bool roster_try()
+{
+    int num_args = argv.argc();
+
+    if (num_args == 2) {
+        if (strcmp(argv[1], "?") != 0)
+            return false;
+        roster.show();
+        return true;
+    }
+
+    int adrs;
+
+    if (num_args == 3 && strcmp(argv[1], "-") == 0) {
+        if (!str_to_int(argv[2], &adrs) || !roster.remove(roster.find(adrs)))
+            return false;
+        printf("OK\n");
+        return true;
+    }
+
+    if (!str_to_int(argv[1], &adrs))
+        return false;
+
+    if (num_args == 3) {
+        int speed;
+        if (!str_to_int(argv[2], &speed))
+            return false;
+        if (speed < DccPkt::speed_min || speed > DccPkt::speed_max)
+            return false;
+        if (!roster.set_speed(roster.add(adrs), speed))
+            return false;
+        printf("OK\n");
+        return true;
+    }
+
+    if (num_args != 5 || strcasecmp(argv[2], "F") != 0)
+        return false;
+
+    int func;
+    if (!str_to_int(argv[3], &func))
+        return false;
+    if (func < DccPkt::function_min || func > DccRoster::func_max)
+        return false;
+    bool on;
+    if (strcasecmp(argv[4], "ON") == 0)
+        on = true;
+    else if (strcasecmp(argv[4], "OFF") == 0)
+        on = false;
+    else
+        return false;
+    if (!roster.set_function(roster.add(adrs), func, on))
+        return false;
+
+    printf("OK\n");
+    return true;
+}
+
+
+static void roster_help(bool verbose)
+{
+    print_help(verbose, "O <a> <s>", "set roster loco speed");
+    print_help(verbose, "O <a> F <f> ON|OFF", "set roster loco function");
+    print_help(verbose, "O - <a>", "remove loco from roster");
+    print_help(verbose, "O ?", "show roster");
+}
+
+
+/*
+CV Access
+
+CV access can be done in either service mode or operations mode. The mode
+used depends on the current command station mode (set with the "T" command).
+If the command station is powered off, service mode is used. If the command
+station is powered on, operations mode is used. "T SVC" powers on for a
+service mode session, where service mode operations are done one after the
+other without powering off between them.
+
+Commands:
+C <c> ?        read CV <c>
+C <c> ?? [<g>] fast read CV <c>, trying value <g> first if given (svc mode)
+C <c> <b> ?    read CV <c> bit <b>
+C <c> <v>      write CV <c> = <v>
+C <c> <b> <v>  write CV <c> bit <b> = <v>
+C <c> <h> <l> ?    read indexed CV <c> with CV31 = <h>, CV32 = <l>
+C <c> <h> <l> <v>  write indexed CV <c> = <v> with CV31 = <h>, CV32 = <l>
+Parameters:
+1 <= c <= 1024 (257 <= c <= 512 for indexed)
+0 <= b <= 7
+-127 <= v <= +255 for byte writes
+0 <= v <= 1 for bit writes
+0 <= h, l <= 255
+
+For indexed CVs, CV31 and CV32 are only written if the decoder doesn't
+already have them (as far as we know: in ops mode, for the current loco;
+in service mode, within a "T SVC" session).
+*/
+
+static bool cv_try()
+{
+    int num_args = argv.argc();
+
+    if (num_args == 5)
+        return cv_indexed_try();
+
+    if (num_args != 3 && num_args != 4)
+        return false;
+
+    if (!str_to_int(argv[1], &cv_num_g))
+        return false;
+
+    if (cv_num_g < DccPkt::cv_num_min || cv_num_g > DccPkt::cv_num_max)
+        return false;
+
+    if (strcmp(argv[2], "??") == 0) {
+        // fast read byte, service mode only
+        if (command.mode() == DccCommand::Mode::OPS)
+            return false;
+        int guess = -1;
+        if (num_args == 4) {
+            if (!str_to_int(argv[3], &guess))
+                return false;
+            if (guess < 0 || guess > 255)
+                return false;
+        }
+        if (guess < 0 && cache_on()) {
+            // anything cached makes a good guess, even if not trusted
+            uint8_t val;
+            DccCvCache::Trust trust;
+            if (cv_cache.get(cache_address_g, cache_mfg_g, cv_num_g, val,
+                             trust))
+                guess = val;
+        }
+        adc.log_reset();
+        svc_ops_g++;
+        cv_bit_g = -1;
+        command.read_cv(cv_num_g, true, guess);
+        active = &loop_svc_cv_read;
+        start_us = time_us_64();
+        // print value or ERROR when done
+        return true;
+    }
+
+    if (strcmp(argv[num_args - 1], "?") == 0) {
+        // read byte or bit
+        uint8_t val;
+        if (num_args == 3 && cache_on() &&
+            cv_cache.lookup(cache_address_g, cache_mfg_g, cv_num_g, val)) {
+            printf("%u", uint(val));
+            if (cmd_show)
+                printf(" (0x%02x) cached", uint(val));
+            printf("\n");
+            return true;
+        }
+        if (command.mode() == DccCommand::Mode::OPS) {
+            // ops mode read using railcom
+            if (num_args != 3)
+                return false; // there is no ops read-bit command
+            // read byte
+            throttle->read_cv(cv_num_g);
+            ops_throttle_g = throttle;
+            active = &loop_ops_cv_read;
+        } else {
+            // service mode, read the old-timey way
+            assert(command.mode() == DccCommand::Mode::OFF ||
+                   command.svc_session());
+            adc.log_reset();
+            svc_ops_g++;
+            if (num_args == 3) {
+                // read byte
+                cv_bit_g = -1;
+                command.read_cv(cv_num_g);
+            } else {
+                assert(num_args == 4);
+                // read bit
+                if (!str_to_int(argv[2], &cv_bit_g))
+                    return false;
+                if (cv_bit_g < 0 || cv_bit_g > 7)
+                    return false;
+                command.read_bit(cv_num_g, cv_bit_g);
+            }
+            active = &loop_svc_cv_read;
+        }
+        start_us = time_us_64();
+        // print OK/ERROR when done
+        return true;
+    } else {
+        // write byte or bit
+        if (num_args == 3) {
+            // write byte
+            if (!str_to_int(argv[2], &cv_val_g))
+                return false;
+            if (cv_val_g < DccPkt::cv_val_min ||
+                cv_val_g > DccPkt::cv_val_max) {
+                return false;
+            }
+            cv_bit_g = -1;
+            if (cache_on() && !cv_cache.write_needed(cache_address_g,
+                                                     cache_mfg_g, cv_num_g,
+                                                     cv_val_g)) {
+                printf("OK");
+                if (cmd_show)
+                    printf(" cached");
+                printf("\n");
+                return true;
+            }
+            // use svc mode if not already in ops mode
+            if (command.mode() == DccCommand::Mode::OPS) {
+                // ops mode
+                throttle->write_cv(cv_num_g, cv_val_g);
+                cache_forget(cv_num_g); // not confirmed
+                printf("OK\n");
+            } else {
+                // service mode
+                assert(command.mode() == DccCommand::Mode::OFF ||
+                       command.svc_session());
+                // print OK/ERROR when done
+                adc.log_reset();
+                svc_ops_g++;
+                command.write_cv(cv_num_g, cv_val_g);
+                active = &loop_svc_cv_write;
+                start_us = time_us_64();
+            }
+            return true;
+
+        } else {
+            // write bit
+            assert(num_args == 4);
+            if (!str_to_int(argv[2], &cv_bit_g))
+                return false;
+            if (cv_bit_g < 0 || cv_bit_g > 7)
+                return false;
+            if (!str_to_int(argv[3], &cv_val_g))
+                return false;
+            if (cv_val_g != 0 && cv_val_g != 1)
+                return false;
+
+            // use svc mode if not already in ops mode
+            if (command.mode() == DccCommand::Mode::OPS) {
+                // ops mode
+                throttle->write_bit(cv_num_g, cv_bit_g, cv_val_g);
+                cache_forget(cv_num_g); // not confirmed
+                printf("OK\n");
+            } else {
+                // service mode
+                assert(command.mode() == DccCommand::Mode::OFF ||
+                       command.svc_session());
+                // print OK/ERROR when done
+                adc.log_reset();
+                svc_ops_g++;
+                command.write_bit(cv_num_g, cv_bit_g, cv_val_g);
+                active = &loop_svc_cv_write;
+                start_us = time_us_64();
+            }
+            return true;
+        }
+    }
+}
+
+
+static bool cv_indexed_try()
+{
+    assert(argv.argc() == 5);
+
+    if (!str_to_int(argv[1], &cv_num_g))
+        return false;
+    if (cv_num_g < 257 || cv_num_g > 512)
+        return false;
+
+    int hi, lo;
+    if (!str_to_int(argv[2], &hi) || !str_to_int(argv[3], &lo))
+        return false;
+    if (hi < 0 || hi > 255 || lo < 0 || lo > 255)
+        return false;
+    int index = DccCv::index(hi, lo);
+
+    cv_bit_g = -1;
+
+    if (strcmp(argv[4], "?") == 0) {
+        // read
+        if (command.mode() == DccCommand::Mode::OPS) {
+            throttle->read_cv_indexed(index, cv_num_g);
+            ops_throttle_g = throttle;
+            active = &loop_ops_cv_read;
+        } else {
+            adc.log_reset();
+            svc_ops_g++;
+            command.read_cv_indexed(index, cv_num_g);
+            active = &loop_svc_cv_read;
+        }
+    } else {
+        // write
+        if (!str_to_int(argv[4], &cv_val_g))
+            return false;
+        if (cv_val_g < DccPkt::cv_val_min || cv_val_g > DccPkt::cv_val_max)
+            return false;
+        if (command.mode() == DccCommand::Mode::OPS) {
+            // unlike a plain ops write, wait for it (and the index writes)
+            throttle->write_cv_indexed(index, cv_num_g, cv_val_g);
+            ops_throttle_g = throttle;
+            active = &loop_ops_cv_write;
+        } else {
+            adc.log_reset();
+            svc_ops_g++;
+            command.write_cv_indexed(index, cv_num_g, cv_val_g);
+            active = &loop_svc_cv_write;
+        }
+    }
+
+    start_us = time_us_64();
+    // print value or OK/ERROR when done
+    return true;
+}
+
+
+static void cv_help(bool verbose)
+{
+    print_help(verbose, "C <c> ?", "read cv number <c>");
+    print_help(verbose, "C <c> ?? [<g>]",
+               "fast read cv number <c>, guessing <g> (svc mode)");
+    print_help(verbose, "C <c> <b> ?", "read cv number <c> bit <b>");
+    print_help(verbose, "C <c> <v>", "write cv number <c> with value <v>");
+    print_help(verbose, "C <c> <b> 0|1",
+               "write cv number <n> bit <b> with 0/1");
+    print_help(verbose, "C <c> <h> <l> ?",
+               "read cv number <c> with index cv31=<h>, cv32=<l>");
+    print_help(verbose, "C <c> <h> <l> <v>",
+               "write cv number <c> with index cv31=<h>, cv32=<l>");
+}
+
+
+/*
+CV Block Read
+
+Read a range of CVs. In operations mode, CVs are read four at a time using
+XPOM. In service mode, they are read one at a time; with track power off,
+each read powers the track up and down, and in a service mode session
+("T SVC") they are read back-to-back. The values are printed on one line; any
+CV that could not be read is printed as "-".
+
+Commands:
+B <c> <n>      read <n> CVs starting at CV <c>
+Parameters:
+1 <= c <= 1024
+1 <= n <= 256
+*/
+
+static bool cv_block_try()
+{
+    if (argv.argc() != 3)
+        return false;
+
+    if (!str_to_int(argv[1], &cv_blk_num_g))
+        return false;
+
+    if (!str_to_int(argv[2], &cv_cnt_g))
+        return false;
+
+    if (cv_blk_num_g < DccPkt::cv_num_min ||
+        cv_blk_num_g > DccPkt::cv_num_max)
+        return false;
+
+    if (cv_cnt_g < 1 || cv_cnt_g > DccThrottle::read_cvs_max)
+        return false;
+
+    if ((cv_blk_num_g + cv_cnt_g - 1) > DccPkt::cv_num_max)
+        return false;
+
+    start_us = time_us_64();
+
+    if (command.mode() == DccCommand::Mode::OPS) {
+        throttle->read_cvs(cv_blk_num_g, cv_cnt_g, cv_vals_g);
+        ops_throttle_g = throttle;
+        active = &loop_ops_cvs_read;
+    } else {
+        cv_idx_g = 0;
+        cv_op_us = start_us;
+        cv_op_max_ms = 0;
+        adc.log_reset();
+        command.read_cv(cv_blk_num_g);
+        svc_ops_g++;
+        active = &loop_svc_cvs_read;
+    }
+
+    // print values or ERROR when done
+    return true;
+}
+
+
+static void cv_block_help(bool verbose)
+{
+    print_help(verbose, "B <c> <n>", "read <n> cvs starting at <c>");
+}
+
+
+/*
+CV Queue
+
+Queue ops mode CV reads and writes for any loco that has a throttle. Queued
+operations for different locos run at the same time; each one's result is
+printed when it is done, as "Q <a> <c> <v>" or "Q <a> <c> ERROR". A write
+is only reported OK if the loco confirms it with railcom.
+
+Commands:
+Q <a> <c> ?    queue read of CV <c> on loco <a>
+Q <a> <c> <v>  queue write of CV <c> = <v> on loco <a>
+Q ?            show queue status and throughput
+Q 0            clear throughput statistics
+*/
+
+static bool queue_try()
+{
+    int num_args = argv.argc();
+
+    if (num_args == 2) {
+        if (strcmp(argv[1], "?") == 0) {
+            char buf[96];
+            printf("%s\n", ops_queue.show(buf, sizeof(buf)));
+            return true;
+        } else if (strcmp(argv[1], "0") == 0) {
+            ops_queue.reset_stats();
+            printf("OK\n");
+            return true;
+        }
+        return false;
+    }
+
+    if (num_args != 4)
+        return false;
+
+    if (command.mode() != DccCommand::Mode::OPS)
+        return false;
+
+    int address;
+    if (!str_to_int(argv[1], &address))
+        return false;
+
+    if (command.find_throttle(address) == nullptr)
+        return false;
+
+    int cv_num;
+    if (!str_to_int(argv[2], &cv_num))
+        return false;
+
+    if (strcmp(argv[3], "?") == 0) {
+        if (cv_async.ops_read_cv(address, cv_num) == 0)
+            return false;
+    } else {
+        int cv_val;
+        if (!str_to_int(argv[3], &cv_val))
+            return false;
+        if (cv_val < DccPkt::cv_val_min || cv_val > DccPkt::cv_val_max)
+            return false;
+        if (cv_async.ops_write_cv(address, cv_num, cv_val) == 0)
+            return false;
+    }
+
+    printf("OK\n");
+    return true;
+}
+
+
+static void queue_help(bool verbose)
+{
+    print_help(verbose, "Q <a> <c> ?", "queue read of cv <c> on loco <a>");
+    print_help(verbose, "Q <a> <c> <v>",
+               "queue write of cv <c> with value <v> on loco <a>");
+    print_help(verbose, "Q ?", "show cv queue status and throughput");
+    print_help(verbose, "Q 0", "clear cv queue throughput statistics");
+}
+
+
+/*
+CV Cache
+
+CV values are remembered for the decoder selected with "K <a> <m>", by its
+address and manufacturer id (CV8). While a decoder is selected, a CV read
+("C <c> ?") it already has a trusted value for (read or written) is answered
+without going to the track, and a write of the value it already has is
+skipped. Reads and writes keep the cache up to date. In ops mode the cache is
+only used when the selected decoder is the current loco.
+
+The cache is saved to flash when the track is off and no command is running,
+and loaded at startup.
+
+Commands:
+K <a> <m>          use the cache for decoder at address <a>, manufacturer <m>
+K ?                show cached CVs for the selected decoder
+K *                show all cached CVs
+K OFF              don't use the cache
+K 0                forget the selected decoder's CVs
+K DEF <c> <v>      CV <c> is assumed to be <v> (factory default)
+*/
+
+// True if the cache should be used for CVs on the track now.
+static bool cache_on()
+{
+    if (cache_address_g < 0)
+        return false;
+    if (command.mode() == DccCommand::Mode::OPS)
+        return throttle->get_address() == cache_address_g;
+    return true;
+}
+
+
+static void cache_set(int cv_num, uint8_t cv_val, DccCvCache::Trust trust)
+{
+    if (cache_on())
+        cv_cache.set(cache_address_g, cache_mfg_g, cv_num, cv_val, trust);
+}
+
+
+static void cache_forget(int cv_num)
+{
+    if (cache_on())
+        cv_cache.forget(cache_address_g, cache_mfg_g, cv_num);
+}
+
+
+static bool cache_try()
+{
+    int num_args = argv.argc();
+
+    if (num_args == 2) {
+        if (strcmp(argv[1], "?") == 0) {
+            if (cache_address_g < 0) {
+                printf("OFF\n");
+                return true;
+            }
+            cv_cache.show(cache_address_g, cache_mfg_g);
+            return true;
+        } else if (strcmp(argv[1], "*") == 0) {
+            cv_cache.show();
+            return true;
+        } else if (strcasecmp(argv[1], "OFF") == 0) {
+            cache_address_g = -1;
+            cache_mfg_g = -1;
+            printf("OK\n");
+            return true;
+        } else if (strcmp(argv[1], "0") == 0) {
+            if (cache_address_g < 0)
+                return false;
+            cv_cache.forget(cache_address_g, cache_mfg_g);
+            printf("OK\n");
+            return true;
+        }
+        return false;
+    }
+
+    if (num_args == 3) {
+        int address;
+        if (!str_to_int(argv[1], &address))
+            return false;
+        if (address < DccPkt::address_min || address > DccPkt::address_max)
+            return false;
+        int mfg;
+        if (!str_to_int(argv[2], &mfg))
+            return false;
+        if (mfg < 0 || mfg > 255)
+            return false;
+        cache_address_g = address;
+        cache_mfg_g = mfg;
+        printf("OK\n");
+        return true;
+    }
+
+    if (num_args == 4 && strcasecmp(argv[1], "DEF") == 0) {
+        if (cache_address_g < 0)
+            return false;
+        int cv_num;
+        if (!str_to_int(argv[2], &cv_num))
+            return false;
+        int cv_val;
+        if (!str_to_int(argv[3], &cv_val))
+            return false;
+        if (cv_val < DccPkt::cv_val_min || cv_val > DccPkt::cv_val_max)
+            return false;
+        if (!cv_cache.set(cache_address_g, cache_mfg_g, cv_num, cv_val,
+                          DccCvCache::Trust::DEFAULT))
+            return false;
+        printf("OK\n");
+        return true;
+    }
+
+    return false;
+}
+
+
+static void cache_help(bool verbose)
+{
+    print_help(verbose, "K <a> <m>",
+               "use cv cache for decoder <a> with manufacturer id <m>");
+    print_help(verbose, "K ?", "show cached cvs for selected decoder");
+    print_help(verbose, "K *", "show all cached cvs");
+    print_help(verbose, "K OFF", "don't use cv cache");
+    print_help(verbose, "K 0", "forget selected decoder's cached cvs");
+    print_help(verbose, "K DEF <c> <v>", "cv <c> is assumed to be <v>");
+}
+
+
+/*
+Delta Programming
+
+Build a list of target CV values, then set them on the decoder, only writing
+the ones that are not already right. Each CV's current value comes from the
+CV cache (K command) if it's there, otherwise it is read (in service mode, a
+fast read guessing the target value). Indexed CVs (257-512) are given with
+their CV31 and CV32; the list is done a page at a time so the index CVs are
+written as little as possible.
+
+In service mode (track off or "T SVC") the decoder on the program track is
+set; in ops mode (track on) it's the current loco. A line is printed as
+each CV is finished (with command output on), then OK if all were set or
+ERROR if any failed. If it's interrupted, "P GO <n>" starts again at item
+<n> of the sorted list.
+
+Commands:
+P + <c> <v>            add CV <c> = <v> to the list
+P + <c> <v> <h> <l>    add indexed CV <c> = <v> (CV31 = <h>, CV32 = <l>)
+P GO [<n>]             set CVs in the list (starting at item <n>)
+P STOP                 stop after the current CV
+P ?                    show list and results
+P 0                    clear list
+*/
+
+static void program_progress(const DccProgram &prog, int n, void *)
+{
+    if (!cmd_show)
+        return;
+    DccProgram::Item item;
+    DccProgram::Status status;
+    if (prog.item(n, item, status))
+        printf("%d/%d: cv %d = %u %s\n", n + 1, prog.item_cnt(), item.cv_num,
+               uint(item.cv_val), DccProgram::status_name(status));
+}
+
+
+static bool program_try()
+{
+    int num_args = argv.argc();
+
+    if (num_args == 2) {
+        if (strcmp(argv[1], "?") == 0) {
+            if (prog_run_g) {
+                program.show();
+            } else {
+                for (int i = 0; i < prog_cnt_g; i++)
+                    printf("cv %d = %u\n", prog_items_g[i].cv_num,
+                           uint(prog_items_g[i].cv_val));
+                printf("%d cvs\n", prog_cnt_g);
+            }
+            return true;
+        } else if (strcmp(argv[1], "0") == 0) {
+            if (program.busy())
+                return false;
+            prog_cnt_g = 0;
+            prog_run_g = false;
+            printf("OK\n");
+            return true;
+        } else if (strcasecmp(argv[1], "STOP") == 0) {
+            program.stop();
+            printf("OK\n");
+            return true;
+        }
+    }
+
+    if ((num_args == 2 || num_args == 3) && strcasecmp(argv[1], "GO") == 0) {
+        int first = 0;
+        if (num_args == 3 && !str_to_int(argv[2], &first))
+            return false;
+        if (cache_on())
+            program.cache_key(cache_address_g, cache_mfg_g);
+        else
+            program.cache_key(-1, -1);
+        program.on_progress(program_progress);
+        bool ok;
+        if (command.mode() == DccCommand::Mode::OPS)
+            ok = program.start_ops(throttle, prog_items_g, prog_cnt_g, first);
+        else
+            ok = program.start_svc(prog_items_g, prog_cnt_g, first);
+        if (!ok)
+            return false;
+        prog_run_g = true;
+        active = &loop_program;
+        // print OK/ERROR when done
+        return true;
+    }
+
+    if ((num_args == 4 || num_args == 6) && strcmp(argv[1], "+") == 0) {
+        if (prog_cnt_g >= DccProgram::item_max || program.busy())
+            return false;
+        DccProgram::Item &item = prog_items_g[prog_cnt_g];
+        int cv_val;
+        if (!str_to_int(argv[2], &item.cv_num))
+            return false;
+        if (!str_to_int(argv[3], &cv_val))
+            return false;
+        if (cv_val < DccPkt::cv_val_min || cv_val > DccPkt::cv_val_max)
+            return false;
+        item.cv_val = cv_val;
+        item.index = -1;
+        if (num_args == 6) {
+            int hi, lo;
+            if (!str_to_int(argv[4], &hi) || !str_to_int(argv[5], &lo))
+                return false;
+            if (hi < 0 || hi > 255 || lo < 0 || lo > 255)
+                return false;
+            item.index = DccCv::index(hi, lo);
+        }
+        prog_cnt_g++;
+        prog_run_g = false;
+        printf("OK\n");
+        return true;
+    }
+
+    return false;
+}
+
+
+static void program_help(bool verbose)
+{
+    print_help(verbose, "P + <c> <v> [<h> <l>]",
+               "add cv <c> = <v> (indexed by <h>/<l>) to program list");
+    print_help(verbose, "P GO [<n>]",
+               "set cvs in program list (starting at item <n>)");
+    print_help(verbose, "P STOP", "stop programming after current cv");
+    print_help(verbose, "P ?", "show program list and results");
+    print_help(verbose, "P 0", "clear program list");
+}
+
+
+static bool verbosity_try()
+{
+    if (argv.argc() != 3) {
+        // wrong number of arguments
+        return false;
+    }
+
+    if (strcasecmp(argv[1], "C") == 0) {
+        if (strcasecmp(argv[2], "ON") == 0) {
+            cmd_show = true;
+            argv.verbosity(1);
+            printf("OK\n");
+            return true;
+        } else if (strcasecmp(argv[2], "OFF") == 0) {
+            cmd_show = false;
+            argv.verbosity(0);
             printf("OK\n");
             return true;
         } else if (strcasecmp(argv[2], "?") == 0) {
@@ -642,8 +1855,6 @@ static void verbosity_help(bool verbose)
 }
 
 
-// All paths with expected output:
-//
 // Always two tokens; first is "A" and second is "?" to read or an integer to
 // write.
 //
@@ -651,39 +1862,12 @@ static void verbosity_help(bool verbose)
 // Address is long if it is > 127
 // Can't write a short address that uses the long-address registers.
 //
-// To write:
-//  Here:
-//      set address_g with address to write (long or short)
-//      if short:
-//          start write of address here:        cv_num_g = 1,  cv_val_g =
-//          address_g
-//      if long:
-//          start write of address_lo here:     cv_num_g = 18, cv_val_g =
-//          address_g & 0xff
-//  In loop_svc_address_write:
-//      if cv_num_g is 1 (address):
-//          start clearing of cv29[5]:          cv_num_g = 29, cv_val_g = 0
-//      else if cv_num_g is 18 (address_lo):
-//          start write of address_hi:          cv_num_g = 17, cv_val_g =
-//          (address >> 8) | 0xc0
-//      else if cv_num_g is 17 (address_hi):
-//          start setting of cv29[5]:           cv_num_g = 29, cv_val_g = 1
-//      else if cv_num_g is 29 (config):
-//          done (success)
-// To read:
-//  Here:
-//      start read of cv29[5]:                  cv_num_g = 29
-//  In loop_svc_addres_read:
-//      if cv_num_g is 29 (config):
-//          if cv29[5]=0, start read of cv1:    cv_num_g = 1
-//          if cv29[5]=1, start read of cv18:   cv_num_g = 18
-//      else if cv_num_g is 1 (address):
-//          done (success), address_g = value
-//      else if cv_num_g is 18 (address_lo):
-//          address_g = value
-//          start read of cv17:                 cv_num_g = 17
-//      else if cv_num_g is 17 (address_hi):
-//          done (success), address_g = address_g | (value & 0x3f) << 8
+// The read (CV29[5], then CV1 or CV18/CV17) or write (CV1 or CV18/CV17, then
+// CV29[5]) is one asynchronous operation; address_done() prints the result.
+
+static uint32_t address_h = 0; // pending address read or write
+
+static void address_done(const DccCvEvent &ev, void *arg);
 
 static bool address_try()
 {
@@ -692,16 +1876,12 @@ static bool address_try()
     if (argv.argc() != 2)
         return false;
 
-    if (command.mode() != DccCommand::Mode::OFF)
+    // service mode only (track off, or in a service mode session)
+    if (command.mode() != DccCommand::Mode::OFF && !command.svc_session())
         return false;
 
     if (strcmp(argv[1], "?") == 0) {
-        // Read CV29, and bit 5 tells us if it's a short or long address
-        // Bit 5 = 0: short address; read CV1
-        // Bit 5 = 1: long address; read CV17 and CV18
-        active = &loop_svc_address_read;
-        cv_num_g = DccCv::config;
-        command.read_bit(cv_num_g, 5);
+        address_h = cv_async.svc_read_address(&address_done);
     } else {
         if (!str_to_int(argv[1], &address_g))
             return false;
@@ -709,28 +1889,53 @@ static bool address_try()
             address_g > DccPkt::address_max) {
             return false;
         }
-        // Short address is <= 127
-        // Short address: write CV1, then clear CV29 bit 5
-        // Long address: write CV18 and CV17, then set CV29 bit 5
-        // Start the first write (CV1 or CV17) and let loop_svc_address_write
-        // figure out what to do next (based on cv_num_g).
-        if (address_g <= 127) {
-            cv_num_g = DccCv::address;
-            cv_val_g = address_g;
-        } else {
-            cv_num_g = DccCv::address_lo;
-            cv_val_g = address_g & 0xff;
-        }
-        active = &loop_svc_address_write;
-        command.write_cv(cv_num_g, cv_val_g);
+        address_h = cv_async.svc_write_address(address_g, &address_done);
     }
 
-    start_us = time_us_64();
+    if (address_h == 0)
+        return false;
+
+    active = &loop_svc_address;
     // print OK/ERROR when done
     return true;
 }
 
 
+static void address_done(const DccCvEvent &ev, void *)
+{
+    uint32_t op_ms = usec_to_msec(ev.done_us - ev.start_us);
+
+    if (ev.status != DccCvEvent::Status::OK) {
+        printf("ERROR");
+        if (cmd_show) {
+            bool read = (ev.op == DccCvEvent::Op::READ_ADDRESS);
+            printf(" %s cv%d", read ? "reading" : "writing", ev.cv_num);
+            if (ev.cv_num == DccCv::config)
+                printf("[5]");
+            printf(" in %lu ms", op_ms);
+        }
+        printf("\n");
+        return;
+    }
+
+    address_g = ev.value;
+    if (ev.op == DccCvEvent::Op::READ_ADDRESS)
+        printf("%d", address_g);
+    else
+        printf("OK");
+    if (cmd_show) {
+        if (address_g <= 127)
+            printf(" (short)");
+        else
+            printf(" (long)");
+        printf(" in %lu ms", op_ms);
+        if (ev.retries > 0)
+            printf(", %d retries", ev.retries);
+    }
+    printf("\n");
+}
+
+
 static void address_help(bool verbose)
 {
     print_help(verbose, "A ?", "read address from loco (long or short)");
@@ -738,11 +1943,120 @@ static void address_help(bool verbose)
 }
 
 
+// RailCom reception statistics
+// R ?          show statistics for all throttles
+// R 0          clear statistics for all throttles
+
+static bool railcom_try()
+{
+    if (argv.argc() != 2)
+        return false;
+
+    if (strcmp(argv[1], "?") == 0) {
+        command.show_rc_stats();
+        return true;
+    } else if (strcmp(argv[1], "0") == 0) {
+        command.reset_rc_stats();
+        printf("OK\n");
+        return true;
+    }
+
+    return false;
+}
+
+
+static void railcom_help(bool verbose)
+{
+    print_help(verbose, "R ?", "show railcom reception statistics per loco");
+    print_help(verbose, "R 0", "clear railcom reception statistics");
+}
+
+
 // Debug ADC (dump log)
 // D A
+// Service mode ack detector
+// D K ?        show detector and counts
+// D K T|M      use threshold or matched-filter detector
+// D I ?        show bitstream idle mode
+// D I ON|OFF   enable/disable bitstream idle mode
+// D L ?        show interrupt path latency
+// D L 0        clear interrupt path latency
+// D M ?        show late bit reloads
+// D M 0        clear late bit reloads
+// D M ON|OFF   abort packet on late bit reload, or not
 
 static bool debug_try()
 {
+    if (argv.argc() == 3 && strcasecmp(argv[1], "I") == 0) {
+        if (strcmp(argv[2], "?") == 0) {
+            printf("%s", command.idle_enabled() ? "ON" : "OFF");
+            if (cmd_show)
+                printf(" (%s, idle %lu times)",
+                       command.idle() ? "idle now" : "not idle",
+                       command.idle_cnt());
+            printf("\n");
+            return true;
+        } else if (strcasecmp(argv[2], "ON") == 0) {
+            command.idle_enable(true);
+            printf("OK\n");
+            return true;
+        } else if (strcasecmp(argv[2], "OFF") == 0) {
+            command.idle_enable(false);
+            printf("OK\n");
+            return true;
+        }
+        return false;
+    }
+
+    if (argv.argc() == 3 && strcasecmp(argv[1], "L") == 0) {
+        if (strcmp(argv[2], "?") == 0) {
+            DccLatency::show();
+            return true;
+        } else if (strcmp(argv[2], "0") == 0) {
+            DccLatency::reset();
+            printf("OK\n");
+            return true;
+        }
+        return false;
+    }
+
+    if (argv.argc() == 3 && strcasecmp(argv[1], "M") == 0) {
+        if (strcmp(argv[2], "?") == 0) {
+            command.late_show();
+            return true;
+        } else if (strcmp(argv[2], "0") == 0) {
+            command.late_reset();
+            printf("OK\n");
+            return true;
+        } else if (strcasecmp(argv[2], "ON") == 0) {
+            command.late_abort(true);
+            printf("OK\n");
+            return true;
+        } else if (strcasecmp(argv[2], "OFF") == 0) {
+            command.late_abort(false);
+            printf("OK\n");
+            return true;
+        }
+        return false;
+    }
+
+    if (argv.argc() == 3 && strcasecmp(argv[1], "K") == 0) {
+        if (strcmp(argv[2], "?") == 0) {
+            char buf[96];
+            printf("%s\n", command.ack_detector().show(buf, sizeof(buf)));
+            return true;
+        } else if (strcasecmp(argv[2], "T") == 0) {
+            command.ack_detector(nullptr); // default
+            printf("OK\n");
+            return true;
+        } else if (strcasecmp(argv[2], "M") == 0) {
+            command.ack_detector(&ack_matched);
+            printf("OK\n");
+            return true;
+        }
+        return false;
+    }
+
     if (argv.argc() != 2)
         return false;
 
@@ -760,6 +2074,18 @@ static bool debug_try()
 
 static void debug_help(bool verbose)
 {
+    print_help(verbose, "D K ?", "show service mode ack detector");
+    print_help(verbose, "D K T|M",
+               "use threshold or matched-filter ack detector");
+    print_help(verbose, "D I ?", "show bitstream idle mode");
+    print_help(verbose, "D I ON|OFF",
+               "DMA idle packets when there are no throttles, or not");
+    print_help(verbose, "D L ?", "show interrupt path latency (cycles)");
+    print_help(verbose, "D L 0", "clear interrupt path latency");
+    print_help(verbose, "D M ?", "show late bit reloads (missed deadlines)");
+    print_help(verbose, "D M 0", "clear late bit reloads");
+    print_help(verbose, "D M ON|OFF",
+               "abort packet on late bit reload, or not");
     if (adc.logging()) {
         print_help(verbose, "D A", "dump ADC log");
     }
@@ -846,6 +2172,7 @@ static bool loop_ops_cv_read()
 
     // it's always a byte read (there is no ops mode bit read)
     if (result) {
+        cache_set(cv_num_g, value, DccCvCache::Trust::READ);
         printf("%u", uint(value));
         if (cmd_show)
             printf(" (0x%02x) in %lu ms", uint(value), op_ms);
@@ -864,59 +2191,115 @@ static bool loop_ops_cv_read()
 }
 
 
-static bool loop_svc_cv_read()
+static bool loop_ops_cv_write()
 {
     bool result;
     uint8_t value;
-    if (!command.svc_done(result, value))
+
+    assert(ops_throttle_g != nullptr);
+    if (!ops_throttle_g->ops_done(result, value))
         return true; // keep going
 
     uint32_t op_ms = usec_to_msec(time_us_64() - start_us);
 
-    if (result) {
-        printf("%u", uint(value));
-        if (cmd_show) {
-            if (cv_bit_g < 0 || cv_bit_g > 7)
-                printf(" (0x%02x)", uint(value)); // byte read
-            printf(" in %lu ms", op_ms);
-        }
-        printf("\n");
-    } else {
+    printf(result ? "OK" : "ERROR");
+    if (cmd_show)
+        printf(" in %lu ms", op_ms);
+    printf("\n");
+
+    ops_throttle_g = nullptr;
+
+    return false; // done!
+}
+
+
+// print the result of a block read (B command)
+static void cvs_print(int cv_ok_cnt, uint32_t op_ms)
+{
+    if (cv_ok_cnt == 0) {
         printf("ERROR");
-        if (cmd_show)
-            printf(" in %lu ms", op_ms);
-        printf("\n");
+    } else {
+        for (int i = 0; i < cv_cnt_g; i++) {
+            if (i > 0)
+                printf(" ");
+            if (cv_oks_g[i])
+                printf("%u", uint(cv_vals_g[i]));
+            else
+                printf("-");
+        }
+    }
+    if (cmd_show)
+        printf(" (%d of %d) in %lu ms", cv_ok_cnt, cv_cnt_g, op_ms);
+}
+
+
+static bool loop_ops_cvs_read()
+{
+    int cv_ok_cnt;
+    uint64_t cv_ok;
+
+    assert(ops_throttle_g != nullptr);
+    if (!ops_throttle_g->read_cvs_done(cv_ok_cnt, &cv_ok))
+        return true; // keep going
+
+    uint32_t op_ms = usec_to_msec(time_us_64() - start_us);
+
+    for (int i = 0; i < cv_cnt_g; i++) {
+        cv_oks_g[i] = (cv_ok & (uint64_t(1) << (i / 4))) != 0;
+        if (cv_oks_g[i])
+            cache_set(cv_blk_num_g + i, cv_vals_g[i],
+                      DccCvCache::Trust::READ);
     }
 
+    cvs_print(cv_ok_cnt, op_ms);
+    printf("\n");
+
+    ops_throttle_g = nullptr;
+
     return false; // done!
 }
 
 
-static bool loop_svc_cv_write()
+static bool loop_svc_cvs_read()
 {
     bool result;
-    if (!command.svc_done(result))
+    uint8_t value;
+    if (!command.svc_done(result, value))
         return true; // keep going
 
-    uint32_t op_ms = usec_to_msec(time_us_64() - start_us);
-
-    if (result) {
-        printf("OK");
-        if (cmd_show)
-            printf(" in %lu ms", op_ms);
-        printf("\n");
-    } else {
-        printf("ERROR");
-        if (cmd_show)
-            printf(" in %lu ms", op_ms);
-        printf("\n");
+    uint64_t now_us = time_us_64();
+    uint32_t cv_ms = usec_to_msec(now_us - cv_op_us);
+    if (cv_ms > cv_op_max_ms)
+        cv_op_max_ms = cv_ms;
+
+    cv_vals_g[cv_idx_g] = value;
+    cv_oks_g[cv_idx_g] = result;
+    if (result)
+        cache_set(cv_blk_num_g + cv_idx_g, value, DccCvCache::Trust::READ);
+
+    if (++cv_idx_g < cv_cnt_g) {
+        // next cv
+        cv_op_us = now_us;
+        command.read_cv(cv_blk_num_g + cv_idx_g);
+        svc_ops_g++;
+        return true; // keep going
     }
 
+    int cv_ok_cnt = 0;
+    for (int i = 0; i < cv_cnt_g; i++)
+        if (cv_oks_g[i])
+            cv_ok_cnt++;
+
+    cvs_print(cv_ok_cnt, usec_to_msec(now_us - start_us));
+    if (cmd_show)
+        printf(", max %lu ms/cv", cv_op_max_ms);
+    printf("\n");
+
     return false; // done!
 }
 
 
-static bool loop_svc_address_read()
+static bool loop_svc_cv_read()
 {
     bool result;
     uint8_t value;
@@ -925,140 +2308,91 @@ static bool loop_svc_address_read()
 
     uint32_t op_ms = usec_to_msec(time_us_64() - start_us);
 
-    if (!result) {
-        printf("ERROR");
+    if (result) {
+        if (cv_bit_g < 0)
+            cache_set(cv_num_g, value, DccCvCache::Trust::READ);
+        printf("%u", uint(value));
         if (cmd_show) {
-            printf(" reading cv%d", cv_num_g);
-            if (cv_num_g == DccCv::config)
-                printf("[5]");
-            printf(" in %lu ms", op_ms);
+            if (cv_bit_g < 0 || cv_bit_g > 7)
+                printf(" (0x%02x)", uint(value)); // byte read
+            printf(" in %lu ms, %d packets", op_ms, command.svc_pkt_cnt());
         }
         printf("\n");
-        return false; // done!
-    }
-
-    if (cv_num_g == DccCv::config) {
-        // done reading the config bit
-        assert(value == 0 || value == 1);
-        if (cmd_show) {
-            printf("read cv%d[5] = %u in %lu ms\n", cv_num_g, uint(value),
-                   op_ms);
-        }
-        if (value == 0)
-            cv_num_g = DccCv::address; // short address, read it
-        else
-            cv_num_g = DccCv::address_lo; // long address, read lower half
-        command.read_cv(cv_num_g);
-        start_us = time_us_64();
-        return true; // keep going
     } else {
-        if (cmd_show) {
-            printf("read cv%d = %u (0x%02x) in %lu ms\n", cv_num_g, uint(value),
-                   uint(value), op_ms);
-        }
-        if (cv_num_g == DccCv::address) {
-            // short address, done
-            address_g = uint(value);
-            printf("%d", address_g);
-            if (cmd_show)
-                printf(" (short)");
-            printf("\n");
-            return false;
-        } else if (cv_num_g == DccCv::address_lo) {
-            // long address: save address_lo and read address_hi
-            address_g = uint(value);
-            cv_num_g = DccCv::address_hi;
-            command.read_cv(cv_num_g);
-            start_us = time_us_64();
-            return true; // keep going
-        } else {
-            assert(cv_num_g == DccCv::address_hi);
-            // long address, done
-            address_g |= (int(value & ~0xc0) << 8);
-            printf("%d", address_g);
-            if (cmd_show)
-                printf(" (long)");
-            printf("\n");
-            return false;
-        }
+        printf("ERROR");
+        if (cmd_show)
+            printf(" in %lu ms, %d packets", op_ms, command.svc_pkt_cnt());
+        printf("\n");
     }
+
+    return false; // done!
 }
 
 
-static bool loop_svc_address_write()
+static bool loop_svc_cv_write()
 {
     bool result;
     if (!command.svc_done(result))
         return true; // keep going
 
-    // one of the writes has finished
-
     uint32_t op_ms = usec_to_msec(time_us_64() - start_us);
 
-    assert(DccPkt::address_min <= address_g &&
-           address_g <= DccPkt::address_max);
-    assert(cv_num_g == DccCv::address || cv_num_g == DccCv::address_lo ||
-           cv_num_g == DccCv::address_hi || cv_num_g == DccCv::config);
+    if (result && cv_bit_g < 0) {
+        cache_set(cv_num_g, cv_val_g, DccCvCache::Trust::WRITTEN);
+    } else if (result) {
+        // update the bit if the rest of the byte is known
+        uint8_t val;
+        if (cache_on() &&
+            cv_cache.lookup(cache_address_g, cache_mfg_g, cv_num_g, val)) {
+            val = (val & ~(1 << cv_bit_g)) | (cv_val_g << cv_bit_g);
+            cache_set(cv_num_g, val, DccCvCache::Trust::WRITTEN);
+        }
+    } else {
+        cache_forget(cv_num_g); // who knows what it is now
+    }
 
-    if (!result) {
+    if (result) {
+        printf("OK");
+        if (cmd_show)
+            printf(" in %lu ms", op_ms);
+        printf("\n");
+    } else {
         printf("ERROR");
-        if (cmd_show) {
-            printf("ERROR writing cv%d", cv_num_g);
-            if (cv_num_g == DccCv::config)
-                printf("[5] = %u", uint(cv_val_g));
-            else
-                printf(" = %u (0x%02x)", uint(cv_val_g), uint(cv_val_g));
+        if (cmd_show)
             printf(" in %lu ms", op_ms);
-        }
         printf("\n");
-        return false; // done!
     }
 
-    if (cmd_show) {
-        printf("wrote cv%d", cv_num_g);
-        if (cv_num_g == DccCv::config)
-            printf("[5] = %u", uint(cv_val_g));
-        else
-            printf(" = %u (0x%02x)", uint(cv_val_g), uint(cv_val_g));
-        printf(" in %lu ms\n", op_ms);
-    }
+    return false; // done!
+}
 
-    if (cv_num_g == DccCv::address) {
-        // short address, and just wrote CV1 (address)
-        // clear CV29 bit 5
-        cv_num_g = DccCv::config;
-        cv_val_g = 0; // only used for an error message if needed
-        command.write_bit(cv_num_g, 5, 0);
-        start_us = time_us_64();
-        return true; // keep going
-    } else if (cv_num_g == DccCv::address_lo) {
-        cv_num_g = DccCv::address_hi;
-        cv_val_g = (address_g >> 8) | 0xc0;
-        command.write_cv(cv_num_g, cv_val_g);
-        start_us = time_us_64();
-        return true; // keep going
-    } else if (cv_num_g == DccCv::address_hi) {
-        // set CV29 bit 5
-        cv_num_g = DccCv::config;
-        cv_val_g = 1; // only used for an error message if needed
-        command.write_bit(cv_num_g, 5, 1);
-        start_us = time_us_64();
-        return true; // keep going
-    } else {
-        assert(cv_num_g == DccCv::config);
-    }
 
-    cv_num_g = DccPkt::cv_num_inv;
-    cv_val_g = DccPkt::cv_val_inv;
+static bool loop_program()
+{
+    program.loop();
+    if (program.busy())
+        return true; // keep going
 
-    printf("OK");
+    if (program.done_cnt() == program.item_cnt() && program.fail_cnt() == 0)
+        printf("OK");
+    else
+        printf("ERROR");
     if (cmd_show) {
-        if (address_g <= 127)
-            printf(" (short)");
-        else
-            printf(" (long)");
+        printf(" (%d written, %d skipped, %d failed) in %lu ms",
+               program.written_cnt(),
+               program.skip_cnt(), program.fail_cnt(), program.elapsed_ms());
+        printf("; %d writes, write-all would be %d",
+               program.write_cnt() + program.index_write_cnt(),
+               program.naive_write_cnt());
     }
     printf("\n");
 
     return false; // done!
 }
+
+
+static bool loop_svc_address()
+{
+    // address_done() prints the result
+    return cv_async.pending(address_h);
+}
@@ -11,6 +11,21 @@ verbosity_tests = [
 track_tests = [
     [ 'T', 'ERROR' ],           # argc != 2
     [ 'T X', 'ERROR' ],         # argv[1] invalid
+    [ 'T SVC', 'OK' ],
+    [ 'T ?', 'SVC' ],
+    [ 'T OFF', 'OK' ],
+    [ 'T TRIP', 'ERROR' ],      # argc < 3
+    [ 'T TRIP X', 'ERROR' ],    # argv[2] invalid
+    [ 'T TRIP 0 1000', 'ERROR' ], # trip_ma out of range
+    [ 'T TRIP 2000 -1', 'ERROR' ], # trip_us out of range
+    [ 'T TRIP 2000 1000', 'OK' ],
+    [ 'T TRIP OFF', 'OK' ],
+    [ 'T TRIP ON', 'OK' ],
+    [ 'T PROF', 'ERROR' ],      # argc != 3
+    [ 'T PROF X', 'ERROR' ],    # argv[2] invalid
+    [ 'T PROF ON', 'OK' ],
+    [ 'T PROF 0', 'OK' ],
+    [ 'T PROF OFF', 'OK' ],
     [ 'T 2', 'ERROR' ],         # argv[1] invalid
     [ 'T ON 0', 'ERROR' ],      # argc != 2
     [ 'T ON', 'OK' ],
@@ -19,6 +34,93 @@ track_tests = [
     [ 'T ?', 'OFF' ],
 ]
 
+estop_tests = [
+    [ 'T ON', 'OK' ],
+    [ 'E X', 'ERROR' ],         # argv[1] invalid
+    [ 'E PWR', 'ERROR' ],       # argc != 3
+    [ 'E PWR -1', 'ERROR' ],    # ms out of range
+    [ 'E PWR 500', 'OK' ],
+    [ 'S 50', 'OK' ],
+    [ 'E', 'OK' ],
+    [ 'E ?', 'ON' ],
+    [ 'S ?', '0' ],
+    [ 'E OFF', 'OK' ],
+    [ 'E ?', 'OFF' ],
+    [ 'E PWR OFF', 'OK' ],
+    [ 'T OFF', 'OK' ],
+]
+
+acc_tests = [
+    [ 'T ON', 'OK' ],
+    [ 'W', 'ERROR' ],           # argc < 2
+    [ 'W X', 'ERROR' ],         # argc != 4
+    [ 'W 0 0', 'ERROR' ],       # address out of range
+    [ 'W 2041 0', 'ERROR' ],    # address out of range
+    [ 'W 1 2', 'ERROR' ],       # output out of range
+    [ 'W 1 0 X', 'ERROR' ],     # argv[3] invalid
+    [ 'W X 1 256', 'ERROR' ],   # aspect out of range
+    [ 'W REP 0', 'ERROR' ],     # repeat out of range
+    [ 'W GAP 1', 'OK' ],
+    [ 'W REP 4', 'OK' ],
+    [ 'W 1 0', 'OK' ],
+    [ 'W 1 1 OFF', 'OK' ],
+    [ 'W X 2040 5', 'OK' ],
+    [ 'T OFF', 'OK' ],
+    [ 'W ?', '0' ],             # off drops the queue
+]
+
+consist_tests = [
+    [ 'T ON', 'OK' ],
+    [ 'N', 'ERROR' ],           # argc < 2
+    [ 'N X', 'ERROR' ],         # argv[1] invalid
+    [ 'N A 128', 'ERROR' ],     # advanced address out of range
+    [ 'N S 10', 'OK' ],
+    [ 'N S 10', 'ERROR' ],      # already a consist
+    [ 'N 10 + 11', 'OK' ],
+    [ 'N 10 + 12 R', 'OK' ],
+    [ 'N 10 + 12', 'ERROR' ],   # already a member
+    [ 'N 10 + 13 X', 'ERROR' ], # argv[4] invalid
+    [ 'N 10 200', 'ERROR' ],    # speed out of range
+    [ 'N 10 20', 'OK' ],
+    [ 'L 12', 'OK' ],
+    [ 'S ?', '-20' ],
+    [ 'N 10 0', 'OK' ],
+    [ 'N 10 - 12', 'OK' ],
+    [ 'N - 10', 'OK' ],
+    [ 'N - 10', 'ERROR' ],      # no such consist
+    [ 'L 3', 'OK' ],
+    [ 'T OFF', 'OK' ],
+]
+
+roster_tests = [
+    [ 'O', 'ERROR' ],           # argc < 2
+    [ 'O X', 'ERROR' ],         # argv[1] invalid
+    [ 'O 0 10', 'ERROR' ],      # address out of range
+    [ 'O 100 200', 'ERROR' ],   # speed out of range
+    [ 'O 100 10', 'OK' ],
+    [ 'O 100 F 32 ON', 'ERROR' ], # function out of range
+    [ 'O 100 F 0 X', 'ERROR' ], # argv[4] invalid
+    [ 'O 100 F 0 ON', 'OK' ],
+    [ 'O 101 F 28 ON', 'OK' ],
+    [ 'O - 100', 'OK' ],
+    [ 'O - 100', 'ERROR' ],     # not in roster
+    [ 'O - 101', 'OK' ],
+]
+
+idle_tests = [
+    [ 'D I X', 'ERROR' ],       # argv[2] invalid
+    [ 'D I ?', 'OFF' ],         # off by default
+    [ 'D I ON', 'OK' ],
+    [ 'D I ?', 'ON' ],
+    [ 'D I OFF', 'OK' ],
+    [ 'D L X', 'ERROR' ],       # argv[2] invalid
+    [ 'D L 0', 'OK' ],
+    [ 'D M X', 'ERROR' ],       # argv[2] invalid
+    [ 'D M ON', 'OK' ],
+    [ 'D M OFF', 'OK' ],
+    [ 'D M 0', 'OK' ],
+]
+
 loco_tests = [
     # argc < 2
     [ 'L', 'ERROR' ],           # argc < 2
@@ -55,6 +157,20 @@ speed_tests = [
     [ 'S 3 X', 'ERROR' ],       # argc > 2
 ]
 
+momentum_tests = [
+    [ 'M', 'ERROR' ],           # argc < 2
+    [ 'M X', 'ERROR' ],         # argv[1] invalid
+    [ 'M 1', 'ERROR' ],         # argc != 3
+    [ 'M 256 0', 'ERROR' ],     # accel out of range
+    [ 'M 0 -1', 'ERROR' ],      # decel out of range
+    [ 'M 1 1', 'OK' ],
+    [ 'S 10', 'OK' ],           # ramps 10 steps in 70 ms
+    [ 'S ?', '10' ],
+    [ 'M 0 0', 'OK' ],
+    [ 'S 0', 'OK' ],
+    [ 'S ?', '0' ],
+]
+
 function_tests = [
     # argc < 2
     [ 'F', 'ERROR' ],           # argc < 2
@@ -104,8 +220,15 @@ function_tests = [
     [ 'F 0 OFF', 'OK' ],
     [ 'F 0 ?', 'OFF' ],
     [ 'F 0 X', 'ERROR' ],       # argv[2] invalid
-    # argc > 3
-    [ 'F 0 1 ON', 'ERROR' ],    # argc > 3
+    # argc == 4
+    [ 'F 0 1 ON', 'ERROR' ],    # argv[1] invalid
+    [ 'F B X ON', 'ERROR' ],    # argv[2] invalid
+    [ 'F B -1 ON', 'ERROR' ],   # binary state out of range
+    [ 'F B 32768 ON', 'ERROR' ], # binary state out of range
+    [ 'F B 29 X', 'ERROR' ],    # argv[3] invalid
+    [ 'F B 29 ON', 'OK' ],
+    [ 'F B 200 ON', 'OK' ],
+    [ 'F B 0 OFF', 'OK' ],
 ]
 
 cv_tests = [
@@ -123,6 +246,16 @@ cv_tests = [
 #   [ 'C 8 ?', '151' ],         # mfg id = ESU
 #   [ 'C 8 7 ?', '1' ],         # cv8 bit 7
 #   [ 'C 8 6 ?', '0' ],         # cv8 bit 6
+#   [ 'C 8 ??', '151' ],        # fast read
+#   [ 'C 8 ?? 151', '151' ],    # fast read, right guess
+#   [ 'C 8 ?? 0', '151' ],      # fast read, wrong guess
+#   [ 'C 8 ?? 256', 'ERROR' ],  # guess out of range
+#   [ 'C 3 16 1 ?', 'ERROR' ],  # not an indexed cv
+#   [ 'C 259 16 256 ?', 'ERROR' ], # index out of range
+#   [ 'T SVC', 'OK' ],          # session remembers the index
+#   [ 'C 259 16 1 192', 'OK' ], # writes cv31, cv32, cv259
+#   [ 'C 275 16 1 ?', '128' ],  # same page, just reads cv275
+#   [ 'T OFF', 'OK' ],
 
 #   [ 'T ON', 'OK' ],           # track on (ops mode)
 
@@ -132,6 +265,8 @@ cv_tests = [
 #   [ 'C 8 8', 'OK' ],          # reset
 #   [ 'C 8 ?', '151' ],         # using railcom
 #   [ 'C 8 7 ?', 'ERROR' ],     # no ops mode read bit
+#   [ 'C 8 ??', 'ERROR' ],      # no ops mode fast read
+#   [ 'C 259 16 1 ?', '192' ],  # indexed, using railcom
 
     [ 'T OFF', 'OK' ],          # track off (svc mode)
     [ 'C 8 8', 'OK' ],          # reset loco to adrs 3
@@ -158,6 +293,78 @@ address_tests = [
     [ 'A ?', '3' ], # get addr
 ]
 
+railcom_stats_tests = [
+    [ 'R', 'ERROR' ],           # argc != 2
+    [ 'R X', 'ERROR' ],         # argv[1] invalid
+    [ 'R 0', 'OK' ],
+    [ 'R 0 0', 'ERROR' ],       # argc != 2
+]
+
+cv_block_tests = [
+    [ 'T ON', 'OK' ],
+    [ 'B', 'ERROR' ],           # argc != 3
+    [ 'B 1', 'ERROR' ],         # argc != 3
+    [ 'B 0 4', 'ERROR' ],       # cv_num out of range
+    [ 'B 1 0', 'ERROR' ],       # cv_cnt out of range
+    [ 'B 1 257', 'ERROR' ],     # cv_cnt out of range
+    [ 'B 1023 4', 'ERROR' ],    # past last cv
+    [ 'T OFF', 'OK' ],
+]
+
+queue_tests = [
+    [ 'T OFF', 'OK' ],
+    [ 'Q 3 1 ?', 'ERROR' ],     # ops mode only
+    [ 'T ON', 'OK' ],
+    [ 'Q', 'ERROR' ],           # argc invalid
+    [ 'Q X', 'ERROR' ],         # argv[1] invalid
+    [ 'Q 3 1', 'ERROR' ],       # argc invalid
+    [ 'Q 4 1 ?', 'ERROR' ],     # no throttle for loco
+    [ 'Q 3 0 ?', 'ERROR' ],     # cv_num out of range
+    [ 'Q 3 1 256', 'ERROR' ],   # cv_val out of range
+    [ 'Q 0', 'OK' ],
+    [ 'T OFF', 'OK' ],
+]
+
+cache_tests = [
+    [ 'K OFF', 'OK' ],
+    [ 'K ?', 'OFF' ],
+    [ 'K 0', 'ERROR' ],         # no decoder selected
+    [ 'K DEF 29 6', 'ERROR' ],  # no decoder selected
+    [ 'K X', 'ERROR' ],         # argv[1] invalid
+    [ 'K 0 151', 'ERROR' ],     # address out of range
+    [ 'K 3 256', 'ERROR' ],     # mfg out of range
+    [ 'K 3 151', 'OK' ],
+    [ 'K 0', 'OK' ],
+    [ 'K DEF 300 0', 'ERROR' ], # indexed cv not cached
+    [ 'K DEF 29 256', 'ERROR' ], # cv_val out of range
+    [ 'K DEF 29 6', 'OK' ],
+    [ 'C 29 6', 'OK' ],         # written, not skipped (default)
+    [ 'C 29 6', 'OK' ],         # skipped (written)
+    [ 'C 29 ?', '6' ],          # from cache
+    [ 'K 0', 'OK' ],
+    [ 'K OFF', 'OK' ],
+]
+
+program_tests = [
+    [ 'T OFF', 'OK' ],
+    [ 'P 0', 'OK' ],
+    [ 'P', 'ERROR' ],           # argc invalid
+    [ 'P X', 'ERROR' ],         # argv[1] invalid
+    [ 'P + 29', 'ERROR' ],      # argc invalid
+    [ 'P + 29 256', 'ERROR' ],  # cv_val out of range
+    [ 'P + 259 192 16 256', 'ERROR' ], # index out of range
+    [ 'P + 8 8', 'OK' ],        # added, but can't be programmed
+    [ 'P GO', 'ERROR' ],
+    [ 'P 0', 'OK' ],
+    [ 'P + 3 20', 'OK' ],
+    [ 'P + 4 20', 'OK' ],
+    [ 'P + 259 192 16 1', 'OK' ],
+    [ 'P + 275 128 16 1', 'OK' ],
+    [ 'P GO', '' ],             # progress lines, then OK
+    [ 'P GO', '' ],             # second time, all skipped
+    [ 'P 0', 'OK' ],
+]
+
 railcom_tests = [
     [ 'C 8 8', 'OK' ],
     [ 'C 31 0', 'OK' ],
@@ -205,11 +412,22 @@ railcom_tests = [
 tests = [
     #verbosity_tests,
     #track_tests,
+    #estop_tests,
+    #idle_tests,
+    #acc_tests,
+    #consist_tests,
+    #roster_tests,
     #loco_tests,
     #speed_tests,
+    #momentum_tests,
     #function_tests,
     #cv_tests,
     #address_tests,
+    #railcom_stats_tests,
+    #cv_block_tests,
+    #queue_tests,
+    #cache_tests,
+    #program_tests,
     railcom_tests,
 ]
 
@@ -224,6 +224,7 @@ static void update_display(const DccPkt &msg)
 static bool pkt_ignore(const uint8_t *pkt, int pkt_len)
 {
     // ignore packets that are not multi-function decoder speed or function messages
+    // (binary state packets are not refreshed, so they are always shown)
     DccPkt msg(pkt, pkt_len);
 
     int speed;
@@ -0,0 +1,174 @@
+// DccCommand's accessory queue on the simulated track: the real bitstream
+// (bit timings, railcom cutouts) and the real scheduler, with TrackSim
+// decoding what goes out.
+//
+// A route is 10 turnouts queued at once. For each setup this prints the time
+// from queueing to the end of the last accessory packet, and checks:
+//
+//   repeat:   each command goes out acc_repeat() times
+//   gap:      with locos, at least acc_gap() loco packets between accessory
+//             packets
+//   coalesce: queueing either output of a turnout that is already queued
+//             replaces the queued command (only the last one goes out)
+//
+// Prints one line per setup and exits nonzero if any check failed.
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+
+#include "dcc_adc.h"
+#include "dcc_command.h"
+#include "dcc_throttle.h"
+#include "hardware/uart.h"
+#include "pico_host.h"
+#include "track_sim.h"
+
+static constexpr int sig_gpio = 4;
+static constexpr int pwr_gpio = 5;
+static constexpr int loco_cnt = 4;
+static constexpr int route_len = 10;
+
+static int fail_cnt = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (ok)
+        return;
+    printf("  FAIL: %s\n", what);
+    fail_cnt++;
+}
+
+
+// What went out since the last reset()
+struct Seen {
+    std::map<uint16_t, int> acc; // accessory packets by first two bytes
+    int acc_cnt;
+    int loco_run;                // loco packets since the last accessory one
+    int loco_run_min;            // fewest between two accessory packets
+    uint64_t acc_last_us;
+
+    void reset()
+    {
+        acc.clear();
+        acc_cnt = 0;
+        loco_run = -1;
+        loco_run_min = INT32_MAX;
+        acc_last_us = 0;
+    }
+};
+
+static void watch(const uint8_t *msg, int, uint64_t end_us, void *arg)
+{
+    Seen *s = (Seen *)arg;
+    if ((msg[0] & 0xc0) == 0x80) {
+        // accessory: 10AAAAAA
+        s->acc[(msg[0] << 8) | msg[1]]++;
+        s->acc_cnt++;
+        if (s->loco_run >= 0 && s->loco_run < s->loco_run_min)
+            s->loco_run_min = s->loco_run;
+        s->loco_run = 0;
+        s->acc_last_us = end_us;
+    } else if (msg[0] != 0xff && s->loco_run >= 0) {
+        s->loco_run++;
+    }
+}
+
+
+// Queue the outputs, run until they're all sent, and return msec from
+// queueing to the end of the last accessory packet. Checks that each went out
+// repeat times and the gap was kept.
+static double route(DccCommand &command, TrackSim &track, Seen &seen,
+                    const int *adrs, int adrs_cnt, bool locos)
+{
+    // start at a packet boundary, as if the route were queued at any time
+    track.run_packets(1);
+    seen.reset();
+    command.acc_reset_stats();
+
+    uint64_t start_us = PicoHost::time_us();
+    for (int i = 0; i < adrs_cnt; i++)
+        check(command.acc_set(adrs[i], 0), "acc_set");
+
+    for (int ms = 0; ms < 10000 && command.acc_pending() > 0; ms++)
+        track.run_us(1000);
+    track.run_packets(2); // the last one fetched is on the track
+
+    check(command.acc_pending() == 0, "route sent");
+    check(int(seen.acc.size()) == adrs_cnt, "one packet kind per output");
+    for (auto &kv : seen.acc)
+        check(kv.second == command.acc_repeat(), "sent acc_repeat() times");
+    if (locos && seen.acc_cnt > 1)
+        check(seen.loco_run_min >= command.acc_gap(), "gap kept");
+
+    return (seen.acc_last_us - start_us) / 1000.0;
+}
+
+
+int main()
+{
+    static DccAdc adc(-1);
+    static DccCommand command(sig_gpio, pwr_gpio, -1, adc);
+    TrackSim track(sig_gpio);
+    Seen seen;
+    track.watch(watch, &seen);
+
+    command.set_mode_ops();
+    DccThrottle *locos[loco_cnt];
+    for (int i = 0; i < loco_cnt; i++) {
+        locos[i] = command.create_throttle(3 + i);
+        locos[i]->set_speed(20 + i);
+        locos[i]->set_function(0, true);
+    }
+    track.run_us(100000);
+
+    int adrs[route_len];
+    for (int i = 0; i < route_len; i++)
+        adrs[i] = 101 + i;
+
+    printf("%d-turnout route, repeat %d, %d locos:\n", route_len,
+           command.acc_repeat(), loco_cnt);
+    for (int gap : {0, 1, 3}) {
+        command.acc_gap(gap);
+        double ms = route(command, track, seen, adrs, route_len, true);
+        printf("  gap %d: last turnout %.0f ms (%.1f routes/s), "
+               "%u accessory packets, fewest loco packets between %d\n",
+               gap, ms, 1000 / ms, command.acc_pkt_cnt(),
+               (seen.loco_run_min == INT32_MAX) ? 0 : seen.loco_run_min);
+    }
+
+    command.acc_gap(DccCommand::acc_gap_default);
+    double one_ms = route(command, track, seen, adrs, 1, true);
+    printf("single turnout, %d locos, gap %d: %.0f ms\n", loco_cnt,
+           command.acc_gap(), one_ms);
+
+    // coalesce: the same output twice, then the turnout's other output;
+    // only the last goes out
+    track.run_packets(1);
+    seen.reset();
+    command.acc_reset_stats();
+    command.acc_set(201, 0);
+    command.acc_set(201, 0);
+    command.acc_set(201, 1);
+    check(command.acc_pending() == 1, "coalesced in the queue");
+    for (int ms = 0; ms < 1000 && command.acc_pending() > 0; ms++)
+        track.run_us(1000);
+    track.run_packets(2);
+    printf("coalesce: 3 commands, %u replaced, %u packets\n",
+           command.acc_coalesce_cnt(), command.acc_pkt_cnt());
+    check(command.acc_coalesce_cnt() == 2, "two replaced");
+    // 1AAACDDR: R is the output
+    check(seen.acc.size() == 1 && (seen.acc.begin()->first & 1) == 1 &&
+              seen.acc_cnt == command.acc_repeat(),
+          "only the last one sent");
+
+    for (int i = 0; i < loco_cnt; i++)
+        command.delete_throttle(locos[i]);
+    command.acc_gap(DccCommand::acc_gap_default);
+    double none_ms = route(command, track, seen, adrs, route_len, false);
+    printf("no locos, gap %d: last turnout %.0f ms (%.1f routes/s)\n",
+           command.acc_gap(), none_ms, 1000 / none_ms);
+
+    printf("%s\n", (fail_cnt == 0) ? "ok" : "FAILED");
+    return (fail_cnt == 0) ? 0 : 1;
+}
@@ -0,0 +1,204 @@
+// DccAckThreshold and DccAckMatched on synthetic current traces.
+//
+// There are no recorded traces from real decoders in the tree; these are
+// made up to look like what a service mode track sees. Each trial is 200 ms
+// of idle current, then both detectors are armed (as DccCommand does before
+// the packets that could be acked), then 100 ms that has an ack pulse or
+// not. Samples go through the ADC FIFO and DccAdc::loop() as on the Pico
+// (without DMA), and both detectors are checked after each sample.
+//
+//   ack:         idle 10-40 ma, noise +/-5 ma, ack 70-120 ma for 5-7 msec
+//   ack weak:    noise +/-10 ma, ack 55-70 ma for 5-7 msec
+//   ack sound:   idle 100-200 ma with 60 Hz ripple of +/-20 ma and noise
+//                +/-15 ma (a sound decoder), ack 70-120 ma for 5-7 msec
+//   none:        idle only
+//   none sound:  the sound decoder, no ack
+//   none spikes: 1-3 spikes of 100-200 ma for 0.5-2 msec
+//   none motor:  the current steps up 80-150 ma and stays there
+//
+// For "ack" traces a miss is a false negative; for "none" traces an ack is
+// a false positive. Prints the rates for each. Exits nonzero if either
+// detector missed a clean ack, if the matched detector acked on idle
+// current, a sound decoder, or a motor, or if its rates on spikes and sound
+// decoder acks (which it sometimes gets wrong) got worse than 1% and 5%.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "dcc_ack.h"
+#include "dcc_adc.h"
+#include "pico_host.h"
+
+static constexpr int trial_cnt = 500;
+static constexpr int idle_len = 2000;   // samples (200 ms)
+static constexpr int window_len = 1000; // samples after arm (100 ms)
+
+static int fail_cnt = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (ok)
+        return;
+    printf("  FAIL: %s\n", what);
+    fail_cnt++;
+}
+
+
+static int rand_in(int lo, int hi) // lo...hi
+{
+    return lo + rand() % (hi - lo + 1);
+}
+
+
+struct Trace {
+    const char *name;
+    bool ack;
+    int amp_lo, amp_hi; // ack
+    int noise_ma;
+    bool sound;
+    bool spikes;
+    bool motor;
+};
+
+static const Trace traces[] = {
+    // name          ack    amp       noise sound  spikes motor
+    {"ack",          true,  70, 120,  5,    false, false, false},
+    {"ack weak",     true,  55, 70,   10,   false, false, false},
+    {"ack sound",    true,  70, 120,  15,   true,  false, false},
+    {"none",         false, 0,  0,    5,    false, false, false},
+    {"none sound",   false, 0,  0,    15,   true,  false, false},
+    {"none spikes",  false, 0,  0,    5,    false, true,  false},
+    {"none motor",   false, 0,  0,    5,    false, false, true},
+};
+
+
+// ma for each sample of one trial
+static void trial_make(const Trace &tr, float *ma)
+{
+    static constexpr int len = idle_len + window_len;
+
+    float base = tr.sound ? rand_in(100, 200) : rand_in(10, 40);
+    float ripple = tr.sound ? 20 : 0;
+    float phase = rand_in(0, 999) / 1000.0f;
+    for (int i = 0; i < len; i++) {
+        float t = i * DccAdc::sample_us() / 1e6f;
+        ma[i] = base + ripple * sinf(2 * float(M_PI) * (60 * t + phase)) +
+                rand_in(-tr.noise_ma, tr.noise_ma);
+    }
+
+    // the ack comes 1-5 msec after arming (after the command packets)
+    if (tr.ack) {
+        int start = idle_len + rand_in(10, 50);
+        int plen = rand_in(50, 70);
+        int amp = rand_in(tr.amp_lo, tr.amp_hi);
+        for (int i = start; i < start + plen; i++)
+            ma[i] += amp;
+    }
+
+    if (tr.spikes) {
+        int n = rand_in(1, 3);
+        for (int s = 0; s < n; s++) {
+            int start = idle_len + rand_in(0, window_len - 20);
+            int slen = rand_in(5, 20);
+            int amp = rand_in(100, 200);
+            for (int i = start; i < start + slen; i++)
+                ma[i] += amp;
+        }
+    }
+
+    if (tr.motor) {
+        int start = idle_len + rand_in(0, window_len / 2);
+        int amp = rand_in(80, 150);
+        for (int i = start; i < len; i++)
+            ma[i] += amp;
+    }
+}
+
+
+// ma to what the ADC reads (see DccAdc: raw * 0.73 = ma)
+static uint16_t ma_to_raw(float ma)
+{
+    if (ma < 0)
+        ma = 0;
+    int raw = int(lroundf(ma * 4096 * 1.1f / 3300));
+    return (raw > 4095) ? 4095 : raw;
+}
+
+
+// Run trial_cnt trials of a trace; counts trials each detector acked in.
+static void run(const Trace &tr, int &thr_cnt, int &mat_cnt)
+{
+    static float ma[idle_len + window_len];
+
+    DccAdc adc(26); // no DMA on the host; loop() reads the FIFO
+    DccAckThreshold thr(adc);
+    DccAckMatched mat(adc);
+    adc.start();
+
+    thr_cnt = 0;
+    mat_cnt = 0;
+
+    for (int n = 0; n < trial_cnt; n++) {
+        trial_make(tr, ma);
+        thr.reset();
+        mat.reset();
+        bool thr_ack = false;
+        bool mat_ack = false;
+        for (int i = 0; i < idle_len + window_len; i++) {
+            if (i == idle_len) {
+                thr.arm();
+                mat.arm();
+            }
+            PicoHost::adc_put(ma_to_raw(ma[i]));
+            PicoHost::time_add(DccAdc::sample_us());
+            adc.loop();
+            if (thr.check())
+                thr_ack = true;
+            if (mat.check())
+                mat_ack = true;
+        }
+        if (thr_ack)
+            thr_cnt++;
+        if (mat_ack)
+            mat_cnt++;
+    }
+
+    adc.stop();
+}
+
+
+int main()
+{
+    srand(1);
+
+    printf("%d trials each (synthetic traces; none recorded)\n", trial_cnt);
+    printf("  %-12s %10s %10s\n", "", "threshold", "matched");
+
+    for (const Trace &tr : traces) {
+        int thr;
+        int mat;
+        run(tr, thr, mat);
+        // rate of wrong answers: misses for acks, acks for none
+        double thr_pct = 100.0 * (tr.ack ? trial_cnt - thr : thr) / trial_cnt;
+        double mat_pct = 100.0 * (tr.ack ? trial_cnt - mat : mat) / trial_cnt;
+        printf("  %-12s %s %5.1f%%    %5.1f%%\n", tr.name,
+               tr.ack ? "FN" : "FP", thr_pct, mat_pct);
+
+        bool weak = tr.ack && tr.amp_lo < DccAckThreshold::ack_inc_ma;
+        if (tr.ack && !tr.sound && !weak) {
+            check(thr_pct == 0, "threshold missed a clean ack");
+            check(mat_pct == 0, "matched missed a clean ack");
+        } else if (tr.ack && tr.sound) {
+            check(mat_pct <= 5, "matched sound decoder misses");
+        } else if (tr.spikes) {
+            check(mat_pct <= 1, "matched acks on spikes");
+        } else if (!tr.ack) {
+            check(mat_pct == 0, "matched acked on no ack");
+        }
+    }
+
+    printf("%s\n", (fail_cnt == 0) ? "ok" : "FAILED");
+    return (fail_cnt == 0) ? 0 : 1;
+}
@@ -0,0 +1,213 @@
+// DccAdc averaging time, before and after the running sums, on the host.
+//
+// "before" is a copy of what DccAdc did before: loop() only stored samples,
+// and each short_avg_ma() or long_avg_ma() summed the window (16 or 166
+// samples), then converted with two rounding divisions (raw to mv, mv to
+// ma). "after" is DccAdc as it is: loop() keeps the sums, and each read is a
+// multiply and a shift.
+//
+// Timed, average over call_cnt calls (best of round_cnt):
+//   isr:          one new sample, loop(), short_avg_ma(); what the bit
+//                 interrupt does in service mode (DccAckThreshold::check())
+//   short_avg_ma: the read alone
+//   long_avg_ma:  the read alone
+//
+// Then both are fed the same random-walk samples, and after each one their
+// averages are compared with the exact average of the window. "after"
+// rounds once, but long_mul (4627) is 4626.49 rounded, which is up to 0.33
+// ma more at full scale, so it can be off by 0.83 ma; "before" rounds three
+// times. It exits nonzero if "after" is ever off by more than that, or by
+// more than "before" was.
+//
+// These are host numbers; they show the difference, not what it is on an
+// RP2040.
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+
+#include "dcc_adc.h"
+#include "hardware/adc.h"
+#include "pico_host.h"
+
+static constexpr int call_cnt = 1000000;
+static constexpr int round_cnt = 5;
+
+
+// DccAdc's averaging before the running sums
+class OldAdc
+{
+
+public:
+
+    OldAdc() : _avg_idx(0)
+    {
+        for (int i = 0; i < avg_max; i++)
+            _avg[i] = 0;
+    }
+
+    bool loop()
+    {
+        bool any = false;
+        while (!adc_fifo_is_empty()) {
+            any = true;
+            uint16_t adc_val = adc_fifo_get();
+            adc_val &= 0x0fff;
+            _avg[_avg_idx] = adc_val;
+            _avg_idx++;
+            if (_avg_idx >= avg_max)
+                _avg_idx = 0;
+        }
+        return any;
+    }
+
+    uint16_t short_avg_ma() const
+    {
+        return mv_to_ma(raw_to_mv(avg_raw(short_cnt)));
+    }
+
+    uint16_t long_avg_ma() const
+    {
+        return mv_to_ma(raw_to_mv(avg_raw(long_cnt)));
+    }
+
+private:
+
+    static const int avg_max = 10000 / 60;
+    static const int short_cnt = 16;
+    static const int long_cnt = avg_max;
+
+    uint16_t _avg[avg_max];
+    int _avg_idx;
+
+    uint16_t avg_raw(int cnt) const
+    {
+        uint32_t sum = 0;
+        int i = _avg_idx;
+        for (int j = 0; j < cnt; j++) {
+            i--;
+            if (i < 0)
+                i = avg_max - 1;
+            sum += _avg[i];
+        }
+        return (sum + cnt / 2) / cnt;
+    }
+
+    static uint16_t raw_to_mv(uint16_t raw)
+    {
+        const uint32_t ref_mv = 3300;
+        const uint16_t raw_max = 4096;
+        return (raw * ref_mv + raw_max / 2) / raw_max;
+    }
+
+    static uint16_t mv_to_ma(uint16_t mv)
+    {
+        const uint32_t mul = 8192 / 1.1; // 7447
+        const uint32_t div = 8192;
+        return (mv * mul + div / 2) / div;
+    }
+
+}; // class OldAdc
+
+
+// Time fn over call_cnt calls, best of round_cnt rounds; returns ns per
+// call. The results are summed into sum so they aren't optimized away.
+template <typename F>
+static double time_ns(F fn, uint32_t &sum)
+{
+    typedef std::chrono::steady_clock clock;
+    double best = 0;
+    for (int r = 0; r < round_cnt; r++) {
+        clock::time_point t0 = clock::now();
+        for (int i = 0; i < call_cnt; i++)
+            sum += fn(i);
+        clock::time_point t1 = clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() /
+                    call_cnt;
+        if (r == 0 || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+
+static uint16_t sample(int i)
+{
+    return 500 + (uint32_t(i) * 7919) % 1000;
+}
+
+
+int main()
+{
+    static DccAdc adc(26); // no DMA on the host; loop() reads the FIFO
+    static OldAdc old;
+    adc.start();
+
+    uint32_t sum = 0;
+
+    double old_isr = time_ns(
+        [](int i) {
+            PicoHost::adc_put(sample(i));
+            old.loop();
+            return old.short_avg_ma();
+        },
+        sum);
+    double new_isr = time_ns(
+        [](int i) {
+            PicoHost::adc_put(sample(i));
+            adc.loop();
+            return adc.short_avg_ma();
+        },
+        sum);
+    double old_short = time_ns([](int) { return old.short_avg_ma(); }, sum);
+    double new_short = time_ns([](int) { return adc.short_avg_ma(); }, sum);
+    double old_long = time_ns([](int) { return old.long_avg_ma(); }, sum);
+    double new_long = time_ns([](int) { return adc.long_avg_ma(); }, sum);
+
+    printf("%-14s %8s %8s\n", "ns per call", "before", "after");
+    printf("%-14s %8.1f %8.1f\n", "isr", old_isr, new_isr);
+    printf("%-14s %8.1f %8.1f\n", "short_avg_ma", old_short, new_short);
+    printf("%-14s %8.1f %8.1f\n", "long_avg_ma", old_long, new_long);
+
+    // same samples to both, from a fresh start, and the exact averages
+    adc.stop();
+    adc.start();
+    old = OldAdc();
+    static constexpr int win_max = 10000 / 60;
+    uint16_t win[win_max] = {};
+    double old_err = 0;
+    double new_err = 0;
+    int raw = 2048;
+    for (int i = 0; i < call_cnt; i++) {
+        raw += rand() % 41 - 20;
+        raw = (raw < 0) ? 0 : (raw > 4095) ? 4095 : raw;
+        win[i % win_max] = raw;
+        // each drains the FIFO, so each gets its own copy
+        PicoHost::adc_put(raw);
+        adc.loop();
+        PicoHost::adc_put(raw);
+        old.loop();
+        for (int cnt : {16, win_max}) {
+            uint32_t s = 0;
+            for (int j = 0; j < cnt; j++)
+                s += win[(i - j + win_max) % win_max];
+            double exact = s * 3300.0 / 4096 / 1.1 / cnt;
+            double o = (cnt == 16) ? old.short_avg_ma() : old.long_avg_ma();
+            double n = (cnt == 16) ? adc.short_avg_ma() : adc.long_avg_ma();
+            if (fabs(o - exact) > old_err)
+                old_err = fabs(o - exact);
+            if (fabs(n - exact) > new_err)
+                new_err = fabs(n - exact);
+        }
+    }
+    printf("largest error from the exact average: before %.2f ma, "
+           "after %.2f ma\n",
+           old_err, new_err);
+
+    bool ok = new_err <= 0.84 && new_err <= old_err && sum != 0;
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
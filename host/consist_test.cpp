@@ -0,0 +1,366 @@
+// DccCommand's consists on the simulated track, with TrackSim decoders that
+// answer POM writes in the railcom cutout and follow their consist address
+// (CV19) once it is written.
+//
+// bandwidth: 3 lashups of 4 (one member reversed in each) and 2 single
+//            locos, all with F0-F31, run three ways: separate throttles,
+//            advanced consists, and station consists. For each, the share
+//            of packets that are speed packets, then for speed changes on
+//            the lashups, the speed packets sent for the lashup and the time
+//            until all 4 decoders have the new speed.
+//
+// cv19:      a member whose decoder replies gets CV19, and its throttle stops
+//            sending speed packets; a member whose decoder never replies is
+//            dropped, CV19 is written back to 0, and its throttle sends speed
+//            packets again.
+//
+// Prints one line per test and exits nonzero if any check failed.
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "dcc_adc.h"
+#include "dcc_command.h"
+#include "dcc_cv_async.h"
+#include "dcc_ops_queue.h"
+#include "dcc_pkt.h"
+#include "dcc_throttle.h"
+#include "hardware/uart.h"
+#include "pico_host.h"
+#include "track_sim.h"
+
+static constexpr int sig_gpio = 4;
+static constexpr int pwr_gpio = 5;
+static constexpr int rc_gpio = 1;
+
+static constexpr int lashup_cnt = 3;
+static constexpr int lashup_len = 4;
+static constexpr int single_cnt = 2;
+static constexpr int change_cnt = 20; // speed changes per lashup
+
+static int fail_cnt = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (ok)
+        return;
+    printf("  FAIL: %s\n", what);
+    fail_cnt++;
+}
+
+
+// A multifunction decoder packet on the track
+struct Pkt {
+    int address;
+    bool speed;     // 128 step speed packet
+    int speed_val;  // speed only
+    bool pom;       // POM (long form CV access)
+    int cv_num;     // pom only
+    uint8_t cv_val; // pom only
+    uint64_t end_us;
+};
+
+static void watch(const uint8_t *msg, int msg_len, uint64_t end_us, void *arg)
+{
+    std::vector<Pkt> *pkts = (std::vector<Pkt> *)arg;
+    Pkt p;
+    int adr_len;
+    if (1 <= msg[0] && msg[0] <= DccPkt::address_short_max) {
+        p.address = msg[0];
+        adr_len = 1;
+    } else if (0xc0 <= msg[0] && msg[0] <= 0xe7) {
+        p.address = ((msg[0] & 0x3f) << 8) | msg[1];
+        adr_len = 2;
+    } else {
+        return; // broadcast, accessory, idle
+    }
+    const uint8_t *ins = msg + adr_len;
+    int ins_len = msg_len - adr_len - 1;
+    p.speed = (ins_len == 2 && ins[0] == 0x3f);
+    p.speed_val = p.speed ? DccPktSpeed128::dcc_to_int(ins[1]) : 0;
+    p.pom = (ins_len == 3 && (ins[0] & 0xf0) == 0xe0);
+    p.cv_num = p.pom ? ((((ins[0] & 0x03) << 8) | ins[1]) + 1) : 0;
+    p.cv_val = p.pom ? ins[2] : 0;
+    p.end_us = end_us;
+    pkts->push_back(p);
+}
+
+
+// The command station, main loop, and track
+struct Layout {
+
+    DccAdc adc;
+    DccCommand command;
+    DccOpsQueue queue;
+    DccCvAsync cv_async;
+    TrackSim track;
+    std::vector<Pkt> pkts;
+
+    Layout() :
+        adc(-1),
+        command(sig_gpio, pwr_gpio, -1, adc, uart0, rc_gpio),
+        queue(command),
+        cv_async(command, queue),
+        track(sig_gpio)
+    {
+        command.cv_async(&cv_async);
+        track.watch(watch, &pkts);
+        command.set_mode_ops();
+    }
+
+    // the main loop, once a msec
+    void run_ms(int ms)
+    {
+        for (int i = 0; i < ms; i++) {
+            track.run_us(1000);
+            cv_async.loop();
+        }
+    }
+
+    // until the CV operations are done; false if they never are
+    bool run_cv(int limit_ms = 10000)
+    {
+        for (int ms = 0; ms < limit_ms; ms++) {
+            if (cv_async.idle())
+                return true;
+            run_ms(1);
+        }
+        return false;
+    }
+
+    // speed packets for address that ended from from_us to to_us (with
+    // speed +/-val only, if val is not speed_inv)
+    int speed_cnt(int address, uint64_t from_us,
+                  uint64_t to_us = UINT64_MAX,
+                  int val = DccPkt::speed_inv) const
+    {
+        int n = 0;
+        for (const Pkt &p : pkts)
+            if (p.speed && p.address == address && p.end_us >= from_us &&
+                p.end_us <= to_us &&
+                (val == DccPkt::speed_inv || p.speed_val == val ||
+                 p.speed_val == -val))
+                n++;
+        return n;
+    }
+
+}; // struct Layout
+
+
+enum class Mode { SEPARATE, ADVANCED, STATION };
+
+static const char *mode_name(Mode mode)
+{
+    switch (mode) {
+        case Mode::SEPARATE: return "separate";
+        case Mode::ADVANCED: return "advanced";
+        case Mode::STATION:  return "station";
+    }
+    return "?";
+}
+
+static int member(int l, int m) { return 10 * (l + 1) + m; }
+static int consist_adrs(Mode mode, int l)
+{
+    return (mode == Mode::ADVANCED) ? 101 + l : member(l, 0);
+}
+static bool reversed(int m) { return m == lashup_len - 1; }
+
+
+static void lashup_speed(Layout &lay, Mode mode, int l, int speed)
+{
+    if (mode == Mode::SEPARATE) {
+        for (int m = 0; m < lashup_len; m++)
+            lay.command.find_throttle(member(l, m))
+                ->set_speed(reversed(m) ? -speed : speed);
+    } else {
+        lay.command.consist_speed(consist_adrs(mode, l), speed);
+    }
+}
+
+
+static bool lashup_at(Layout &lay, int l, int speed)
+{
+    for (int m = 0; m < lashup_len; m++) {
+        TrackSim::Decoder *d = lay.track.decoder(member(l, m));
+        if (d->speed != (reversed(m) ? -speed : speed))
+            return false;
+    }
+    return true;
+}
+
+
+static void test_bandwidth(Mode mode)
+{
+    Layout lay;
+
+    for (int l = 0; l < lashup_cnt; l++) {
+        for (int m = 0; m < lashup_len; m++) {
+            lay.track.decoder_add(member(l, m));
+            DccThrottle *t = lay.command.create_throttle(member(l, m));
+            t->set_function(0, true);
+        }
+    }
+    for (int s = 0; s < single_cnt; s++) {
+        lay.track.decoder_add(100 - 1 - s);
+        lay.command.create_throttle(100 - 1 - s)->set_speed(30);
+    }
+
+    if (mode != Mode::SEPARATE) {
+        bool adv = mode == Mode::ADVANCED;
+        for (int l = 0; l < lashup_cnt; l++) {
+            check(lay.command.consist_create(consist_adrs(mode, l), adv),
+                  "consist_create");
+            for (int m = adv ? 0 : 1; m < lashup_len; m++)
+                check(lay.command.consist_add(consist_adrs(mode, l),
+                                              member(l, m), reversed(m)),
+                      "consist_add");
+        }
+        check(lay.run_cv(), "CV19 writes done");
+    }
+
+    for (int l = 0; l < lashup_cnt; l++)
+        lashup_speed(lay, mode, l, 10);
+    lay.run_ms(1000);
+
+    // speed share, everything steady
+    lay.pkts.clear();
+    lay.run_ms(5000);
+    int speed = 0;
+    for (const Pkt &p : lay.pkts)
+        if (p.speed)
+            speed++;
+    double share = 100.0 * speed / lay.pkts.size();
+
+    // speed changes, each at a different point in the packet sequence
+    int pkt_sum = 0;
+    double ms_sum = 0;
+    double ms_max = 0;
+    bool all = true;
+    for (int n = 0; n < change_cnt * lashup_cnt; n++) {
+        int l = n % lashup_cnt;
+        int s = 20 + n;
+        lay.run_ms(1 + n % 7);
+        lay.pkts.clear();
+        uint64_t start_us = PicoHost::time_us();
+        lashup_speed(lay, mode, l, s);
+        for (int ms = 0; ms < 2000 && !lashup_at(lay, l, s); ms++)
+            lay.run_ms(1);
+        all = all && lashup_at(lay, l, s);
+        uint64_t last_us = 0;
+        for (int m = 0; m < lashup_len; m++) {
+            uint64_t us = lay.track.decoder(member(l, m))->speed_us;
+            if (us > last_us)
+                last_us = us;
+        }
+        double at_ms = (last_us - start_us) / 1000.0;
+        ms_sum += at_ms;
+        if (at_ms > ms_max)
+            ms_max = at_ms;
+        // packets with the new speed, until the last decoder had it
+        int cnt = 0;
+        if (mode == Mode::ADVANCED)
+            cnt = lay.speed_cnt(consist_adrs(mode, l), start_us, last_us, s);
+        else
+            for (int m = 0; m < lashup_len; m++)
+                cnt += lay.speed_cnt(member(l, m), start_us, last_us, s);
+        pkt_sum += cnt;
+    }
+
+    double pkts_per = double(pkt_sum) / (change_cnt * lashup_cnt);
+    printf("%-8s: speed %4.1f%% of packets; lashup change: %.1f speed "
+           "packets, all 4 in %.0f ms avg, %.0f ms max\n",
+           mode_name(mode), share, pkts_per, ms_sum / (change_cnt * lashup_cnt),
+           ms_max);
+
+    check(all, "all members got each speed");
+    if (mode == Mode::ADVANCED) {
+        check(pkts_per == 1.0, "one speed packet per change");
+        // the members' throttles send none
+        check(lay.speed_cnt(member(0, 0), 0) == 0, "member speed stopped");
+    } else {
+        check(pkts_per == lashup_len, "a speed packet per member");
+    }
+}
+
+
+static DccCvEvent cv19_ev;
+static int cv19_ev_cnt = 0;
+
+static void cv19_done(const DccCvEvent &ev, void *)
+{
+    cv19_ev = ev;
+    cv19_ev_cnt++;
+}
+
+
+static void test_cv19()
+{
+    static constexpr int consist = 101;
+    static constexpr int good = 10;
+    static constexpr int mute = 11;
+
+    Layout lay;
+    lay.track.decoder_add(good);
+    lay.track.decoder_add(mute)->reply_pct = 0;
+    lay.command.consist_create(consist, true);
+    lay.command.consist_speed(consist, 40);
+    lay.run_ms(100);
+
+    // replies: linked, refresh off
+    cv19_ev_cnt = 0;
+    check(lay.command.consist_add(consist, good, false, cv19_done),
+          "consist_add (replies)");
+    check(lay.run_cv(), "CV19 write done");
+    bool ok = cv19_ev_cnt == 1 && cv19_ev.status == DccCvEvent::Status::OK;
+    lay.pkts.clear();
+    uint64_t from_us = PicoHost::time_us();
+    lay.run_ms(1000);
+    int good_speed = lay.speed_cnt(good, from_us);
+    TrackSim::Decoder *d = lay.track.decoder(good);
+    printf("cv19: replies: %s, CV19 %d, %d own speed packets in 1 s, "
+           "decoder speed %d\n",
+           ok ? "OK" : "not OK", d->cv[19], good_speed, d->speed);
+    check(ok, "CV19 write OK");
+    check(d->cv[19] == consist, "decoder has CV19");
+    check(good_speed == 0, "member's own speed packets stop");
+    check(d->speed == 40, "member follows the consist address");
+
+    // no replies: dropped, CV19 back to 0, refresh on
+    cv19_ev_cnt = 0;
+    lay.pkts.clear();
+    check(lay.command.consist_add(consist, mute, false, cv19_done),
+          "consist_add (no replies)");
+    check(lay.run_cv(30000), "CV19 write done");
+    ok = cv19_ev_cnt == 1 && cv19_ev.status == DccCvEvent::Status::FAILED;
+    bool back = false;
+    for (const Pkt &p : lay.pkts)
+        if (p.pom && p.address == mute && p.cv_num == 19 && p.cv_val == 0)
+            back = true;
+    lay.pkts.clear();
+    from_us = PicoHost::time_us();
+    lay.run_ms(1000);
+    int mute_speed = lay.speed_cnt(mute, from_us);
+    d = lay.track.decoder(mute);
+    printf("cv19: no replies: %s, CV19 0 %s, CV19 %d, "
+           "%d own speed packets in 1 s\n",
+           ok ? "FAILED" : "not FAILED", back ? "sent" : "not sent", d->cv[19],
+           mute_speed);
+    check(ok, "CV19 write FAILED");
+    check(back, "CV19 written back to 0");
+    check(d->cv[19] == 0, "decoder CV19 0");
+    check(mute_speed > 0, "dropped member's speed packets resume");
+}
+
+
+int main()
+{
+    test_bandwidth(Mode::SEPARATE);
+    test_bandwidth(Mode::ADVANCED);
+    test_bandwidth(Mode::STATION);
+    test_cv19();
+
+    printf("%s\n", (fail_cnt == 0) ? "ok" : "FAILED");
+    return (fail_cnt == 0) ? 0 : 1;
+}
@@ -0,0 +1,312 @@
+// DccCvCache with DccCvStoreRam standing in for flash.
+//
+//   forget:   set, flush, set again, forget, flush; a new cache loaded from
+//             the store must not have the CV (it used to get the first
+//             value back)
+//   reload:   a new cache loaded from the store has what was flushed
+//   rotate:   many small flushes; after each, a new cache loaded from the
+//             store matches what was set, and compaction moves through the
+//             sectors so they are erased evenly
+//   cut:      power lost partway through a compaction (programs after the
+//             n'th don't happen); a new cache loaded from the store has what
+//             was there before it started
+//
+// Prints one line per test and exits nonzero if any check failed.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+
+#include "dcc_cv_cache.h"
+
+typedef DccCvCache::Trust Trust;
+
+static int fail_cnt = 0;
+
+static void check(bool ok, const char *what, int n = -1)
+{
+    if (ok)
+        return;
+    if (n >= 0)
+        printf("  FAIL: %s (%d)\n", what, n);
+    else
+        printf("  FAIL: %s\n", what);
+    fail_cnt++;
+}
+
+
+// DccCvStoreRam, counting erases per sector, and optionally losing power
+// (dropping programs and erases) after some number of programs.
+class TestStore : public DccCvStore
+{
+
+public:
+
+    TestStore(int sector_cnt) :
+        _ram(sector_cnt),
+        _program_left(-1)
+    {
+        for (int s = 0; s < sector_max; s++)
+            _erase_cnt[s] = 0;
+    }
+
+    virtual int sector_cnt() const override { return _ram.sector_cnt(); }
+
+    virtual void read(uint32_t off, void *buf, uint32_t len) const override
+    {
+        _ram.read(off, buf, len);
+    }
+
+    virtual void erase(uint32_t off) override
+    {
+        if (_program_left == 0)
+            return;
+        _ram.erase(off);
+        _erase_cnt[off / sector_size]++;
+    }
+
+    virtual void program(uint32_t off, const uint8_t *buf) override
+    {
+        if (_program_left == 0)
+            return;
+        if (_program_left > 0)
+            _program_left--;
+        _ram.program(off, buf);
+    }
+
+    // -1 for no limit
+    void program_left(int n) { _program_left = n; }
+
+    uint32_t erase_cnt(int sector) const { return _erase_cnt[sector]; }
+
+    static constexpr int sector_max = 8;
+
+private:
+
+    DccCvStoreRam _ram;
+    int _program_left;
+    uint32_t _erase_cnt[sector_max];
+
+}; // class TestStore
+
+
+// what the cache should have: (address, mfg, cv) -> val
+typedef std::map<uint32_t, uint8_t> Model;
+
+static uint32_t key(int address, int mfg, int cv_num)
+{
+    return (uint32_t(address) << 20) | (uint32_t(mfg) << 10) | cv_num;
+}
+
+
+static bool matches(const DccCvCache &cache, const Model &model)
+{
+    if (cache.cnt() != int(model.size()))
+        return false;
+    for (auto &kv : model) {
+        int address = kv.first >> 20;
+        int mfg = (kv.first >> 10) & 0x3ff;
+        int cv_num = kv.first & 0x3ff;
+        uint8_t val;
+        Trust trust;
+        if (!cache.get(address, mfg, cv_num, val, trust) || val != kv.second)
+            return false;
+    }
+    return true;
+}
+
+
+static bool load_matches(DccCvStore &store, const Model &model)
+{
+    DccCvCache cache(&store);
+    cache.load();
+    return matches(cache, model);
+}
+
+
+static void test_forget()
+{
+    printf("forget\n");
+
+    // one CV
+    {
+        TestStore store(2);
+        DccCvCache cache(&store);
+        cache.set(3, 151, 2, 10, Trust::READ);
+        cache.flush();
+        cache.set(3, 151, 2, 20, Trust::WRITTEN);
+        cache.forget(3, 151, 2);
+        check(cache.dirty(), "dirty after forgetting a stored CV");
+        cache.flush();
+
+        DccCvCache loaded(&store);
+        loaded.load();
+        uint8_t val;
+        Trust trust;
+        check(!loaded.get(3, 151, 2, val, trust), "forgotten CV came back");
+    }
+
+    // a whole decoder, other decoders kept
+    {
+        TestStore store(2);
+        DccCvCache cache(&store);
+        Model model;
+        for (int cv = 1; cv <= 10; cv++) {
+            cache.set(3, 151, cv, cv, Trust::READ);
+            cache.set(4, 151, cv, cv + 100, Trust::READ);
+            model[key(4, 151, cv)] = cv + 100;
+        }
+        cache.flush();
+        cache.set(3, 151, 5, 55, Trust::WRITTEN);
+        cache.forget(3, 151);
+        cache.flush();
+        check(load_matches(store, model), "forgotten decoder");
+    }
+
+    // CV8 write resets the decoder
+    {
+        TestStore store(2);
+        DccCvCache cache(&store);
+        cache.set(3, 151, 29, 6, Trust::READ);
+        cache.flush();
+        cache.set(3, 151, 8, 8, Trust::WRITTEN);
+        cache.flush();
+        check(load_matches(store, Model()), "CV8 write forgets");
+    }
+}
+
+
+static void test_reload()
+{
+    printf("reload\n");
+
+    TestStore store(2);
+    DccCvCache cache(&store);
+    Model model;
+
+    check(!cache.load(), "load from an erased store");
+
+    for (int i = 0; i < 200; i++) {
+        int address = 1 + i % 20;
+        int cv_num = 1 + i / 20;
+        uint8_t val = rand();
+        cache.set(address, 151, cv_num, val, Trust::READ);
+        model[key(address, 151, cv_num)] = val;
+    }
+    cache.flush();
+    check(load_matches(store, model), "all in one flush");
+
+    // trust survives too
+    DccCvCache loaded(&store);
+    loaded.load();
+    uint8_t val;
+    Trust trust;
+    loaded.set(7, 151, 3, 0, Trust::DEFAULT);
+    check(loaded.get(7, 151, 3, val, trust) && trust == Trust::READ &&
+              val == model[key(7, 151, 3)],
+          "default doesn't replace a loaded read");
+}
+
+
+static void test_rotate()
+{
+    static constexpr int sector_cnt = 4;
+    static constexpr int entry_cnt = 100;
+    static constexpr int flush_cnt = 20000;
+
+    printf("rotate: %d sectors, %d entries, %d flushes of one change\n",
+           sector_cnt, entry_cnt, flush_cnt);
+
+    TestStore store(sector_cnt);
+    DccCvCache cache(&store);
+    Model model;
+
+    // CVs from 10 up; writing CV8 would forget the decoder
+    for (int i = 0; i < entry_cnt; i++) {
+        cache.set(3, 151, 10 + i, i, Trust::READ);
+        model[key(3, 151, 10 + i)] = i;
+    }
+    cache.flush();
+
+    int bad = 0;
+    for (int n = 0; n < flush_cnt; n++) {
+        int cv_num = 10 + rand() % entry_cnt;
+        uint8_t val = rand();
+        cache.set(3, 151, cv_num, val, Trust::WRITTEN);
+        model[key(3, 151, cv_num)] = val;
+        cache.flush();
+        // loading every time is slow; every 7th catches each page offset
+        if ((n % 7) == 0 && !load_matches(store, model))
+            bad++;
+    }
+    check(bad == 0, "load after flush", bad);
+    check(load_matches(store, model), "load at end");
+
+    uint32_t lo = UINT32_MAX;
+    uint32_t hi = 0;
+    printf("  erases:");
+    for (int s = 0; s < sector_cnt; s++) {
+        uint32_t e = store.erase_cnt(s);
+        printf(" %u", e);
+        if (e < lo)
+            lo = e;
+        if (e > hi)
+            hi = e;
+    }
+    printf("\n");
+    check(lo > 0 && hi - lo <= 1, "erases even across sectors");
+}
+
+
+static void test_cut()
+{
+    printf("cut\n");
+
+    // enough entries that a compaction takes several pages
+    static constexpr int entry_cnt = 150;
+
+    int n;
+    for (n = 0;; n++) {
+        TestStore store(3);
+        DccCvCache cache(&store);
+        Model model;
+        for (int i = 0; i < entry_cnt; i++) {
+            cache.set(3, 151, 1 + i, i, Trust::READ);
+            model[key(3, 151, 1 + i)] = i;
+        }
+        cache.flush();
+
+        // forgetting forces a compaction; power is lost after n programs
+        Model after = model;
+        cache.forget(3, 151, 1);
+        after.erase(key(3, 151, 1));
+        store.program_left(n);
+        cache.flush();
+        store.program_left(-1);
+
+        // all programs done: the compaction finished
+        bool done = store.erase_cnt(1) == 1 && load_matches(store, after);
+        if (!done)
+            check(load_matches(store, model), "old state after cut", n);
+        if (done)
+            break;
+        if (n > 100) {
+            check(false, "compaction never finished");
+            break;
+        }
+    }
+    printf("  cut after 0...%d programs\n", n - 1);
+}
+
+
+int main()
+{
+    test_forget();
+    test_reload();
+    test_rotate();
+    test_cut();
+
+    printf("%s\n", (fail_cnt == 0) ? "ok" : "FAILED");
+    return (fail_cnt == 0) ? 0 : 1;
+}
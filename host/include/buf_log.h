@@ -0,0 +1,13 @@
+#pragma once
+
+// host build: BufLog (misc/include) with the same interface; lines go to
+// stdout when PicoHost::log_show() is on, and are dropped otherwise
+
+namespace BufLog {
+
+constexpr int line_len = 80;
+
+char *write_line_get();
+void write_line_put();
+
+}; // namespace BufLog
@@ -0,0 +1,12 @@
+#pragma once
+
+// host build: DbgGpio (misc/include) with the same interface; the pins don't
+// do anything
+
+class DbgGpio
+{
+public:
+    DbgGpio(int gpio) { (void)gpio; }
+    ~DbgGpio() {}
+    static void init(int gpio) { (void)gpio; }
+};
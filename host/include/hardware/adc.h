@@ -0,0 +1,35 @@
+#pragma once
+
+// host build: the parts of the Pico SDK's hardware/adc.h used here; there
+// is no ADC DMA, and the FIFO gets what PicoHost::adc_put() puts there
+
+#include <cstdint>
+
+#include "pico/types.h"
+
+typedef struct {
+    volatile uint32_t cs;
+    volatile uint32_t result;
+    volatile uint32_t fcs;
+    volatile uint32_t fifo;
+    volatile uint32_t div;
+    volatile uint32_t intr;
+    volatile uint32_t inte;
+    volatile uint32_t intf;
+    volatile uint32_t ints;
+} adc_hw_t;
+
+extern adc_hw_t *const adc_hw;
+
+#define ADC_FCS_OVER_BITS 0x00000800u
+
+void adc_init();
+void adc_gpio_init(uint gpio);
+void adc_select_input(uint input);
+void adc_set_clkdiv(float clkdiv);
+void adc_fifo_setup(bool en, bool dreq_en, uint16_t dreq_thresh,
+                    bool err_in_fifo, bool byte_shift);
+void adc_run(bool run);
+bool adc_fifo_is_empty();
+uint16_t adc_fifo_get();
+void adc_fifo_drain();
@@ -0,0 +1,12 @@
+#pragma once
+
+// host build: the parts of the Pico SDK's hardware/clocks.h used here
+
+#include <cstdint>
+
+enum clock_index {
+    clk_sys = 5,
+};
+
+// 125 MHz
+uint32_t clock_get_hz(clock_index clk_index);
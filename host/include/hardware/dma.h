@@ -0,0 +1,59 @@
+#pragma once
+
+// host build: the parts of the Pico SDK's hardware/dma.h used here; there
+// are no channels to claim, so the library's DMA paths are not used
+
+#include <cstdint>
+
+#include "pico/types.h"
+
+typedef struct {
+    uint32_t ctrl;
+} dma_channel_config;
+
+enum dma_channel_transfer_size {
+    DMA_SIZE_8 = 0,
+    DMA_SIZE_16 = 1,
+    DMA_SIZE_32 = 2,
+};
+
+#define DREQ_ADC 36
+
+#define DMA_CH0_CTRL_TRIG_EN_BITS 0x00000001u
+
+typedef struct {
+    volatile uint32_t read_addr;
+    volatile uint32_t write_addr;
+    volatile uint32_t transfer_count;
+    volatile uint32_t ctrl_trig;
+    volatile uint32_t al1_ctrl;
+} dma_channel_hw_t;
+
+// returns -1
+int dma_claim_unused_channel(bool required);
+void dma_channel_unclaim(uint channel);
+
+dma_channel_config dma_channel_get_default_config(uint channel);
+void channel_config_set_transfer_data_size(dma_channel_config *c,
+                                           dma_channel_transfer_size size);
+void channel_config_set_read_increment(dma_channel_config *c, bool incr);
+void channel_config_set_write_increment(dma_channel_config *c, bool incr);
+void channel_config_set_dreq(dma_channel_config *c, uint dreq);
+void channel_config_set_ring(dma_channel_config *c, bool write,
+                             uint size_bits);
+void channel_config_set_chain_to(dma_channel_config *c, uint chain_to);
+void channel_config_set_irq_quiet(dma_channel_config *c, bool irq_quiet);
+
+void dma_channel_configure(uint channel, const dma_channel_config *config,
+                           volatile void *write_addr,
+                           const volatile void *read_addr,
+                           uint transfer_count, bool trigger);
+void dma_channel_set_write_addr(uint channel, volatile void *write_addr,
+                                bool trigger);
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count,
+                                 bool trigger);
+void dma_channel_abort(uint channel);
+bool dma_channel_is_busy(uint channel);
+dma_channel_hw_t *dma_channel_hw_addr(uint channel);
+
+void hw_clear_bits(volatile uint32_t *addr, uint32_t mask);
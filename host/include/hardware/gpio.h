@@ -0,0 +1,21 @@
+#pragma once
+
+// host build: the parts of the Pico SDK's hardware/gpio.h used here; the
+// pins don't do anything (pico_host.cpp)
+
+#include "pico/types.h"
+
+enum gpio_function {
+    GPIO_FUNC_UART = 2,
+    GPIO_FUNC_PWM = 4,
+    GPIO_FUNC_SIO = 5,
+};
+
+#define GPIO_IN 0
+#define GPIO_OUT 1
+
+void gpio_init(uint gpio);
+void gpio_put(uint gpio, bool value);
+bool gpio_get(uint gpio);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_set_function(uint gpio, gpio_function fn);
@@ -0,0 +1,4 @@
+#pragma once
+
+// host build: nothing from hardware/irq.h is used directly (the PWM
+// interrupt is connected with pwm_irq_mux_connect())
@@ -0,0 +1,51 @@
+#pragma once
+
+// host build: the parts of the Pico SDK's hardware/pwm.h used here. Slices
+// don't run on their own; PicoHost::pwm_wrap() ends a slice's current period
+// (see pico_host.h).
+
+#include <cstdint>
+
+#include "pico/types.h"
+
+enum pwm_chan {
+    PWM_CHAN_A = 0,
+    PWM_CHAN_B = 1,
+};
+
+#define PWM_CH0_CC_A_LSB 0
+#define PWM_CH0_CC_B_LSB 16
+
+typedef struct {
+    uint32_t csr;
+    uint32_t div;
+    uint32_t top;
+} pwm_config;
+
+typedef struct {
+    volatile uint32_t csr;
+    volatile uint32_t div;
+    volatile uint32_t ctr;
+    volatile uint32_t cc;
+    volatile uint32_t top;
+} pwm_slice_hw_t;
+
+typedef struct {
+    pwm_slice_hw_t slice[8];
+} pwm_hw_t;
+
+extern pwm_hw_t *const pwm_hw;
+
+uint pwm_gpio_to_slice_num(uint gpio);
+uint pwm_gpio_to_channel(uint gpio);
+
+pwm_config pwm_get_default_config();
+void pwm_config_set_clkdiv_int(pwm_config *c, uint div);
+void pwm_init(uint slice_num, pwm_config *c, bool start);
+void pwm_set_enabled(uint slice_num, bool enabled);
+void pwm_set_wrap(uint slice_num, uint16_t wrap);
+void pwm_set_chan_level(uint slice_num, uint chan, uint16_t level);
+uint16_t pwm_get_counter(uint slice_num);
+void pwm_clear_irq(uint slice_num);
+void pwm_set_irq_enabled(uint slice_num, bool enabled);
+uint pwm_get_dreq(uint slice_num);
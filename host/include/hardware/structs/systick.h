@@ -0,0 +1,14 @@
+#pragma once
+
+// host build: SysTick registers (only used with INCLUDE_LATENCY)
+
+#include <cstdint>
+
+typedef struct {
+    volatile uint32_t csr;
+    volatile uint32_t rvr;
+    volatile uint32_t cvr;
+    volatile uint32_t calib;
+} systick_hw_t;
+
+extern systick_hw_t *const systick_hw;
@@ -0,0 +1,22 @@
+#pragma once
+
+// host build: the program provides these (pico_host.cpp, or its own)
+
+#include <cstdint>
+
+#include "pico/types.h"
+
+uint32_t save_and_disable_interrupts();
+void restore_interrupts(uint32_t status);
+
+// One core, and "interrupts" are signals on the same thread, so ordering only
+// has to hold against the compiler.
+inline void __dmb()
+{
+    __asm__ volatile("" ::: "memory");
+}
+
+inline void __compiler_memory_barrier()
+{
+    __asm__ volatile("" ::: "memory");
+}
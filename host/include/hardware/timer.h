@@ -0,0 +1,12 @@
+#pragma once
+
+// host build: the program provides the clock (pico_host.cpp, or its own)
+
+#include <cstdint>
+
+#include "pico/types.h"
+
+uint32_t time_us_32();
+uint64_t time_us_64();
+
+void busy_wait_us_32(uint32_t delay_us);
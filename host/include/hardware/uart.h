@@ -0,0 +1,19 @@
+#pragma once
+
+// host build: the parts of the Pico SDK's hardware/uart.h used here; what
+// uart_getc() returns is put there with PicoHost::uart_put()
+
+#include "hardware/gpio.h"
+#include "pico/types.h"
+
+typedef struct uart_inst uart_inst_t;
+
+extern uart_inst_t *const uart0;
+extern uart_inst_t *const uart1;
+
+#define UART_FUNCSEL_NUM(uart, gpio) GPIO_FUNC_UART
+
+uint uart_init(uart_inst_t *uart, uint baudrate);
+void uart_deinit(uart_inst_t *uart);
+bool uart_is_readable(uart_inst_t *uart);
+char uart_getc(uart_inst_t *uart);
@@ -0,0 +1,10 @@
+#pragma once
+
+// host build: what the Pico SDK's pico/stdlib.h brings in, as used here
+
+#include <cstdio>
+
+#include "hardware/gpio.h"
+#include "hardware/uart.h"
+#include "pico/time.h"
+#include "pico/types.h"
@@ -0,0 +1,26 @@
+#pragma once
+
+// host build: the parts of the Pico SDK's pico/time.h used here; repeating
+// timers are kept, but never fire (pico_host.cpp)
+
+#include <cstdint>
+
+#include "hardware/timer.h"
+
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+
+typedef struct repeating_timer repeating_timer_t;
+
+typedef bool (*repeating_timer_callback_t)(repeating_timer_t *rt);
+
+struct repeating_timer {
+    int64_t delay_us;
+    repeating_timer_callback_t callback;
+    void *user_data;
+};
+
+bool add_repeating_timer_us(int64_t delay_us,
+                            repeating_timer_callback_t callback,
+                            void *user_data, repeating_timer_t *out);
+bool cancel_repeating_timer(repeating_timer_t *timer);
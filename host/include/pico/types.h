@@ -0,0 +1,7 @@
+#pragma once
+
+// host build: the parts of the Pico SDK's pico/types.h used here
+
+#include <cstdint>
+
+typedef unsigned int uint;
@@ -0,0 +1,8 @@
+#pragma once
+
+// host build: pwm_irq_mux (misc/include); PicoHost::pwm_wrap() calls the
+// handler connected for the slice
+
+#include "pico/types.h"
+
+void pwm_irq_mux_connect(uint slice_num, void (*handler)(void *), void *arg);
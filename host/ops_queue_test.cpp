@@ -0,0 +1,134 @@
+// DccOpsQueue throughput against the number of locos, on the simulated
+// track with TrackSim decoders that reply in the railcom cutout.
+//
+// The same 32 jobs (half CV reads, half CV writes) are spread over 1, 2, 4,
+// 8, and 16 locos, and run two ways:
+//
+//   one at a time: each job queued when the one before it is done, as
+//                  dcc_cmd did before the queue
+//   queued:        all queued at once, so jobs for different locos overlap
+//
+// Prints CV operations/sec for each (from DccOpsQueue::ops_per_sec_x10()).
+// Checks that every job succeeds with the right value, and that with 4 or
+// more locos, queued is at least twice as fast as one at a time. Exits
+// nonzero if any check failed.
+
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+
+#include "dcc_adc.h"
+#include "dcc_command.h"
+#include "dcc_ops_queue.h"
+#include "dcc_throttle.h"
+#include "hardware/uart.h"
+#include "pico_host.h"
+#include "track_sim.h"
+
+static constexpr int sig_gpio = 4;
+static constexpr int pwr_gpio = 5;
+static constexpr int rc_gpio = 1;
+
+static constexpr int job_cnt = DccOpsQueue::wait_max;
+
+static int fail_cnt = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (ok)
+        return;
+    printf("  FAIL: %s\n", what);
+    fail_cnt++;
+}
+
+
+// job j: loco, and what it reads or writes
+static int job_loco(int j, int loco_cnt) { return 3 + j % loco_cnt; }
+static bool job_write(int j) { return (j & 1) != 0; }
+static int job_cv(int j) { return job_write(j) ? 50 + j : 10 + j; }
+static uint8_t job_val(int j) { return uint8_t(j * 13 + 5); }
+
+static bool queue_job(DccOpsQueue &queue, int j, int loco_cnt)
+{
+    int loco = job_loco(j, loco_cnt);
+    if (job_write(j))
+        return queue.write_cv(loco, job_cv(j), job_val(j), j);
+    return queue.read_cv(loco, job_cv(j), j);
+}
+
+
+// Run until the queue is idle, then check the done jobs; returns ops/sec.
+static double run(DccOpsQueue &queue, TrackSim &track, int loco_cnt,
+                  bool &all_ok)
+{
+    while (!queue.idle()) {
+        track.run_us(1000);
+        queue.loop();
+    }
+    DccOpsJob job;
+    while (queue.get_done(job)) {
+        int j = job.tag;
+        TrackSim::Decoder *d = track.decoder(job_loco(j, loco_cnt));
+        bool ok = job.result && job.cv_val == job_val(j) &&
+                  d->cv[job_cv(j)] == job_val(j);
+        all_ok = all_ok && ok;
+    }
+    return queue.ops_per_sec_x10() / 10.0;
+}
+
+
+int main()
+{
+    printf("%d CV jobs (half reads, half writes):\n", job_cnt);
+    printf("  %5s %14s %10s\n", "locos", "one at a time", "queued");
+
+    for (int loco_cnt : {1, 2, 4, 8, 16}) {
+        DccAdc adc(-1);
+        DccCommand command(sig_gpio, pwr_gpio, -1, adc, uart0, rc_gpio);
+        DccOpsQueue queue(command);
+        TrackSim track(sig_gpio);
+        command.set_mode_ops();
+
+        for (int i = 0; i < loco_cnt; i++) {
+            TrackSim::Decoder *d = track.decoder_add(3 + i);
+            for (int j = 0; j < job_cnt; j++)
+                if (!job_write(j))
+                    d->cv[job_cv(j)] = job_val(j);
+            command.create_throttle(3 + i)->set_speed(10);
+        }
+        track.run_us(100000);
+
+        bool all_ok = true;
+        int ok_cnt = 0;
+
+        // one at a time
+        queue.reset_stats();
+        for (int j = 0; j < job_cnt; j++) {
+            queue_job(queue, j, loco_cnt);
+            run(queue, track, loco_cnt, all_ok);
+        }
+        double one = queue.ops_per_sec_x10() / 10.0;
+        ok_cnt += queue.ok_cnt();
+
+        // undo the writes, so the second run's are seen
+        for (int i = 0; i < loco_cnt; i++)
+            for (int j = 0; j < job_cnt; j++)
+                if (job_write(j))
+                    track.decoder(3 + i)->cv[job_cv(j)] = 0;
+
+        // all at once
+        queue.reset_stats();
+        for (int j = 0; j < job_cnt; j++)
+            check(queue_job(queue, j, loco_cnt), "queued");
+        double all = run(queue, track, loco_cnt, all_ok);
+        ok_cnt += queue.ok_cnt();
+
+        printf("  %5d %11.1f/s %8.1f/s\n", loco_cnt, one, all);
+        check(all_ok && ok_cnt == 2 * job_cnt, "all jobs done right");
+        if (loco_cnt >= 4)
+            check(all >= 2 * one, "queued twice as fast");
+    }
+
+    printf("%s\n", (fail_cnt == 0) ? "ok" : "FAILED");
+    return (fail_cnt == 0) ? 0 : 1;
+}
@@ -0,0 +1,519 @@
+// Host stand-ins for the Pico SDK (see pico_host.h)
+
+#include "pico_host.h"
+
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+
+#include "buf_log.h"
+#include "hardware/adc.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "hardware/pwm.h"
+#include "hardware/structs/systick.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include "hardware/uart.h"
+#include "pico/time.h"
+#include "pwm_irq_mux.h"
+
+// clock
+
+static uint64_t now_us = 0;
+
+uint64_t PicoHost::time_us()
+{
+    return now_us;
+}
+
+void PicoHost::time_set(uint64_t us)
+{
+    now_us = us;
+}
+
+void PicoHost::time_add(uint64_t us)
+{
+    now_us += us;
+}
+
+uint32_t time_us_32()
+{
+    return uint32_t(now_us);
+}
+
+uint64_t time_us_64()
+{
+    return now_us;
+}
+
+// interrupts
+
+static int irq_sig = 0;
+
+void PicoHost::irq_signal(int sig)
+{
+    irq_sig = sig;
+}
+
+// Returns nonzero if it was already blocked, so nested calls work.
+uint32_t save_and_disable_interrupts()
+{
+    if (irq_sig == 0)
+        return 0;
+    sigset_t set;
+    sigset_t old;
+    sigemptyset(&set);
+    sigaddset(&set, irq_sig);
+    sigprocmask(SIG_BLOCK, &set, &old);
+    return sigismember(&old, irq_sig) ? 1 : 0;
+}
+
+void restore_interrupts(uint32_t status)
+{
+    if (irq_sig == 0 || status != 0)
+        return;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, irq_sig);
+    sigprocmask(SIG_UNBLOCK, &set, nullptr);
+}
+
+// gpio
+
+void gpio_init(uint)
+{
+}
+
+void gpio_put(uint, bool)
+{
+}
+
+bool gpio_get(uint)
+{
+    return false;
+}
+
+void gpio_set_dir(uint, bool)
+{
+}
+
+void gpio_set_function(uint, gpio_function)
+{
+}
+
+// uart
+
+struct uart_inst {
+    int num;
+};
+
+static uart_inst uart_insts[2] = {{0}, {1}};
+
+uart_inst_t *const uart0 = &uart_insts[0];
+uart_inst_t *const uart1 = &uart_insts[1];
+
+static constexpr int uart_rx_max = 64;
+static uint8_t uart_rx[uart_rx_max];
+static int uart_rx_get = 0;
+static int uart_rx_cnt = 0;
+
+void PicoHost::uart_put(const uint8_t *buf, int len)
+{
+    for (int i = 0; i < len && uart_rx_cnt < uart_rx_max; i++)
+        uart_rx[(uart_rx_get + uart_rx_cnt++) % uart_rx_max] = buf[i];
+}
+
+void PicoHost::uart_flush()
+{
+    uart_rx_cnt = 0;
+}
+
+uint uart_init(uart_inst_t *, uint baudrate)
+{
+    return baudrate;
+}
+
+// a reset empties the receive FIFO
+void uart_deinit(uart_inst_t *)
+{
+    uart_rx_cnt = 0;
+}
+
+bool uart_is_readable(uart_inst_t *)
+{
+    return uart_rx_cnt > 0;
+}
+
+char uart_getc(uart_inst_t *)
+{
+    if (uart_rx_cnt == 0)
+        return 0;
+    char c = char(uart_rx[uart_rx_get]);
+    uart_rx_get = (uart_rx_get + 1) % uart_rx_max;
+    uart_rx_cnt--;
+    return c;
+}
+
+// SysTick
+
+static systick_hw_t systick;
+
+systick_hw_t *const systick_hw = &systick;
+
+// BufLog
+
+static bool log_on = false;
+static char log_line[BufLog::line_len];
+
+void PicoHost::log_show(bool show)
+{
+    log_on = show;
+}
+
+char *BufLog::write_line_get()
+{
+    return log_line;
+}
+
+void BufLog::write_line_put()
+{
+    if (log_on)
+        printf("%s\n", log_line);
+}
+
+// sleeps just move the clock
+
+void sleep_us(uint64_t us)
+{
+    now_us += us;
+}
+
+void sleep_ms(uint32_t ms)
+{
+    now_us += uint64_t(ms) * 1000;
+}
+
+void busy_wait_us_32(uint32_t delay_us)
+{
+    now_us += delay_us;
+}
+
+// Repeating timers are accepted, but never fire. The library only uses one
+// in the bitstream's idle mode, which needs DMA, and there is none here.
+
+bool add_repeating_timer_us(int64_t delay_us,
+                            repeating_timer_callback_t callback,
+                            void *user_data, repeating_timer_t *out)
+{
+    out->delay_us = delay_us;
+    out->callback = callback;
+    out->user_data = user_data;
+    return true;
+}
+
+bool cancel_repeating_timer(repeating_timer_t *timer)
+{
+    timer->callback = nullptr;
+    return true;
+}
+
+// clocks
+
+static constexpr uint32_t sys_hz = 125000000;
+
+uint32_t clock_get_hz(clock_index)
+{
+    return sys_hz;
+}
+
+// DMA: no channels
+
+int dma_claim_unused_channel(bool)
+{
+    return -1;
+}
+
+void dma_channel_unclaim(uint)
+{
+}
+
+dma_channel_config dma_channel_get_default_config(uint)
+{
+    return dma_channel_config{0};
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config *,
+                                           dma_channel_transfer_size)
+{
+}
+
+void channel_config_set_read_increment(dma_channel_config *, bool)
+{
+}
+
+void channel_config_set_write_increment(dma_channel_config *, bool)
+{
+}
+
+void channel_config_set_dreq(dma_channel_config *, uint)
+{
+}
+
+void channel_config_set_ring(dma_channel_config *, bool, uint)
+{
+}
+
+void channel_config_set_chain_to(dma_channel_config *, uint)
+{
+}
+
+void channel_config_set_irq_quiet(dma_channel_config *, bool)
+{
+}
+
+void dma_channel_configure(uint, const dma_channel_config *, volatile void *,
+                           const volatile void *, uint, bool)
+{
+}
+
+void dma_channel_set_write_addr(uint, volatile void *, bool)
+{
+}
+
+void dma_channel_set_trans_count(uint, uint32_t, bool)
+{
+}
+
+void dma_channel_abort(uint)
+{
+}
+
+bool dma_channel_is_busy(uint)
+{
+    return false;
+}
+
+static dma_channel_hw_t dma_channel_hw;
+
+dma_channel_hw_t *dma_channel_hw_addr(uint)
+{
+    return &dma_channel_hw;
+}
+
+void hw_clear_bits(volatile uint32_t *addr, uint32_t mask)
+{
+    *addr = *addr & ~mask;
+}
+
+// ADC
+
+static adc_hw_t adc_regs;
+
+adc_hw_t *const adc_hw = &adc_regs;
+
+static uint16_t adc_fifo[PicoHost::adc_fifo_max];
+static int adc_fifo_get_idx = 0;
+static int adc_fifo_cnt_now = 0;
+
+void PicoHost::adc_put(uint16_t sample)
+{
+    if (adc_fifo_cnt_now >= adc_fifo_max) {
+        adc_regs.fcs = adc_regs.fcs | ADC_FCS_OVER_BITS;
+        return;
+    }
+    adc_fifo[(adc_fifo_get_idx + adc_fifo_cnt_now++) % adc_fifo_max] = sample;
+}
+
+int PicoHost::adc_fifo_cnt()
+{
+    return adc_fifo_cnt_now;
+}
+
+void adc_init()
+{
+}
+
+void adc_gpio_init(uint)
+{
+}
+
+void adc_select_input(uint)
+{
+}
+
+void adc_set_clkdiv(float)
+{
+}
+
+void adc_fifo_setup(bool, bool, uint16_t, bool, bool)
+{
+}
+
+void adc_run(bool)
+{
+}
+
+bool adc_fifo_is_empty()
+{
+    return adc_fifo_cnt_now == 0;
+}
+
+uint16_t adc_fifo_get()
+{
+    if (adc_fifo_cnt_now == 0)
+        return 0;
+    uint16_t sample = adc_fifo[adc_fifo_get_idx];
+    adc_fifo_get_idx = (adc_fifo_get_idx + 1) % PicoHost::adc_fifo_max;
+    adc_fifo_cnt_now--;
+    return sample;
+}
+
+void adc_fifo_drain()
+{
+    adc_fifo_cnt_now = 0;
+}
+
+// PWM
+
+static constexpr int slice_max = 8;
+
+struct Slice {
+    bool enabled;
+    bool irq_enabled;
+    uint32_t div;
+    // set during a period, used from the next one
+    uint32_t top;
+    uint32_t level[2];
+    // the period going out now
+    uint32_t top_now;
+    uint32_t level_now[2];
+    void (*handler)(void *);
+    void *arg;
+};
+
+static Slice slices[slice_max];
+
+static PicoHost::pwm_watch_t *pwm_watcher = nullptr;
+static void *pwm_watcher_arg = nullptr;
+
+static pwm_hw_t pwm_regs;
+
+pwm_hw_t *const pwm_hw = &pwm_regs;
+
+void PicoHost::pwm_watch(pwm_watch_t *watch, void *arg)
+{
+    pwm_watcher = watch;
+    pwm_watcher_arg = arg;
+}
+
+// new period: latch what was set, and tell the watcher
+static void pwm_latch(uint slice_num)
+{
+    Slice &s = slices[slice_num];
+    s.top_now = s.top;
+    s.level_now[0] = s.level[0];
+    s.level_now[1] = s.level[1];
+    if (pwm_watcher != nullptr)
+        pwm_watcher(slice_num, s.top_now, s.level_now[0], s.level_now[1],
+                    pwm_watcher_arg);
+}
+
+// length of the current period
+static uint32_t pwm_len_us(uint slice_num)
+{
+    const Slice &s = slices[slice_num];
+    return uint32_t((uint64_t(s.top_now) + 1) * s.div / (sys_hz / 1000000));
+}
+
+uint32_t PicoHost::pwm_wrap(unsigned slice_num)
+{
+    Slice &s = slices[slice_num];
+    if (!s.enabled) {
+        now_us += 100;
+        return 100;
+    }
+    pwm_latch(slice_num);
+    if (s.irq_enabled && s.handler != nullptr)
+        s.handler(s.arg);
+    uint32_t len_us = pwm_len_us(slice_num);
+    now_us += len_us;
+    return len_us;
+}
+
+void pwm_irq_mux_connect(uint slice_num, void (*handler)(void *), void *arg)
+{
+    slices[slice_num].handler = handler;
+    slices[slice_num].arg = arg;
+}
+
+uint pwm_gpio_to_slice_num(uint gpio)
+{
+    return (gpio >> 1) & 7;
+}
+
+uint pwm_gpio_to_channel(uint gpio)
+{
+    return gpio & 1;
+}
+
+pwm_config pwm_get_default_config()
+{
+    return pwm_config{0, 1, 0xffff};
+}
+
+void pwm_config_set_clkdiv_int(pwm_config *c, uint div)
+{
+    c->div = div;
+}
+
+void pwm_init(uint slice_num, pwm_config *c, bool start)
+{
+    Slice &s = slices[slice_num];
+    s.div = c->div;
+    s.top = c->top;
+    s.level[0] = 0;
+    s.level[1] = 0;
+    pwm_set_enabled(slice_num, start);
+}
+
+// Starting a slice starts a period with what was set.
+void pwm_set_enabled(uint slice_num, bool enabled)
+{
+    Slice &s = slices[slice_num];
+    bool start = enabled && !s.enabled;
+    s.enabled = enabled;
+    if (start)
+        pwm_latch(slice_num);
+}
+
+void pwm_set_wrap(uint slice_num, uint16_t wrap)
+{
+    slices[slice_num].top = wrap;
+}
+
+void pwm_set_chan_level(uint slice_num, uint chan, uint16_t level)
+{
+    slices[slice_num].level[chan & 1] = level;
+}
+
+// The handler runs right at the wrap.
+uint16_t pwm_get_counter(uint)
+{
+    return 0;
+}
+
+void pwm_clear_irq(uint)
+{
+}
+
+void pwm_set_irq_enabled(uint slice_num, bool enabled)
+{
+    slices[slice_num].irq_enabled = enabled;
+}
+
+uint pwm_get_dreq(uint slice_num)
+{
+    return slice_num;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+// Host stand-ins for the Pico SDK calls the library makes (pico_host.cpp),
+// and what a host program uses to drive them.
+
+#include <cstdint>
+
+namespace PicoHost {
+
+// The clock (time_us_32(), time_us_64()) is simulated; it only moves when
+// the program moves it.
+uint64_t time_us();
+void time_set(uint64_t us);
+void time_add(uint64_t us);
+
+// Signal standing in for the DCC interrupt. While interrupts are disabled
+// (save_and_disable_interrupts()), it is blocked. 0 (the default) for none.
+void irq_signal(int sig);
+
+// Bytes for uart_getc() (any uart)
+void uart_put(const uint8_t *buf, int len);
+void uart_flush();
+
+// ADC samples for the FIFO (adc_fifo_get()), in order. If more are put
+// than the FIFO holds (adc_fifo_max), the rest are dropped and the overflow bit
+// is set, as on the chip.
+void adc_put(uint16_t sample);
+int adc_fifo_cnt();
+constexpr int adc_fifo_max = 1024;
+
+// PWM. A slice's period (one DCC bit here) ends when the program calls
+// pwm_wrap(). TOP and the channel levels set during a period take effect at
+// the wrap (they're double buffered, as on the chip). At each wrap, the
+// watcher (if any) is told about the period starting, then the interrupt
+// handler connected with pwm_irq_mux_connect() runs (if enabled), then the
+// clock moves to the end of the new period. Returns its length in usec. A
+// slice that is not enabled just lets 100 usec pass.
+uint32_t pwm_wrap(unsigned slice);
+
+// What a slice does in the period starting now: top + 1 counts, and each
+// channel is high for level counts.
+typedef void pwm_watch_t(unsigned slice, uint32_t top, uint32_t level_a,
+                         uint32_t level_b, void *arg);
+void pwm_watch(pwm_watch_t *watch, void *arg);
+
+// BufLog lines to stdout (default off)
+void log_show(bool show);
+
+}; // namespace PicoHost
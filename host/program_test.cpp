@@ -0,0 +1,279 @@
+// DccProgram in ops mode against writing every CV, on the simulated track
+// with a TrackSim decoder that replies in the railcom cutout.
+//
+// The target is 100 CVs, as for setting up a sound decoder: 60 plain ones
+// and 40 indexed ones on two CV31/CV32 pages, listed with the pages
+// alternating. (TrackSim's decoder has no pages, so the indexed CVs have
+// numbers of their own.)
+//
+//   naive:    write every item in list order, CV31 and CV32 before each
+//             indexed one
+//   delta:    DccProgram, with the decoder already having 80% of the values
+//   no read:  DccProgram with verify false (write without reading)
+//   resume:   delta, with the power lost halfway (the program and the
+//             throttle gone), then started again from done_cnt()
+//
+// and naive, delta, and no read again with none of the values right. For
+// each, the CV packets sent, writes (CV31/CV32 writes), reads, and time.
+//
+// Checks that the decoder ends up with every target value, and that delta
+// sends fewer packets than naive when most values are right. Prints one line
+// per run and exits nonzero if any check failed.
+//
+// Service mode is not covered; TrackSim has no ack (current) model.
+
+#include <cstdint>
+#include <cstdio>
+
+#include "dcc_adc.h"
+#include "dcc_command.h"
+#include "dcc_cv.h"
+#include "dcc_program.h"
+#include "dcc_throttle.h"
+#include "hardware/uart.h"
+#include "pico_host.h"
+#include "track_sim.h"
+
+static constexpr int sig_gpio = 4;
+static constexpr int pwr_gpio = 5;
+static constexpr int rc_gpio = 1;
+
+static constexpr int loco = 3;
+static constexpr int plain_cnt = 60;
+static constexpr int indexed_cnt = 40;
+static constexpr int item_cnt = plain_cnt + indexed_cnt;
+static_assert(item_cnt <= DccProgram::item_max);
+
+static int fail_cnt = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (ok)
+        return;
+    printf("  FAIL: %s\n", what);
+    fail_cnt++;
+}
+
+
+static DccProgram::Item items[item_cnt];
+
+static void items_init()
+{
+    // plain and indexed alternate at first, and indexed alternate pages
+    int p = 0;
+    int x = 0;
+    for (int i = 0; i < item_cnt; i++) {
+        DccProgram::Item &it = items[i];
+        if ((i & 1) == 0 && x < indexed_cnt) {
+            it.cv_num = 257 + x;
+            it.index = DccCv::index(16, x & 1);
+            x++;
+        } else {
+            it.cv_num = 33 + p;
+            it.index = -1;
+            p++;
+        }
+        it.cv_val = uint8_t(i * 29 + 7);
+    }
+}
+
+
+// ops mode CV packets for the loco
+static void watch(const uint8_t *msg, int msg_len, uint64_t, void *arg)
+{
+    if (msg[0] == loco && msg_len >= 5 && (msg[1] & 0xf0) == 0xe0)
+        (*(uint32_t *)arg)++;
+}
+
+
+struct Layout {
+
+    DccAdc adc;
+    DccCommand command;
+    TrackSim track;
+    uint32_t pkt_cnt;
+    TrackSim::Decoder *decoder;
+    DccThrottle *throttle;
+
+    Layout(int right_pct) :
+        adc(-1),
+        command(sig_gpio, pwr_gpio, -1, adc, uart0, rc_gpio),
+        track(sig_gpio),
+        pkt_cnt(0)
+    {
+        track.watch(watch, &pkt_cnt);
+        command.set_mode_ops();
+        decoder = track.decoder_add(loco);
+        for (int i = 0; i < item_cnt; i++) {
+            bool right = (i * 100 / item_cnt) % 100 < right_pct;
+            decoder->cv[items[i].cv_num] =
+                right ? items[i].cv_val : ~items[i].cv_val;
+        }
+        throttle = command.create_throttle(loco);
+        track.run_us(100000);
+    }
+
+    bool all_right() const
+    {
+        for (int i = 0; i < item_cnt; i++)
+            if (decoder->cv[items[i].cv_num] != items[i].cv_val)
+                return false;
+        return true;
+    }
+
+}; // struct Layout
+
+
+struct Result {
+    uint32_t pkt_cnt;
+    int write_cnt;
+    int index_cnt; // CV31/CV32 writes
+    int read_cnt;
+    double sec;
+    bool right;
+};
+
+
+static void show(const char *name, const Result &r)
+{
+    printf("  %-8s %4u packets, %3d writes (%2d index), %3d reads, "
+           "%5.2f s\n",
+           name, r.pkt_cnt, r.write_cnt, r.index_cnt, r.read_cnt, r.sec);
+}
+
+
+static bool write(Layout &lay, int cv_num, uint8_t cv_val)
+{
+    lay.throttle->write_cv(cv_num, cv_val);
+    bool result = false;
+    uint8_t val;
+    while (!lay.throttle->ops_done(result, val))
+        lay.track.run_us(1000);
+    return result;
+}
+
+
+static Result naive(int right_pct)
+{
+    Layout lay(right_pct);
+    Result r = {};
+    uint64_t start_us = PicoHost::time_us();
+    for (const DccProgram::Item &it : items) {
+        if (it.index >= 0) {
+            write(lay, DccCv::index_hi, it.index >> 8);
+            write(lay, DccCv::index_lo, it.index & 0xff);
+            r.write_cnt += 2;
+            r.index_cnt += 2;
+        }
+        write(lay, it.cv_num, it.cv_val);
+        r.write_cnt++;
+    }
+    r.pkt_cnt = lay.pkt_cnt;
+    r.sec = (PicoHost::time_us() - start_us) / 1e6;
+    r.right = lay.all_right();
+    return r;
+}
+
+
+// Run a DccProgram until it's done, or until done_cnt() gets to stop_at.
+static void prog_run(Layout &lay, DccProgram &prog, int stop_at = item_cnt)
+{
+    while (prog.busy() && prog.done_cnt() < stop_at) {
+        lay.track.run_us(1000);
+        prog.loop();
+    }
+}
+
+
+static void prog_add(const DccProgram &prog, Result &r)
+{
+    r.write_cnt += prog.write_cnt() + prog.index_write_cnt();
+    r.index_cnt += prog.index_write_cnt();
+    r.read_cnt += prog.read_cnt();
+}
+
+
+static Result delta(int right_pct, bool verify)
+{
+    Layout lay(right_pct);
+    Result r = {};
+    uint64_t start_us = PicoHost::time_us();
+    DccProgram prog(lay.command);
+    check(prog.start_ops(lay.throttle, items, item_cnt, 0, verify), "start");
+    prog_run(lay, prog);
+    prog_add(prog, r);
+    r.pkt_cnt = lay.pkt_cnt;
+    r.sec = (PicoHost::time_us() - start_us) / 1e6;
+    r.right = lay.all_right() && prog.fail_cnt() == 0;
+    return r;
+}
+
+
+static Result resume(int right_pct)
+{
+    Layout lay(right_pct);
+    Result r = {};
+    uint64_t start_us = PicoHost::time_us();
+    int done;
+    {
+        DccProgram prog(lay.command);
+        prog.start_ops(lay.throttle, items, item_cnt);
+        prog_run(lay, prog, item_cnt / 2);
+        done = prog.done_cnt();
+        prog_add(prog, r);
+    }
+    // power back: a new throttle (that knows nothing of CV31/CV32)
+    lay.command.delete_throttle(lay.throttle);
+    lay.throttle = lay.command.create_throttle(loco);
+    lay.track.run_us(100000);
+
+    DccProgram prog(lay.command);
+    check(prog.start_ops(lay.throttle, items, item_cnt, done), "restart");
+    prog_run(lay, prog);
+    prog_add(prog, r);
+    r.pkt_cnt = lay.pkt_cnt;
+    // not counting the 100 msec with the new throttle before restarting
+    r.sec = (PicoHost::time_us() - start_us - 100000) / 1e6;
+    r.right = lay.all_right() && prog.fail_cnt() == 0;
+    return r;
+}
+
+
+int main()
+{
+    items_init();
+
+    {
+        DccAdc adc(-1);
+        DccCommand command(sig_gpio, pwr_gpio, -1, adc);
+        DccProgram prog(command);
+        command.set_mode_ops();
+        prog.start_ops(command.create_throttle(loco), items, item_cnt);
+        printf("%d CVs (%d indexed); naive_write_cnt() %d\n", item_cnt,
+               indexed_cnt, prog.naive_write_cnt());
+    }
+
+    printf("80%% already right:\n");
+    Result n = naive(80);
+    show("naive", n);
+    Result d = delta(80, true);
+    show("delta", d);
+    Result w = delta(80, false);
+    show("no read", w);
+    Result s = resume(80);
+    show("resume", s);
+    check(n.right && d.right && w.right && s.right, "decoder has the targets");
+    check(d.pkt_cnt < n.pkt_cnt, "delta sends fewer packets");
+
+    printf("none right:\n");
+    n = naive(0);
+    show("naive", n);
+    d = delta(0, true);
+    show("delta", d);
+    w = delta(0, false);
+    show("no read", w);
+    check(n.right && d.right && w.right, "decoder has the targets");
+
+    printf("%s\n", (fail_cnt == 0) ? "ok" : "FAILED");
+    return (fail_cnt == 0) ? 0 : 1;
+}
@@ -0,0 +1,185 @@
+// DccRamp on the simulated clock, called every millisecond like the main
+// loop would.
+//
+//   accel:    0 to 127 at CV3 10 takes 127/128 * 8.96 s, and the throttle
+//             gets one set_speed() per step, never speed 1 (e-stop)
+//   decel:    127 to 0 at CV4 5 takes 125/128 * 4.48 s (it goes from 2
+//             straight to 0)
+//   reverse:  40 to -40 slows to 0 at the decel rate, then speeds up at the
+//             accel rate, never through +/-1
+//   none:     CV 0 sets the speed on the next tick
+//   estop:    an e-stopped throttle stays at 0
+//   tick:     tick() time with ramp_max throttles ramping (host clock; it
+//             shows how the time scales, not what it is on an RP2040)
+//
+// Prints one line per test and exits nonzero if any check failed.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "dcc_ramp.h"
+#include "dcc_throttle.h"
+#include "pico_host.h"
+
+static int fail_cnt = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (ok)
+        return;
+    printf("  FAIL: %s\n", what);
+    fail_cnt++;
+}
+
+
+// Run the ramp until the throttle is at the target speed (or limit_ms),
+// calling loop() every msec. Returns msec taken; counts speed changes and
+// checks that no speed was 1 or -1, and that each change was toward the
+// target.
+static uint32_t run(DccRamp &ramp, DccThrottle &t, int target, int &changes,
+                    uint32_t limit_ms = 60000)
+{
+    ramp.set_target(&t, target);
+
+    int speed = t.get_speed();
+    bool one = false;
+    bool back = false;
+    changes = 0;
+
+    uint32_t ms;
+    for (ms = 0; ms < limit_ms && t.get_speed() != target; ms++) {
+        PicoHost::time_add(1000);
+        ramp.loop();
+        int s = t.get_speed();
+        if (s == speed)
+            continue;
+        changes++;
+        if (s == 1 || s == -1)
+            one = true;
+        if ((s > speed) != (target > speed))
+            back = true;
+        speed = s;
+    }
+
+    check(!one, "speed 1 sent");
+    check(!back, "speed moved away from the target");
+    return ms;
+}
+
+
+static void test_accel(DccRamp &ramp, DccThrottle &t)
+{
+    int changes;
+    ramp.add(&t, 10, 5);
+    uint32_t ms = run(ramp, t, 127, changes);
+    // 127 steps of 70 msec, to within a tick
+    uint32_t want = 127 * 70;
+    printf("accel: 0 to 127 at CV3 10: %.3f s (%.3f s), %d speed changes\n",
+           ms / 1000.0, want / 1000.0, changes);
+    check(ms + 10 >= want && ms <= want + 20, "accel time");
+    check(changes == 126, "one change per step, skipping 1");
+}
+
+
+static void test_decel(DccRamp &ramp, DccThrottle &t)
+{
+    int changes;
+    uint32_t ms = run(ramp, t, 0, changes);
+    uint32_t want = 125 * 35;
+    printf("decel: 127 to 0 at CV4 5: %.3f s (%.3f s), %d speed changes\n",
+           ms / 1000.0, want / 1000.0, changes);
+    check(ms + 10 >= want && ms <= want + 20, "decel time");
+    check(changes == 126, "one change per step, skipping 1");
+}
+
+
+static void test_reverse(DccRamp &ramp, DccThrottle &t)
+{
+    int changes;
+    run(ramp, t, 40, changes);
+    uint32_t ms = run(ramp, t, -40, changes);
+    uint32_t want = 40 * 35 + 40 * 70;
+    printf("reverse: 40 to -40: %.3f s (%.3f s), %d speed changes\n",
+           ms / 1000.0, want / 1000.0, changes);
+    check(ms + 20 >= want && ms <= want + 40, "reverse time");
+}
+
+
+static void test_none(DccRamp &ramp, DccThrottle &t)
+{
+    int changes;
+    ramp.add(&t, 0, 0);
+    uint32_t ms = run(ramp, t, 100, changes);
+    printf("none: 0 to 100 at CV 0: %u ms\n", ms);
+    check(ms <= DccRamp::tick_us_default / 1000, "no momentum time");
+    check(changes == 1, "one change");
+    ramp.add(&t, 10, 5);
+}
+
+
+static void test_estop(DccRamp &ramp, DccThrottle &t)
+{
+    int changes;
+    run(ramp, t, 60, changes);
+    int before = t.get_speed();
+    t.estop();
+    t.next_packet(); // applies it
+    for (int ms = 0; ms < 1000; ms++) {
+        PicoHost::time_add(1000);
+        ramp.loop();
+    }
+    printf("estop: at %d, then %d after 1 s; target %d\n", before,
+           t.get_speed(), ramp.get_target(&t));
+    check(before > 0 && t.get_speed() == 0 && ramp.get_target(&t) == 0,
+          "estop stays stopped");
+}
+
+
+static void test_tick()
+{
+    typedef std::chrono::steady_clock clock;
+    static constexpr int tick_cnt = 10000;
+
+    static DccThrottle throttles[DccRamp::ramp_max];
+    DccRamp ramp;
+    for (int i = 0; i < DccRamp::ramp_max; i++) {
+        throttles[i].set_address(1 + i);
+        ramp.add(&throttles[i], 1 + i % 20, 1 + i % 20);
+    }
+
+    // up and down, so they are all ramping all the time
+    double ns = 0;
+    for (int n = 0; n < tick_cnt; n++) {
+        if ((n % 500) == 0)
+            for (int i = 0; i < DccRamp::ramp_max; i++)
+                ramp.set_target(&throttles[i], (n % 1000) ? -127 : 127);
+        clock::time_point t0 = clock::now();
+        ramp.tick();
+        clock::time_point t1 = clock::now();
+        ns += std::chrono::duration<double, std::nano>(t1 - t0).count();
+    }
+
+    printf("tick: %d throttles: %.2f us/tick, %.1f ns/throttle; "
+           "%u speed changes in %d ticks\n",
+           DccRamp::ramp_max, ns / tick_cnt / 1000,
+           ns / tick_cnt / DccRamp::ramp_max, ramp.set_cnt(), tick_cnt);
+}
+
+
+int main()
+{
+    DccRamp ramp;
+    DccThrottle t;
+
+    test_accel(ramp, t);
+    test_decel(ramp, t);
+    test_reverse(ramp, t);
+    test_none(ramp, t);
+    test_estop(ramp, t);
+    test_tick();
+
+    printf("%s\n", (fail_cnt == 0) ? "ok" : "FAILED");
+    return (fail_cnt == 0) ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+// DccRoster::next_packet() time with 1000 locos, some moving, on the host.
+//
+// The clock is simulated: it advances one packet time (6 msec, a long
+// packet) per next_packet(), so parked locos come due as they would on the
+// track. Every 50th packet a random loco gets a function change. For each
+// number of moving locos, this prints the average over 2M calls, the 99.9th
+// percentile of 20k individually timed calls, and how the packets were
+// split between changes, moving locos, parked locos, and nothing to send.
+//
+// Then it e-stops them all, and checks that every loco is at speed 0 and
+// that the next packets are those speeds.
+//
+// These are host numbers; they show how the time scales with the roster,
+// not what it is on an RP2040.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+
+#include "dcc_pkt.h"
+#include "dcc_roster.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+
+static uint32_t now_us = 0;
+
+uint32_t time_us_32()
+{
+    return now_us;
+}
+
+uint64_t time_us_64()
+{
+    return now_us;
+}
+
+uint32_t save_and_disable_interrupts()
+{
+    return 0;
+}
+
+void restore_interrupts(uint32_t)
+{
+}
+
+static constexpr int loco_cnt = 1000;
+static constexpr uint32_t pkt_us = 6000;
+static constexpr int avg_cnt = 2000000;
+static constexpr int pct_cnt = 20000;
+
+static DccRoster roster; // big; not on the stack
+static double call_ns[pct_cnt];
+
+int main()
+{
+    typedef std::chrono::steady_clock clock;
+
+    printf("sizeof(DccRoster) %zu, %.2f bytes/slot\n", sizeof(DccRoster),
+           double(sizeof(DccRoster)) / DccRoster::slot_max);
+
+    for (int i = 0; i < loco_cnt; i++)
+        roster.add(100 + i);
+
+    DccPkt pkt;
+
+    for (int moving : {0, 10, 50, 200}) {
+        for (int s = 0; s < loco_cnt; s++)
+            roster.set_speed(s, (s < moving) ? 20 : 0);
+
+        // send the changes just made
+        for (int i = 0; i < 5000; i++) {
+            now_us += pkt_us;
+            roster.next_packet(pkt);
+        }
+        roster.reset_stats();
+
+        uint32_t sent = 0;
+        clock::time_point t0 = clock::now();
+        for (int i = 0; i < avg_cnt; i++) {
+            now_us += pkt_us;
+            if ((i % 50) == 0)
+                roster.set_function(rand() % loco_cnt, rand() % 29, true);
+            sent += roster.next_packet(pkt);
+        }
+        clock::time_point t1 = clock::now();
+
+        for (int i = 0; i < pct_cnt; i++) {
+            now_us += pkt_us;
+            clock::time_point a = clock::now();
+            roster.next_packet(pkt);
+            clock::time_point b = clock::now();
+            call_ns[i] = std::chrono::duration<double, std::nano>(b - a).count();
+        }
+        std::sort(call_ns, call_ns + pct_cnt);
+
+        double avg_ns =
+            std::chrono::duration<double, std::nano>(t1 - t0).count() / avg_cnt;
+        printf("moving %4d: %.1f ns avg, %.0f ns p99.9; packets: change %u, "
+               "moving %u, parked %u, none %u\n",
+               moving, avg_ns, call_ns[pct_cnt * 999 / 1000],
+               roster.dirty_pkt_cnt(), roster.moving_pkt_cnt(),
+               roster.parked_pkt_cnt(), uint32_t(avg_cnt) - sent);
+    }
+
+    // e-stop with the last number of moving locos; it's called from
+    // get_packet() in interrupt context, so its time matters too
+    int moving = roster.moving_cnt();
+    clock::time_point t0 = clock::now();
+    roster.estop();
+    clock::time_point t1 = clock::now();
+    int stopped = 0;
+    for (int s = 0; s < loco_cnt; s++)
+        stopped += (roster.get_speed(s) == 0);
+    roster.reset_stats();
+    for (int i = 0; i < moving; i++) {
+        now_us += pkt_us;
+        roster.next_packet(pkt);
+    }
+    printf("estop with %d moving: %.0f ns; %d of %d stopped, %d moving; "
+           "next %d packets: change %u\n",
+           moving,
+           std::chrono::duration<double, std::nano>(t1 - t0).count(),
+           stopped, loco_cnt, roster.moving_cnt(), moving,
+           roster.dirty_pkt_cnt());
+
+    return (stopped == loco_cnt && roster.moving_cnt() == 0) ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+// DccThrottle::next_packet() against a main loop that never stops changing
+// the throttle, with and without the seqlock (_upd_seq).
+//
+// The DCC interrupt is modeled with an interval timer signal on the main
+// thread, so like the interrupt on the Pico, it can stop the main loop
+// anywhere, and the main loop can't run until it returns. Each "interrupt"
+// gets a packet and checks it: it is torn if its xor is bad or its address
+// is neither of the two the main loop switches between.
+//
+//   no lock: what next_packet() did before the seqlock (estop_apply() and
+//            packet_next() with no check)
+//   seqlock: next_packet()
+//
+// Prints the counts for each and exits nonzero if the seqlock let a torn
+// packet through, or if the run without it saw none (then the test didn't
+// catch the main loop mid-change and shows nothing).
+
+#include <cassert>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <sys/time.h>
+
+// "no lock" calls the private packet_next() directly
+#define private public
+#include "dcc_throttle.h"
+#undef private
+
+#include "dcc_pkt.h"
+#include "pico_host.h"
+
+static constexpr int address_a = 3;    // short
+static constexpr int address_b = 1000; // long
+static constexpr uint32_t pkt_cnt = 100000;
+static constexpr int irq_us = 10;
+
+static DccThrottle *volatile throttle = nullptr;
+static volatile bool use_lock = true;
+static volatile uint32_t irq_cnt = 0;
+static volatile uint32_t torn_cnt = 0;
+
+static void irq(int)
+{
+    DccThrottle *t = throttle;
+    if (t == nullptr)
+        return;
+
+    DccPkt pkt;
+    if (use_lock) {
+        pkt = t->next_packet();
+    } else {
+        t->estop_apply();
+        pkt = t->packet_next();
+    }
+
+    int address = pkt.get_address();
+    if (!pkt.check_xor() || (address != address_a && address != address_b))
+        torn_cnt = torn_cnt + 1;
+    irq_cnt = irq_cnt + 1;
+}
+
+static void timer_run(bool on)
+{
+    struct itimerval it;
+    memset(&it, 0, sizeof(it));
+    if (on) {
+        it.it_interval.tv_usec = irq_us;
+        it.it_value.tv_usec = irq_us;
+    }
+    setitimer(ITIMER_REAL, &it, nullptr);
+}
+
+struct Result {
+    uint32_t torn;
+    uint32_t held;
+    uint32_t passes;
+    double sec;
+};
+
+static Result run(bool lock)
+{
+    typedef std::chrono::steady_clock clock;
+
+    DccThrottle t(address_a);
+
+    use_lock = lock;
+    irq_cnt = 0;
+    torn_cnt = 0;
+    throttle = &t;
+
+    auto start = clock::now();
+    timer_run(true);
+
+    // Every call is a change in progress; nothing else runs between them.
+    uint32_t i;
+    for (i = 0; irq_cnt < pkt_cnt; i++) {
+        t.set_speed(int(i % 255) - 127);
+        t.set_function(i % 29, (i & 1) != 0);
+        if ((i % 8) == 0)
+            t.set_address((i & 8) ? address_b : address_a);
+        if ((i % 16) == 0)
+            t.write_cv(1 + i % 100, uint8_t(i));
+        if ((i % 64) == 0)
+            t.set_binstate(DccPktBinState::num_min + i % 100, (i & 64) != 0);
+    }
+
+    timer_run(false);
+    throttle = nullptr;
+
+    Result r;
+    r.torn = torn_cnt;
+    r.held = t.held_cnt();
+    r.passes = i;
+    r.sec = std::chrono::duration<double>(clock::now() - start).count();
+    return r;
+}
+
+static void show(const char *name, const Result &r)
+{
+    printf("  %-8s torn %6u (%5.2f%%)  held %6u (%5.2f%%)  "
+           "%u main loop passes in %.2f s\n",
+           name, r.torn, 100.0 * r.torn / pkt_cnt, r.held,
+           100.0 * r.held / pkt_cnt, r.passes, r.sec);
+}
+
+int main()
+{
+    signal(SIGALRM, irq);
+    PicoHost::irq_signal(SIGALRM); // set_binstate() disables interrupts
+
+    printf("seqlock: %u packets each, one every %d usec (requested)\n",
+           pkt_cnt, irq_us);
+
+    Result before = run(false);
+    show("no lock", before);
+
+    Result after = run(true);
+    show("seqlock", after);
+
+    bool ok = after.torn == 0 && before.torn > 0;
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
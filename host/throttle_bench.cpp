@@ -0,0 +1,56 @@
+// DccThrottle size and next_packet() time for different func_max, on the
+// host.
+//
+// For each func_max, this prints the packet sequence length and the average
+// next_packet() time over 20M calls, with a function change every 50th
+// packet. sizeof(DccThrottle) is the same for all of them; function state is
+// a bit array sized from DCC_FUNC_MAX, and the group table is constexpr (not
+// per throttle).
+//
+// These are host numbers; they show how the time changes with func_max, not
+// what it is on an RP2040.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+
+#include "dcc_pkt.h"
+#include "dcc_throttle.h"
+
+static constexpr int call_cnt = 20000000;
+
+int main()
+{
+    typedef std::chrono::steady_clock clock;
+
+    printf("sizeof(DccThrottle) %zu, function state %zu bytes "
+           "(DCC_FUNC_MAX %d)\n",
+           sizeof(DccThrottle), ((DCC_FUNC_MAX + 32) / 32) * sizeof(uint32_t),
+           DCC_FUNC_MAX);
+
+    uint32_t sum = 0; // so the packets are used
+
+    for (int func_max : {4, 8, 12, 20, 28, DCC_FUNC_MAX}) {
+        DccThrottle t(3, func_max);
+        t.set_speed(20);
+
+        clock::time_point t0 = clock::now();
+        for (int i = 0; i < call_cnt; i++) {
+            if ((i % 50) == 0)
+                t.set_function(i % (func_max + 1), (i & 1) != 0);
+            DccPkt pkt = t.next_packet();
+            sum += pkt.data(pkt.msg_len() - 1);
+        }
+        clock::time_point t1 = clock::now();
+
+        double ns =
+            std::chrono::duration<double, std::nano>(t1 - t0).count() / call_cnt;
+        printf("func_max %2d: groups %d, sequence %2d packets, "
+               "next_packet() %.1f ns\n",
+               func_max, DccPktFuncGroup::group_cnt(func_max),
+               2 * DccPktFuncGroup::group_cnt(func_max), ns);
+    }
+
+    return (sum == 0) ? 1 : 0;
+}
@@ -0,0 +1,310 @@
+#include "track_sim.h"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "dcc_pkt.h"
+#include "dcc_spec.h"
+#include "hardware/pwm.h"
+#include "pico_host.h"
+#include "railcom_spec.h"
+
+// 4/8 encoding for railcom replies: the inverse of RailComSpec::decode
+static uint8_t rc_encode[RailComSpec::DecId::dec_max];
+static uint8_t rc_ack = 0;
+
+static void rc_encode_init()
+{
+    for (int enc = 0; enc <= UINT8_MAX; enc++) {
+        uint8_t dec = RailComSpec::decode[enc];
+        if (dec < RailComSpec::DecId::dec_max)
+            rc_encode[dec] = uint8_t(enc);
+        else if (dec == RailComSpec::DecId::dec_ack)
+            rc_ack = uint8_t(enc);
+    }
+}
+
+
+TrackSim::TrackSim(int sig_gpio) :
+    _slice(pwm_gpio_to_slice_num(sig_gpio)),
+    _channel(pwm_gpio_to_channel(sig_gpio)),
+    _watch(nullptr),
+    _watch_arg(nullptr),
+    _ones(0),
+    _in_pkt(false),
+    _bit_cnt(0),
+    _byte(0),
+    _msg_len(0),
+    _msg_long(false),
+    _pkt_cnt(0),
+    _bad_cnt(0),
+    _cutout_cnt(0),
+    _rc_len(0),
+    _decoder_cnt(0)
+{
+    rc_encode_init();
+    PicoHost::pwm_watch(pwm_period, this);
+}
+
+
+TrackSim::~TrackSim()
+{
+    PicoHost::pwm_watch(nullptr, nullptr);
+}
+
+
+void TrackSim::run_us(uint32_t us)
+{
+    uint64_t end_us = PicoHost::time_us() + us;
+    while (PicoHost::time_us() < end_us)
+        PicoHost::pwm_wrap(_slice);
+}
+
+
+int TrackSim::run_packets(int n, uint32_t limit_us)
+{
+    uint32_t start_cnt = _pkt_cnt;
+    uint64_t end_us = PicoHost::time_us() + limit_us;
+    while (int(_pkt_cnt - start_cnt) < n && PicoHost::time_us() < end_us)
+        PicoHost::pwm_wrap(_slice);
+    return _pkt_cnt - start_cnt;
+}
+
+
+void TrackSim::watch(watch_t *watch, void *arg)
+{
+    _watch = watch;
+    _watch_arg = arg;
+}
+
+
+TrackSim::Decoder *TrackSim::decoder_add(int address)
+{
+    if (_decoder_cnt >= decoder_max)
+        return nullptr;
+    Decoder &d = _decoders[_decoder_cnt++];
+    memset(&d, 0, sizeof(d));
+    d.address = address;
+    d.reply_pct = 100;
+    if (address <= DccPkt::address_short_max)
+        d.cv[1] = address;
+    return &d;
+}
+
+
+TrackSim::Decoder *TrackSim::decoder(int address)
+{
+    for (int i = 0; i < _decoder_cnt; i++)
+        if (_decoders[i].address == address)
+            return &_decoders[i];
+    return nullptr;
+}
+
+
+void TrackSim::pwm_period(unsigned slice, uint32_t top, uint32_t level_a,
+                          uint32_t level_b, void *arg)
+{
+    TrackSim *me = (TrackSim *)arg;
+    if (slice != me->_slice)
+        return;
+    if (me->_channel == PWM_CHAN_A)
+        me->bit(top, level_a, level_b);
+    else
+        me->bit(top, level_b, level_a);
+}
+
+
+// One bit: sig is the half bit time, and pwr is how long power is on.
+void TrackSim::bit(uint32_t top, uint32_t sig, uint32_t pwr)
+{
+    if (pwr < top + 1) {
+        // power off, or a railcom cutout
+        if (pwr > 0) {
+            // cutout start: the addressed decoder replies in channel 2
+            _cutout_cnt++;
+            if (_rc_len > 0)
+                PicoHost::uart_put(_rc, _rc_len);
+        }
+        _rc_len = 0;
+        _ones = 0;
+        _in_pkt = false;
+        return;
+    }
+
+    int b = (sig < uint32_t(DccSpec::t0_min_us)) ? 1 : 0;
+
+    if (!_in_pkt) {
+        if (b == 1) {
+            _ones++;
+        } else if (_ones >= 10) {
+            // packet start bit
+            _in_pkt = true;
+            _msg_len = 0;
+            _msg_long = false;
+            _bit_cnt = 0;
+            _byte = 0;
+            _rc_len = 0;
+        } else {
+            _ones = 0;
+        }
+        return;
+    }
+
+    if (_bit_cnt < 8) {
+        _byte = (_byte << 1) | b;
+        if (++_bit_cnt == 8) {
+            if (_msg_len < msg_max)
+                _msg[_msg_len++] = _byte;
+            else
+                _msg_long = true;
+        }
+        return;
+    }
+
+    if (b == 0) {
+        // byte start bit
+        _bit_cnt = 0;
+        _byte = 0;
+        return;
+    }
+
+    // packet stop bit, which is also the first preamble one
+    _in_pkt = false;
+    _ones = 1;
+    packet();
+}
+
+
+void TrackSim::packet()
+{
+    if (_msg_long || _msg_len < 3 || !DccPkt::check_xor(_msg, _msg_len)) {
+        _bad_cnt++;
+        return;
+    }
+
+    _pkt_cnt++;
+
+    if (_watch != nullptr)
+        _watch(_msg, _msg_len, PicoHost::time_us(), _watch_arg);
+
+    // address
+    int address;
+    int adr_len;
+    if (_msg[0] == 0) {
+        address = 0; // broadcast
+        adr_len = 1;
+    } else if (_msg[0] <= DccPkt::address_short_max) {
+        address = _msg[0];
+        adr_len = 1;
+    } else if (0xc0 <= _msg[0] && _msg[0] <= 0xe7) {
+        address = ((_msg[0] & 0x3f) << 8) | _msg[1];
+        adr_len = 2;
+    } else {
+        return; // accessory, idle, ...
+    }
+
+    const uint8_t *ins = _msg + adr_len;
+    int ins_len = _msg_len - adr_len - 1;
+
+    // speed (128 step), or broadcast stop
+    bool speed_pkt = (ins_len == 2 && ins[0] == 0x3f);
+    bool stop_pkt = (address == 0 && ins_len == 1 && (ins[0] & 0xce) == 0x40);
+    int speed = 0;
+    if (speed_pkt)
+        speed = DccPktSpeed128::dcc_to_int(ins[1]);
+
+    for (int i = 0; i < _decoder_cnt; i++) {
+        Decoder &d = _decoders[i];
+        int consist = d.cv[19] & 0x7f;
+        int s = DccPkt::speed_inv;
+        if (stop_pkt) {
+            s = 0;
+        } else if (speed_pkt && consist != 0 && address == consist) {
+            s = (d.cv[19] & 0x80) ? -speed : speed;
+        } else if (speed_pkt && consist == 0 && address == d.address) {
+            s = speed;
+        }
+        if (s != DccPkt::speed_inv) {
+            d.speed_cnt++;
+            if (s != d.speed) {
+                d.speed = s;
+                d.speed_us = PicoHost::time_us();
+            }
+        }
+        if (address == d.address && ins_len >= 3 && (ins[0] & 0xf0) == 0xe0)
+            packet_ops(d, ins, ins_len);
+    }
+}
+
+
+// POM (RCN-214 long form) and XPOM read; the reply goes out in the cutout
+void TrackSim::packet_ops(Decoder &d, const uint8_t *ins, int ins_len)
+{
+    d.ops_cnt++;
+
+    bool reply = (rand() % 100) < d.reply_pct;
+    if (reply)
+        d.reply_cnt++;
+
+    if ((ins[0] & 0xfc) == 0xe4 && ins_len == 4) {
+        // XPOM read four: 111001ss, 24-bit cv
+        int cv_num = ((ins[1] << 16) | (ins[2] << 8) | ins[3]) + 1;
+        uint8_t val[4];
+        for (int i = 0; i < 4; i++)
+            val[i] = (cv_num + i <= DccPkt::cv_num_max) ? d.cv[cv_num + i] : 0;
+        if (reply)
+            railcom_xpom(ins[0] & 0x03, val);
+        return;
+    }
+
+    if (ins_len != 3)
+        return;
+
+    // 1110GGVV VVVVVVVV DDDDDDDD
+    int gg = (ins[0] >> 2) & 0x03;
+    int cv_num = (((ins[0] & 0x03) << 8) | ins[1]) + 1;
+    uint8_t data = ins[2];
+
+    if (gg == 3) {
+        d.cv[cv_num] = data;
+    } else if (gg == 2 && (data & 0x10) != 0) {
+        // bit write: 111KDBBB
+        uint8_t m = 1 << (data & 0x07);
+        if (data & 0x08)
+            d.cv[cv_num] |= m;
+        else
+            d.cv[cv_num] &= ~m;
+    } else if (gg != 1 && gg != 2) {
+        return;
+    }
+
+    if (reply)
+        railcom_pom(d.cv[cv_num]);
+}
+
+
+// channel 2: POM (id 0, 8 bits), then acks to fill it out
+void TrackSim::railcom_pom(uint8_t val)
+{
+    _rc[0] = rc_encode[(RailComSpec::PktId::pkt_pom << 2) | (val >> 6)];
+    _rc[1] = rc_encode[val & 0x3f];
+    for (int i = 2; i < 6; i++)
+        _rc[i] = rc_ack;
+    _rc_len = 6;
+}
+
+
+// channel 2: XPOM (id 8-11 with the sequence number, 32 bits)
+void TrackSim::railcom_xpom(int ss, const uint8_t *val)
+{
+    uint8_t id = RailComSpec::PktId::pkt_xpom | ss;
+    _rc[0] = rc_encode[(id << 2) | (val[0] >> 6)];
+    _rc[1] = rc_encode[val[0] & 0x3f];
+    _rc[2] = rc_encode[val[1] >> 2];
+    _rc[3] = rc_encode[((val[1] & 0x03) << 4) | (val[2] >> 4)];
+    _rc[4] = rc_encode[((val[2] & 0x0f) << 2) | (val[3] >> 6)];
+    _rc[5] = rc_encode[val[3] & 0x3f];
+    _rc_len = 6;
+}
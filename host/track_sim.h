@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+
+#include "dcc_pkt.h"
+
+// The track, as seen from the PWM slice that DccBitstream drives on the host.
+//
+// Each PWM period is one bit: the signal channel's level is the half bit
+// time, and the power channel is on for the whole bit, part of it (the start
+// of a railcom cutout), or none of it. Bits are decoded into packets (a
+// preamble of at least 10 ones, then bytes with start bits, then a stop bit),
+// which are checked, counted, and passed to a watcher.
+//
+// Decoders can be put on the track. Each has CVs, and follows the speed
+// packets for its address, or for its consist address (CV19) if it has one.
+// In the cutout after an ops mode CV packet (POM or XPOM) for its own
+// address, it sends the railcom channel 2 reply (to the UART, for RailCom),
+// reply_pct percent of the time.
+
+class TrackSim
+{
+
+public:
+
+    TrackSim(int sig_gpio);
+    ~TrackSim();
+
+    // Run the bitstream (PWM periods) for at least us.
+    void run_us(uint32_t us);
+
+    // Run until n more packets are seen, or limit_us goes by. Returns the
+    // number seen.
+    int run_packets(int n, uint32_t limit_us = 10000000);
+
+    // Called for each good packet; end_us is when its stop bit started.
+    typedef void watch_t(const uint8_t *msg, int msg_len, uint64_t end_us,
+                         void *arg);
+    void watch(watch_t *watch, void *arg);
+
+    uint32_t pkt_cnt() const { return _pkt_cnt; }
+    uint32_t bad_cnt() const { return _bad_cnt; } // bad xor
+    uint32_t cutout_cnt() const { return _cutout_cnt; }
+
+    struct Decoder {
+        int address;
+        uint8_t cv[DccPkt::cv_num_max + 1]; // cv[1]...cv[1024]
+        int speed;            // last speed packet it followed
+        uint64_t speed_us;    // when it changed
+        int reply_pct;        // railcom replies that get through
+        uint32_t speed_cnt;   // speed packets followed
+        uint32_t reply_cnt;   // railcom replies sent
+        uint32_t ops_cnt;     // POM/XPOM packets for it
+    };
+
+    static constexpr int decoder_max = 32;
+
+    Decoder *decoder_add(int address);
+    Decoder *decoder(int address);
+
+private:
+
+    static void pwm_period(unsigned slice, uint32_t top, uint32_t level_a,
+                           uint32_t level_b, void *arg);
+    void bit(uint32_t top, uint32_t sig, uint32_t pwr);
+    void packet();
+    void packet_ops(Decoder &d, const uint8_t *ins, int ins_len);
+    void railcom_pom(uint8_t val);
+    void railcom_xpom(int ss, const uint8_t *val);
+
+    unsigned _slice;
+    unsigned _channel;
+
+    watch_t *_watch;
+    void *_watch_arg;
+
+    // packet decoding
+    int _ones;          // preamble ones so far
+    bool _in_pkt;
+    int _bit_cnt;       // bits of the current byte
+    uint8_t _byte;
+    static constexpr int msg_max = 8; // as DccPkt (protected there)
+    uint8_t _msg[msg_max];
+    int _msg_len;
+    bool _msg_long;     // more than msg_max bytes; dropped
+
+    uint32_t _pkt_cnt;
+    uint32_t _bad_cnt;
+    uint32_t _cutout_cnt;
+
+    // railcom reply for the next cutout
+    uint8_t _rc[6];
+    int _rc_len;
+
+    Decoder _decoders[decoder_max];
+    int _decoder_cnt;
+
+}; // class TrackSim
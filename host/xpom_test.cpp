@@ -0,0 +1,154 @@
+// DccThrottle::read_cvs() (XPOM, four CVs per packet) against read_cv() (one
+// CV per packet) on the simulated track, with a TrackSim decoder that
+// replies in the railcom cutout.
+//
+// For 1 and 4 locos on the track, 256 CVs are read from one of them each
+// way, and for each this prints the CV packets sent, the time, and CVs/sec.
+// Then the same with the decoder's replies getting through 80% of the time,
+// so read_cvs() has to go back for missing quads.
+//
+// Checks that every value read is right, that read_cvs() reads all of them
+// when every reply gets through, and that it takes no more than a third of
+// read_cv()'s packets. Prints one line per run and exits nonzero if any
+// check failed.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+
+#include "dcc_adc.h"
+#include "dcc_command.h"
+#include "dcc_throttle.h"
+#include "hardware/uart.h"
+#include "pico_host.h"
+#include "track_sim.h"
+
+static constexpr int sig_gpio = 4;
+static constexpr int pwr_gpio = 5;
+static constexpr int rc_gpio = 1;
+
+static constexpr int loco = 3;
+static constexpr int cv_cnt = DccThrottle::read_cvs_max;
+
+static int fail_cnt = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (ok)
+        return;
+    printf("  FAIL: %s\n", what);
+    fail_cnt++;
+}
+
+
+// ops mode CV packets for the loco
+static void watch(const uint8_t *msg, int msg_len, uint64_t, void *arg)
+{
+    if (msg[0] == loco && msg_len >= 5 && (msg[1] & 0xf0) == 0xe0)
+        (*(uint32_t *)arg)++;
+}
+
+
+static uint8_t cv_val(int cv_num)
+{
+    return uint8_t(cv_num * 37 + 11);
+}
+
+
+struct Result {
+    int ok_cnt;      // CVs read
+    bool right;      // all those read were right
+    uint32_t pkt_cnt;
+    double sec;
+};
+
+
+static void show(const char *name, const Result &r)
+{
+    printf("  %-9s %3d CVs, %4u packets, %6.2f s, %5.1f CVs/s\n", name,
+           r.ok_cnt, r.pkt_cnt, r.sec, r.ok_cnt / r.sec);
+}
+
+
+static void run(int loco_cnt, int reply_pct, Result &one, Result &four)
+{
+    DccAdc adc(-1);
+    DccCommand command(sig_gpio, pwr_gpio, -1, adc, uart0, rc_gpio);
+    TrackSim track(sig_gpio);
+    uint32_t pkt_cnt = 0;
+    track.watch(watch, &pkt_cnt);
+    command.set_mode_ops();
+
+    TrackSim::Decoder *d = track.decoder_add(loco);
+    d->reply_pct = reply_pct;
+    for (int cv_num = 1; cv_num <= cv_cnt; cv_num++)
+        d->cv[cv_num] = cv_val(cv_num);
+    DccThrottle *t = command.create_throttle(loco);
+    for (int i = 1; i < loco_cnt; i++) {
+        track.decoder_add(loco + i);
+        command.create_throttle(loco + i)->set_speed(10);
+    }
+    track.run_us(100000);
+
+    // one at a time
+    pkt_cnt = 0;
+    uint64_t start_us = PicoHost::time_us();
+    one.ok_cnt = 0;
+    one.right = true;
+    for (int cv_num = 1; cv_num <= cv_cnt; cv_num++) {
+        t->read_cv(cv_num);
+        bool result = false;
+        uint8_t val = 0;
+        while (!t->ops_done(result, val))
+            track.run_us(1000);
+        if (result) {
+            one.ok_cnt++;
+            one.right = one.right && val == cv_val(cv_num);
+        }
+    }
+    one.pkt_cnt = pkt_cnt;
+    one.sec = (PicoHost::time_us() - start_us) / 1e6;
+
+    // four at a time
+    static uint8_t buf[cv_cnt];
+    pkt_cnt = 0;
+    start_us = PicoHost::time_us();
+    t->read_cvs(1, cv_cnt, buf);
+    uint64_t ok_bits = 0;
+    while (!t->read_cvs_done(four.ok_cnt, &ok_bits))
+        track.run_us(1000);
+    four.right = true;
+    for (int i = 0; i < cv_cnt; i++)
+        if ((ok_bits & (uint64_t(1) << (i / 4))) != 0)
+            four.right = four.right && buf[i] == cv_val(1 + i);
+    four.pkt_cnt = pkt_cnt;
+    four.sec = (PicoHost::time_us() - start_us) / 1e6;
+}
+
+
+int main()
+{
+    srand(1);
+
+    for (int reply_pct : {100, 80}) {
+        for (int loco_cnt : {1, 4}) {
+            Result one;
+            Result four;
+            run(loco_cnt, reply_pct, one, four);
+            printf("%d loco%s, %d%% of replies:\n", loco_cnt,
+                   (loco_cnt == 1) ? "" : "s", reply_pct);
+            show("read_cv", one);
+            show("read_cvs", four);
+            check(one.right && four.right, "values read");
+            if (reply_pct == 100) {
+                check(one.ok_cnt == cv_cnt, "read_cv read all");
+                check(four.ok_cnt == cv_cnt, "read_cvs read all");
+                check(four.pkt_cnt * 3 <= one.pkt_cnt, "a third the packets");
+            }
+        }
+    }
+
+    printf("%s\n", (fail_cnt == 0) ? "ok" : "FAILED");
+    return (fail_cnt == 0) ? 0 : 1;
+}
@@ -1,10 +1,22 @@
 
 #pragma once
 
+#include "dcc_ack.h"
 #include "dcc_adc.h"
 #include "dcc_bitstream.h"
 #include "dcc_command.h"
 #include "dcc_cv.h"
+#include "dcc_cv_async.h"
+#include "dcc_cv_cache.h"
+#include "dcc_cv_index.h"
+#include "dcc_latency.h"
+#include "dcc_ops_queue.h"
 #include "dcc_pkt.h"
+#include "dcc_profile.h"
+#include "dcc_program.h"
+#include "dcc_protect.h"
+#include "dcc_ramp.h"
+#include "dcc_roster.h"
 #include "dcc_throttle.h"
 #include "railcom.h"
+#include "railcom_stats.h"
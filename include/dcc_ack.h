@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstdint>
+
+class DccAdc;
+
+// Service mode ack detection.
+//
+// S 9.2.3: a decoder acknowledges by drawing at least 60 ma more than it was
+// for 6 msec +/- 1 msec.
+//
+// DccCommand owns a detector and uses it like this:
+//   reset()  when an operation starts or ends
+//   arm()    just before sending packets that could be acked
+//   check()  from the bit interrupt, after DccAdc::loop() gets new samples
+// check() returns true once per ack, then pulse() describes it.
+//
+// DccAckThreshold is the original detector: ack when the short average goes
+// some fixed amount over the long average at the time it was armed.
+//
+// DccAckMatched looks for the pulse's shape: a rising edge, a level that
+// holds for about the pulse length, and a falling edge. Its baseline follows
+// the current between pulses, so a decoder with a high or changing idle
+// current (sound, a motor spinning up) is measured against its own level.
+// It only calls it an ack at the end of the pulse, so it is a few msec later
+// than the threshold detector.
+
+class DccAck
+{
+
+public:
+
+    virtual ~DccAck() {}
+
+    virtual void reset() = 0;
+    virtual void arm() = 0;
+    virtual bool check() = 0; // called in interrupt context
+
+    struct Pulse {
+        uint32_t start_us; // time_us_32() at start
+        uint32_t len_us;   // 0 if not known
+        uint16_t amp_ma;   // above baseline
+    };
+
+    const Pulse &pulse() const { return _pulse; }
+
+    // counters since construction
+    uint32_t arm_cnt() const { return _arm_cnt; }
+    uint32_t ack_cnt() const { return _ack_cnt; }
+    uint32_t reject_cnt() const { return _reject_cnt; }
+
+    virtual const char *name() const = 0;
+
+    char *show(char *buf, int buf_len) const;
+
+protected:
+
+    DccAck(DccAdc &adc);
+
+    DccAdc &_adc;
+
+    Pulse _pulse;
+
+    uint32_t _arm_cnt;
+    uint32_t _ack_cnt;
+    uint32_t _reject_cnt; // pulse-like things that were not acks
+
+}; // class DccAck
+
+
+class DccAckThreshold : public DccAck
+{
+
+public:
+
+    DccAckThreshold(DccAdc &adc);
+
+    virtual void reset() override;
+    virtual void arm() override;
+    virtual bool check() override; // called in interrupt context
+
+    virtual const char *name() const override { return "threshold"; }
+
+    static constexpr uint16_t ack_inc_ma = 60;
+
+private:
+
+    // ack_ma_inv when not armed
+    uint16_t _ack_ma;
+    uint16_t _base_ma;
+    static constexpr uint16_t ack_ma_inv = UINT16_MAX;
+
+}; // class DccAckThreshold
+
+
+class DccAckMatched : public DccAck
+{
+
+public:
+
+    DccAckMatched(DccAdc &adc);
+
+    virtual void reset() override;
+    virtual void arm() override;
+    virtual bool check() override; // called in interrupt context
+
+    virtual const char *name() const override { return "matched"; }
+
+    // Pulse must average at least amp_min_ma over the baseline. Edges are
+    // where the edge-window average crosses half that.
+    static constexpr uint16_t amp_min_ma = 50;
+
+    // Pulse length limits; nominal is 6 msec
+    static constexpr uint32_t len_min_us = 4000;
+    static constexpr uint32_t len_max_us = 9000;
+
+private:
+
+    enum class State {
+        IDLE,  // not armed
+        BASE,  // armed, following the baseline, looking for a rising edge
+        PULSE, // in a possible pulse, looking for a falling edge
+    };
+    State _state;
+
+    // Edges are detected with the average of the last edge_len samples (the
+    // edge filter), against the baseline. That's short compared to the pulse
+    // so the edge time is accurate to within edge_len samples.
+    static constexpr int edge_len = 8;
+    uint16_t _edge[edge_len];
+    int _edge_idx;
+    uint32_t _edge_sum;
+    int _edge_cnt; // samples in _edge (until it fills)
+
+    // Baseline in ma << base_shift, following the edge filter with a time
+    // constant of (1 << base_tc_shift) samples while not in a pulse.
+    static constexpr int base_shift = 8;
+    static constexpr int base_tc_shift = 6;
+    uint32_t _base;
+    bool _base_ok;
+
+    // While in a pulse, sum of (sample - baseline) and sample count. The
+    // sum over the pulse is the matched filter output for a rectangular
+    // pulse of that length.
+    uint32_t _pulse_idx; // adc sample index of the rising edge
+    int32_t _pulse_sum;
+    uint32_t _pulse_cnt;
+
+    uint32_t _idx; // next adc sample to look at
+
+    bool sample(uint16_t ma); // true on ack
+
+}; // class DccAckMatched
@@ -3,6 +3,21 @@
 #include <cstdint>
 #include "dbg_gpio.h"
 
+// Track current sensing.
+//
+// Samples are captured into a ring buffer. If a DMA channel is available, the
+// ADC FIFO is drained into the ring by DMA, and the ring holds the last
+// ring_len samples no matter how often anyone looks at it. If no DMA channel
+// is available, loop() drains the FIFO into the ring, in which case loop()
+// must be called at least every 400 usec (4-entry FIFO at 10 KHz).
+//
+// loop() takes new samples from the ring and updates the averages and log.
+// With DMA, it only needs to be called once per ring_len samples (25 msec at
+// 10 KHz) to not miss any; if it is late, the samples that were overwritten
+// are counted as overruns and skipped.
+//
+// Samples can also be read directly by index (see sample_cnt() and sample()).
+
 class DccAdc
 {
 public:
@@ -18,6 +33,26 @@ public:
     uint16_t short_avg_ma() const;
     uint16_t long_avg_ma() const;
 
+    // Number of samples captured since start(). It wraps at 2^32, so compare
+    // indexes by subtracting.
+    uint32_t sample_cnt() const;
+
+    // Get raw sample idx (0 ... sample_cnt() - 1), as long as it is still in
+    // the ring. Returns false if it is not (yet, or any more).
+    bool sample(uint32_t idx, uint16_t &raw) const;
+
+    static uint32_t sample_us() { return 1000000 / sample_rate; }
+
+    static uint16_t raw_to_ma(uint16_t raw)
+    {
+        return sum_to_ma(raw, raw_mul);
+    }
+
+    // samples loop() missed because the ring (or FIFO) overflowed
+    uint32_t overrun_cnt() const { return _overrun_cnt; }
+
+    bool using_dma() const { return _dma_ch >= 0; }
+
     bool logging() const
     {
         return _log != nullptr;
@@ -37,40 +72,50 @@ private:
 
     int _gpio;
 
-    uint16_t avg_raw(int cnt) const;
-
-    uint16_t short_avg_raw() const
+    // With 12 bits, 3.3V ref, mv = (raw / 4096) * 3300 = raw * 0.80
+    // Pololu DRV8874: 1.1 mv/ma, so ma = mv / 1.1 = raw * 0.73
+    //
+    // Averages are kept as sums of the last cnt raw samples, so the average
+    // in ma is sum * (3300 / 4096 / 1.1 / cnt). That is done in one step as
+    // (sum * mul) >> ma_shift, with mul computed at compile time for each
+    // window length. The largest sum times its mul must fit in 32 bits.
+    static constexpr uint32_t ref_mv = 3300;
+    static constexpr uint32_t raw_max = 4096;
+    static constexpr int ma_shift = 20;
+
+    // mv/ma = 1.1 = 11/10
+    static constexpr uint64_t ma_num = uint64_t(ref_mv) * 10 << ma_shift;
+    static constexpr uint64_t ma_den = uint64_t(raw_max) * 11;
+
+    static uint16_t sum_to_ma(uint32_t sum, uint32_t mul)
     {
-        return avg_raw(short_cnt);
+        return uint16_t((sum * mul + (1 << (ma_shift - 1))) >> ma_shift);
     }
 
-    uint16_t long_avg_raw() const
-    {
-        return avg_raw(long_cnt);
-    }
+    static const uint32_t clock_rate = 48000000;
+    static const uint32_t sample_rate = 10000; // 10 KHz = 100 usec per sample
 
-    static uint16_t raw_to_mv(uint16_t raw)
-    {
-        // With 12 bits, 3.3V ref, mv = (raw / 4096) * 3300 = raw * 0.80
-        // Basically, [0...4096] -> [0...3300]
-        const uint32_t ref_mv = 3300;
-        const uint16_t raw_max = 4096;
-        return (raw * ref_mv + raw_max / 2) / raw_max;
-    }
+    // Ring of raw samples. With DMA, the ring's address must be aligned to
+    // its size in bytes, and the DMA wraps the write address.
+    static constexpr int ring_bits = 9; // 512 bytes
+    static constexpr int ring_len = (1 << ring_bits) / sizeof(uint16_t); // 256
+    alignas(1 << ring_bits) uint16_t _ring[ring_len];
 
-    static uint16_t mv_to_ma(uint16_t mv)
-    {
-        // Pololu DRV8874: 1.1 mv/ma
-        //                 0.9091 ma/mv
-        // 1.1 = 8192 / 7447
-        const uint32_t mul = 8192 / 1.1; // 7447
-        const uint32_t div = 8192;
-        // ma = mv * 7447 / 8192 = mv / 1.10 = raw * 0.73
-        return (mv * mul + div / 2) / div;
-    }
+    int _dma_ch; // -1 if not using dma
 
-    static const uint32_t clock_rate = 48000000;
-    static const uint32_t sample_rate = 10000; // 10 KHz = 100 usec per sample
+    // DMA transfer count when triggered; it is restarted from loop() if it
+    // ever runs out (about 7 hours at 10 KHz). 28 bits, since on the RP2350
+    // the top 4 bits of the count register are the mode (and read back).
+    static constexpr uint32_t dma_cnt = 0x0fffffff;
+    uint32_t _dma_base; // samples captured by previous dma triggers
+
+    uint32_t _fifo_cnt; // samples captured by loop(), when not using dma
+
+    uint32_t _loop_cnt; // samples processed by loop()
+
+    uint32_t _overrun_cnt;
+
+    void sample_add(uint16_t adc_val);
 
     static const int avg_max =
         sample_rate / 60; // 1 cycle of 60 Hz noise (166 for 10 KHz)
@@ -81,6 +126,24 @@ private:
 
     static const int long_cnt = avg_max;
 
+    static constexpr uint32_t raw_mul = (ma_num + ma_den / 2) / ma_den;
+    static constexpr uint32_t short_mul =
+        (ma_num + ma_den * short_cnt / 2) / (ma_den * short_cnt); // 48000
+    static constexpr uint32_t long_mul =
+        (ma_num + ma_den * long_cnt / 2) / (ma_den * long_cnt); // 4627
+
+    static_assert(uint64_t(raw_max - 1) * raw_mul <= UINT32_MAX);
+    static_assert(uint64_t(raw_max - 1) * short_cnt * short_mul <= UINT32_MAX);
+    static_assert(uint64_t(raw_max - 1) * long_cnt * long_mul <= UINT32_MAX);
+
+    // Running sums of the last short_cnt and long_cnt samples, updated by
+    // loop() as each sample arrives. Each is a single aligned word, so it
+    // can be read from any context without a lock.
+    volatile uint32_t _short_sum;
+    volatile uint32_t _long_sum;
+
+    void avg_reset();
+
     int _err_cnt;
 
     int _log_max;
@@ -3,6 +3,7 @@
 #include "buf_log.h"
 #include "dcc_pkt.h"
 #include "dcc_pkt2.h"
+#include "dcc_profile.h"
 #include "dcc_spec.h"
 #include "hardware/pwm.h"
 #include "hardware/uart.h"
@@ -24,6 +25,59 @@ public:
     void start_svc();
     void stop();
 
+    // Cut track power now, without waiting for the end of the current bit,
+    // by taking the power gpio away from the PWM and driving it low. The
+    // bitstream keeps running. power_restore() gives the gpio back to the
+    // PWM, and power comes back on at the start of the next bit.
+    void power_cut(); // called in interrupt context
+    void power_restore(); // called in interrupt context
+
+    // Idle mode. In ops mode with no throttles, DccCommand only has idle
+    // packets to send. Instead of an interrupt for every bit, a pre-encoded
+    // idle packet is looped into the PWM by DMA (paced by the PWM's wrap
+    // DREQ), so nothing runs per bit. DccCommand::loop() (adc and overcurrent
+    // protection) still runs, from a timer every idle_loop_us that is only
+    // armed while idle. Idle mode starts at the end of a packet, when
+    // DccCommand::idle_ok() says so. idle_exit() asks for the normal
+    // bitstream back; the handover is done in the preamble of the next idle
+    // packet, so within one packet time. If the DMA channels or the timer
+    // can't be had, the bitstream just doesn't go idle.
+    //
+    // Idle mode is off until idle_enable(true). The DMA loop and the handover
+    // back to next_bit() have not been checked on hardware yet.
+    void idle_enable(bool en)
+    {
+        _idle_en = en;
+        if (!en)
+            idle_exit();
+    }
+    bool idle_enabled() const { return _idle_en; }
+    bool idle() const { return _idle; }
+    void idle_exit(); // called in any context
+    uint32_t idle_cnt() const { return _idle_cnt; }
+
+    static constexpr uint32_t idle_loop_us = 1000;
+
+    // Late reload detection. TOP and CC for the next bit must be written
+    // before the current bit ends; if not, the PWM sends the previous bit
+    // again and the one programmed late replaces (or follows) it, so the
+    // packet on the track is wrong. Each time a bit is programmed, the start
+    // of the bit on the track now (timer minus PWM counter, both in usec) is
+    // checked against where the last bit programmed should have started, and
+    // a mismatch is counted, with where in the packet it was. A wrap just
+    // after the write is counted too, so this errs by a few cycles on the
+    // side of counting.
+    //
+    // With abort on, a miss in a packet's data bytes ends the packet there
+    // and starts the next preamble, so a garbled packet can't go out whole
+    // and decode as something else. The packet is not sent again.
+    uint32_t late_cnt() const { return _late_cnt; }
+    uint32_t late_max_us() const { return _late_max_us; }
+    bool late_abort() const { return _late_abort; }
+    void late_abort(bool en) { _late_abort = en; }
+    void late_reset();
+    void late_show() const;
+
     // log DCC packets sent to BufLog
     bool show_dcc() const
     {
@@ -71,6 +125,58 @@ private:
 
     bool _use_railcom;   // railcom cutout or not
 
+    // Idle mode: three DMA channels in a loop. "pace" waits for the PWM wrap
+    // DREQ and moves a dummy word, then chains to "top", which writes the
+    // next TOP from _idle_top, then "cc" writes the next CC from _idle_cc and
+    // chains back to pace. Reads wrap around the buffers (DMA ring), so the
+    // packet repeats forever. Like prog_bit(), each wrap programs the bit
+    // after the one just started.
+    static constexpr int idle_bits = 64; // power of 2 for the DMA ring
+    static constexpr int idle_ring_bits = 8; // log2(idle_bits * 4 bytes)
+    // preamble, then 3 bytes each with a start bit, then the stop bit; the
+    // preamble is long to fill the ring, which decoders are fine with
+    static constexpr int idle_preamble_bits = idle_bits - 3 * 9 - 1;
+    static_assert((1 << idle_ring_bits) == idle_bits * 4);
+    static_assert(idle_preamble_bits >= DccPkt::ops_preamble_bits * 2);
+
+    alignas(idle_bits * 4) uint32_t _idle_top[idle_bits];
+    alignas(idle_bits * 4) uint32_t _idle_cc[idle_bits];
+    uint32_t _idle_dummy;
+
+    bool _idle_en;
+    volatile bool _idle;      // DMA is sending the idle packet
+    volatile bool _idle_exit; // asked to hand back to next_bit()
+    uint32_t _idle_cnt;
+    int _dma_pace; // -1 if not claimed
+    int _dma_top;
+    int _dma_cc;
+    repeating_timer_t _idle_timer;
+    bool _idle_timer_on;      // armed while _idle
+
+    void idle_init();
+    void idle_encode();
+    bool idle_start(); // called in interrupt context
+    bool idle_handover(); // called in interrupt context
+    void idle_dma_stop(); // called in interrupt context
+    static bool idle_timer_cb(repeating_timer_t *rt); // called in interrupt context
+
+    // late reload detection
+    static constexpr int32_t late_slop_us = 2; // timer and PWM not in phase
+    uint32_t _bit_start_us; // start of the bit on the track
+    uint32_t _bit_len_us;   // its length
+    uint32_t _prog_len_us;  // length of the bit programmed after it
+    bool _late_sync;        // next check just sets the above
+    bool _late_now;         // miss in this next_bit()
+    bool _late_abort;
+    uint32_t _late_cnt;
+    uint32_t _late_max_us;
+    uint32_t _late_abort_cnt;
+    int _late_byte; // _byte_num and _bit_num being programmed at the last miss
+    int _late_bit;
+    DccPkt2 _late_pkt; // _current2 then
+
+    void late_check(uint32_t len_us); // called in interrupt context
+
     void start(int preamble_bits, bool cutout = true);
 
     // PWM programming: we always program a 50% duty cycle, changing the
@@ -100,6 +206,7 @@ private:
         pwm_set_chan_level(_slice, _channel, half_us);
         // power on
         pwm_set_chan_level(_slice, 1 - _channel, 2 * half_us);
+        late_check(2 * half_us);
     }
 
     void prog_bit_cutout_start() // called in interrupt context
@@ -108,6 +215,7 @@ private:
         pwm_set_chan_level(_slice, _channel, DccSpec::t1_nom_us);
         // power on for a quarter-bit (half-bit / 2)
         pwm_set_chan_level(_slice, 1 - _channel, DccSpec::t1_nom_us / 2);
+        late_check(2 * DccSpec::t1_nom_us);
     }
 
     void prog_bit_cutout() // called in interrupt context
@@ -116,10 +224,14 @@ private:
         pwm_set_chan_level(_slice, _channel, DccSpec::t1_nom_us);
         // power off
         pwm_set_chan_level(_slice, 1 - _channel, 0);
+        late_check(2 * DccSpec::t1_nom_us);
     }
 
     void next_bit(); // called in interrupt context
 
+    // tell DccCommand's profiler what's on the track now
+    void profile_mark(DccProfile::MarkType type); // called in interrupt context
+
     static void pwm_handler(void *arg); // called in interrupt context
 
     ///// Debug
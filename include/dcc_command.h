@@ -3,14 +3,21 @@
 #include <cstdint>
 #include <list>
 
+#include "dcc_ack.h"
 #include "dcc_bitstream.h"
+#include "dcc_cv_async.h"
+#include "dcc_cv_index.h"
 #include "dcc_pkt2.h"
+#include "dcc_profile.h"
+#include "dcc_protect.h"
+#include "dcc_spec.h"
 #include "dcc_throttle.h"
 #include "hardware/uart.h"
 
 #undef INCLUDE_ACK_DBG
 
 class DccAdc;
+class DccRoster;
 
 class DccCommand
 {
@@ -25,15 +32,48 @@ public:
 
     void write_cv(int cv_num, uint8_t cv_val);
     void write_bit(int cv_num, int bit_num, int bit_val);
-    void read_cv(int cv_num);
+    // Service mode CV read. By default this reads bit by bit: a bit-verify
+    // phase for each of the 8 bits, then a byte-verify of the result. With
+    // fast set, each bit-verify phase is cut short as soon as it is acked,
+    // and if guess is a valid cv value, a byte-verify of the guess is tried
+    // first; if that is acked, that's the value, and if not, the read falls
+    // back to bit by bit.
+    void read_cv(int cv_num, bool fast = false, int guess = -1);
     void read_bit(int cv_num, int bit_num);
 
+    // Indexed CV (257-512) write and read; index is DccCv::index(CV31, CV32).
+    // CV31 and CV32 are written first if needed, then the CV is written or
+    // read; svc_done() returns true when all of that is done (result false
+    // if any of it failed). In a session, the index last written is
+    // remembered and not written again; outside a session it is always
+    // written, since it could be a different decoder.
+    void write_cv_indexed(int index, int cv_num, uint8_t cv_val);
+    void read_cv_indexed(int index, int cv_num, bool fast = false,
+                         int guess = -1);
+
+    const DccCvIndex &svc_index() const { return _svc_index; }
+
     // Returns true if service mode operation is done, and result is set
     // true (success) or false (failed). For read operations, use the one
     // with val to get the result.
     bool svc_done(bool &result);
     bool svc_done(bool &result, uint8_t &val);
 
+    // packets sent by the last (or current) service mode operation,
+    // including index cv writes for an indexed operation
+    int svc_pkt_cnt() const { return _svc_idx_pkt_cnt + _svc_pkt_cnt; }
+
+    // Service mode session. Normally each service mode operation powers up
+    // the track, sends DccSpec::svc_reset1_cnt resets, does the operation,
+    // and powers off. Inside a session, the track is powered up once and
+    // stays powered, with resets sent while no operation is in progress;
+    // each operation starts after only DccSpec::svc_resume_reset_cnt
+    // resets. Start operations as usual, but only when the previous one is
+    // done. set_mode_off() or set_mode_ops() also end the session.
+    void svc_session_start();
+    void svc_session_end() { set_mode_off(); }
+    bool svc_session() const { return _svc_session; }
+
     enum class Mode {
         OFF,
         OPS,
@@ -44,6 +84,165 @@ public:
 
     DccAdc &adc() const { return _adc; }
 
+    // Service mode ack detector; nullptr goes back to the default (threshold)
+    // detector. Only change it when no service mode operation is running.
+    void ack_detector(DccAck *ack_det)
+    {
+        _ack_det = (ack_det != nullptr) ? ack_det : &_ack_threshold;
+    }
+    DccAck &ack_detector() const { return *_ack_det; }
+
+    // ops mode overcurrent protection
+    DccProtect &protect() { return _protect; }
+
+    // ops mode track current by loco address
+    DccProfile &profile() { return _profile; }
+
+    // Emergency stop, callable from any context (including interrupts).
+    //
+    // Broadcast e-stop packets preempt the throttles: the packet being sent
+    // finishes, the railcom cutout after it is skipped, and the next packet
+    // (after the preamble) is an e-stop, sent estop_pkt_cnt times in a row.
+    // All throttles and roster locos are set to speed 0 (DccThrottle::estop(),
+    // DccRoster::estop()), so locos stay stopped when their packets resume,
+    // and DccRamp stops ramping them. If a power-off delay is set, track
+    // power is also cut that long after the first e-stop packet. estop_clear()
+    // ends it (and turns power back on if it was cut); so does set_mode_off()
+    // or set_mode_ops(). E-stop packets only go out in ops mode.
+    //
+    // Latency is from estop() to get_packet() returning the first e-stop
+    // packet; its start bit goes out at the end of the bit then in progress
+    // (a preamble one). The worst case is estop() just after the longest
+    // packet was started: all of that packet, then the preamble.
+    void estop();
+    void estop_clear();
+    bool estop_active() const { return _estop; }
+
+    // called in interrupt context (by DccBitstream)
+    bool estop_pending() const { return _estop_pkt_cnt > 0; }
+
+    // power-off delay in msec after an e-stop; -1 to leave power on
+    void estop_power_off_ms(int ms) { _estop_power_off_ms = ms; }
+    int estop_power_off_ms() const { return _estop_power_off_ms; }
+
+    uint32_t estop_cnt() const { return _estop_cnt; }
+    uint32_t estop_latency_us() const { return _estop_latency_us; }
+    uint32_t estop_latency_max_us() const { return _estop_latency_max_us; }
+
+    static constexpr int estop_pkt_cnt = 10;
+
+    // worst-case latency, all zero bits in the packet (8 bytes is
+    // DccPkt::msg_max)
+    static constexpr uint32_t estop_latency_bound_us =
+        (8 * 9 + 1) * 2 * DccSpec::t0_nom_us +
+        (DccPkt::ops_preamble_bits + 1) * 2 * DccSpec::t1_nom_us;
+
+    // Accessory commands (turnouts, signals). Unlike loco packets, which
+    // are refreshed forever, each command is sent acc_repeat() times and
+    // then dropped. Queued commands take turns, so a route's commands all go
+    // out together, interleaved with the throttles' packets: at least
+    // acc_gap() throttle packets go between accessory packets (if there are
+    // throttles), which bounds the share of the track accessories get.
+    //
+    // A command for an output that already has one queued replaces it (in
+    // its place in the queue, with its count restarted), so if a route is
+    // changed before it has all gone out, only the final state is sent.
+    // Basic commands are for the same output if they are for the same
+    // address and have the same 'on'; extended, if for the same address.
+    //
+    // Returns false if the queue is full or arguments are out of range.
+    // Commands are only sent in ops mode; set_mode_off() drops any left.
+    bool acc_set(int acc_adrs, int out, bool on = true);
+    bool acc_aspect(int acc_adrs, int aspect);
+
+    int acc_pending() const { return _acc_cnt; }
+
+    void acc_repeat(int n) { _acc_repeat = n; }
+    int acc_repeat() const { return _acc_repeat; }
+    void acc_gap(int n) { _acc_gap = n; }
+    int acc_gap() const { return _acc_gap; }
+
+    // counts since the last acc_reset_stats()
+    uint32_t acc_cmd_cnt() const { return _acc_cmd_cnt; }
+    uint32_t acc_coalesce_cnt() const { return _acc_coalesce_cnt; }
+    uint32_t acc_pkt_cnt() const { return _acc_pkt_cnt; }
+    uint32_t acc_done_cnt() const { return _acc_done_cnt; }
+    // queued (or last replaced) to last repeat sent
+    uint32_t acc_latency_us() const { return _acc_latency_us; }
+    uint32_t acc_latency_max_us() const { return _acc_latency_max_us; }
+    void acc_reset_stats();
+
+    static constexpr int acc_max = 32;
+    static constexpr int acc_repeat_default = 4;
+    static constexpr int acc_gap_default = 1;
+
+    // Consists (lashups), named by their address.
+    //
+    // An advanced consist's address (1-127) is a consist address that the
+    // members' decoders answer speed commands on (S-9.2.2 CV19). It gets a
+    // throttle of its own, which carries the speed; adding a member writes
+    // its CV19 in ops mode (bit 7 set if reversed), and removing it writes
+    // CV19 back to 0. A member is set to speed 0 when it is added; once its
+    // CV19 write succeeds, its throttle stops sending speed packets, but
+    // still sends functions. So one speed packet does for the whole consist.
+    // If the write fails, the member is taken back out (and CV19 written to
+    // 0, in case the decoder took it without replying).
+    // This needs ops mode, decoders that support advanced consisting, and a
+    // DccCvAsync (cv_async()): the CV19 writes are queued there, so they wait
+    // for any ops CV operation already going on the loco, and each one's
+    // result is a DccCvEvent (to done, or the event ring if done is null).
+    // consist_add() fails if the write can't be queued; consist_remove() and
+    // consist_delete() remove the loco either way, but return false if it
+    // couldn't be.
+    //
+    // A station consist is done here, for decoders that don't. Its address
+    // is its first member's. Setting its speed sets each member's, negated
+    // for reversed members. For scheduling it's one throttle: when the first
+    // member's turn is a speed packet, the other members' speed packets go
+    // right after it, and their own turns only send functions. So a speed
+    // change gets to all of them within a few packets.
+    //
+    // Members (and an advanced consist's address) get throttles if they
+    // don't already have them. A loco can be in one consist at a time.
+    bool consist_create(int address, bool advanced);
+    bool consist_delete(int address);
+    bool consist_add(int address, int loco, bool reversed = false,
+                     DccCvAsync::done_t *done = nullptr, void *arg = nullptr);
+    bool consist_remove(int address, int loco,
+                        DccCvAsync::done_t *done = nullptr,
+                        void *arg = nullptr);
+    bool consist_speed(int address, int speed);
+    void consist_show() const;
+
+    static constexpr int consist_max = 8;
+    static constexpr int consist_member_max = 8;
+
+    // where advanced consists' CV19 writes are queued
+    void cv_async(DccCvAsync *cv_async) { _cv_async = cv_async; }
+
+    // A roster of locos without throttles (see DccRoster). When there are
+    // throttles too, it gets every other packet.
+    void roster(DccRoster *roster) { _roster = roster; }
+    DccRoster *roster() const { return _roster; }
+
+    // Nothing to send but idle packets (ops mode with no throttles), so the
+    // bitstream can go to its idle mode. Creating a throttle or an e-stop
+    // brings it back within one packet. Not without ADC DMA: in idle mode,
+    // loop() only runs every DccBitstream::idle_loop_us, and the ADC FIFO
+    // would overflow between calls.
+    bool idle_ok() const; // called in interrupt context (by DccBitstream)
+    void idle_enable(bool en) { _bitstream.idle_enable(en); }
+    bool idle_enabled() const { return _bitstream.idle_enabled(); }
+    bool idle() const { return _bitstream.idle(); }
+    uint32_t idle_cnt() const { return _bitstream.idle_cnt(); }
+
+    // late bit reloads in the bitstream (see DccBitstream::late_cnt())
+    uint32_t late_cnt() const { return _bitstream.late_cnt(); }
+    bool late_abort() const { return _bitstream.late_abort(); }
+    void late_abort(bool en) { _bitstream.late_abort(en); }
+    void late_reset() { _bitstream.late_reset(); }
+    void late_show() const { _bitstream.late_show(); }
+
     // called by DccBitstream to get a packet to send
     void get_packet(DccPkt2 &pkt);
 
@@ -57,6 +256,10 @@ public:
 
     void show();
 
+    // railcom reception statistics for all throttles
+    void show_rc_stats();
+    void reset_rc_stats();
+
     void show_dcc(bool show)
     {
         _bitstream.show_dcc(show);
@@ -90,6 +293,10 @@ private:
 
     DccAdc &_adc;
 
+    DccProtect _protect;
+
+    DccProfile _profile;
+
     Mode _mode;
 
     enum class ModeSvc {
@@ -102,13 +309,111 @@ private:
 
     ModeSvc _mode_svc;
 
+    bool _svc_session;
+    int _svc_reset_need; // resets still needed before the next operation
+
     std::list<DccThrottle *> _throttles;
     std::list<DccThrottle *>::iterator _next_throttle;
 
+    DccPktIdle _pkt_idle; // ops mode with no throttles
     void get_packet_ops(DccPkt2 &pkt);
 
+    // accessory queue, oldest first
+    struct AccCmd {
+        DccPkt pkt;
+        int key;            // same output, same key
+        int left;           // times still to send
+        uint32_t queued_us;
+    };
+    AccCmd _acc[acc_max];
+    int _acc_cnt;
+    int _acc_next;          // next to send (round robin)
+    int _acc_repeat;
+    int _acc_gap;
+    int _acc_gap_left;      // throttle packets before the next accessory one
+    uint32_t _acc_cmd_cnt;
+    uint32_t _acc_coalesce_cnt;
+    uint32_t _acc_pkt_cnt;
+    uint32_t _acc_done_cnt;
+    uint32_t _acc_latency_us;
+    uint32_t _acc_latency_max_us;
+    bool acc_queue(const DccPkt &pkt, int key);
+    void get_packet_acc(DccPkt2 &pkt);
+
+    // consists
+    struct Consist {
+        int address;            // 0 if slot is free
+        bool advanced;
+        DccThrottle *throttle;  // advanced: for the consist address
+        int speed;
+        int member_cnt;
+        DccThrottle *member[consist_member_max];
+        bool reversed[consist_member_max];
+        uint32_t cv19_h[consist_member_max]; // advanced: CV19 write handle
+        bool cv19_ok[consist_member_max];    // advanced: CV19 write succeeded
+    };
+    Consist _consists[consist_max];
+    DccThrottle *_consist_burst; // next station member speed packet to send
+    Consist *consist_find(int address);
+    const Consist *consist_find(int address) const;
+    Consist *consist_find_member(const DccThrottle *throttle);
+    void consist_link(Consist &c);
+    void consist_drop(Consist &c, int i);
+    void consist_unlink(DccThrottle *throttle);
+    void consist_forget(DccThrottle *throttle);
+    DccCvAsync *_cv_async;
+
+    // Advanced consist member CV19 writes not done yet, with the caller's
+    // callback. No more than DccCvAsync::req_max can be pending.
+    struct Cv19Wait {
+        uint32_t handle; // 0 if slot is free
+        DccCvAsync::done_t *done;
+        void *arg;
+    };
+    Cv19Wait _cv19_wait[DccCvAsync::req_max];
+    static void cv19_done(const DccCvEvent &ev, void *arg);
+    void cv19_result(const DccCvEvent &ev);
+
+    // roster
+    DccRoster *_roster;
+    bool _roster_turn; // roster's turn if there are throttles too
+
+    // emergency stop
+    DccPktEStop _pkt_estop;
+    bool _estop;
+    int _estop_pkt_cnt;     // e-stop packets still to send
+    bool _estop_sent;       // first one has been sent
+    bool _estop_cut;        // track power cut
+    int _estop_power_off_ms;
+    uint32_t _estop_us;     // when estop() was called
+    uint32_t _estop_sent_us;
+    uint32_t _estop_cnt;
+    uint32_t _estop_latency_us;
+    uint32_t _estop_latency_max_us;
+    void get_packet_estop(DccPkt2 &pkt);
+    void estop_check();
+
     // used by write_cv(), write_bit(), read_cv(), and read_bit()
-    void svc_start();
+    void svc_start(ModeSvc mode_svc);
+
+    // end of an operation: power off, or stay on if in a session
+    void svc_end(DccPkt2 &pkt);
+
+    // in a session, between operations
+    void get_packet_svc_idle(DccPkt2 &pkt);
+
+    // indexed cv operation in progress
+    DccCvIndex _svc_index;
+    ModeSvc _svc_idx_op;   // NONE if not doing an indexed operation
+    int _svc_idx_cv;       // index cv being written, or 0 if doing the op
+    uint8_t _svc_idx_val;  // value being written to it
+    int _svc_idx_cv_num;   // the op
+    uint8_t _svc_idx_cv_val;
+    bool _svc_idx_fast;
+    int _svc_idx_guess;
+    int _svc_idx_pkt_cnt;  // packets in earlier steps
+    void svc_index_step();
+    bool svc_index_next();
 
     // for CV operations
     enum CvOp {
@@ -119,36 +424,42 @@ private:
 
     CvOp _svc_status, _svc_status_next;
 
-    // When in service mode, we check for ack in the bit loop. _ack_ma is
-    // initialized to ack_ma_inv and _ack false. After the initial resets, we
-    // set _ack_ma to the long average + ack_inc_ma. In the bit loop, if
-    // _ack_ma is not ack_ma_invalid, and the short average is larger than
-    // _ack_ma, we set _ack true. The next get_packet_* call sees that,
-    // handles it, and sets _ack_ma to ack_ma_invalid.
-    uint16_t _ack_ma;
-    static constexpr uint16_t ack_ma_inv = UINT16_MAX;
-    static constexpr uint16_t ack_inc_ma = 60;
+    // When in service mode, we check for ack in the bit loop. _ack_armed is
+    // initially false. After the initial resets, we arm the detector (e.g.
+    // the threshold detector sets its threshold to the long average plus
+    // 60 ma) and set _ack_armed. In the bit loop, the detector looks at new
+    // adc samples, and if it sees an ack while _ack_armed is set, we set _ack
+    // true. The next get_packet_* call sees that, handles it, and clears
+    // _ack_armed until the next arm.
+    DccAckThreshold _ack_threshold;
+    DccAck *_ack_det;
+    bool _ack_armed;
     bool _ack;
 
+    // When the track is powered up for service mode; forget everything
     void ack_reset()
     {
-        _ack_ma = ack_ma_inv;
+        _ack_det->reset();
+        _ack_armed = false;
         _ack = false;
     }
 
-    // When we start looking for an ack, set the threshold
-    void ack_arm(uint16_t ack_ma)
+    // When we start looking for an ack
+    void ack_arm()
     {
-        _ack_ma = ack_ma;
+        _ack_det->arm();
+        _ack_armed = true;
         _ack = false;
     }
 
     // Look for ack and trigger if we see one
-    bool ack_check(uint16_t track_ma)
+    bool ack_check()
     {
-        if (_ack_ma != ack_ma_inv && track_ma >= _ack_ma) {
+        // Let the detector see every sample, armed or not; the matched
+        // filter detector follows the baseline.
+        if (_ack_det->check() && _ack_armed) {
             // ack!
-            _ack_ma = ack_ma_inv;
+            _ack_armed = false;
             _ack = true;
             return true;
         } else {
@@ -161,11 +472,13 @@ private:
     bool ack()
     {
         if (_ack) {
-            ack_reset();
+            _ack = false;
             if (_show_acks) {
                 char *b = BufLog::write_line_get();
                 if (b != nullptr) {
-                    snprintf(b, BufLog::line_len, "<< ACK");
+                    const DccAck::Pulse &p = _ack_det->pulse();
+                    snprintf(b, BufLog::line_len, "<< ACK %u ma %lu us",
+                             uint(p.amp_ma), p.len_us);
                     BufLog::write_line_put();
                 }
             }
@@ -197,6 +510,9 @@ private:
     int _verify_bit;
     int _verify_bit_val; // 0 or 1
     uint8_t _cv_val;
+    bool _read_fast;
+    int _read_guess; // -1 if none
+    int _svc_pkt_cnt;
     void get_packet_svc_read_cv(DccPkt2 &pkt);
     void get_packet_svc_read_bit(DccPkt2 &pkt);
 
@@ -208,15 +524,4 @@ private:
     // All default to -1 (disabled).
     static int dbg_get_packet; // asserted for duration of get_packet()
     static void dbg_init();    // call this after changing any from default
-
-    uint32_t _get_packet_min_us;
-    uint32_t _get_packet_max_us;
-    uint32_t _get_packet_avg_us;
-    static constexpr int get_packet_avg_len = 16;
-    void dbg_times_reset()
-    {
-        _get_packet_min_us = UINT32_MAX;
-        _get_packet_max_us = 0;
-        _get_packet_avg_us = 0;
-    }
 };
@@ -13,6 +13,9 @@ const int config = 29;
 const int index_hi = 31;
 const int index_lo = 32;
 
+// CV31/CV32 as one number, for indexed CV access
+constexpr int index(int hi, int lo) { return (hi << 8) | lo; }
+
 const int master_volume = 63; // Loksound 5
 
 const int ext_config_2 = 124;
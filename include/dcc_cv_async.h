@@ -0,0 +1,193 @@
+#pragma once
+
+#include <cstdint>
+
+class DccCommand;
+class DccOpsQueue;
+struct DccOpsJob;
+
+// A finished CV operation from DccCvAsync.
+
+struct DccCvEvent {
+
+    enum class Op : uint8_t {
+        READ_CV,
+        READ_BIT,
+        WRITE_CV,
+        WRITE_BIT,
+        READ_ADDRESS,  // CV29 bit 5, then CV1 or CV17/CV18
+        WRITE_ADDRESS, // CV1 or CV18/CV17, then CV29 bit 5
+    };
+
+    enum class Status : uint8_t {
+        OK,
+        FAILED,    // no ack (service mode) or no railcom reply (ops mode)
+        CANCELLED, // cancelled before it started
+    };
+
+    uint32_t handle;
+    Op op;
+    Status status;
+    int address; // ops mode loco; -1 for service mode
+    int cv_num;  // for READ/WRITE_ADDRESS, the last CV accessed (the one
+                 // that failed, if it failed)
+    int bit_num; // READ_BIT and WRITE_BIT (and CV29 in READ/WRITE_ADDRESS)
+    int value;   // value read (if OK) or written; a bit is 0 or 1; for
+                 // READ/WRITE_ADDRESS, the loco address
+    int retries; // retries after failures, all steps
+    uint32_t queued_us;
+    uint32_t start_us; // service mode: when it was started on the track;
+                       // ops mode: same as queued_us
+    uint32_t done_us;
+
+    static const char *op_name(Op op);
+    static const char *status_name(Status status);
+
+}; // struct DccCvEvent
+
+
+// Asynchronous CV operations.
+//
+// Each operation returns a handle (nonzero) as soon as it is queued, or 0 if
+// it could not be (bad arguments, or too many pending). When it finishes, a
+// DccCvEvent with the same handle is passed to the operation's callback, or
+// if it has none, put in an event ring for the main loop to pick up with
+// get_event(). If the ring is full, the oldest event is dropped (and counted).
+//
+// Service mode operations are done one at a time, in the order they were
+// queued; each one is started when the one before it finishes, and fails if
+// the track is not off (or in a service mode session) then. Ops mode
+// operations go through the DccOpsQueue, so operations for different locos
+// run at the same time.
+//
+// READ_ADDRESS and WRITE_ADDRESS are sequences of service mode commands that
+// complete as one operation. A failed command is retried (up to the retry
+// count set when the operation was queued); if it still fails, the operation
+// stops there and fails.
+//
+// Callbacks are called from loop(), and may queue more operations, so a
+// multi-step flow can be written as a chain of callbacks.
+//
+// loop() must be called from the main loop (not interrupt context); it also
+// runs the DccOpsQueue's loop(). This installs itself as the queue's job-done
+// callback, so queue ops mode operations through here, not on the queue
+// directly. Don't start service mode operations on the DccCommand directly
+// while any are pending here.
+
+class DccCvAsync
+{
+
+public:
+
+    DccCvAsync(DccCommand &command, DccOpsQueue &queue);
+    ~DccCvAsync();
+
+    // event callback function type
+    typedef void done_t(const DccCvEvent &ev, void *arg);
+
+    // retries for operations queued after this
+    void retries(int retry_max) { _retry_max = retry_max; }
+
+    uint32_t svc_read_cv(int cv_num, done_t *done = nullptr,
+                         void *arg = nullptr);
+    uint32_t svc_read_bit(int cv_num, int bit_num, done_t *done = nullptr,
+                          void *arg = nullptr);
+    uint32_t svc_write_cv(int cv_num, uint8_t cv_val, done_t *done = nullptr,
+                          void *arg = nullptr);
+    uint32_t svc_write_bit(int cv_num, int bit_num, int bit_val,
+                           done_t *done = nullptr, void *arg = nullptr);
+    uint32_t svc_read_address(done_t *done = nullptr, void *arg = nullptr);
+    uint32_t svc_write_address(int address, done_t *done = nullptr,
+                               void *arg = nullptr);
+
+    uint32_t ops_read_cv(int address, int cv_num, done_t *done = nullptr,
+                         void *arg = nullptr);
+    uint32_t ops_write_cv(int address, int cv_num, uint8_t cv_val,
+                          done_t *done = nullptr, void *arg = nullptr);
+    uint32_t ops_write_bit(int address, int cv_num, int bit_num, int bit_val,
+                           done_t *done = nullptr, void *arg = nullptr);
+
+    // Cancel a service mode operation that has not started. Its event has
+    // status CANCELLED. Returns false if it has started or is not pending.
+    bool cancel(uint32_t handle);
+
+    bool pending(uint32_t handle) const;
+    int pending_cnt() const;
+    bool idle() const { return pending_cnt() == 0; }
+
+    // get the oldest event from the event ring
+    bool get_event(DccCvEvent &ev);
+
+    // Put an event in the ring, as if its operation had no callback. This is
+    // for a callback that passes some events on to the main loop.
+    void put_event(const DccCvEvent &ev);
+
+    void loop();
+
+    uint32_t ok_cnt() const { return _ok_cnt; }
+    uint32_t err_cnt() const { return _err_cnt; }
+    uint32_t drop_cnt() const { return _drop_cnt; }
+
+    static constexpr int req_max = 32;
+    static constexpr int event_max = 16;
+
+private:
+
+    DccCommand &_command;
+    DccOpsQueue &_queue;
+
+    int _retry_max;
+    uint32_t _handle_next;
+
+    // A pending operation. The command on the track (service mode) or in
+    // the queue (ops mode) is the current step.
+    struct Req {
+        uint32_t handle; // 0 if slot is free
+        DccCvEvent ev;   // filled in as it goes
+        done_t *done;
+        void *arg;
+        int retry_max;
+        int retry;
+        DccCvEvent::Op step_op; // READ_CV, READ_BIT, WRITE_CV, or WRITE_BIT
+        int step_cv;
+        int step_bit;
+        uint8_t step_val;
+        bool job_done; // ops mode: queue finished the job
+        bool job_result;
+        uint8_t job_val;
+    };
+
+    Req _reqs[req_max];
+
+    // service mode requests (index in _reqs) waiting to start, oldest first
+    int _svc_wait[req_max];
+    int _svc_wait_cnt;
+    int _svc_act; // index in _reqs of the one started; -1 if none
+
+    // event ring, used for operations with no callback
+    DccCvEvent _events[event_max];
+    int _event_put;
+    int _event_get;
+    int _event_cnt;
+
+    uint32_t _ok_cnt;
+    uint32_t _err_cnt;
+    uint32_t _drop_cnt;
+
+    Req *alloc(DccCvEvent::Op op, int address, int cv_num, int bit_num,
+               int value, done_t *done, void *arg);
+    Req *find(uint32_t handle);
+    void step(Req &r, DccCvEvent::Op op, int cv_num, int bit_num = 0,
+              int val = 0);
+    bool step_next(Req &r, uint8_t val);
+    uint32_t svc_queue(Req *r);
+    void svc_issue(Req &r);
+    void svc_loop();
+    uint32_t ops_queue(Req *r);
+    bool ops_issue(Req &r);
+    void ops_loop();
+    void complete(Req &r, DccCvEvent::Status status);
+
+    static void job_done(const DccOpsJob &job, void *arg);
+
+}; // class DccCvAsync
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <cstdint>
+
+// Storage for DccCvCache's log: a few erase sectors that behave like NOR
+// flash. Erase sets a sector to 0xff; program writes one page and can only
+// clear bits, so a page can be programmed more than once as long as each
+// program only puts 0xff over bytes already written (which leaves them
+// unchanged).
+
+class DccCvStore
+{
+
+public:
+
+    virtual ~DccCvStore() {}
+
+    static constexpr uint32_t sector_size = 4096;
+    static constexpr uint32_t page_size = 256;
+
+    virtual int sector_cnt() const = 0;
+
+    // offsets are from the start of the store
+    virtual void read(uint32_t off, void *buf, uint32_t len) const = 0;
+    virtual void erase(uint32_t off) = 0; // one sector, off sector-aligned
+    virtual void program(uint32_t off, const uint8_t *buf) = 0; // one page
+
+}; // class DccCvStore
+
+
+// Store in the Pico's flash, sector_cnt sectors starting at flash_off (from
+// the start of flash, not XIP_BASE).
+//
+// Erase and program stop execution from flash, so they are done with
+// interrupts disabled, including the DCC bit interrupt. A sector erase takes
+// tens of msec, so only use this (DccCvCache::flush()) with track power off.
+
+class DccCvStoreFlash : public DccCvStore
+{
+
+public:
+
+    DccCvStoreFlash(uint32_t flash_off, int sector_cnt);
+
+    virtual int sector_cnt() const override { return _sector_cnt; }
+
+    virtual void read(uint32_t off, void *buf, uint32_t len) const override;
+    virtual void erase(uint32_t off) override;
+    virtual void program(uint32_t off, const uint8_t *buf) override;
+
+private:
+
+    uint32_t _flash_off;
+    int _sector_cnt;
+
+}; // class DccCvStoreFlash
+
+
+// Store in RAM that acts like flash (program only clears bits), for trying
+// out DccCvCache without wearing flash. It and DccCvCache have no SDK
+// dependencies (DccCvStoreFlash is in a file of its own), so they also build
+// on a host; host/cv_cache_test uses them.
+
+class DccCvStoreRam : public DccCvStore
+{
+
+public:
+
+    DccCvStoreRam(int sector_cnt);
+    virtual ~DccCvStoreRam();
+
+    virtual int sector_cnt() const override { return _sector_cnt; }
+
+    virtual void read(uint32_t off, void *buf, uint32_t len) const override;
+    virtual void erase(uint32_t off) override;
+    virtual void program(uint32_t off, const uint8_t *buf) override;
+
+    uint32_t erase_cnt() const { return _erase_cnt; }
+    uint32_t program_cnt() const { return _program_cnt; }
+
+private:
+
+    int _sector_cnt;
+    uint8_t *_mem;
+
+    uint32_t _erase_cnt;
+    uint32_t _program_cnt;
+
+}; // class DccCvStoreRam
+
+
+// Cache of known CV values, by decoder.
+//
+// A decoder is identified by its address and manufacturer (CV8), so moving a
+// loco's address to a different decoder doesn't pick up the old decoder's
+// values. Each value has a trust level:
+//   READ     read back from the decoder
+//   WRITTEN  written, and the decoder acked it (or railcom confirmed it)
+//   DEFAULT  assumed (e.g. factory default); never overrides READ or WRITTEN
+// READ and WRITTEN are "trusted": a read can be answered from the cache, and
+// a write of the same value can be skipped.
+//
+// CVs 257-512 are indexed by CV31/CV32 (S-9.2.2), so the CV number alone
+// doesn't say which CV it is; they are not cached. Writing CV8 resets the
+// decoder to defaults (S-9.2.2), so that forgets everything about it.
+//
+// With a store, the cache is persistent: load() reads it at startup, and
+// changes are kept in RAM (marked dirty) until flush() appends them to the
+// store. The store is an append-only log of 8-byte records, in one sector at
+// a time. When the sector is full (or something was forgotten), flush()
+// writes the whole cache to the next sector and continues there, so erases
+// rotate through all the sectors.
+
+class DccCvCache
+{
+
+public:
+
+    DccCvCache(DccCvStore *store = nullptr);
+    ~DccCvCache();
+
+    enum class Trust : uint8_t {
+        NONE,
+        DEFAULT,
+        WRITTEN,
+        READ,
+    };
+
+    static const char *trust_name(Trust trust);
+
+    // Get a value and its trust; false if not cached.
+    bool get(int address, int mfg, int cv_num, uint8_t &val,
+             Trust &trust) const;
+
+    // Get a value only if it is trusted (counts hits and misses).
+    bool lookup(int address, int mfg, int cv_num, uint8_t &val);
+
+    // Record a value. Returns false if the table is full or the CV is not
+    // cacheable. Writing CV8 with trust WRITTEN forgets the decoder.
+    bool set(int address, int mfg, int cv_num, uint8_t val, Trust trust);
+
+    // False if the decoder is trusted to already have val in cv_num. Always
+    // true for CV8 (writing it is a reset).
+    bool write_needed(int address, int mfg, int cv_num, uint8_t val) const;
+
+    // Forget one CV (e.g. after a failed or unconfirmed write), or all of a
+    // decoder's CVs (cv_num = -1).
+    void forget(int address, int mfg, int cv_num = -1);
+
+    static bool cacheable(int cv_num);
+
+    // Load from the store, replacing anything in RAM. Returns false if there
+    // is no store or nothing valid in it (the cache is then empty).
+    bool load();
+
+    // Write changes to the store. Returns false if there is no store.
+    bool flush();
+
+    bool dirty() const { return _dirty_cnt > 0 || _compact_need; }
+
+    int cnt() const { return _entry_cnt; }
+
+    static constexpr int entry_max = 256;
+
+    uint32_t hit_cnt() const { return _hit_cnt; }
+    uint32_t miss_cnt() const { return _miss_cnt; }
+
+    // show one decoder's CVs, or everything (address = -1)
+    void show(int address = -1, int mfg = -1) const;
+
+private:
+
+    DccCvStore *_store;
+
+    struct Entry {
+        uint16_t address;
+        uint16_t cv_num;
+        uint8_t mfg;
+        Trust trust;
+        uint8_t val;
+        bool dirty;  // changed since last flush()
+        bool stored; // some value for it is in the store
+    };
+
+    Entry _entries[entry_max];
+    int _entry_cnt;
+    int _dirty_cnt;
+
+    uint32_t _hit_cnt;
+    uint32_t _miss_cnt;
+
+    Entry *find(int address, int mfg, int cv_num);
+    const Entry *find(int address, int mfg, int cv_num) const;
+    void remove(int idx);
+
+    // Log record as stored; erased (all 0xff) marks the end of the log.
+    // The first record slot in each sector is the sector header.
+    struct Record {
+        uint16_t address;
+        uint16_t cv_num;
+        uint8_t mfg;
+        uint8_t trust;
+        uint8_t val;
+        uint8_t check;
+    };
+    static_assert(sizeof(Record) == 8);
+
+    struct Header {
+        uint32_t magic;
+        uint32_t seq;
+    };
+    static_assert(sizeof(Header) == sizeof(Record));
+
+    static constexpr uint32_t magic = 0x56434344; // "DCCV"
+
+    static constexpr uint32_t rec_per_sector =
+        DccCvStore::sector_size / sizeof(Record);
+    static_assert(entry_max < rec_per_sector);
+
+    static uint8_t check(const Record &rec);
+
+    int _sector;       // sector being appended to; -1 if none yet
+    uint32_t _seq;     // its header's sequence number
+    uint32_t _log_off; // offset in the store of next record
+    bool _compact_need;
+
+    uint8_t _page[DccCvStore::page_size];
+    uint32_t _page_off; // store offset of _page; UINT32_MAX if none
+
+    void append(const Record &rec);
+    void append_done();
+    void compact();
+
+}; // class DccCvCache
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+
+#include "dcc_cv.h"
+
+// CV31/CV32 index tracking for indexed CV access (S-9.2.2: CVs 257-512 are
+// selected by CV31 and CV32).
+//
+// An indexed access is: write CV31 if it is not already right, write CV32 if
+// it is not already right, then access the CV. want() starts an access, and
+// next() says which index CV (if any) has to be written next; written() is
+// told how each of those writes went. If a write fails, that index CV is
+// unknown, and the next access writes it again.
+//
+// An index is (CV31 << 8) | CV32 (DccCv::index()).
+
+class DccCvIndex
+{
+
+public:
+
+    DccCvIndex() :
+        _hi(-1),
+        _lo(-1),
+        _want(-1),
+        _access_cnt(0),
+        _write_cnt(0)
+    {
+    }
+
+    // decoder might have changed
+    void forget()
+    {
+        _hi = -1;
+        _lo = -1;
+    }
+
+    void want(int index)
+    {
+        _want = index;
+        _access_cnt++;
+    }
+
+    // Returns DccCv::index_hi or DccCv::index_lo, with the value to write in
+    // val, or 0 if the wanted index is selected.
+    int next(uint8_t &val)
+    {
+        if (_want < 0)
+            return 0;
+        int hi = _want >> 8;
+        int lo = _want & 0xff;
+        if (hi != _hi) {
+            val = hi;
+            return DccCv::index_hi;
+        } else if (lo != _lo) {
+            val = lo;
+            return DccCv::index_lo;
+        } else {
+            return 0;
+        }
+    }
+
+    // Call after any write to CV31 or CV32 (ok false if it failed or it's not
+    // known whether it worked).
+    void written(int cv_num, bool ok, uint8_t val)
+    {
+        if (cv_num == DccCv::index_hi) {
+            _hi = ok ? val : -1;
+            if (ok)
+                _write_cnt++;
+        } else if (cv_num == DccCv::index_lo) {
+            _lo = ok ? val : -1;
+            if (ok)
+                _write_cnt++;
+        }
+    }
+
+    // index selected in the decoder, or -1 if not known
+    int index() const
+    {
+        return (_hi < 0 || _lo < 0) ? -1 : DccCv::index(_hi, _lo);
+    }
+
+    // indexed accesses, and index cv writes they needed; writing both index
+    // cvs every time would be 2 * access_cnt() writes
+    uint32_t access_cnt() const { return _access_cnt; }
+    uint32_t write_cnt() const { return _write_cnt; }
+
+private:
+
+    int _hi; // -1 if not known
+    int _lo;
+    int _want;
+
+    uint32_t _access_cnt;
+    uint32_t _write_cnt;
+
+}; // class DccCvIndex
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+
+#include "hardware/structs/systick.h"
+
+// Define to time the interrupt paths (see DccLatency); undefined, the probes
+// compile to nothing. It's off by default since every interrupt pays for the
+// probes in it (see below), and that cost hasn't been measured on a Pico.
+#undef INCLUDE_LATENCY
+
+// Interrupt path latency, in CPU cycles.
+//
+// Each path is timed with SysTick, which counts down at the CPU clock and
+// wraps every 2^24 cycles (134 msec at 125 MHz). A Probe reads it when it is
+// made and again when it goes out of scope, and adds the difference to the
+// path's histogram: bucket n counts runs of 2^(n-1) to 2^n-1 cycles. That's
+// two SysTick reads, a subtract and mask, a count-leading-zeros (a call to
+// libgcc's __clzsi2 on the M0+, which has no CLZ instruction), an increment,
+// and two compares (max and overrun). The probe costs several tens of cycles
+// (not measured), and an outer path's time includes the probes nested inside
+// it (see below). Percentiles come from the histogram, so they are the top of
+// a bucket (within a factor of two, on the high side); max is exact.
+//
+// A run longer than half a bit time (DccSpec::t1_nom_us) is an overrun, and
+// is counted; next_bit() doing that can stretch a bit.
+//
+// Paths nest: next_bit() includes get_packet() and the railcom calls.
+
+class DccLatency
+{
+
+public:
+
+    enum Path {
+        NEXT_BIT,         // DccBitstream::next_bit()
+        GET_PACKET,       // DccCommand::get_packet()
+        RAILCOM_READ,     // RailCom::read()
+        RAILCOM_PARSE,    // RailCom::parse()
+        THROTTLE_RAILCOM, // DccThrottle::railcom()
+        ADC_LOOP,         // DccAdc::loop()
+        path_cnt
+    };
+
+    static constexpr int bucket_cnt = 25; // 0, 1, 2-3, ... 2^23 - 2^24-1
+
+    // Start SysTick (if not already) and set the overrun limit from the
+    // system clock. Called by DccBitstream when it starts.
+    static void init();
+
+    static void reset();
+
+    class Probe
+    {
+    public:
+#ifdef INCLUDE_LATENCY
+        Probe(Path path) : _path(path), _start(systick_hw->cvr)
+        {
+        }
+        ~Probe()
+        {
+            record(_path, (_start - systick_hw->cvr) & 0xffffff);
+        }
+    private:
+        Path _path;
+        uint32_t _start;
+#else
+        Probe(Path)
+        {
+        }
+#endif
+    };
+
+    // value (in cycles) under which pct percent of the runs were
+    static uint32_t percentile(Path path, int pct);
+
+    static uint32_t cnt(Path path);
+    static uint32_t max(Path path) { return _max[path]; }
+    static uint32_t over(Path path) { return _over[path]; }
+
+    static uint32_t cycles_per_us() { return _cyc_per_us; }
+
+    static const char *name(Path path);
+
+    static void show();
+
+private:
+
+    static uint32_t _hist[path_cnt][bucket_cnt];
+    static uint32_t _max[path_cnt];
+    static uint32_t _over[path_cnt];
+    static uint32_t _over_cyc; // half a bit time
+    static uint32_t _cyc_per_us;
+
+    static void record(Path path, uint32_t cyc) // called in interrupt context
+    {
+        int b = (cyc == 0) ? 0 : (32 - __builtin_clz(cyc));
+        _hist[path][b]++;
+        if (cyc > _max[path])
+            _max[path] = cyc;
+        if (cyc > _over_cyc)
+            _over[path]++;
+    }
+
+}; // class DccLatency
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+
+class DccCommand;
+
+// One ops-mode CV operation in a DccOpsQueue.
+
+struct DccOpsJob {
+
+    enum class Op : uint8_t {
+        READ_CV,
+        WRITE_CV,
+        WRITE_BIT,
+    };
+
+    Op op;
+    int address;
+    int cv_num;
+    int bit_num;     // WRITE_BIT only
+    uint8_t cv_val;  // value to write, or value read (or written, if railcom
+                     // confirmed it) when done
+    uint32_t tag;    // caller's, returned unchanged
+    bool result;     // when done: true if railcom confirmed it
+    uint32_t queued_us;
+    uint32_t done_us;
+};
+
+// Queue of ops-mode CV operations for any number of locomotives.
+//
+// Each DccThrottle can only do one ops CV operation at a time, but the
+// command station sends packets to each throttle in turn, so while one loco
+// is being asked for a CV (and answering in the cutout after its packet),
+// other locos can be working on their own CV operations. The queue holds
+// jobs for all locos and starts each one as soon as its loco's throttle is
+// idle. Jobs for the same loco are done in the order they were queued.
+//
+// A job's loco must have a throttle (DccCommand::create_throttle()); if not,
+// the job completes immediately with result false. Track power must be on
+// (ops mode) for jobs to make progress.
+//
+// loop() must be called from the main loop (not interrupt context). Jobs
+// that are done are passed to the callback if one is installed, otherwise
+// they are put in a completion ring to be picked up with get_done(). If the
+// completion ring is full, the oldest completion is dropped (and counted).
+//
+// Don't issue ops CV commands directly on a throttle that the queue is also
+// using.
+
+class DccOpsQueue
+{
+
+public:
+
+    DccOpsQueue(DccCommand &command);
+    ~DccOpsQueue();
+
+    // Queue an operation. Returns false if the queue is full or arguments
+    // are out of range.
+    bool read_cv(int address, int cv_num, uint32_t tag = 0);
+    bool write_cv(int address, int cv_num, uint8_t cv_val, uint32_t tag = 0);
+    bool write_bit(int address, int cv_num, int bit_num, int bit_val,
+                   uint32_t tag = 0);
+
+    // job-done function type
+    typedef void job_done_t(const DccOpsJob &job, void *arg);
+
+    // install function to be called (from loop()) when a job is done;
+    // nullptr to use the completion ring instead
+    void on_job_done(job_done_t *job_done, void *arg = nullptr)
+    {
+        _job_done = job_done;
+        _job_done_arg = arg;
+    }
+
+    // get the oldest completed job from the completion ring
+    bool get_done(DccOpsJob &job);
+
+    void loop();
+
+    int waiting() const { return _wait_cnt; }
+    int active() const { return _act_cnt; }
+    bool idle() const { return _wait_cnt == 0 && _act_cnt == 0; }
+
+    // Throughput since the last reset_stats(): jobs done per second, from
+    // the first job queued to the last one done.
+    uint32_t ok_cnt() const { return _ok_cnt; }
+    uint32_t err_cnt() const { return _err_cnt; }
+    uint32_t drop_cnt() const { return _drop_cnt; }
+    uint32_t max_us() const { return _max_us; }
+    int ops_per_sec_x10() const;
+
+    void reset_stats();
+
+    char *show(char *buf, int buf_len) const;
+
+    static constexpr int wait_max = 32;
+    static constexpr int active_max = 16;
+    static constexpr int done_max = 32;
+
+private:
+
+    DccCommand &_command;
+
+    // waiting jobs, oldest first
+    DccOpsJob _wait[wait_max];
+    int _wait_cnt;
+
+    // jobs that have been started on a throttle
+    DccOpsJob _act[active_max];
+    int _act_cnt;
+
+    // completion ring, used if no callback installed
+    DccOpsJob _done[done_max];
+    int _done_put;
+    int _done_get;
+    int _done_cnt;
+
+    job_done_t *_job_done;
+    void *_job_done_arg;
+
+    // stats
+    uint32_t _ok_cnt;
+    uint32_t _err_cnt;
+    uint32_t _drop_cnt;
+    uint32_t _max_us; // longest queued-to-done time
+    uint32_t _first_us;
+    uint32_t _last_us;
+    bool _timing;
+
+    bool queue(const DccOpsJob &job);
+    bool busy(int address) const;
+    void start(DccOpsJob &job);
+    void finish(DccOpsJob &job, bool result, uint8_t cv_val);
+
+}; // class DccOpsQueue
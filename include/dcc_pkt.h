@@ -24,6 +24,7 @@ public:
     enum PktType {
         Invalid,
         Reset,
+        BroadcastStop,
         Ccc0, // 2.3.1 Decoder and Consist Control
         Speed128,
         Speed28,
@@ -49,6 +50,7 @@ public:
 #if (DCC_FUNC_MAX >= 61)
         Func61,
 #endif
+        BinState,
         OpsRead1Cv,
         OpsRead4Cv,
         OpsWriteCv,
@@ -98,6 +100,11 @@ public:
     static constexpr int speed_max = 127;
     static constexpr int speed_inv = INT_MAX;
 
+    // accessory address constraints (RCN-213 user address; address 1 is
+    // decoder 1 output pair 0, and decoder 511 is broadcast)
+    static constexpr int acc_address_min = 1;
+    static constexpr int acc_address_max = 2040;
+
     static constexpr int function_min = 0;
     static constexpr int function_max = DCC_FUNC_MAX;
 
@@ -150,6 +157,7 @@ public:
 #if (DCC_FUNC_MAX >= 61)
     bool decode_func_61(int *f) const; // f[8] is f61..f68
 #endif
+    bool decode_binstate(int &num, bool &on) const; // short or long form
 
 protected:
 
@@ -162,6 +170,7 @@ protected:
     bool check_len_min(char *&b, char *e, int min_len) const;
     bool check_len_is(char *&b, char *e, int len) const;
     void show_cv_access(char *&b, char *e, uint8_t instr, int idx) const;
+    void show_xpom_access(char *&b, char *e, uint8_t instr, int idx) const;
 
     static PktType decode_payload(const uint8_t *pay, int pay_len);
 
@@ -191,6 +200,19 @@ public:
     }
 };
 
+// Broadcast Stop Packet (S-9.2 baseline): 00000000 01DC000S
+// Always sent with C set (direction ignored) and S set (emergency stop).
+class DccPktEStop : public DccPkt
+{
+public:
+
+    DccPktEStop();
+    virtual PktType get_type() const override
+    {
+        return BroadcastStop;
+    }
+};
+
 // 2.3.2.1 - 128 Speed Step Control
 class DccPktSpeed128 : public DccPkt
 {
@@ -399,6 +421,86 @@ typedef DccPktFuncHi<0xdb, 53> DccPktFunc53;
 typedef DccPktFuncHi<0xdc, 61> DccPktFunc61;
 #endif
 
+// Any of the function group packets above, for a throttle that keeps its
+// function states itself and only needs one packet at a time. The groups are
+// in a constexpr table (in the order they are refreshed), so a throttle's
+// packet sequence follows from its highest function number.
+class DccPktFuncGroup : public DccPkt
+{
+public:
+
+    struct Group {
+        uint8_t inst;  // instruction byte
+        uint8_t f_min; // first function
+        uint8_t f_cnt; // functions in group
+        uint8_t len;   // instruction bytes: 1 (inst | funcs) or 2 (inst, funcs)
+    };
+
+    static constexpr Group group[] = {
+        {0x80, 0, 5, 1},  // f0:f4:f3:f2:f1
+        {0xb0, 5, 4, 1},  // f8:f7:f6:f5
+        {0xa0, 9, 4, 1},  // f12:f11:f10:f9
+        {0xde, 13, 8, 2}, // f20...f13
+        {0xdf, 21, 8, 2}, // f28...f21
+        {0xd8, 29, 8, 2}, // f36...f29
+        {0xd9, 37, 8, 2}, // f44...f37
+        {0xda, 45, 8, 2}, // f52...f45
+        {0xdb, 53, 8, 2}, // f60...f53
+        {0xdc, 61, 8, 2}, // f68...f61
+    };
+
+    static constexpr int group_max = sizeof(group) / sizeof(group[0]);
+
+    // group containing function f
+    static constexpr int group_of(int f)
+    {
+        return (f <= 4) ? 0 : (f <= 8) ? 1 : (f <= 12) ? 2 : 3 + (f - 13) / 8;
+    }
+
+    // number of groups needed for f0...func_max
+    static constexpr int group_cnt(int func_max)
+    {
+        return group_of(func_max) + 1;
+    }
+
+    DccPktFuncGroup(int adrs = 3);
+    virtual int set_address(int adrs) override;
+
+    // funcs bit 0 is the group's f_min
+    void set_group(int g, uint32_t funcs);
+};
+
+// 2.3.6.3 - Binary State Control Instruction Long Form:
+//     11000000 DLLLLLLL HHHHHHHH, state 0...32767 (0 is all states)
+// 2.3.6.4 - Binary State Control Instruction Short Form:
+//     11011101 DLLLLLLL, state 1...127
+// The short form is used when it can be.
+class DccPktBinState : public DccPkt
+{
+public:
+
+    DccPktBinState(int adrs = 3, int num = num_min, bool on = false);
+    virtual int set_address(int adrs) override;
+    void set_state(int num, bool on);
+    int get_num() const;
+    bool get_on() const;
+    virtual PktType get_type() const override
+    {
+        return BinState;
+    }
+
+    static constexpr uint8_t inst_long = 0xc0;
+    static constexpr uint8_t inst_short = 0xdd;
+
+    static constexpr int num_min = 0;
+    static constexpr int num_max = 32767;
+    static constexpr int num_short_max = 127;
+
+private:
+
+    void refresh(int adrs, int num, bool on);
+};
+
 // 2.3.7.3 - Configuration Variable Access - Long Form (read/verify byte)
 class DccPktOpsReadCv : public DccPkt
 {
@@ -418,6 +520,32 @@ private:
     int get_cv_num() const; // get from message
 };
 
+// RCN-214 2.3.7.4 - XPOM (read four bytes)
+//
+// The decoder replies with an XPOM RailCom message carrying the values of
+// cv_num...cv_num+3, tagged with the sequence number (0...3) from this packet
+// so the reply can be matched with the request.
+class DccPktOpsRead4Cv : public DccPkt
+{
+public:
+
+    DccPktOpsRead4Cv(int adrs = 3, int cv_num = 1, int seq = 0);
+    virtual int set_address(int adrs) override;
+    void set_cv(int cv_num, int seq); // set cv num and sequence in message
+    int get_cv_num() const;           // get from message
+    int get_seq() const;              // get from message
+    virtual PktType get_type() const override
+    {
+        return OpsRead4Cv;
+    }
+
+    static constexpr int seq_max = 4;
+
+private:
+
+    void refresh(int adrs, int cv_num, int seq);
+};
+
 // There is no ops "read bit" command. It does not add any functionality, and
 // the returned value would just be the whole byte anyway.
 
@@ -462,6 +590,44 @@ private:
     int get_bit_val() const;
 };
 
+// 2.4.1 - Basic Accessory Decoder Packet Format: 10AAAAAA 1AAACDDR
+// 'out' is R, which of the output pair (e.g. 0 = thrown, 1 = closed), and
+// 'on' is C, activate or deactivate it. get_address() returns the 11-bit
+// address in the packet, which is the accessory address + 3.
+class DccPktAccBasic : public DccPkt
+{
+public:
+
+    DccPktAccBasic(int acc_adrs = acc_address_min, int out = 0, bool on = true);
+    void set(int acc_adrs, int out, bool on);
+    int get_acc_address() const;
+    int get_out() const;
+    bool get_on() const;
+    virtual PktType get_type() const override
+    {
+        return Accessory;
+    }
+};
+
+// 2.4.2 - Extended Accessory Decoder Control Packet Format:
+// 10AAAAAA 0AAA0AA1 XXXXXXXX, where X is the aspect (e.g. a signal head).
+class DccPktAccExt : public DccPkt
+{
+public:
+
+    DccPktAccExt(int acc_adrs = acc_address_min, int aspect = 0);
+    void set(int acc_adrs, int aspect);
+    int get_acc_address() const;
+    int get_aspect() const;
+    virtual PktType get_type() const override
+    {
+        return Accessory;
+    }
+
+    static constexpr int aspect_min = 0;
+    static constexpr int aspect_max = 255;
+};
+
 // Std 9.2.3, Section E, Service Mode Instruction Packets for Direct Mode
 class DccPktSvcWriteCv : public DccPkt
 {
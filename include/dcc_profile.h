@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+
+class DccAdc;
+
+// Track current profiling in ops mode.
+//
+// The bit interrupt (DccBitstream) calls mark() when a packet starts and when
+// a cutout starts and ends. A mark is just the ADC sample index at that time
+// plus the loco address, put in a small ring; nothing else is done in
+// interrupt context.
+//
+// loop(), called from the main loop, walks the ADC samples since the last
+// call along with the marks, and adds each sample to the statistics for the
+// loco whose packet was on the track at the time, separately for samples in
+// the packet (and preamble) and in the cutout. With more than one loco on the
+// track the current is the sum of all of them, so the numbers are most useful
+// with one loco, or for seeing the difference when one changes.
+//
+// Marks are made when the next bit is programmed, so they are early by about
+// one bit time (58 to 100 usec, about one sample at 10 KHz).
+
+class DccProfile
+{
+
+public:
+
+    DccProfile(DccAdc &adc);
+    ~DccProfile();
+
+    void enable(bool en);
+    bool enabled() const { return _enabled; }
+
+    enum class MarkType : uint8_t {
+        PACKET,       // packet for address is starting
+        CUTOUT_START, // cutout after address's packet is starting
+        CUTOUT_END,   // cutout ended, preamble is starting
+    };
+
+    void mark(MarkType type, int address) // called in interrupt context
+    {
+        if (_enabled)
+            mark_add(type, address);
+    }
+
+    void loop();
+
+    void reset();
+
+    struct Stats {
+        int address;
+        uint32_t pkt_cnt;     // samples during packets
+        uint64_t pkt_sum_ma;
+        uint16_t pkt_max_ma;
+        uint32_t cut_cnt;     // samples during cutouts
+        uint64_t cut_sum_ma;
+        uint16_t cut_max_ma;
+    };
+
+    static constexpr int stats_max = 16;
+
+    // get stats for the n'th address seen; false if there are not that many
+    bool stats(int n, Stats &s) const;
+
+    // samples for addresses not in the table (table full), or lost because
+    // loop() was not called often enough
+    uint32_t drop_cnt() const { return _drop_cnt; }
+
+    void show() const;
+
+private:
+
+    DccAdc &_adc;
+
+    volatile bool _enabled;
+
+    struct Mark {
+        uint32_t idx; // adc sample index
+        int16_t address;
+        MarkType type;
+    };
+
+    // Marks, written in interrupt context and read by loop(). At 10 KHz
+    // sampling and the shortest packets, there are a couple of marks per
+    // msec, so this is good for a few tens of msec between loop() calls.
+    static constexpr int mark_max = 64;
+    Mark _marks[mark_max];
+    volatile uint32_t _mark_put; // only written in interrupt context
+    volatile uint32_t _mark_get; // only written by loop()
+
+    void mark_add(MarkType type, int address); // called in interrupt context
+
+    // loop() state
+    uint32_t _idx; // next adc sample
+    int _address;  // -1 if unknown
+    bool _cutout;
+
+    Stats _stats[stats_max];
+    int _stats_cnt;
+
+    uint32_t _drop_cnt;
+
+    Stats *find(int address);
+
+}; // class DccProfile
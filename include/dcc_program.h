@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstdint>
+
+class DccCommand;
+class DccCvCache;
+class DccCvIndex;
+class DccThrottle;
+
+// Delta programming: set a decoder's CVs to a list of target values, only
+// writing the ones that are not already right.
+//
+// For each CV, the current value is looked up in the cache (if there is one)
+// or read: in service mode with a fast read guessing the target value, which
+// is a single byte-verify when it is already right; in ops mode with a
+// railcom read. Only CVs that are different (or could not be read) are
+// written. Writes are verified: in service mode by the ack, in ops mode by
+// the railcom reply.
+//
+// Items are done in order of index (CV31/CV32) then CV number. Indexed CVs
+// use the indexed CV access of DccCommand or DccThrottle, which only writes
+// CV31 and CV32 when they change, so each page is selected once.
+//
+// Progress: a callback is called as each item is finished. done_cnt() is the
+// number of items finished in the sorted order, so a caller that saves it can
+// resume after a power loss by starting again with the same items and first
+// set to it. With a persistent cache, starting again from the beginning also
+// works, since everything written so far is in the cache.
+//
+// loop() must be called from the main loop (not interrupt context). Track
+// power should be off (or in a service mode session) for service mode, and
+// on for ops mode. Don't start other CV operations while this is running.
+
+class DccProgram
+{
+
+public:
+
+    DccProgram(DccCommand &command, DccCvCache *cache = nullptr);
+    ~DccProgram();
+
+    struct Item {
+        int cv_num;
+        int index; // DccCv::index(CV31, CV32) for cvs 257-512, else -1
+        uint8_t cv_val;
+    };
+
+    static constexpr int item_max = 128;
+
+    // Decoder in the cache (address and CV8); -1 to not use the cache.
+    void cache_key(int address, int mfg)
+    {
+        _cache_address = address;
+        _cache_mfg = mfg;
+    }
+
+    // Start in service mode, or in ops mode on the throttle's loco. Items
+    // are copied (and sorted). With verify false, CVs not in the cache are
+    // written without reading them first. Returns false if something is
+    // running, the items are not valid (CV8, CV31, and CV32 are not allowed;
+    // only 257-512 can be indexed), or the track is in the wrong mode.
+    bool start_svc(const Item *items, int item_cnt, int first = 0,
+                   bool verify = true);
+    bool start_ops(DccThrottle *throttle, const Item *items, int item_cnt,
+                   int first = 0, bool verify = true);
+
+    // stop after the current cv operation
+    void stop();
+
+    void loop();
+
+    bool busy() const { return _step != Step::IDLE && _step != Step::DONE; }
+
+    enum class Status : uint8_t {
+        PENDING,
+        EARLIER, // before first when started
+        SKIPPED, // already had the value
+        WRITTEN,
+        FAILED,
+    };
+
+    static const char *status_name(Status status);
+
+    int item_cnt() const { return _item_cnt; }
+    bool item(int n, Item &item, Status &status) const;
+
+    // items finished, in sorted order (resume point)
+    int done_cnt() const { return _item; }
+
+    // progress function type; n is the item just finished
+    typedef void progress_t(const DccProgram &prog, int n, void *arg);
+
+    void on_progress(progress_t *progress, void *arg = nullptr)
+    {
+        _progress = progress;
+        _progress_arg = arg;
+    }
+
+    // counts for the last (or current) run
+    int written_cnt() const { return _written_cnt; }
+    int skip_cnt() const { return _skip_cnt; }
+    int fail_cnt() const { return _fail_cnt; }
+    int read_cnt() const { return _read_cnt; }
+    int write_cnt() const { return _write_cnt; }
+    int index_write_cnt() const;
+    int svc_pkt_cnt() const { return _svc_pkt_cnt; }
+    uint32_t elapsed_ms() const;
+
+    // writes that writing every item would take (index cvs before each
+    // indexed cv)
+    int naive_write_cnt() const;
+
+    void show() const;
+
+private:
+
+    DccCommand &_command;
+    DccCvCache *_cache;
+    int _cache_address;
+    int _cache_mfg;
+
+    DccThrottle *_throttle; // nullptr for service mode
+    bool _verify;
+
+    Item _items[item_max];
+    Status _status[item_max];
+    int _item_cnt;
+    int _item; // current
+
+    enum class Step {
+        IDLE,
+        READ,
+        WRITE,
+        DONE,
+    };
+    Step _step;
+    bool _stop; // stop after the current operation
+
+    static constexpr int retry_max = 2;
+    int _retry;
+
+    progress_t *_progress;
+    void *_progress_arg;
+
+    int _written_cnt;
+    int _skip_cnt;
+    int _fail_cnt;
+    int _read_cnt;
+    int _write_cnt;
+    uint32_t _index_write_base; // cv_index().write_cnt() at start
+    int _svc_pkt_cnt;
+    uint32_t _start_us;
+    uint32_t _done_us;
+
+    bool start(const Item *items, int item_cnt, int first);
+    void item_start();
+    void item_done(Status status);
+
+    void op_read(const Item &it);
+    void op_write(const Item &it);
+    bool op_done(bool &result, uint8_t &val);
+    const DccCvIndex &cv_index() const;
+
+}; // class DccProgram
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+
+class DccAdc;
+class DccBitstream;
+
+// Overcurrent protection for ops mode.
+//
+// check() is called from the bit interrupt (via DccCommand::loop()). It looks
+// at every new ADC sample, and if the track current is at or above the trip
+// threshold for the trip time, it cuts track power right away (not at the
+// end of the bit) by taking the power gpio away from the PWM.
+//
+// After a trip, power is turned back on after a backoff time. The backoff
+// starts at retry_min_ms, doubles with each trip up to retry_max_ms, and goes
+// back to retry_min_ms once power has stayed on for good_ms.
+//
+// The last event_max trips are kept, each with the current just before the
+// trip and the trip latency: how long from the sample that met the trip
+// condition to power being cut. Note the total response time to a short is
+// the trip time plus the latency.
+
+class DccProtect
+{
+
+public:
+
+    DccProtect(DccAdc &adc, DccBitstream &bitstream);
+    ~DccProtect();
+
+    void config(uint16_t trip_ma, uint32_t trip_us);
+    uint16_t trip_ma() const { return _trip_ma; }
+    uint32_t trip_us() const;
+
+    void enable(bool en) { _enabled = en; }
+    bool enabled() const { return _enabled; }
+
+    // called when track power is turned on or off in ops mode
+    void start();
+    void stop();
+
+    void check(); // called in interrupt context
+
+    bool tripped() const { return _tripped; }
+    uint32_t trip_cnt() const { return _trip_cnt; }
+
+    static constexpr int trace_len = 32; // samples before each trip
+
+    struct TripEvent {
+        uint32_t time_us;    // when power was cut
+        uint32_t latency_us; // trip condition met to power cut
+        uint32_t retry_ms;   // backoff before power is turned back on
+        uint16_t peak_ma;
+        uint16_t trace_ma[trace_len]; // oldest first
+    };
+
+    // Get trip event n (0 is the most recent). Returns false if there are
+    // not that many.
+    bool event(int n, TripEvent &ev) const;
+
+    void show() const;
+
+    static constexpr uint16_t trip_ma_default = 2000;
+    static constexpr uint32_t trip_us_default = 1000;
+
+    static constexpr uint32_t retry_min_ms = 250;
+    static constexpr uint32_t retry_max_ms = 8000;
+    static constexpr uint32_t good_ms = 5000;
+
+private:
+
+    DccAdc &_adc;
+    DccBitstream &_bitstream;
+
+    bool _enabled;
+
+    uint16_t _trip_ma;
+    int _trip_samples; // consecutive samples >= _trip_ma to trip
+
+    bool _running;
+    bool _tripped;
+    uint32_t _retry_us;   // when tripped, when to turn power back on
+    uint32_t _retry_ms;   // next backoff
+    uint32_t _power_us;   // when power was last turned on
+
+    uint32_t _idx;        // next adc sample to look at
+    int _over_cnt;        // consecutive samples at or over _trip_ma
+    uint16_t _peak_ma;    // largest of those
+
+    uint32_t _trip_cnt;
+
+    static constexpr int event_max = 4;
+    TripEvent _events[event_max];
+    int _event_idx; // where the next one goes
+    int _event_cnt;
+
+    void trip(uint32_t now_us); // called in interrupt context
+
+}; // class DccProtect
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+
+class DccThrottle;
+
+// Momentum in the command station.
+//
+// Each throttle added here has a target speed, and every tick its speed is
+// moved toward the target at its acceleration rate (speeding up) or
+// deceleration rate (slowing down, including down to zero before reversing).
+// Since the command station does the ramping, locos with different decoders
+// (or decoder CV3/CV4 set to 0) ramp the same way, e.g. in a consist.
+//
+// Rates are given like decoder CV3/CV4 (S-9.2.2): stop to full speed takes
+// cv * 0.896 seconds; 0 means no momentum. Speed is kept in 16.16 fixed
+// point, and the throttle's speed is only set when the 128-step value
+// changes, so a loco that is ramping slowly only gets a new speed packet when
+// there is a new speed to send. Speed 1 (e-stop in 128-step mode) is never
+// sent; a ramp goes between 0 and 2.
+//
+// loop() must be called from the main loop (not interrupt context); it runs
+// however many ticks are due. A throttle that was e-stopped
+// (DccThrottle::estop()) is left at speed 0 with target 0. Remove a throttle
+// before deleting it.
+
+class DccRamp
+{
+
+public:
+
+    DccRamp(uint32_t tick_us = tick_us_default);
+    ~DccRamp();
+
+    static constexpr uint32_t tick_us_default = 10000;
+    static constexpr int ramp_max = 256;
+
+    // Add a throttle, starting at its current speed. Returns false if there
+    // is no room. Adding one already here just changes its rates.
+    bool add(DccThrottle *throttle, int accel_cv, int decel_cv);
+
+    void remove(DccThrottle *throttle);
+
+    bool has(const DccThrottle *throttle) const;
+
+    // Set the speed to ramp to (DccPkt::speed_min...speed_max). Returns
+    // false if the throttle is not here.
+    bool set_target(DccThrottle *throttle, int speed);
+    int get_target(const DccThrottle *throttle) const;
+
+    // Stop now, with no ramp (e.g. emergency).
+    bool stop(DccThrottle *throttle);
+    void stop_all();
+
+    void loop();
+
+    // one tick, for a caller that has its own schedule
+    void tick();
+
+    int cnt() const { return _ramp_cnt; }
+    int active_cnt() const;
+
+    // rate, in 16.16 speed steps per tick, for a CV3/CV4-style value
+    int32_t cv_to_rate(int cv) const;
+
+    // counts since the last reset_stats()
+    uint32_t tick_cnt() const { return _tick_cnt; }
+    uint32_t set_cnt() const { return _set_cnt; }
+    uint32_t tick_max_us() const { return _tick_max_us; }
+    void reset_stats();
+
+    void show() const;
+
+private:
+
+    static constexpr int32_t one = 1 << 16;
+
+    uint32_t _tick_us;
+    uint32_t _tick_next_us;
+    bool _ticking;
+
+    struct Ramp {
+        DccThrottle *throttle;
+        int32_t speed;  // 16.16
+        int32_t target; // 16.16
+        int32_t accel;  // 16.16 per tick; 0 for no momentum
+        int32_t decel;
+        int accel_cv;
+        int decel_cv;
+        int speed_set; // last speed set in throttle
+        uint32_t estop_cnt; // throttle's, as of the last tick
+    };
+
+    Ramp _ramps[ramp_max];
+    int _ramp_cnt;
+
+    uint32_t _tick_cnt;
+    uint32_t _set_cnt;
+    uint32_t _tick_max_us;
+
+    Ramp *find(const DccThrottle *throttle);
+    const Ramp *find(const DccThrottle *throttle) const;
+
+}; // class DccRamp
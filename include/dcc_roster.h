@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+
+#include "dcc_pkt.h"
+
+// Loco state for a large roster, where most locos are parked.
+//
+// A loco is a slot number. Its state is spread over one array per field
+// (address, speed, f0...f31 as a bitmask, dirty packets, place in its refresh
+// sequence, and when it was last sent), so a slot takes 11 bytes, plus a bit
+// in each of three bitmaps. There are no packets per slot; one is built when
+// the slot is scheduled.
+//
+// next_packet() picks:
+//   1. a changed packet, round robin over slots with any change waiting
+//   2. otherwise the next refresh packet of a moving loco (speed not 0),
+//      round robin, except every parked_every'th refresh goes to
+//   3. the next parked loco, round robin, if it was last sent at least
+//      parked_ms ago
+// A slot's refresh sequence is speed, group 0, speed, group 1, ..., the same
+// as DccThrottle's. With a big roster the parked locos just get their turn
+// when they get it; e.g. 1000 parked locos at one packet in four means each
+// one's turn comes every 20 seconds or so.
+//
+// Set state from the main loop; those calls disable interrupts briefly, since
+// next_packet() is called in interrupt context. There is no railcom or CV
+// access here; that still needs a DccThrottle.
+
+class DccRoster
+{
+
+public:
+
+    DccRoster();
+    ~DccRoster();
+
+    static constexpr int slot_max = 1024;
+
+    // functions in the bitmask
+    static constexpr int func_max =
+        (DCC_FUNC_MAX < 31) ? DCC_FUNC_MAX : 31;
+
+    // Add a loco (stopped, functions off) and return its slot, or -1 if
+    // there's no room. Adding one already here returns its slot.
+    int add(int address);
+    bool remove(int slot);
+
+    // slot for an address, or -1
+    int find(int address) const;
+
+    int cnt() const { return _cnt; }
+    int moving_cnt() const;
+
+    int get_address(int slot) const;
+
+    bool set_speed(int slot, int speed);
+    int get_speed(int slot) const;
+
+    bool set_function(int slot, int func, bool on);
+    bool get_function(int slot, int func) const;
+
+    // Set every loco to speed 0, sending those speeds first (as changes).
+    // Callable from any context; the time taken goes with the number of
+    // moving locos, since parked ones are already at 0.
+    void estop();
+
+    // Minimum time between refreshes of a parked loco, and how often (every
+    // n'th refresh packet) a parked loco gets a turn.
+    void parked_ms(uint16_t ms) { _parked_ms = ms; }
+    void parked_every(int n) { _parked_every = (n < 1) ? 1 : n; }
+
+    // Get the next packet to send; false if there is nothing to send now.
+    bool next_packet(DccPkt &pkt);
+
+    // packets sent since the last reset_stats()
+    uint32_t dirty_pkt_cnt() const { return _dirty_pkt_cnt; }
+    uint32_t moving_pkt_cnt() const { return _moving_pkt_cnt; }
+    uint32_t parked_pkt_cnt() const { return _parked_pkt_cnt; }
+    void reset_stats();
+
+    void show() const;
+
+private:
+
+    static constexpr int map_words = slot_max / 32;
+    static constexpr int group_cnt = DccPktFuncGroup::group_cnt(func_max);
+    static constexpr int seq_max = 2 * group_cnt;
+
+    // per slot
+    uint16_t _address[slot_max]; // 0 if slot is free
+    int8_t _speed[slot_max];
+    uint32_t _funcs[slot_max];   // bit n is fn
+    uint8_t _dirty[slot_max];    // bit 0 speed, bit 1+g function group g
+    uint8_t _seq[slot_max];      // next in refresh sequence (0...seq_max-1)
+    uint16_t _sent_ms[slot_max]; // when last sent (ms, wraps)
+
+    // bit for each slot
+    uint32_t _moving_map[map_words];
+    uint32_t _parked_map[map_words];
+    uint32_t _dirty_map[map_words];
+
+    int _cnt;
+
+    // round robin
+    int _dirty_next;
+    int _moving_next;
+    int _parked_next;
+    int _refresh_cnt;
+
+    uint16_t _parked_ms;
+    int _parked_every;
+
+    // where packets are built
+    DccPktSpeed128 _pkt_speed;
+    DccPktFuncGroup _pkt_func;
+
+    uint32_t _dirty_pkt_cnt;
+    uint32_t _moving_pkt_cnt;
+    uint32_t _parked_pkt_cnt;
+
+    bool slot_ok(int slot) const;
+    void mark(int slot, int dirty_bit);
+    void build(DccPkt &pkt, int slot, int seq);
+
+    static void map_set(uint32_t *map, int slot, bool on);
+    static int map_next(const uint32_t *map, int from);
+
+}; // class DccRoster
@@ -38,4 +38,9 @@ constexpr int svc_command_cnt = 5;
 // Reset packets sent after a service mode request
 constexpr int svc_reset2_cnt = 5;
 
+// Reset packets sent before a service mode request when the track is already
+// powered (service mode session). S 9.2.3 asks for at least 3; a couple more
+// let the ADC's long average settle after a previous op's ack pulse.
+constexpr int svc_resume_reset_cnt = 5;
+
 }; // namespace DccSpec
@@ -2,7 +2,9 @@
 
 #include <cstdint>
 
+#include "dcc_cv_index.h"
 #include "dcc_pkt.h"
+#include "railcom_stats.h"
 
 class RailComMsg;
 
@@ -11,27 +13,102 @@ class DccThrottle
 
 public:
 
-    DccThrottle(int address = DccPkt::address_default);
+    // Functions f0...func_max are refreshed, so each throttle's packet
+    // sequence is as long as its loco needs. Function storage is the same
+    // for all (DCC_FUNC_MAX).
+    DccThrottle(int address = DccPkt::address_default,
+                int func_max = DCC_FUNC_MAX);
     ~DccThrottle();
 
+    int func_max() const { return _func_max; }
+
     int get_address() const;
     void set_address(int address);
 
     int get_speed() const;
     void set_speed(int speed);
 
+    // Emergency stop this loco: speed 0 from its next packet on. Callable in
+    // interrupt context; it only counts, and next_packet() does the change,
+    // so it can't collide with a set_speed() in progress. A set_speed()
+    // after it wins.
+    void estop() { _estop_cnt = _estop_cnt + 1; } // called in any context
+    uint32_t estop_cnt() const { return _estop_cnt; }
+
+    // Functions above func_max() can be set, but are not sent.
     bool get_function(int func) const;
     void set_function(int func, bool on);
 
+    // Binary State Control (S-9.2.1 2.3.6.3/4), for functions past the
+    // ones refreshed here (up to DccPktBinState::num_max). A change is sent
+    // binstate_send_cnt times in a row, then not again (there's no refresh).
+    // Changes wait in order, up to binstate_max; a second change to a state
+    // still waiting replaces the first. Returns false if the state number is
+    // bad or there is no room.
+    bool set_binstate(int num, bool on);
+    int binstate_pending() const { return _bs_cnt; }
+
+    static constexpr int binstate_max = 8;
+
     void read_cv(int cv_num);
 
     void write_cv(int cv_num, uint8_t cv_val);
     void write_bit(int cv_num, int bit_num, int bit_val);
 
+    // Indexed CV (257-512) write and read; index is DccCv::index(CV31,
+    // CV32). CV31 and CV32 are written first unless the decoder is known to
+    // have them already (from earlier railcom-confirmed writes); ops_done()
+    // returns true when all of that is done.
+    void write_cv_indexed(int index, int cv_num, uint8_t cv_val);
+    void read_cv_indexed(int index, int cv_num);
+
+    const DccCvIndex &cv_index() const { return _index; }
+
     bool ops_done(bool &result, uint8_t &value);
 
+    // true if a read_cv(), write_cv(), write_bit(), or read_cvs() is in
+    // progress
+    bool ops_busy() const
+    {
+        return _read_cv_cnt > 0 || _write_cv_cnt > 0 || _write_bit_cnt > 0 ||
+               _cvs_val != nullptr;
+    }
+
+    // Read cv_cnt CVs starting at cv_num, four at a time using XPOM. Values
+    // are stored in cv_val[0...cv_cnt-1] as replies arrive, so cv_val must
+    // stay valid until read_cvs_done() returns true. Quads that get no reply
+    // are retried, up to read_cvs_round_max passes in all.
+    void read_cvs(int cv_num, int cv_cnt, uint8_t *cv_val);
+
+    // Returns true when the read_cvs() is done; cv_ok_cnt is set to the
+    // number of CVs read, and cv_ok (if not null) gets a bit for each quad
+    // read (bit 0 is cv_val[0...3]).
+    bool read_cvs_done(int &cv_ok_cnt, uint64_t *cv_ok = nullptr) const;
+
+    static constexpr int read_cvs_max = 256;
+
+    // Called in interrupt context. Changes made from the main loop are seen
+    // whole: if this interrupted one, the last packet is sent again instead.
+    // That depends on the main loop not running while this does, so make
+    // changes on the core that takes the DCC bit interrupt; nothing here
+    // makes changes from the other core safe.
     DccPkt next_packet();
 
+    // packets sent again because of a change in progress
+    uint32_t held_cnt() const { return _held_cnt; }
+
+    // Consist support (see DccCommand::consist_create()). With speed
+    // refresh off, next_packet() skips the speed packets, since the speed
+    // goes out some other way. speed_packet() is for sending it out of turn.
+    void speed_refresh(bool en) { _speed_refresh = en; }
+    bool speed_refresh() const { return _speed_refresh; }
+    DccPkt speed_packet();
+    bool last_was_speed() const { return _pkt_last == &_pkt_speed; }
+
+    // station consist: member whose speed packet follows this one's
+    DccThrottle *consist_next() const { return _consist_next; }
+    void consist_next(DccThrottle *next) { _consist_next = next; }
+
     void railcom(const RailComMsg *msg, int msg_cnt);
 
     // reset packet sequence to start (typically for debug purposes)
@@ -44,60 +121,78 @@ public:
 
     uint8_t get_rc_speed() const { return _rc_speed; }
 
+    // railcom reception statistics for this loco
+    RailComStats &rc_stats() { return _rc_stats; }
+    const RailComStats &rc_stats() const { return _rc_stats; }
+
 private:
 
     DccPktSpeed128 _pkt_speed; // sent if seq even (0, 2, ... 16, 18)
-    DccPktFunc0 _pkt_func_0;   // seq == 1
-    DccPktFunc5 _pkt_func_5;   // seq == 3
-    DccPktFunc9 _pkt_func_9;   // seq == 5
-    DccPktFunc13 _pkt_func_13; // seq == 7
-#if (DCC_FUNC_MAX >= 21)
-    DccPktFunc21 _pkt_func_21; // seq == 9
-#endif
-#if (DCC_FUNC_MAX >= 29)
-    DccPktFunc29 _pkt_func_29; // seq == 11
-#endif
-#if (DCC_FUNC_MAX >= 37)
-    DccPktFunc37 _pkt_func_37; // seq == 13
-#endif
-#if (DCC_FUNC_MAX >= 45)
-    DccPktFunc45 _pkt_func_45; // seq == 15
-#endif
-#if (DCC_FUNC_MAX >= 53)
-    DccPktFunc53 _pkt_func_53; // seq == 17
-#endif
-#if (DCC_FUNC_MAX >= 61)
-    DccPktFunc61 _pkt_func_61; // seq == 19
-#endif
+    DccPktFuncGroup _pkt_func; // group seq/2 if seq odd
+
+    // function states, bit n is fn
+    static const int func_words = (DCC_FUNC_MAX + 32) / 32;
+    uint32_t _funcs[func_words];
+    uint32_t func_bits(int g) const;
+    int _func_max;
 
     // where in packet sequence we are
+    int _seq_max; // 2 * number of function groups
+    int _seq; // _seq = 0 ... _seq_max-1
 
-#if (DCC_FUNC_MAX >= 61)
-    static const int seq_max = 20;
-#elif (DCC_FUNC_MAX >= 53)
-    static const int seq_max = 18;
-#elif (DCC_FUNC_MAX >= 45)
-    static const int seq_max = 16;
-#elif (DCC_FUNC_MAX >= 37)
-    static const int seq_max = 14;
-#elif (DCC_FUNC_MAX >= 29)
-    static const int seq_max = 12;
-#elif (DCC_FUNC_MAX >= 21)
-    static const int seq_max = 10;
-#else
-    static const int seq_max = 8;
-#endif
-
-    int _seq; // _seq = 0 ... seq_max-1
+    bool _speed_refresh;
+    DccThrottle *_consist_next;
 
     // last packet returned by next_packet, saved so we can match received
     // railcom data with the packet it came after
     DccPkt *_pkt_last;
 
+    // Main loop changes vs. next_packet(). Anything that changes packet bytes
+    // (or the counts of how many times to send them) is between
+    // update_begin() and update_end(); _upd_seq is odd during one, and
+    // next_packet() sends _pkt_hold again instead of looking at half-changed
+    // state. When it is even, no change can start until next_packet()
+    // returns (same core), so the state next_packet() changes is never thrown
+    // away.
+    volatile uint32_t _upd_seq;
+    DccPkt _pkt_hold; // last packet next_packet() returned
+    uint32_t _held_cnt;
+    void update_begin();
+    void update_end();
+    DccPkt packet_next();
+
+    volatile uint32_t _estop_cnt;
+    uint32_t _estop_done; // _estop_cnt as of the last estop applied
+    void estop_apply();
+
     DccPktOpsReadCv _pkt_read_cv;
     static const int read_cv_send_cnt = 5; // how many times to send it
     int _read_cv_cnt; // times left to send it (5, 4, ... 1, 0)
 
+    // ranged read using XPOM
+    DccPktOpsRead4Cv _pkt_read_cv4;
+    static const int read_cvs_round_max = 5; // passes over missing quads
+    uint8_t *_cvs_val;   // where to put values; nullptr when not reading
+    int _cvs_num;        // first cv
+    int _cvs_cnt;        // number of cvs
+    uint64_t _cvs_need;  // bit for each quad not yet read
+    int _cvs_quad;       // next quad to consider sending
+    int _cvs_round;      // pass over the missing quads (0...)
+    int _cvs_sent[DccPktOpsRead4Cv::seq_max]; // quad last sent with each seq
+    bool _cvs_done;
+    int cvs_next_quad();
+
+    // binary state changes waiting to go out; _bs[0] is the one being sent
+    DccPktBinState _pkt_binstate;
+    static const int binstate_send_cnt = 3; // how many times to send each
+    struct BinState {
+        int num;
+        bool on;
+    };
+    BinState _bs[binstate_max];
+    int _bs_cnt;
+    int _bs_left; // times left to send _bs[0] (3, 2, 1), or 0 if not loaded
+
     // There is no ops "read bit" command
 
     DccPktOpsWriteCv _pkt_write_cv;
@@ -112,9 +207,26 @@ private:
     bool _ops_cv_status;
     uint8_t _ops_cv_val;
 
+    // indexed cv operation in progress
+    enum class IndexOp {
+        NONE,
+        WRITE_CV,
+        READ_CV,
+    };
+    DccCvIndex _index;
+    IndexOp _idx_op;
+    int _idx_cv;          // index cv being written, or 0 if doing the op
+    uint8_t _idx_val;     // value being written to it
+    int _idx_cv_num;      // the op
+    uint8_t _idx_cv_val;
+    void index_step();
+    bool index_next();
+
     // speed reported in railcom data, if any
     uint8_t _rc_speed;
     uint64_t _rc_speed_us;
     bool _show_rc_speed;
 
+    RailComStats _rc_stats;
+
 }; // class DccThrottle
@@ -32,11 +32,18 @@ public:
 
     char *show(char *buf, int buf_len) const; // pretty
 
-    int get_ch2_msgs(const RailComMsg *&msgs) {
+    int get_ch2_msgs(const RailComMsg *&msgs) const {
         msgs = _ch2_msg;
         return _ch2_msg_cnt;
     }
 
+    // what the last read() and parse() saw, for statistics
+    int pkt_len() const { return _pkt_len; }
+    int inv_cnt() const { return _inv_cnt; }
+    bool parsed_all() const { return _parsed_all; }
+
+    static constexpr int pkt_max = RailComSpec::ch1_bytes + RailComSpec::ch2_bytes;
+
 private:
 
     uart_inst_t *_uart;
@@ -45,10 +52,10 @@ private:
 
     ///// Raw RailCom Data (4/8 encoded, and decoded bytes)
 
-    static constexpr int pkt_max = RailComSpec::ch1_bytes + RailComSpec::ch2_bytes;
     uint8_t _enc[pkt_max]; // encoded (4/8 code)
     uint8_t _dec[pkt_max]; // decoded (6 bits per byte) from decode[]
     int _pkt_len;          // _enc[] and _dec[] are the same length
+    int _inv_cnt;          // bytes in _dec[] that are dec_inv
 
     ///// Parsed RailCom Messages
 
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+
+class RailCom;
+
+// RailCom reception statistics for one locomotive.
+//
+// DccBitstream calls update() once for each cutout that follows a packet sent
+// to the loco, after RailCom::read() and RailCom::parse(). Updating is a
+// handful of increments and shifts; nothing is allocated, and the cost does
+// not depend on how long the statistics have been running.
+//
+// Counts are totals since the last reset(). Rates are exponentially decaying
+// averages of "fraction of cutouts where this happened", so they follow the
+// loco's current condition (e.g. a dirty section of track) rather than its
+// whole history. Each rate is 16-bit fixed point (rate_one is 100%), and
+// decays with a time constant of about (1 << rate_shift) cutouts.
+
+class RailComStats
+{
+
+public:
+
+    RailComStats()
+    {
+        reset();
+    }
+
+    void reset();
+
+    void update(const RailCom &railcom); // called in interrupt context
+
+    // counts
+    uint32_t cutout_cnt() const { return _cutout_cnt; }
+    uint32_t reply_cnt() const { return _reply_cnt; }
+    uint32_t inv_cnt() const { return _inv_cnt; }
+    uint32_t short_cnt() const { return _short_cnt; }
+    uint32_t partial_cnt() const { return _partial_cnt; }
+    uint32_t pom_cnt() const { return _pom_cnt; }
+    uint32_t dyn_cnt() const { return _dyn_cnt; }
+
+    // decaying rates in percent (0...100)
+    int reply_pct() const { return rate_to_pct(_reply_rate); }
+    int inv_pct() const { return rate_to_pct(_inv_rate); }
+    int short_pct() const { return rate_to_pct(_short_rate); }
+    int partial_pct() const { return rate_to_pct(_partial_rate); }
+    int good_pct() const { return rate_to_pct(_good_rate); }
+
+    // one line of counts and rates; see show_hdr() for the column titles
+    char *show(char *buf, int buf_len) const;
+    static const char *show_hdr();
+
+private:
+
+    uint32_t _cutout_cnt;  // cutouts following a packet to this loco
+    uint32_t _reply_cnt;   // ...where at least one byte was received
+    uint32_t _inv_cnt;     // bytes received that were not valid 4/8 codes
+    uint32_t _short_cnt;   // ...where some, but not all, bytes were received
+    uint32_t _partial_cnt; // ...where something was left over after parsing
+    uint32_t _pom_cnt;     // POM messages received
+    uint32_t _dyn_cnt;     // DYN messages received
+
+    static constexpr int rate_shift = 5; // ~32 cutouts
+    static constexpr uint32_t rate_one = 1 << 16;
+
+    uint32_t _reply_rate;   // any byte received
+    uint32_t _inv_rate;     // any invalid 4/8 code received
+    uint32_t _short_rate;   // short read
+    uint32_t _partial_rate; // partial parse
+    uint32_t _good_rate;    // a POM or DYN message received
+
+    static void rate_update(uint32_t &rate, bool event)
+    {
+        rate -= rate >> rate_shift;
+        if (event)
+            rate += rate_one >> rate_shift;
+    }
+
+    static int rate_to_pct(uint32_t rate)
+    {
+        return (rate * 100 + rate_one / 2) / rate_one;
+    }
+
+}; // class RailComStats
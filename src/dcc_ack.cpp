@@ -0,0 +1,226 @@
+#include "dcc_ack.h"
+
+#include <cstdint>
+#include <cstdio>
+
+#include "dcc_adc.h"
+#include "hardware/timer.h"
+
+
+DccAck::DccAck(DccAdc &adc) :
+    _adc(adc),
+    _pulse({0, 0, 0}),
+    _arm_cnt(0),
+    _ack_cnt(0),
+    _reject_cnt(0)
+{
+}
+
+
+char *DccAck::show(char *buf, int buf_len) const
+{
+    snprintf(buf, buf_len,
+             "%s: armed=%lu acks=%lu rejects=%lu last: %u ma %lu us",
+             name(), _arm_cnt, _ack_cnt, _reject_cnt, uint(_pulse.amp_ma),
+             _pulse.len_us);
+    return buf;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Threshold detector
+/////////////////////////////////////////////////////////////////////////////
+
+
+DccAckThreshold::DccAckThreshold(DccAdc &adc) :
+    DccAck(adc),
+    _ack_ma(ack_ma_inv),
+    _base_ma(0)
+{
+}
+
+
+void DccAckThreshold::reset()
+{
+    _ack_ma = ack_ma_inv;
+}
+
+
+// The long average adc reading is the baseline for detecting an ack pulse.
+void DccAckThreshold::arm()
+{
+    _base_ma = _adc.long_avg_ma();
+    _ack_ma = _base_ma + ack_inc_ma;
+    _arm_cnt++;
+}
+
+
+bool DccAckThreshold::check() // called in interrupt context
+{
+    if (_ack_ma == ack_ma_inv)
+        return false;
+
+    uint16_t track_ma = _adc.short_avg_ma();
+    if (track_ma < _ack_ma)
+        return false;
+
+    // ack!
+    _ack_ma = ack_ma_inv;
+    _pulse.start_us = time_us_32();
+    _pulse.len_us = 0; // don't know
+    _pulse.amp_ma = track_ma - _base_ma;
+    _ack_cnt++;
+    return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Matched filter detector
+/////////////////////////////////////////////////////////////////////////////
+
+
+DccAckMatched::DccAckMatched(DccAdc &adc) :
+    DccAck(adc),
+    _state(State::IDLE),
+    _edge_idx(0),
+    _edge_sum(0),
+    _edge_cnt(0),
+    _base(0),
+    _base_ok(false),
+    _pulse_idx(0),
+    _pulse_sum(0),
+    _pulse_cnt(0),
+    _idx(0)
+{
+}
+
+
+// Called when an operation starts or ends. The baseline is forgotten, since
+// the next operation might be on a different decoder.
+void DccAckMatched::reset()
+{
+    _state = State::IDLE;
+    _base_ok = false;
+}
+
+
+// Start looking for a pulse. The baseline carries on from the last arm() if
+// there was one (it's the same decoder); otherwise it starts at the long
+// average. A pulse already in progress is finished normally, since it could
+// be a late ack to the previous packets.
+void DccAckMatched::arm()
+{
+    if (_state == State::IDLE) {
+        _idx = _adc.sample_cnt();
+        _edge_idx = 0;
+        _edge_sum = 0;
+        _edge_cnt = 0;
+        _state = State::BASE;
+    }
+
+    if (!_base_ok) {
+        _base = uint32_t(_adc.long_avg_ma()) << base_shift;
+        _base_ok = true;
+    }
+
+    _arm_cnt++;
+}
+
+
+bool DccAckMatched::check() // called in interrupt context
+{
+    if (_state == State::IDLE)
+        return false;
+
+    uint32_t cnt = _adc.sample_cnt();
+
+    while (_idx != cnt) {
+        uint16_t raw;
+        bool ok = _adc.sample(_idx, raw);
+        _idx++;
+        if (!ok)
+            continue; // fell behind
+        if (sample(DccAdc::raw_to_ma(raw)))
+            return true; // the rest will be looked at next time
+    }
+
+    return false;
+}
+
+
+// Process one sample (sample _idx - 1). Return true if it ends an ack pulse.
+bool DccAckMatched::sample(uint16_t ma) // called in interrupt context
+{
+    // edge filter
+    if (_edge_cnt == edge_len)
+        _edge_sum -= _edge[_edge_idx];
+    else
+        _edge_cnt++;
+    _edge[_edge_idx] = ma;
+    _edge_sum += ma;
+    if (++_edge_idx >= edge_len)
+        _edge_idx = 0;
+
+    if (_edge_cnt < edge_len)
+        return false; // not enough samples yet
+
+    int32_t edge_ma = _edge_sum / edge_len;
+    int32_t base_ma = _base >> base_shift;
+    int32_t above_ma = edge_ma - base_ma;
+    constexpr int32_t edge_ma_min = amp_min_ma / 2;
+
+    uint32_t len_min = len_min_us / DccAdc::sample_us();
+    uint32_t len_max = len_max_us / DccAdc::sample_us();
+
+    if (_state == State::BASE) {
+        if (above_ma >= edge_ma_min) {
+            // rising edge; it started about halfway into the edge window
+            _state = State::PULSE;
+            _pulse_idx = _idx - 1 - edge_len / 2;
+            _pulse_sum = 0;
+            _pulse_cnt = 0;
+        } else {
+            // follow the baseline
+            _base += (uint32_t(edge_ma) << base_shift >> base_tc_shift);
+            _base -= (_base >> base_tc_shift);
+        }
+        return false;
+    }
+
+    // State::PULSE
+
+    _pulse_sum += int32_t(ma) - base_ma;
+    _pulse_cnt++;
+
+    if (above_ma >= edge_ma_min) {
+        if (_pulse_cnt > len_max) {
+            // Too long to be an ack; more likely a motor starting or a
+            // change in idle current. Take the new level as the baseline.
+            _base = uint32_t(edge_ma) << base_shift;
+            _state = State::BASE;
+            _reject_cnt++;
+        }
+        return false;
+    }
+
+    // falling edge; the edge filter delays it by about half its length, same
+    // as the rising edge, so the two cancel in the length
+    _state = State::BASE;
+
+    uint32_t len = _pulse_cnt;
+    int32_t amp_ma = _pulse_sum / int32_t(len);
+
+    if (len < len_min || amp_ma < amp_min_ma) {
+        _reject_cnt++;
+        return false;
+    }
+
+    uint32_t now_us = time_us_32();
+    uint32_t age = _adc.sample_cnt() - _pulse_idx;
+    _pulse.start_us = now_us - age * DccAdc::sample_us();
+    _pulse.len_us = len * DccAdc::sample_us();
+    _pulse.amp_ma = uint16_t(amp_ma);
+    _ack_cnt++;
+
+    return true;
+}
@@ -5,11 +5,21 @@
 #include <cstdio>
 #include <cstring>
 
+#include "dcc_latency.h"
 #include "hardware/adc.h"
+#include "hardware/dma.h"
 
 
 DccAdc::DccAdc(int gpio) :
     _gpio(gpio),
+    _dma_ch(-1),
+    _dma_base(0),
+    _fifo_cnt(0),
+    _loop_cnt(0),
+    _overrun_cnt(0),
+    _avg_idx(0),
+    _short_sum(0),
+    _long_sum(0),
     _err_cnt(0),
     _log_max(0),
     _log_idx(0),
@@ -22,14 +32,35 @@ DccAdc::DccAdc(int gpio) :
     adc_init();
     adc_gpio_init(_gpio);         // e.g. 26
     adc_select_input(_gpio - 26); // e.g. 0; rp2040 GPIO 26 is ADC 0
-    adc_fifo_setup(true, false, 0, true, false); // err_in_fifo true
     adc_set_clkdiv(clock_rate / sample_rate - 1);
+
+    // Use DMA if there is a channel; if not, loop() reads the FIFO.
+    _dma_ch = dma_claim_unused_channel(false);
+    if (_dma_ch >= 0) {
+        dma_channel_config c = dma_channel_get_default_config(_dma_ch);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        channel_config_set_ring(&c, true, ring_bits); // wrap write address
+        channel_config_set_dreq(&c, DREQ_ADC);
+        dma_channel_configure(_dma_ch, &c, _ring, &adc_hw->fifo, dma_cnt,
+                              false);
+        // err_in_fifo true, dreq when at least one sample
+        adc_fifo_setup(true, true, 1, true, false);
+    } else {
+        adc_fifo_setup(true, false, 0, true, false); // err_in_fifo true
+    }
+
+    avg_reset();
 }
 
 
 DccAdc::~DccAdc()
 {
     stop();
+
+    if (_dma_ch >= 0)
+        dma_channel_unclaim(_dma_ch);
 }
 
 
@@ -38,72 +69,162 @@ void DccAdc::start()
     if (_gpio < 0)
         return;
 
+    // Start averaging from zero rather than from whatever was left over from
+    // the last time it was running.
+    adc_fifo_drain();
+    avg_reset();
+
+    _dma_base = 0;
+    _fifo_cnt = 0;
+    _loop_cnt = 0;
+
+    if (_dma_ch >= 0) {
+        dma_channel_set_write_addr(_dma_ch, _ring, false);
+        dma_channel_set_trans_count(_dma_ch, dma_cnt, true);
+    }
+
     adc_run(true);
 }
 
 
+void DccAdc::avg_reset()
+{
+    memset(_avg, 0, sizeof(_avg));
+    _avg_idx = 0;
+    _short_sum = 0;
+    _long_sum = 0;
+}
+
+
 void DccAdc::stop()
 {
     if (_gpio < 0)
         return;
 
     adc_run(false);
+
+    if (_dma_ch >= 0)
+        dma_channel_abort(_dma_ch);
 }
 
 
-// When the ADC FIFO is empty, this function takes about 250 ns; when there is
-// data, about 600 ns (by one particular measurement). Note that at 10 KHz, a
-// new samples is available every 100 usec. With the rp2040 4-sample fifo,
-// that means this must be called at least every 400 usec. Calling it once per
-// DCC bit time should be fine (zeros are 200 usec). Sometimes one call will
-// get two samples, so make sure that works.
+uint32_t DccAdc::sample_cnt() const
+{
+    if (_dma_ch < 0)
+        return _fifo_cnt;
+
+    uint32_t left = dma_channel_hw_addr(_dma_ch)->transfer_count & dma_cnt;
+    return _dma_base + (dma_cnt - left);
+}
+
+
+bool DccAdc::sample(uint32_t idx, uint16_t &raw) const
+{
+    // The oldest sample might be being overwritten by the DMA, so leave a
+    // little margin, then check again after reading to make sure it didn't
+    // get overwritten while we were at it.
+    constexpr uint32_t margin = 4;
+
+    uint32_t age = sample_cnt() - idx; // 1 for the newest
+    if (age == 0 || age > ring_len - margin)
+        return false;
+
+    raw = _ring[idx % ring_len] & 0x0fff;
+
+    age = sample_cnt() - idx;
+    return age <= ring_len - margin;
+}
+
+
+// Without DMA: when the ADC FIFO is empty, this function takes about 250 ns;
+// when there is data, about 600 ns (by one particular measurement). Note that
+// at 10 KHz, a new samples is available every 100 usec. With the rp2040
+// 4-sample fifo, that means this must be called at least every 400 usec.
+// Calling it once per DCC bit time should be fine (zeros are 200 usec).
+// Sometimes one call will get two samples, so make sure that works.
+//
+// With DMA, the FIFO is drained by the DMA and this just picks up whatever
+// new samples are in the ring, which can be any number up to ring_len.
+//
 // Return true if there was at least one sample, false if none.
 bool DccAdc::loop()
 {
     DbgGpio d(_dbg_loop_gpio);
+    DccLatency::Probe l(DccLatency::ADC_LOOP);
 
     if (_gpio < 0)
         return false;
 
-    bool any = false;
-
-    while (!adc_fifo_is_empty()) {
+    if (_dma_ch < 0) {
+        // no dma; move samples from the FIFO to the ring
+        if (adc_hw->fcs & ADC_FCS_OVER_BITS) {
+            // FIFO overflowed; we don't know how many were lost
+            _overrun_cnt++;
+            adc_hw->fcs = ADC_FCS_OVER_BITS; // write 1 to clear
+        }
+        while (!adc_fifo_is_empty())
+            _ring[_fifo_cnt++ % ring_len] = adc_fifo_get();
+    } else if (!dma_channel_is_busy(_dma_ch)) {
+        // transfer count ran out; restart
+        _dma_base += dma_cnt;
+        dma_channel_set_trans_count(_dma_ch, dma_cnt, true);
+    }
 
-        any = true;
+    uint32_t cnt = sample_cnt();
 
-        uint16_t adc_val = adc_fifo_get();
+    if (cnt == _loop_cnt)
+        return false;
 
-        if (adc_val & 0x8000)
-            _err_cnt++;
+    // If we are too far behind, skip the samples that have been (or are about
+    // to be) overwritten.
+    constexpr uint32_t loop_max = ring_len - 8;
+    if ((cnt - _loop_cnt) > loop_max) {
+        _overrun_cnt += (cnt - _loop_cnt) - loop_max;
+        _loop_cnt = cnt - loop_max;
+    }
 
-        adc_val &= 0x0fff;
+    while (_loop_cnt != cnt)
+        sample_add(_ring[_loop_cnt++ % ring_len]);
 
-        if (logging() && _log_idx < _log_max)
-            _log[_log_idx++] = adc_val;
+    return true;
+}
 
-        _avg[_avg_idx] = adc_val;
-        _avg_idx++;
-        if (_avg_idx >= avg_max)
-            _avg_idx = 0;
-    }
 
-    return any;
+void DccAdc::sample_add(uint16_t adc_val)
+{
+    if (adc_val & 0x8000)
+        _err_cnt++;
+
+    adc_val &= 0x0fff;
+
+    if (logging() && _log_idx < _log_max)
+        _log[_log_idx++] = adc_val;
+
+    // The sample leaving the long window is the oldest one, the one about to
+    // be overwritten. The one leaving the short window is short_cnt samples
+    // back from the new one.
+    int short_idx = _avg_idx - short_cnt;
+    if (short_idx < 0)
+        short_idx += avg_max;
+    _short_sum = _short_sum + adc_val - _avg[short_idx];
+    _long_sum = _long_sum + adc_val - _avg[_avg_idx];
+
+    _avg[_avg_idx] = adc_val;
+    _avg_idx++;
+    if (_avg_idx >= avg_max)
+        _avg_idx = 0;
 }
 
 
 uint16_t DccAdc::short_avg_ma() const
 {
-    uint16_t raw = short_avg_raw();
-    uint16_t mv = raw_to_mv(raw);
-    return mv_to_ma(mv);
+    return sum_to_ma(_short_sum, short_mul);
 }
 
 
 uint16_t DccAdc::long_avg_ma() const
 {
-    uint16_t raw = long_avg_raw();
-    uint16_t mv = raw_to_mv(raw);
-    return mv_to_ma(mv);
+    return sum_to_ma(_long_sum, long_mul);
 }
 
 
@@ -140,6 +261,8 @@ void DccAdc::log_show() const
         printf("adc log: %d entries\n", _log_idx);
         printf("\n");
         printf("err_cnt = %d\n", _err_cnt);
+        printf("overrun_cnt = %lu (%s)\n", _overrun_cnt,
+               using_dma() ? "dma" : "fifo");
         printf("\n");
         printf(" idx  raw\n");
         //      ---- ----
@@ -148,17 +271,3 @@ void DccAdc::log_show() const
     }
 }
 
-
-uint16_t DccAdc::avg_raw(int cnt) const
-{
-    // XXX lock _avg[]
-    uint32_t sum = 0;
-    int i = _avg_idx;
-    for (int j = 0; j < cnt; j++) {
-        i--;
-        if (i < 0)
-            i = avg_max - 1;
-        sum += _avg[i];
-    }
-    return (sum + cnt / 2) / cnt;
-}
@@ -8,9 +8,12 @@
 #include "buf_log.h"
 #include "dbg_gpio.h" // misc/include
 #include "dcc_command.h"
+#include "dcc_latency.h"
 #include "dcc_pkt.h"
+#include "dcc_profile.h"
 #include "dcc_throttle.h"
 #include "hardware/clocks.h"
+#include "hardware/dma.h"
 #include "hardware/gpio.h"
 #include "hardware/irq.h"
 #include "hardware/pwm.h"
@@ -70,7 +73,29 @@ DccBitstream::DccBitstream(DccCommand &command, int sig_gpio, int pwr_gpio,
     _channel(pwm_gpio_to_channel(sig_gpio)),
     _byte_num(INT_MAX), // set in start_*()
     _bit_num(INT_MAX),  // set in start_*()
-    _use_railcom(false)
+    _use_railcom(false),
+    _idle_dummy(0),
+    _idle_en(false),
+    _idle(false),
+    _idle_exit(false),
+    _idle_cnt(0),
+    _dma_pace(-1), // claimed in idle_init()
+    _dma_top(-1),
+    _dma_cc(-1),
+    _idle_timer(),
+    _idle_timer_on(false),
+    _bit_start_us(0),
+    _bit_len_us(0),
+    _prog_len_us(0),
+    _late_sync(true),
+    _late_now(false),
+    _late_abort(false),
+    _late_cnt(0),
+    _late_max_us(0),
+    _late_abort_cnt(0),
+    _late_byte(0),
+    _late_bit(0),
+    _late_pkt()
 {
     // Do not do PWM setup here since this might be a static object, and
     // other stuff is not fully initialized. In particular, clock_get_hz()
@@ -86,6 +111,8 @@ DccBitstream::DccBitstream(DccCommand &command, int sig_gpio, int pwr_gpio,
 
     gpio_set_function(pwr_gpio, GPIO_FUNC_PWM);
 
+    idle_encode();
+
     dbg_init();
 }
 
@@ -93,6 +120,14 @@ DccBitstream::DccBitstream(DccCommand &command, int sig_gpio, int pwr_gpio,
 DccBitstream::~DccBitstream()
 {
     stop(); // track power off, pwm output low
+
+    if (_idle_timer_on)
+        cancel_repeating_timer(&_idle_timer);
+    if (_dma_pace >= 0) {
+        dma_channel_unclaim(_dma_pace);
+        dma_channel_unclaim(_dma_top);
+        dma_channel_unclaim(_dma_cc);
+    }
 }
 
 
@@ -104,6 +139,7 @@ void DccBitstream::dbg_init()
 
 void DccBitstream::start_ops()
 {
+    idle_init();
     start(DccPkt::ops_preamble_bits, true);
 }
 
@@ -120,6 +156,10 @@ void DccBitstream::start(int preamble_bits, bool cutout)
     const uint32_t pwm_hz = 1000000; // 1 MHz; 1 usec/count
     uint32_t pwm_div = sys_hz / pwm_hz;
 
+    idle_dma_stop();
+
+    DccLatency::init();
+
     // If this is a start after a previous stop, the pwm is not disabled,
     // it's just running a 0% duty cycle waveform.
     pwm_set_enabled(_slice, false);
@@ -142,6 +182,9 @@ void DccBitstream::start(int preamble_bits, bool cutout)
     _byte_num = byte_num_preamble;
     _bit_num = _preamble_bits;
 
+    // PWM is stopped; nothing to check against
+    _late_sync = true;
+
     next_bit();
 
     // _bit_num = _preamble_bits - 1
@@ -151,6 +194,8 @@ void DccBitstream::start(int preamble_bits, bool cutout)
     // The first bit of the preamble has just started going out.
     // Program for second bit when first bit finishes.
     // This assumes the RP2040's double-buffering of TOP and LEVEL.
+    // Late checks start from this bit.
+    _late_sync = true;
     next_bit();
 
     // _bit_num = _preamble_bits - 2
@@ -161,6 +206,7 @@ void DccBitstream::start(int preamble_bits, bool cutout)
 void DccBitstream::stop()
 {
     pwm_set_irq_enabled(_slice, false);
+    idle_dma_stop();
     // stop with output low (0% duty)
     pwm_set_chan_level(_slice, _channel, 0);
     pwm_set_chan_level(_slice, 1 - _channel, 0); // enable low
@@ -172,6 +218,237 @@ void DccBitstream::stop()
 } // void DccBitstream::stop()
 
 
+void DccBitstream::power_cut() // called in interrupt context
+{
+    gpio_put(_pwr_gpio, 0);
+    gpio_set_dir(_pwr_gpio, GPIO_OUT);
+    gpio_set_function(_pwr_gpio, GPIO_FUNC_SIO);
+}
+
+
+void DccBitstream::power_restore() // called in interrupt context
+{
+    gpio_set_function(_pwr_gpio, GPIO_FUNC_PWM);
+}
+
+
+// Pre-encode the idle packet: TOP and CC values for each bit, the same values
+// prog_bit() programs. This only depends on which channel is which, so it's
+// done once.
+void DccBitstream::idle_encode()
+{
+    DccPktIdle pkt;
+    int n = 0;
+
+    auto put = [this, &n](int b) {
+        uint32_t half_us = (b == 0 ? DccSpec::t0_nom_us : DccSpec::t1_nom_us);
+        uint32_t sig = half_us;
+        uint32_t pwr = 2 * half_us; // power on
+        _idle_top[n] = 2 * half_us - 1;
+        if (_channel == PWM_CHAN_A)
+            _idle_cc[n] = (sig << PWM_CH0_CC_A_LSB) | (pwr << PWM_CH0_CC_B_LSB);
+        else
+            _idle_cc[n] = (pwr << PWM_CH0_CC_A_LSB) | (sig << PWM_CH0_CC_B_LSB);
+        n++;
+    };
+
+    for (int i = 0; i < idle_preamble_bits; i++)
+        put(1);
+
+    for (int i = 0; i < pkt.msg_len(); i++) {
+        put(0); // start bit
+        for (int bit = 7; bit >= 0; bit--)
+            put((pkt.data(i) >> bit) & 1);
+    }
+
+    put(1); // stop bit
+
+    assert(n == idle_bits);
+}
+
+
+// Claim DMA channels the first time ops mode is started (not in the
+// constructor, for the same reason the PWM isn't set up there). If they can't
+// be had, idle mode is not used. They're claimed even if idle mode is
+// disabled, so it can be enabled later.
+void DccBitstream::idle_init()
+{
+    if (_dma_pace >= 0)
+        return;
+
+    int pace = dma_claim_unused_channel(false);
+    int top = dma_claim_unused_channel(false);
+    int cc = dma_claim_unused_channel(false);
+
+    if (pace >= 0 && top >= 0 && cc >= 0) {
+        _dma_pace = pace;
+        _dma_top = top;
+        _dma_cc = cc;
+        return;
+    }
+
+    if (pace >= 0)
+        dma_channel_unclaim(pace);
+    if (top >= 0)
+        dma_channel_unclaim(top);
+    if (cc >= 0)
+        dma_channel_unclaim(cc);
+}
+
+
+// Called at the end of a packet, just after the stop bit was programmed. The
+// pace channel's first DREQ is the wrap that starts the stop bit, and it
+// loads the first bit of the idle packet's preamble for the wrap after that.
+// If the DREQ for the wrap just past is counted too, the first preamble bit
+// replaces the stop bit, which is also a one, and the packet is just one bit
+// earlier.
+bool DccBitstream::idle_start() // called in interrupt context
+{
+    if (!_idle_en || _dma_pace < 0)
+        return false;
+
+    // DccCommand::loop() runs from this while idle
+    if (!add_repeating_timer_us(-int64_t(idle_loop_us), idle_timer_cb, this,
+                                &_idle_timer))
+        return false;
+    _idle_timer_on = true;
+
+    pwm_set_irq_enabled(_slice, false);
+
+    dma_channel_config c;
+
+    c = dma_channel_get_default_config(_dma_cc);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_ring(&c, false, idle_ring_bits); // ring on read
+    channel_config_set_chain_to(&c, _dma_pace);
+    channel_config_set_irq_quiet(&c, true);
+    dma_channel_configure(_dma_cc, &c, &pwm_hw->slice[_slice].cc, _idle_cc, 1,
+                          false);
+
+    c = dma_channel_get_default_config(_dma_top);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_ring(&c, false, idle_ring_bits);
+    channel_config_set_chain_to(&c, _dma_cc);
+    channel_config_set_irq_quiet(&c, true);
+    dma_channel_configure(_dma_top, &c, &pwm_hw->slice[_slice].top, _idle_top,
+                          1, false);
+
+    c = dma_channel_get_default_config(_dma_pace);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pwm_get_dreq(_slice));
+    channel_config_set_chain_to(&c, _dma_top);
+    channel_config_set_irq_quiet(&c, true);
+    dma_channel_configure(_dma_pace, &c, &_idle_dummy, &_idle_dummy, 1, true);
+
+    _idle = true;
+    _idle_exit = false;
+    _idle_cnt++;
+
+    return true;
+}
+
+
+// Stop the DMA loop. The chain is broken first (enables cleared) so aborting
+// one channel can't start the next one.
+void DccBitstream::idle_dma_stop() // called in interrupt context
+{
+    if (!_idle)
+        return;
+
+    hw_clear_bits(&dma_channel_hw_addr(_dma_pace)->al1_ctrl,
+                  DMA_CH0_CTRL_TRIG_EN_BITS);
+    hw_clear_bits(&dma_channel_hw_addr(_dma_top)->al1_ctrl,
+                  DMA_CH0_CTRL_TRIG_EN_BITS);
+    hw_clear_bits(&dma_channel_hw_addr(_dma_cc)->al1_ctrl,
+                  DMA_CH0_CTRL_TRIG_EN_BITS);
+    dma_channel_abort(_dma_pace);
+    dma_channel_abort(_dma_top);
+    dma_channel_abort(_dma_cc);
+
+    cancel_repeating_timer(&_idle_timer);
+    _idle_timer_on = false;
+
+    _idle = false;
+    _idle_exit = false;
+}
+
+
+// Ask for the normal bitstream back. The PWM interrupt is turned back on, and
+// next_bit() does the handover from there.
+void DccBitstream::idle_exit() // called in any context
+{
+    uint32_t save = save_and_disable_interrupts();
+    if (_idle && !_idle_exit) {
+        _idle_exit = true;
+        pwm_clear_irq(_slice);
+        pwm_set_irq_enabled(_slice, true);
+    }
+    restore_interrupts(save);
+}
+
+
+// Called from next_bit() after idle_exit(). The DMA is only stopped when it's
+// in the idle packet's preamble with at least a normal preamble left, so the
+// bits already out and the bits next_bit() sends make one good packet.
+//
+// n is the next bit the cc channel will load. If the DMA already handled the
+// wrap that caused this interrupt, that's two bits after the one that just
+// started; if not, it's one after, and the next bit has not been programmed.
+// Either way, the next bit is a preamble one, so it's programmed here, and the
+// preamble is (at worst) a bit longer than needed.
+bool DccBitstream::idle_handover() // called in interrupt context
+{
+    uint32_t read_addr = dma_channel_hw_addr(_dma_cc)->read_addr;
+    int n = (read_addr - uint32_t(uintptr_t(_idle_cc))) / 4;
+
+    if (n < 2 || n > (idle_preamble_bits - _preamble_bits))
+        return false; // not yet
+
+    idle_dma_stop();
+
+    // the DMA was sending preamble ones; late checks start from here
+    _late_sync = true;
+    _prog_len_us = 2 * DccSpec::t1_nom_us;
+
+    prog_bit(1);
+    _byte_num = byte_num_preamble;
+    _bit_num = idle_preamble_bits - n;
+
+    return true;
+}
+
+
+// In idle mode, run DccCommand::loop() as next_bit() would.
+bool DccBitstream::idle_timer_cb(repeating_timer_t *rt) // called in interrupt context
+{
+    DccBitstream *me = (DccBitstream *)rt->user_data;
+    if (!me->_idle)
+        return false; // shouldn't happen; idle_dma_stop() cancels it
+    me->_command.loop();
+    return true; // keep repeating
+}
+
+
+// The address is that of the packet in _current2, which is the one just
+// started (PACKET) or the one the cutout follows (CUTOUT_START). Packets that
+// are not from a throttle (idle) get -1.
+void DccBitstream::profile_mark(DccProfile::MarkType type) // called in interrupt context
+{
+    DccProfile &profile = _command.profile();
+    if (!profile.enabled())
+        return;
+    DccThrottle *throttle = _current2.get_throttle();
+    int address = (throttle != nullptr) ? throttle->get_address() : -1;
+    profile.mark(type, address);
+}
+
+
 // Called from start(), then the PWM IRQ handler in response to the end of
 // each bit. When this is called, a new bit has already started. Programming
 // in here affects the next bit, the one that will start at the next
@@ -184,6 +461,16 @@ void DccBitstream::stop()
 void DccBitstream::next_bit() // called in interrupt context
 {
     DbgGpio g(dbg_next_bit);
+    DccLatency::Probe l(DccLatency::NEXT_BIT);
+
+    if (_idle) {
+        // Interrupts are only on in idle mode after idle_exit(). Until the
+        // handover, the DMA is still sending bits.
+        idle_handover();
+        return;
+    }
+
+    _late_now = false;
 
     if (_byte_num == byte_num_cutout) {
         // doing railcom cutout
@@ -191,6 +478,7 @@ void DccBitstream::next_bit() // called in interrupt context
             // first bit, power is on for a quarter bit time
             prog_bit_cutout_start();
             _bit_num--;
+            profile_mark(DccProfile::MarkType::CUTOUT_START);
             // reset uart in case it got glitched
             _railcom.reset();
         } else if (_bit_num > 0) {
@@ -203,6 +491,7 @@ void DccBitstream::next_bit() // called in interrupt context
             prog_bit(1); // first bit in preamble
             _byte_num = byte_num_preamble;
             _bit_num = _preamble_bits - 1;
+            profile_mark(DccProfile::MarkType::CUTOUT_END);
             // Note: All the prog_bit(1) calls (after the first) when sending
             // the preamble are not needed since the PWM will send ones and
             // interrupt until we change it. But prog_bit(1) only takes about
@@ -240,6 +529,7 @@ void DccBitstream::next_bit() // called in interrupt context
                     // _current2 changes at the end of the preamble
                     DccThrottle *throttle = _current2.get_throttle();
                     if (throttle != nullptr) {
+                        throttle->rc_stats().update(_railcom);
                         const RailComMsg *msg;
                         int msg_cnt = _railcom.get_ch2_msgs(msg);
                         throttle->railcom(msg, msg_cnt);
@@ -255,6 +545,7 @@ void DccBitstream::next_bit() // called in interrupt context
             _bit_num = 7;  // data goes msb first
             // get the next packet to send from DccCommand
             _command.get_packet(_current2);
+            profile_mark(DccProfile::MarkType::PACKET);
         }
     } else {
         assert(0 <= _byte_num);
@@ -269,7 +560,14 @@ void DccBitstream::next_bit() // called in interrupt context
             if ((_byte_num + 1) == msg_len) {
                 // end of message, send message-stop bit
                 prog_bit(1);
-                if (_use_railcom) {
+                if (_command.idle_ok() && idle_start()) {
+                    // nothing but idle packets to send; DMA takes over
+                    // after the stop bit (_byte_num and _bit_num are set at
+                    // the handover)
+                    return;
+                }
+                // no cutout if an e-stop is waiting to go out
+                if (_use_railcom && !_command.estop_pending()) {
                     // cutout first, then message preamble
                     _byte_num = byte_num_cutout;
                     _bit_num = 4;
@@ -292,6 +590,18 @@ void DccBitstream::next_bit() // called in interrupt context
             _bit_num--;
         }
     }
+
+    if (_late_now && _late_abort && _late_byte >= 0 && _byte_num >= 0) {
+        // The rest of this packet would go out shifted or with a bit
+        // missing; start the next preamble now instead. No cutout, and the
+        // throttle doesn't get the (no) railcom response.
+        prog_bit(1);
+        _byte_num = byte_num_preamble;
+        _bit_num = _preamble_bits - 1;
+        _current2.set_throttle(nullptr);
+        _late_abort_cnt++;
+    }
+
     _command.loop();
 
     // Demonstrate taking more than a bit time in this processing, showing
@@ -302,6 +612,83 @@ void DccBitstream::next_bit() // called in interrupt context
 } // void DccBitstream::next_bit()
 
 
+// Called after each bit is programmed (see late_cnt()). len_us is the length
+// of the bit just programmed. If this is a second call for the same PWM wrap
+// (the interrupt for a wrap that happened while the last call was late, or a
+// bit programmed again), only the length changes: the bit on the track is the
+// same one, and it's the last one programmed before the wrap either way.
+void DccBitstream::late_check(uint32_t len_us) // called in interrupt context
+{
+    uint32_t save = save_and_disable_interrupts();
+    uint32_t start_us = time_us_32() - pwm_get_counter(_slice);
+    restore_interrupts(save);
+
+    if (_late_sync) {
+        _late_sync = false;
+    } else {
+        int32_t dt_us = start_us - _bit_start_us;
+        if (-late_slop_us <= dt_us && dt_us <= late_slop_us) {
+            _prog_len_us = len_us;
+            return;
+        }
+        int32_t late_us = dt_us - int32_t(_bit_len_us);
+        if (late_us < -late_slop_us || late_us > late_slop_us) {
+            _late_cnt++;
+            if (late_us > int32_t(_late_max_us))
+                _late_max_us = late_us;
+            _late_byte = _byte_num;
+            _late_bit = _bit_num;
+            _late_pkt = _current2;
+            _late_now = true;
+        }
+    }
+
+    _bit_start_us = start_us;
+    _bit_len_us = _prog_len_us;
+    _prog_len_us = len_us;
+}
+
+
+void DccBitstream::late_reset()
+{
+    uint32_t save = save_and_disable_interrupts();
+    _late_cnt = 0;
+    _late_max_us = 0;
+    _late_abort_cnt = 0;
+    restore_interrupts(save);
+}
+
+
+// For a miss in the preamble or cutout, the packet shown is the one before.
+void DccBitstream::late_show() const
+{
+    uint32_t save = save_and_disable_interrupts();
+    uint32_t cnt = _late_cnt;
+    uint32_t max_us = _late_max_us;
+    uint32_t abort_cnt = _late_abort_cnt;
+    int byte_num = _late_byte;
+    int bit_num = _late_bit;
+    DccPkt2 pkt = _late_pkt;
+    restore_interrupts(save);
+
+    printf("%lu late (max %lu us), %lu aborted, abort %s", cnt, max_us,
+           abort_cnt, _late_abort ? "on" : "off");
+    if (cnt > 0) {
+        if (byte_num == byte_num_cutout)
+            printf("; last in cutout");
+        else if (byte_num == byte_num_preamble)
+            printf("; last in preamble");
+        else if (bit_num == -1)
+            printf("; last at byte %d stop bit", byte_num);
+        else
+            printf("; last at byte %d bit %d", byte_num, bit_num);
+        char buf[80];
+        printf(": %s", pkt.show(buf, sizeof(buf)));
+    }
+    printf("\n");
+}
+
+
 // interrupt handler
 void DccBitstream::pwm_handler(void *arg) // called in interrupt context
 {
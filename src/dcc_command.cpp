@@ -9,8 +9,11 @@
 #include "buf_log.h"
 #include "dcc_adc.h"
 #include "dcc_bitstream.h"
+#include "dcc_latency.h"
 #include "dcc_pkt.h"
+#include "dcc_roster.h"
 #include "dcc_throttle.h"
+#include "hardware/sync.h"
 #include "hardware/uart.h"
 
 
@@ -22,11 +25,48 @@ DccCommand::DccCommand(int sig_gpio, int pwr_gpio, int slp_gpio, DccAdc &adc,
                        uart_inst_t *const rc_uart, int rc_gpio) :
     _bitstream(*this, sig_gpio, pwr_gpio, rc_uart, rc_gpio),
     _adc(adc),
+    _protect(adc, _bitstream),
+    _profile(adc),
     _mode(Mode::OFF),
     _mode_svc(ModeSvc::NONE),
+    _svc_session(false),
+    _svc_reset_need(0),
     _next_throttle(_throttles.begin()),
+    _pkt_idle(),
+    _acc_cnt(0),
+    _acc_next(0),
+    _acc_repeat(acc_repeat_default),
+    _acc_gap(acc_gap_default),
+    _acc_gap_left(0),
+    _consist_burst(nullptr),
+    _cv_async(nullptr),
+    _roster(nullptr),
+    _roster_turn(false),
+    _pkt_estop(),
+    _estop(false),
+    _estop_pkt_cnt(0),
+    _estop_sent(false),
+    _estop_cut(false),
+    _estop_power_off_ms(-1),
+    _estop_us(0),
+    _estop_sent_us(0),
+    _estop_cnt(0),
+    _estop_latency_us(0),
+    _estop_latency_max_us(0),
+    _svc_idx_op(ModeSvc::NONE),
+    _svc_idx_cv(0),
+    _svc_idx_val(0),
+    _svc_idx_cv_num(0),
+    _svc_idx_cv_val(0),
+    _svc_idx_fast(false),
+    _svc_idx_guess(-1),
+    _svc_idx_pkt_cnt(0),
     _svc_status(ERROR),
     _svc_status_next(ERROR),
+    _ack_threshold(adc),
+    _ack_det(&_ack_threshold),
+    _ack_armed(false),
+    _ack(false),
     _svc_cmd_step(SvcCmdStep::NONE),
     _svc_cmd_cnt(0),
     _pkt_reset(),
@@ -36,25 +76,31 @@ DccCommand::DccCommand(int sig_gpio, int pwr_gpio, int slp_gpio, DccAdc &adc,
     _pkt_svc_verify_bit(),
     _verify_bit(0),
     _verify_bit_val(0),
-    _cv_val(0)
+    _cv_val(0),
+    _read_fast(false),
+    _read_guess(-1),
+    _svc_pkt_cnt(0)
 {
     if (slp_gpio >= 0) {
         gpio_init(slp_gpio);
         gpio_put(slp_gpio, 1);
         gpio_set_dir(slp_gpio, GPIO_OUT);
     }
+    for (Consist &c : _consists)
+        c.address = 0;
+    for (Cv19Wait &w : _cv19_wait)
+        w.handle = 0;
     ack_reset();
+    acc_reset_stats();
     dbg_init();
-    dbg_times_reset();
 }
 
 
 DccCommand::~DccCommand()
 {
-    for (DccThrottle *t : _throttles) {
-        _throttles.remove(t);
+    for (DccThrottle *t : _throttles)
         delete t;
-    }
+    _throttles.clear();
     _next_throttle = _throttles.begin();
 }
 
@@ -67,8 +113,13 @@ void DccCommand::dbg_init()
 
 void DccCommand::set_mode_off()
 {
+    estop_clear();
+    _acc_cnt = 0;
+    _acc_next = 0;
     _mode = Mode::OFF;
     _mode_svc = ModeSvc::NONE;
+    _svc_session = false;
+    _protect.stop();
     _adc.stop();
     _bitstream.stop();
 }
@@ -76,35 +127,58 @@ void DccCommand::set_mode_off()
 
 void DccCommand::set_mode_ops()
 {
+    estop_clear();
     _mode = Mode::OPS;
     _mode_svc = ModeSvc::NONE;
+    _svc_session = false;
+    // track current is watched in ops mode for overcurrent
+    _adc.start();
+    _protect.start();
     _bitstream.start_ops();
 }
 
 
+void DccCommand::svc_session_start()
+{
+    assert_svc_idle();
+    _svc_session = true;
+    _svc_index.forget(); // could be a different decoder now
+    _svc_reset_need = DccSpec::svc_reset1_cnt; // power-on resets
+    _mode_svc = ModeSvc::NONE; // get_packet_svc_idle() until an op starts
+    _mode = Mode::SVC;
+    ack_reset();
+    _adc.start();
+    _bitstream.start_svc();
+}
+
+
 void DccCommand::write_cv(int cv_num, uint8_t cv_val)
 {
+    _svc_index.written(cv_num, false, cv_val); // not known until it's done
     _pkt_svc_write_cv.set_cv(cv_num, cv_val);
-    _mode_svc = ModeSvc::WRITE_CV;
-    svc_start();
+    svc_start(ModeSvc::WRITE_CV);
 }
 
 
 void DccCommand::write_bit(int cv_num, int bit_num, int bit_val)
 {
+    _svc_index.written(cv_num, false, 0);
     _pkt_svc_write_bit.set_cv_bit(cv_num, bit_num, bit_val);
-    _mode_svc = ModeSvc::WRITE_BIT;
-    svc_start();
+    svc_start(ModeSvc::WRITE_BIT);
 }
 
 
-void DccCommand::read_cv(int cv_num)
+void DccCommand::read_cv(int cv_num, bool fast, int guess)
 {
     _cv_val = 0;
+    _read_fast = fast;
+    if (fast && 0 <= guess && guess <= 255)
+        _read_guess = guess;
+    else
+        _read_guess = -1;
     _pkt_svc_verify_bit.set_cv_num(cv_num);
     _pkt_svc_verify_cv.set_cv_num(cv_num);
-    _mode_svc = ModeSvc::READ_CV;
-    svc_start();
+    svc_start(ModeSvc::READ_CV);
 }
 
 
@@ -112,29 +186,149 @@ void DccCommand::read_bit(int cv_num, int bit_num)
 {
     _verify_bit = bit_num;
     _pkt_svc_verify_bit.set_cv_num(cv_num);
-    _mode_svc = ModeSvc::READ_BIT;
-    svc_start();
+    svc_start(ModeSvc::READ_BIT);
+}
+
+
+void DccCommand::write_cv_indexed(int index, int cv_num, uint8_t cv_val)
+{
+    if (!_svc_session)
+        _svc_index.forget();
+    _svc_index.want(index);
+    _svc_idx_pkt_cnt = 0;
+    _svc_idx_op = ModeSvc::WRITE_CV;
+    _svc_idx_cv_num = cv_num;
+    _svc_idx_cv_val = cv_val;
+    svc_index_step();
+}
+
+
+void DccCommand::read_cv_indexed(int index, int cv_num, bool fast, int guess)
+{
+    if (!_svc_session)
+        _svc_index.forget();
+    _svc_index.want(index);
+    _svc_idx_pkt_cnt = 0;
+    _svc_idx_op = ModeSvc::READ_CV;
+    _svc_idx_cv_num = cv_num;
+    _svc_idx_fast = fast;
+    _svc_idx_guess = guess;
+    svc_index_step();
+}
+
+
+// Start the next operation of an indexed access: an index cv write, or the
+// operation itself.
+void DccCommand::svc_index_step()
+{
+    _svc_idx_cv = _svc_index.next(_svc_idx_val);
+    if (_svc_idx_cv != 0)
+        write_cv(_svc_idx_cv, _svc_idx_val);
+    else if (_svc_idx_op == ModeSvc::WRITE_CV)
+        write_cv(_svc_idx_cv_num, _svc_idx_cv_val);
+    else
+        read_cv(_svc_idx_cv_num, _svc_idx_fast, _svc_idx_guess);
+}
+
+
+// Called from svc_done() when an operation is done. If it was an index cv
+// write of an indexed access, and it worked, start the next step and return
+// true. Otherwise the indexed access is over.
+bool DccCommand::svc_index_next()
+{
+    if (_svc_idx_op == ModeSvc::NONE)
+        return false;
+
+    if (_svc_idx_cv == 0) {
+        // the operation itself finished
+        _svc_idx_op = ModeSvc::NONE;
+        return false;
+    }
+
+    bool ok = (_svc_status == SUCCESS);
+    _svc_index.written(_svc_idx_cv, ok, _svc_idx_val);
+    if (!ok) {
+        _svc_idx_op = ModeSvc::NONE;
+        return false;
+    }
+
+    _svc_idx_pkt_cnt += _svc_pkt_cnt;
+    svc_index_step();
+    return true;
 }
 
 
-void DccCommand::svc_start()
+void DccCommand::svc_start(ModeSvc mode_svc)
 {
+    if (_svc_idx_op == ModeSvc::NONE)
+        _svc_idx_pkt_cnt = 0; // not part of an indexed operation
+
+    if (_svc_session) {
+        // Track is already powered and the interrupt handler is sending
+        // resets; set everything up, then set _mode_svc to start the op.
+        assert(_mode == Mode::SVC);
+        assert(_mode_svc == ModeSvc::NONE);
+        assert(_svc_cmd_step == SvcCmdStep::NONE);
+        _svc_status = IN_PROGRESS;
+        _svc_status_next = IN_PROGRESS;
+        _svc_pkt_cnt = 0;
+        _svc_cmd_step = SvcCmdStep::RESET1;
+        int reset_cnt = _svc_reset_need;
+        if (reset_cnt < DccSpec::svc_resume_reset_cnt)
+            reset_cnt = DccSpec::svc_resume_reset_cnt;
+        _svc_cmd_cnt = reset_cnt;
+        __compiler_memory_barrier();
+        _mode_svc = mode_svc;
+        return;
+    }
+
     assert_svc_idle();
     _mode = Mode::SVC;
+    _mode_svc = mode_svc;
     _svc_status = IN_PROGRESS;
     _svc_status_next = IN_PROGRESS;
+    _svc_pkt_cnt = 0;
     assert(_svc_cmd_step == SvcCmdStep::NONE);
     assert(_svc_cmd_cnt == 0);
     _svc_cmd_step = SvcCmdStep::RESET1;
     _svc_cmd_cnt = DccSpec::svc_reset1_cnt;
+    ack_reset();
     _adc.start();
     _bitstream.start_svc();
 }
 
 
+// Called at the end of each service mode operation, after _svc_status is set.
+void DccCommand::svc_end(DccPkt2 &pkt2) // called in interrupt context
+{
+    if (_svc_session) {
+        // Stay powered and go back to sending resets. Don't bother counting
+        // the ones sent at the end of this op; the next one sends at least
+        // svc_resume_reset_cnt anyway. The ack detector is not reset, since
+        // it's the same decoder.
+        _svc_reset_need = 0;
+        _mode_svc = ModeSvc::NONE;
+        _ack_armed = false;
+        _ack = false;
+        pkt2.set(_pkt_reset);
+    } else {
+        set_mode_off();
+    }
+}
+
+
+// In a service mode session, between operations
+void DccCommand::get_packet_svc_idle(DccPkt2 &pkt2) // called in interrupt context
+{
+    pkt2.set(_pkt_reset);
+    if (_svc_reset_need > 0)
+        _svc_reset_need--;
+}
+
+
 bool DccCommand::svc_done(bool &result)
 {
-    if (_svc_status == IN_PROGRESS)
+    if (_svc_status == IN_PROGRESS || svc_index_next())
         return false;
 
     result = (_svc_status == SUCCESS);
@@ -144,7 +338,7 @@ bool DccCommand::svc_done(bool &result)
 
 bool DccCommand::svc_done(bool &result, uint8_t &val)
 {
-    if (_svc_status == IN_PROGRESS)
+    if (_svc_status == IN_PROGRESS || svc_index_next())
         return false;
 
     result = (_svc_status == SUCCESS);
@@ -157,57 +351,101 @@ bool DccCommand::svc_done(bool &result, uint8_t &val)
 
 void DccCommand::loop() // called in interrupt context
 {
+    if (_mode == Mode::OPS) {
+        _adc.loop();
+        _protect.check();
+        if (_estop)
+            estop_check();
+        // roster locos added while idle (this runs from the idle timer then)
+        if (_roster != nullptr && _bitstream.idle() && _roster->cnt() > 0)
+            _bitstream.idle_exit();
+        return;
+    }
+
     if (_mode != Mode::SVC)
         return;
 
     if (!_adc.loop())
         return; // no new adc samples
 
-    ack_check(_adc.short_avg_ma());
+    ack_check();
+}
+
+
+bool DccCommand::idle_ok() const // called in interrupt context
+{
+    return _mode == Mode::OPS && _throttles.empty() && _estop_pkt_cnt == 0 &&
+           _acc_cnt == 0 && (_roster == nullptr || _roster->cnt() == 0) &&
+           _adc.using_dma();
 }
 
 
 void DccCommand::get_packet(DccPkt2 &pkt2) // called in interrupt context
 {
     DbgGpio d(dbg_get_packet);
-    uint32_t start_us = time_us_32();
+    DccLatency::Probe l(DccLatency::GET_PACKET);
 
     if (_mode == Mode::OPS) {
-        get_packet_ops(pkt2);
+        if (_estop_pkt_cnt > 0)
+            get_packet_estop(pkt2);
+        else
+            get_packet_ops(pkt2);
     } else if (_mode == Mode::SVC) {
-        if (_mode_svc == ModeSvc::WRITE_CV || _mode_svc == ModeSvc::WRITE_BIT) {
+        if (_mode_svc == ModeSvc::NONE) {
+            get_packet_svc_idle(pkt2);
+        } else if (_mode_svc == ModeSvc::WRITE_CV || _mode_svc == ModeSvc::WRITE_BIT) {
+            _svc_pkt_cnt++;
             get_packet_svc_write(pkt2);
         } else if (_mode_svc == ModeSvc::READ_CV) {
+            _svc_pkt_cnt++;
             get_packet_svc_read_cv(pkt2);
         } else {
             assert(_mode_svc == ModeSvc::READ_BIT);
+            _svc_pkt_cnt++;
             get_packet_svc_read_bit(pkt2);
         }
     }
-
-    // measure how long this function took for debug/analysis
-    uint32_t time_us = time_us_32() - start_us;
-    if (time_us < _get_packet_min_us)
-        _get_packet_min_us = time_us;
-    if (time_us > _get_packet_max_us)
-        _get_packet_max_us = time_us;
-    if (_get_packet_avg_us == 0)
-        _get_packet_avg_us = time_us * get_packet_avg_len;
-    else
-        _get_packet_avg_us =
-            (_get_packet_avg_us * (get_packet_avg_len - 1) + time_us) /
-            get_packet_avg_len;
 }
 
 
 void DccCommand::get_packet_ops(DccPkt2 &pkt2) // called in interrupt context
 {
+    if (_acc_cnt > 0 && (_acc_gap_left <= 0 || _throttles.empty())) {
+        get_packet_acc(pkt2);
+        _acc_gap_left = _acc_gap;
+        return;
+    }
+
+    if (_acc_gap_left > 0)
+        _acc_gap_left--;
+
+    if (_consist_burst != nullptr) {
+        // rest of a station consist's speed packets
+        DccThrottle *t = _consist_burst;
+        pkt2.set(t->speed_packet(), t);
+        _consist_burst = t->consist_next();
+        return;
+    }
+
+    if (_roster != nullptr &&
+        (_roster_turn || _next_throttle == _throttles.end())) {
+        DccPkt pkt;
+        if (_roster->next_packet(pkt)) {
+            pkt2.set(pkt);
+            _roster_turn = false;
+            return;
+        }
+    }
+    _roster_turn = true;
+
     if (_next_throttle == _throttles.end()) {
-        // XXX no throttles - return an idle packet
-        // XXX how did we get into ops mode?
-        assert(false);
+        // no throttles; the bitstream goes to idle mode after this one
+        pkt2.set(_pkt_idle);
     } else {
-        pkt2.set((*_next_throttle)->next_packet(), *_next_throttle);
+        DccThrottle *t = *_next_throttle;
+        pkt2.set(t->next_packet(), t);
+        if (t->consist_next() != nullptr && t->last_was_speed())
+            _consist_burst = t->consist_next();
         _next_throttle++;
         if (_next_throttle == _throttles.end())
             _next_throttle = _throttles.begin();
@@ -215,6 +453,177 @@ void DccCommand::get_packet_ops(DccPkt2 &pkt2) // called in interrupt context
 }
 
 
+bool DccCommand::acc_set(int acc_adrs, int out, bool on)
+{
+    if (acc_adrs < DccPkt::acc_address_min ||
+        acc_adrs > DccPkt::acc_address_max || (out != 0 && out != 1))
+        return false;
+
+    return acc_queue(DccPktAccBasic(acc_adrs, out, on),
+                     (acc_adrs << 1) | (on ? 1 : 0));
+}
+
+
+bool DccCommand::acc_aspect(int acc_adrs, int aspect)
+{
+    if (acc_adrs < DccPkt::acc_address_min ||
+        acc_adrs > DccPkt::acc_address_max ||
+        aspect < DccPktAccExt::aspect_min || aspect > DccPktAccExt::aspect_max)
+        return false;
+
+    // extended keys are above all the basic ones
+    return acc_queue(DccPktAccExt(acc_adrs, aspect), 0x10000 | acc_adrs);
+}
+
+
+// Interrupts are disabled since get_packet_acc() changes the queue too.
+bool DccCommand::acc_queue(const DccPkt &pkt, int key)
+{
+    uint32_t now_us = time_us_32();
+    bool ok = true;
+
+    uint32_t save = save_and_disable_interrupts();
+
+    int i;
+    for (i = 0; i < _acc_cnt; i++)
+        if (_acc[i].key == key)
+            break;
+
+    if (i < _acc_cnt) {
+        _acc_coalesce_cnt++;
+    } else if (_acc_cnt < acc_max) {
+        _acc_cnt++;
+    } else {
+        ok = false;
+    }
+
+    if (ok) {
+        _acc[i].pkt = pkt;
+        _acc[i].key = key;
+        _acc[i].left = _acc_repeat > 0 ? _acc_repeat : 1;
+        _acc[i].queued_us = now_us;
+        _acc_cmd_cnt++;
+        _bitstream.idle_exit();
+    }
+
+    restore_interrupts(save);
+
+    return ok;
+}
+
+
+void DccCommand::get_packet_acc(DccPkt2 &pkt2) // called in interrupt context
+{
+    if (_acc_next >= _acc_cnt)
+        _acc_next = 0;
+
+    AccCmd &a = _acc[_acc_next];
+    pkt2.set(a.pkt);
+    _acc_pkt_cnt++;
+
+    if (--a.left > 0) {
+        _acc_next++;
+        return;
+    }
+
+    // done; the ones after it move up, so _acc_next is the next one now
+    _acc_latency_us = time_us_32() - a.queued_us;
+    if (_acc_latency_us > _acc_latency_max_us)
+        _acc_latency_max_us = _acc_latency_us;
+    _acc_done_cnt++;
+
+    for (int i = _acc_next + 1; i < _acc_cnt; i++)
+        _acc[i - 1] = _acc[i];
+    _acc_cnt--;
+}
+
+
+void DccCommand::acc_reset_stats()
+{
+    _acc_cmd_cnt = 0;
+    _acc_coalesce_cnt = 0;
+    _acc_pkt_cnt = 0;
+    _acc_done_cnt = 0;
+    _acc_latency_us = 0;
+    _acc_latency_max_us = 0;
+}
+
+
+// Interrupts are disabled so this can be called from an interrupt handler
+// (e.g. an e-stop button) as well as the main loop.
+void DccCommand::estop()
+{
+    uint32_t save = save_and_disable_interrupts();
+    if (!_estop) {
+        _estop = true;
+        _estop_us = time_us_32();
+        _estop_sent = false;
+        _estop_cut = false;
+    }
+    // another estop() while active sends another burst
+    _estop_pkt_cnt = estop_pkt_cnt;
+    _bitstream.idle_exit();
+    restore_interrupts(save);
+}
+
+
+void DccCommand::estop_clear()
+{
+    uint32_t save = save_and_disable_interrupts();
+    bool cut = _estop_cut;
+    _estop = false;
+    _estop_pkt_cnt = 0;
+    _estop_cut = false;
+    restore_interrupts(save);
+
+    if (cut) {
+        _bitstream.power_restore();
+        if (_mode == Mode::OPS)
+            _protect.start();
+    }
+}
+
+
+void DccCommand::get_packet_estop(DccPkt2 &pkt2) // called in interrupt context
+{
+    if (!_estop_sent) {
+        _estop_sent = true;
+        _estop_sent_us = time_us_32();
+        _estop_latency_us = _estop_sent_us - _estop_us;
+        if (_estop_latency_us > _estop_latency_max_us)
+            _estop_latency_max_us = _estop_latency_us;
+        _estop_cnt++;
+        // So locos stay stopped when throttle packets resume. This can't
+        // change throttle state directly (the main loop might be in the
+        // middle of changing it); each throttle zeroes its own speed. The
+        // roster changes its state with interrupts disabled, so it can be
+        // zeroed here.
+        for (DccThrottle *t : _throttles)
+            t->estop();
+        if (_roster != nullptr)
+            _roster->estop();
+    }
+    pkt2.set(_pkt_estop);
+    _estop_pkt_cnt--;
+}
+
+
+// Cut power when the e-stop's power-off delay is up. Overcurrent protection
+// is stopped first so it doesn't turn power back on.
+void DccCommand::estop_check() // called in interrupt context
+{
+    if (_estop_cut || !_estop_sent || _estop_power_off_ms < 0)
+        return;
+
+    if ((time_us_32() - _estop_sent_us) < uint32_t(_estop_power_off_ms) * 1000)
+        return;
+
+    _protect.stop();
+    _bitstream.power_cut();
+    _estop_cut = true;
+}
+
+
 // Service mode, write CV (byte or bit)
 // 1. Send out DccSpec::svc_reset1_cnt (20) resets
 // 2. Send out DccSpec::svc_command_cnt (5) commands (write byte/bit)
@@ -232,7 +641,7 @@ void DccCommand::get_packet_svc_write(DccPkt2 &pkt2) // called in interrupt cont
             // Done with resets (second-to-last one has just started).
             // The long average adc reading is the baseline for
             // detecting an ack pulse.
-            ack_arm(_adc.long_avg_ma() + ack_inc_ma);
+            ack_arm();
             // Next send write command.
             _svc_cmd_step = SvcCmdStep::COMMAND;
             _svc_cmd_cnt = DccSpec::svc_command_cnt;
@@ -284,10 +693,10 @@ void DccCommand::get_packet_svc_write(DccPkt2 &pkt2) // called in interrupt cont
     else
         _svc_status = SUCCESS;
 
-    set_mode_off();
-
     _svc_cmd_step = SvcCmdStep::NONE;
 
+    svc_end(pkt2);
+
 } // void DccCommand::get_packet_svc_write(DccPkt2 &pkt2)
 
 
@@ -312,6 +721,13 @@ void DccCommand::get_packet_svc_write(DccPkt2 &pkt2) // called in interrupt cont
 //      b. if no ack has been received when the last reset goes out, we are
 //         done, _svc_status is set to ERROR, and calling svc_done() will
 //         return "done/error"
+//
+// A fast read (_read_fast) differs in two ways:
+//   1. if there is a guess (_read_guess), five byte-verifies of the guess and
+//      five resets are sent before step 2; if that gets an ack, we are done
+//      as in 3a, and if not, the read goes on with step 2
+//   2. in step 2, once a bit-verify gets an ack, the rest of the bit-verifies
+//      for that bit are skipped and the resets are started
 void DccCommand::get_packet_svc_read_cv(DccPkt2 &pkt2) // called in interrupt context
 {
     assert(_svc_cmd_step != SvcCmdStep::NONE);
@@ -324,11 +740,17 @@ void DccCommand::get_packet_svc_read_cv(DccPkt2 &pkt2) // called in interrupt co
             // Done with resets (second-to-last one has just started).
             // The long average adc reading is the baseline for
             // detecting an ack pulse.
-            ack_arm(_adc.long_avg_ma() + ack_inc_ma);
-            // Now start bit-verifies for each bit in the CV.
-            _verify_bit = 7;
+            ack_arm();
             _verify_bit_val = 1;
-            _pkt_svc_verify_bit.set_bit(_verify_bit, _verify_bit_val);
+            if (_read_guess >= 0) {
+                // Try a byte-verify of the guess first.
+                _verify_bit = 9; // magic number signifies verify guess
+                _pkt_svc_verify_cv.set_cv_val(_read_guess);
+            } else {
+                // Now start bit-verifies for each bit in the CV.
+                _verify_bit = 7;
+                _pkt_svc_verify_bit.set_bit(_verify_bit, _verify_bit_val);
+            }
             _svc_cmd_step = SvcCmdStep::COMMAND;
             _svc_cmd_cnt = DccSpec::svc_command_cnt;
         }
@@ -339,12 +761,19 @@ void DccCommand::get_packet_svc_read_cv(DccPkt2 &pkt2) // called in interrupt co
         if (_verify_bit < 8) {
             // This is an ack for a bit-verify
             _cv_val |= (1 << _verify_bit);
-            // It is probably okay to not send any more bit-verifies for the
-            // current bit and start the resets. It might even be possible to
-            // skip the resets and start the next bit verify. But for now we
-            // just keep going. It could save a few packets per 1-bit someday.
+            // For a fast read, don't send any more bit-verifies for the
+            // current bit; start the resets. The resets are still needed to
+            // let the ack pulse end and the long average settle before the
+            // next bit. A normal read just keeps going.
+            if (_read_fast && _svc_cmd_step == SvcCmdStep::COMMAND) {
+                _svc_cmd_step = SvcCmdStep::RESET2;
+                _svc_cmd_cnt = DccSpec::svc_reset2_cnt;
+            }
         } else {
-            // This is the ack for the byte-verify at the end
+            // This is the ack for the byte-verify at the end, or for the
+            // byte-verify of the guess at the start.
+            if (_verify_bit == 9)
+                _cv_val = uint8_t(_read_guess);
             // Don't send any more packets, and power off.
             if (!_adc.logging()) {
                 _svc_cmd_step = SvcCmdStep::RESET2;
@@ -356,8 +785,8 @@ void DccCommand::get_packet_svc_read_cv(DccPkt2 &pkt2) // called in interrupt co
 
     if (_svc_cmd_step == SvcCmdStep::COMMAND) {
         assert(_svc_cmd_cnt > 0);
-        if (_verify_bit == 8)
-            pkt2.set(_pkt_svc_verify_cv);
+        if (_verify_bit >= 8)
+            pkt2.set(_pkt_svc_verify_cv); // final byte-verify or guess
         else
             pkt2.set(_pkt_svc_verify_bit);
         _svc_cmd_cnt--;
@@ -378,7 +807,7 @@ void DccCommand::get_packet_svc_read_cv(DccPkt2 &pkt2) // called in interrupt co
             // each time just before sending out the verify packets. The
             // current might not always hold steady through the whole
             // sequence.
-            ack_arm(_adc.long_avg_ma() + ack_inc_ma);
+            ack_arm();
         }
         return;
     }
@@ -388,6 +817,17 @@ void DccCommand::get_packet_svc_read_cv(DccPkt2 &pkt2) // called in interrupt co
 
     assert(_svc_cmd_cnt == 0);
 
+    if (_verify_bit == 9 && _svc_status_next == IN_PROGRESS) {
+        // Guess was wrong; read it bit by bit.
+        _verify_bit = 7;
+        assert(_verify_bit_val == 1);
+        _pkt_svc_verify_bit.set_bit(_verify_bit, _verify_bit_val);
+        pkt2.set(_pkt_svc_verify_bit);
+        _svc_cmd_step = SvcCmdStep::COMMAND;
+        _svc_cmd_cnt = DccSpec::svc_command_cnt - 1;
+        return;
+    }
+
     if (_verify_bit >= 1 && _verify_bit <= 7) {
         // Done with one of the first 7 single-bit verifies;
         // start the next bit verify.
@@ -412,18 +852,18 @@ void DccCommand::get_packet_svc_read_cv(DccPkt2 &pkt2) // called in interrupt co
         return;
     }
 
-    assert(_verify_bit == 8);
+    assert(_verify_bit == 8 || _verify_bit == 9);
 
-    // Done with the byte verify at the end.
+    // Done with the byte verify at the end (or the guess was right).
     if (_svc_status_next == IN_PROGRESS)
         _svc_status = ERROR; // no ack, failed
     else
         _svc_status = SUCCESS;
 
-    set_mode_off();
-
     _svc_cmd_step = SvcCmdStep::NONE;
 
+    svc_end(pkt2);
+
 } // void DccCommand::get_packet_svc_read_cv(DccPkt2 &pkt2)
 
 
@@ -439,7 +879,7 @@ void DccCommand::get_packet_svc_read_bit(DccPkt2 &pkt2) // called in interrupt c
             // Done with resets (second-to-last one has just started).
             // The long average adc reading is the baseline for
             // detecting an ack pulse.
-            ack_arm(_adc.long_avg_ma() + ack_inc_ma);
+            ack_arm();
             // Next send bit-verify command.
             _svc_cmd_step = SvcCmdStep::COMMAND;
             _svc_cmd_cnt = DccSpec::svc_command_cnt;
@@ -504,10 +944,10 @@ void DccCommand::get_packet_svc_read_bit(DccPkt2 &pkt2) // called in interrupt c
     else
         _svc_status = SUCCESS;
 
-    set_mode_off();
-
     _svc_cmd_step = SvcCmdStep::NONE;
 
+    svc_end(pkt2);
+
 } // void DccCommand::get_packet_svc_read_bit(DccPkt2 &pkt2)
 
 
@@ -537,6 +977,7 @@ DccThrottle *DccCommand::create_throttle(int address)
         throttle = new DccThrottle(address);
         _throttles.push_back(throttle);
         restart_throttles();
+        _bitstream.idle_exit();
     }
 
     return throttle;
@@ -545,10 +986,12 @@ DccThrottle *DccCommand::create_throttle(int address)
 
 DccThrottle *DccCommand::delete_throttle(DccThrottle *throttle)
 {
+    consist_forget(throttle);
     _throttles.remove(throttle);
     delete throttle;
     restart_throttles();
-    return *_throttles.begin();
+    // none left is okay; ops mode sends idle packets
+    return _throttles.empty() ? nullptr : _throttles.front();
 }
 
 
@@ -556,12 +999,11 @@ DccThrottle *DccCommand::delete_throttle(int address)
 {
     for (DccThrottle *throttle : _throttles) {
         if (throttle->get_address() == address) {
-            delete_throttle(throttle);
-            return *_throttles.begin();
+            return delete_throttle(throttle);
         }
     }
     // not found
-    return *_throttles.begin();
+    return _throttles.empty() ? nullptr : _throttles.front();
 }
 
 
@@ -579,6 +1021,364 @@ void DccCommand::restart_throttles()
 }
 
 
+DccCommand::Consist *DccCommand::consist_find(int address)
+{
+    for (Consist &c : _consists)
+        if (c.address != 0 && c.address == address)
+            return &c;
+    return nullptr;
+}
+
+
+const DccCommand::Consist *DccCommand::consist_find(int address) const
+{
+    for (const Consist &c : _consists)
+        if (c.address != 0 && c.address == address)
+            return &c;
+    return nullptr;
+}
+
+
+DccCommand::Consist *DccCommand::consist_find_member(const DccThrottle *throttle)
+{
+    for (Consist &c : _consists) {
+        if (c.address == 0)
+            continue;
+        for (int i = 0; i < c.member_cnt; i++)
+            if (c.member[i] == throttle)
+                return &c;
+    }
+    return nullptr;
+}
+
+
+// Set up the members' throttles for the scheduler. Interrupts are disabled
+// since get_packet_ops() follows the station consist links.
+void DccCommand::consist_link(Consist &c)
+{
+    uint32_t save = save_and_disable_interrupts();
+    _consist_burst = nullptr;
+    for (int i = 0; i < c.member_cnt; i++) {
+        DccThrottle *t = c.member[i];
+        if (c.advanced) {
+            // own speed packets until it answers the consist address
+            t->speed_refresh(!c.cv19_ok[i]);
+            t->consist_next(nullptr);
+        } else {
+            // first member's speed packet brings the others along
+            t->speed_refresh(i == 0);
+            t->consist_next((i + 1 < c.member_cnt) ? c.member[i + 1] : nullptr);
+        }
+    }
+    restore_interrupts(save);
+}
+
+
+// Take member i out of the list (the throttle is not changed).
+void DccCommand::consist_drop(Consist &c, int i)
+{
+    for (int j = i + 1; j < c.member_cnt; j++) {
+        c.member[j - 1] = c.member[j];
+        c.reversed[j - 1] = c.reversed[j];
+        c.cv19_h[j - 1] = c.cv19_h[j];
+        c.cv19_ok[j - 1] = c.cv19_ok[j];
+    }
+    c.member_cnt--;
+}
+
+
+// Throttle back to normal, no longer in a consist.
+void DccCommand::consist_unlink(DccThrottle *throttle)
+{
+    uint32_t save = save_and_disable_interrupts();
+    _consist_burst = nullptr;
+    throttle->speed_refresh(true);
+    throttle->consist_next(nullptr);
+    restore_interrupts(save);
+}
+
+
+bool DccCommand::consist_create(int address, bool advanced)
+{
+    if (address < DccPkt::address_min || address > DccPkt::address_max)
+        return false;
+
+    // advanced consist addresses are 7 bits (CV19)
+    if (advanced && address > DccPkt::address_short_max)
+        return false;
+
+    if (consist_find(address) != nullptr)
+        return false;
+
+    Consist *c = nullptr;
+    for (Consist &s : _consists) {
+        if (s.address == 0) {
+            c = &s;
+            break;
+        }
+    }
+    if (c == nullptr)
+        return false;
+
+    // the address can't already be a member somewhere
+    DccThrottle *t = find_throttle(address);
+    if (t != nullptr && consist_find_member(t) != nullptr)
+        return false;
+
+    t = create_throttle(address);
+    if (t == nullptr)
+        return false;
+
+    c->advanced = advanced;
+    c->speed = 0;
+    c->member_cnt = 0;
+    if (advanced) {
+        c->throttle = t;
+    } else {
+        c->throttle = nullptr;
+        c->member[c->member_cnt] = t;
+        c->reversed[c->member_cnt] = false;
+        c->member_cnt++;
+    }
+    t->set_speed(0);
+    c->address = address;
+    consist_link(*c);
+
+    return true;
+}
+
+
+bool DccCommand::consist_delete(int address)
+{
+    Consist *c = consist_find(address);
+    if (c == nullptr)
+        return false;
+
+    // it goes even if a CV19 write can't be queued
+    bool ok = true;
+    while (c->member_cnt > 0)
+        ok &= consist_remove(address,
+                             c->member[c->member_cnt - 1]->get_address());
+
+    // an advanced consist's throttle is left; the caller can delete it
+    c->address = 0;
+    return ok;
+}
+
+
+bool DccCommand::consist_add(int address, int loco, bool reversed,
+                             DccCvAsync::done_t *done, void *arg)
+{
+    Consist *c = consist_find(address);
+    if (c == nullptr || c->member_cnt >= consist_member_max)
+        return false;
+
+    if (loco < DccPkt::address_min || loco > DccPkt::address_max ||
+        loco == address)
+        return false;
+
+    if (c->advanced && (_mode != Mode::OPS || _cv_async == nullptr))
+        return false; // can't write CV19
+
+    DccThrottle *t = find_throttle(loco);
+    if (t != nullptr && (consist_find_member(t) != nullptr ||
+                         consist_find(loco) != nullptr))
+        return false;
+
+    if (t == nullptr)
+        t = create_throttle(loco);
+    if (t == nullptr)
+        return false;
+
+    uint32_t cv19_h = 0;
+    if (c->advanced) {
+        Cv19Wait *w = nullptr;
+        for (Cv19Wait &s : _cv19_wait) {
+            if (s.handle == 0) {
+                w = &s;
+                break;
+            }
+        }
+        if (w == nullptr)
+            return false;
+        // S-9.2.2 CV19: consist address, bit 7 for reversed
+        cv19_h = _cv_async->ops_write_cv(
+            loco, 19, uint8_t(address | (reversed ? 0x80 : 0x00)), &cv19_done,
+            this);
+        if (cv19_h == 0)
+            return false; // the throttle (if new) is left; that's harmless
+        w->handle = cv19_h;
+        w->done = done;
+        w->arg = arg;
+        // its own speed packets stop it until cv19_result() links it
+        t->set_speed(0);
+    } else {
+        t->set_speed(reversed ? -c->speed : c->speed);
+    }
+
+    c->member[c->member_cnt] = t;
+    c->reversed[c->member_cnt] = reversed;
+    c->cv19_h[c->member_cnt] = cv19_h;
+    c->cv19_ok[c->member_cnt] = false;
+    c->member_cnt++;
+    consist_link(*c);
+
+    return true;
+}
+
+
+bool DccCommand::consist_remove(int address, int loco,
+                                DccCvAsync::done_t *done, void *arg)
+{
+    Consist *c = consist_find(address);
+    if (c == nullptr)
+        return false;
+
+    int i;
+    for (i = 0; i < c->member_cnt; i++)
+        if (c->member[i]->get_address() == loco)
+            break;
+    if (i >= c->member_cnt)
+        return false;
+
+    DccThrottle *t = c->member[i];
+    consist_drop(*c, i);
+
+    consist_unlink(t);
+    consist_link(*c);
+
+    bool ok = true;
+    if (c->advanced) {
+        ok = _cv_async != nullptr &&
+             _cv_async->ops_write_cv(loco, 19, 0, done, arg) != 0;
+        t->set_speed(0);
+    }
+
+    // a station consist is gone with its first member
+    if (!c->advanced && i == 0) {
+        while (c->member_cnt > 0) {
+            consist_unlink(c->member[c->member_cnt - 1]);
+            c->member_cnt--;
+        }
+        c->address = 0;
+    }
+
+    return ok;
+}
+
+
+void DccCommand::cv19_done(const DccCvEvent &ev, void *arg)
+{
+    ((DccCommand *)arg)->cv19_result(ev);
+}
+
+
+// An advanced consist member's CV19 write is done (called from
+// DccCvAsync::loop()). If the member was removed while it was pending,
+// there's nothing to do but pass the event on. The write back to 0 after a
+// failure has no wait slot, and its event is dropped.
+void DccCommand::cv19_result(const DccCvEvent &ev)
+{
+    Cv19Wait *w = nullptr;
+    for (Cv19Wait &s : _cv19_wait) {
+        if (s.handle == ev.handle) {
+            w = &s;
+            break;
+        }
+    }
+    if (w == nullptr)
+        return;
+    DccCvAsync::done_t *done = w->done;
+    void *arg = w->arg;
+    w->handle = 0;
+
+    for (Consist &c : _consists) {
+        if (c.address == 0 || !c.advanced)
+            continue;
+        int i;
+        for (i = 0; i < c.member_cnt; i++)
+            if (c.cv19_h[i] == ev.handle)
+                break;
+        if (i >= c.member_cnt)
+            continue;
+        if (ev.status == DccCvEvent::Status::OK) {
+            c.cv19_ok[i] = true;
+            consist_link(c);
+        } else {
+            DccThrottle *t = c.member[i];
+            consist_drop(c, i);
+            consist_unlink(t);
+            consist_link(c);
+            _cv_async->ops_write_cv(t->get_address(), 19, 0, &cv19_done,
+                                    this);
+        }
+        break;
+    }
+
+    if (done != nullptr)
+        (*done)(ev, arg);
+    else
+        _cv_async->put_event(ev);
+}
+
+
+bool DccCommand::consist_speed(int address, int speed)
+{
+    if (speed < DccPkt::speed_min || speed > DccPkt::speed_max)
+        return false;
+
+    Consist *c = consist_find(address);
+    if (c == nullptr)
+        return false;
+
+    c->speed = speed;
+    if (c->advanced) {
+        c->throttle->set_speed(speed);
+    } else {
+        for (int i = 0; i < c->member_cnt; i++)
+            c->member[i]->set_speed(c->reversed[i] ? -speed : speed);
+    }
+
+    return true;
+}
+
+
+// A throttle is being deleted.
+void DccCommand::consist_forget(DccThrottle *throttle)
+{
+    for (Consist &c : _consists) {
+        if (c.address == 0)
+            continue;
+        if (c.advanced && c.throttle == throttle) {
+            consist_delete(c.address);
+            continue;
+        }
+        for (int i = 0; i < c.member_cnt; i++) {
+            if (c.member[i] == throttle) {
+                consist_remove(c.address, throttle->get_address());
+                break;
+            }
+        }
+    }
+}
+
+
+void DccCommand::consist_show() const
+{
+    for (const Consist &c : _consists) {
+        if (c.address == 0)
+            continue;
+        printf("%4d: %s speed %d:", c.address,
+               c.advanced ? "advanced" : "station", c.speed);
+        for (int i = 0; i < c.member_cnt; i++)
+            printf(" %d%s%s", c.member[i]->get_address(),
+                   c.reversed[i] ? "r" : "",
+                   (c.advanced && !c.cv19_ok[i]) ? " (cv19 pending)" : "");
+        printf("\n");
+    }
+}
+
+
 void DccCommand::show()
 {
     if (_throttles.empty()) {
@@ -592,6 +1392,29 @@ void DccCommand::show()
 }
 
 
+void DccCommand::show_rc_stats()
+{
+    if (_throttles.empty()) {
+        printf("no throttles\n");
+        return;
+    }
+
+    char buf[96];
+    printf(" adrs%s\n", RailComStats::show_hdr());
+    for (DccThrottle *throttle : _throttles) {
+        printf("%5d%s\n", throttle->get_address(),
+               throttle->rc_stats().show(buf, sizeof(buf)));
+    }
+}
+
+
+void DccCommand::reset_rc_stats()
+{
+    for (DccThrottle *throttle : _throttles)
+        throttle->rc_stats().reset();
+}
+
+
 void DccCommand::assert_svc_idle()
 {
     assert(_mode == Mode::OFF);
@@ -0,0 +1,557 @@
+#include "dcc_cv_async.h"
+
+#include <cassert>
+#include <cstdint>
+
+#include "dcc_command.h"
+#include "dcc_cv.h"
+#include "dcc_ops_queue.h"
+#include "dcc_pkt.h"
+#include "hardware/timer.h"
+
+
+const char *DccCvEvent::op_name(Op op)
+{
+    switch (op) {
+        case Op::READ_CV:
+            return "read_cv";
+        case Op::READ_BIT:
+            return "read_bit";
+        case Op::WRITE_CV:
+            return "write_cv";
+        case Op::WRITE_BIT:
+            return "write_bit";
+        case Op::READ_ADDRESS:
+            return "read_address";
+        case Op::WRITE_ADDRESS:
+            return "write_address";
+        default:
+            return "?";
+    }
+}
+
+
+const char *DccCvEvent::status_name(Status status)
+{
+    switch (status) {
+        case Status::OK:
+            return "ok";
+        case Status::FAILED:
+            return "failed";
+        case Status::CANCELLED:
+            return "cancelled";
+        default:
+            return "?";
+    }
+}
+
+
+DccCvAsync::DccCvAsync(DccCommand &command, DccOpsQueue &queue) :
+    _command(command),
+    _queue(queue),
+    _retry_max(0),
+    _handle_next(1),
+    _svc_wait_cnt(0),
+    _svc_act(-1),
+    _event_put(0),
+    _event_get(0),
+    _event_cnt(0),
+    _ok_cnt(0),
+    _err_cnt(0),
+    _drop_cnt(0)
+{
+    for (int i = 0; i < req_max; i++)
+        _reqs[i].handle = 0;
+
+    _queue.on_job_done(&job_done, this);
+}
+
+
+DccCvAsync::~DccCvAsync()
+{
+    _queue.on_job_done(nullptr);
+}
+
+
+DccCvAsync::Req *DccCvAsync::alloc(DccCvEvent::Op op, int address, int cv_num,
+                                   int bit_num, int value, done_t *done,
+                                   void *arg)
+{
+    Req *r = nullptr;
+    for (int i = 0; i < req_max; i++) {
+        if (_reqs[i].handle == 0) {
+            r = &_reqs[i];
+            break;
+        }
+    }
+    if (r == nullptr)
+        return nullptr;
+
+    r->handle = _handle_next;
+    if (++_handle_next == 0)
+        _handle_next = 1;
+
+    DccCvEvent &ev = r->ev;
+    ev.handle = r->handle;
+    ev.op = op;
+    ev.status = DccCvEvent::Status::FAILED;
+    ev.address = address;
+    ev.cv_num = cv_num;
+    ev.bit_num = bit_num;
+    ev.value = value;
+    ev.retries = 0;
+    ev.queued_us = time_us_32();
+    ev.start_us = ev.queued_us;
+    ev.done_us = 0;
+
+    r->done = done;
+    r->arg = arg;
+    r->retry_max = _retry_max;
+    r->retry = 0;
+    r->job_done = false;
+
+    return r;
+}
+
+
+DccCvAsync::Req *DccCvAsync::find(uint32_t handle)
+{
+    if (handle == 0)
+        return nullptr;
+    for (int i = 0; i < req_max; i++)
+        if (_reqs[i].handle == handle)
+            return &_reqs[i];
+    return nullptr;
+}
+
+
+// Set the request's next command.
+void DccCvAsync::step(Req &r, DccCvEvent::Op op, int cv_num, int bit_num,
+                      int val)
+{
+    r.step_op = op;
+    r.step_cv = cv_num;
+    r.step_bit = bit_num;
+    r.step_val = uint8_t(val);
+    r.retry = 0;
+}
+
+
+// The request's current command succeeded (val is what was read, if it was a
+// read). Set up the next command and return true, or return false if the
+// operation is finished.
+bool DccCvAsync::step_next(Req &r, uint8_t val)
+{
+    DccCvEvent &ev = r.ev;
+
+    if (ev.op == DccCvEvent::Op::READ_ADDRESS) {
+        if (r.step_cv == DccCv::config) {
+            // bit 5: 0 = short address, 1 = long address
+            if (val == 0)
+                step(r, DccCvEvent::Op::READ_CV, DccCv::address);
+            else
+                step(r, DccCvEvent::Op::READ_CV, DccCv::address_lo);
+            return true;
+        } else if (r.step_cv == DccCv::address) {
+            ev.value = val;
+            return false;
+        } else if (r.step_cv == DccCv::address_lo) {
+            ev.value = val;
+            step(r, DccCvEvent::Op::READ_CV, DccCv::address_hi);
+            return true;
+        } else {
+            assert(r.step_cv == DccCv::address_hi);
+            ev.value |= (int(val & ~0xc0) << 8);
+            return false;
+        }
+    } else if (ev.op == DccCvEvent::Op::WRITE_ADDRESS) {
+        if (r.step_cv == DccCv::address) {
+            // short address written, clear CV29 bit 5
+            step(r, DccCvEvent::Op::WRITE_BIT, DccCv::config, 5, 0);
+            return true;
+        } else if (r.step_cv == DccCv::address_lo) {
+            step(r, DccCvEvent::Op::WRITE_CV, DccCv::address_hi, 0,
+                 (ev.value >> 8) | 0xc0);
+            return true;
+        } else if (r.step_cv == DccCv::address_hi) {
+            // long address written, set CV29 bit 5
+            step(r, DccCvEvent::Op::WRITE_BIT, DccCv::config, 5, 1);
+            return true;
+        } else {
+            assert(r.step_cv == DccCv::config);
+            return false;
+        }
+    } else {
+        if (ev.op == DccCvEvent::Op::READ_CV ||
+            ev.op == DccCvEvent::Op::READ_BIT)
+            ev.value = val;
+        return false;
+    }
+}
+
+
+uint32_t DccCvAsync::svc_read_cv(int cv_num, done_t *done, void *arg)
+{
+    if (cv_num < DccPkt::cv_num_min || cv_num > DccPkt::cv_num_max)
+        return 0;
+
+    Req *r = alloc(DccCvEvent::Op::READ_CV, -1, cv_num, 0, 0, done, arg);
+    if (r == nullptr)
+        return 0;
+    step(*r, DccCvEvent::Op::READ_CV, cv_num);
+    return svc_queue(r);
+}
+
+
+uint32_t DccCvAsync::svc_read_bit(int cv_num, int bit_num, done_t *done,
+                                  void *arg)
+{
+    if (cv_num < DccPkt::cv_num_min || cv_num > DccPkt::cv_num_max)
+        return 0;
+
+    if (bit_num < 0 || bit_num > 7)
+        return 0;
+
+    Req *r =
+        alloc(DccCvEvent::Op::READ_BIT, -1, cv_num, bit_num, 0, done, arg);
+    if (r == nullptr)
+        return 0;
+    step(*r, DccCvEvent::Op::READ_BIT, cv_num, bit_num);
+    return svc_queue(r);
+}
+
+
+uint32_t DccCvAsync::svc_write_cv(int cv_num, uint8_t cv_val, done_t *done,
+                                  void *arg)
+{
+    if (cv_num < DccPkt::cv_num_min || cv_num > DccPkt::cv_num_max)
+        return 0;
+
+    Req *r =
+        alloc(DccCvEvent::Op::WRITE_CV, -1, cv_num, 0, cv_val, done, arg);
+    if (r == nullptr)
+        return 0;
+    step(*r, DccCvEvent::Op::WRITE_CV, cv_num, 0, cv_val);
+    return svc_queue(r);
+}
+
+
+uint32_t DccCvAsync::svc_write_bit(int cv_num, int bit_num, int bit_val,
+                                   done_t *done, void *arg)
+{
+    if (cv_num < DccPkt::cv_num_min || cv_num > DccPkt::cv_num_max)
+        return 0;
+
+    if (bit_num < 0 || bit_num > 7 || bit_val < 0 || bit_val > 1)
+        return 0;
+
+    Req *r = alloc(DccCvEvent::Op::WRITE_BIT, -1, cv_num, bit_num, bit_val,
+                   done, arg);
+    if (r == nullptr)
+        return 0;
+    step(*r, DccCvEvent::Op::WRITE_BIT, cv_num, bit_num, bit_val);
+    return svc_queue(r);
+}
+
+
+uint32_t DccCvAsync::svc_read_address(done_t *done, void *arg)
+{
+    Req *r = alloc(DccCvEvent::Op::READ_ADDRESS, -1, DccCv::config, 5, 0,
+                   done, arg);
+    if (r == nullptr)
+        return 0;
+    step(*r, DccCvEvent::Op::READ_BIT, DccCv::config, 5);
+    return svc_queue(r);
+}
+
+
+// Short address (<= 127): write CV1, then clear CV29 bit 5.
+// Long address: write CV18 and CV17, then set CV29 bit 5.
+uint32_t DccCvAsync::svc_write_address(int address, done_t *done, void *arg)
+{
+    if (address < DccPkt::address_min || address > DccPkt::address_max)
+        return 0;
+
+    Req *r = alloc(DccCvEvent::Op::WRITE_ADDRESS, -1, DccCv::address, 0,
+                   address, done, arg);
+    if (r == nullptr)
+        return 0;
+    if (address <= 127)
+        step(*r, DccCvEvent::Op::WRITE_CV, DccCv::address, 0, address);
+    else
+        step(*r, DccCvEvent::Op::WRITE_CV, DccCv::address_lo, 0,
+             address & 0xff);
+    return svc_queue(r);
+}
+
+
+uint32_t DccCvAsync::svc_queue(Req *r)
+{
+    assert(_svc_wait_cnt < req_max);
+    _svc_wait[_svc_wait_cnt++] = int(r - _reqs);
+    return r->handle;
+}
+
+
+void DccCvAsync::svc_issue(Req &r)
+{
+    switch (r.step_op) {
+        case DccCvEvent::Op::READ_CV:
+            _command.read_cv(r.step_cv);
+            break;
+        case DccCvEvent::Op::READ_BIT:
+            _command.read_bit(r.step_cv, r.step_bit);
+            break;
+        case DccCvEvent::Op::WRITE_CV:
+            _command.write_cv(r.step_cv, r.step_val);
+            break;
+        default:
+            assert(r.step_op == DccCvEvent::Op::WRITE_BIT);
+            _command.write_bit(r.step_cv, r.step_bit, r.step_val);
+            break;
+    }
+}
+
+
+void DccCvAsync::svc_loop()
+{
+    if (_svc_act >= 0) {
+        Req &r = _reqs[_svc_act];
+        bool result;
+        uint8_t val = 0;
+        if (!_command.svc_done(result, val))
+            return;
+        if (!result && r.retry < r.retry_max) {
+            r.retry++;
+            r.ev.retries++;
+            svc_issue(r);
+            return;
+        }
+        if (result && step_next(r, val)) {
+            svc_issue(r);
+            return;
+        }
+        _svc_act = -1;
+        complete(r, result ? DccCvEvent::Status::OK
+                           : DccCvEvent::Status::FAILED);
+    }
+
+    // start the next one (a callback above might have queued one)
+    while (_svc_act < 0 && _svc_wait_cnt > 0) {
+        int i = _svc_wait[0];
+        for (int w = 1; w < _svc_wait_cnt; w++)
+            _svc_wait[w - 1] = _svc_wait[w];
+        _svc_wait_cnt--;
+        Req &r = _reqs[i];
+        if (_command.mode() != DccCommand::Mode::OFF &&
+            !_command.svc_session()) {
+            complete(r, DccCvEvent::Status::FAILED);
+            continue;
+        }
+        r.ev.start_us = time_us_32();
+        _svc_act = i;
+        svc_issue(r);
+    }
+}
+
+
+uint32_t DccCvAsync::ops_read_cv(int address, int cv_num, done_t *done,
+                                 void *arg)
+{
+    Req *r =
+        alloc(DccCvEvent::Op::READ_CV, address, cv_num, 0, 0, done, arg);
+    if (r == nullptr)
+        return 0;
+    step(*r, DccCvEvent::Op::READ_CV, cv_num);
+    return ops_queue(r);
+}
+
+
+uint32_t DccCvAsync::ops_write_cv(int address, int cv_num, uint8_t cv_val,
+                                  done_t *done, void *arg)
+{
+    Req *r = alloc(DccCvEvent::Op::WRITE_CV, address, cv_num, 0, cv_val,
+                   done, arg);
+    if (r == nullptr)
+        return 0;
+    step(*r, DccCvEvent::Op::WRITE_CV, cv_num, 0, cv_val);
+    return ops_queue(r);
+}
+
+
+uint32_t DccCvAsync::ops_write_bit(int address, int cv_num, int bit_num,
+                                   int bit_val, done_t *done, void *arg)
+{
+    Req *r = alloc(DccCvEvent::Op::WRITE_BIT, address, cv_num, bit_num,
+                   bit_val, done, arg);
+    if (r == nullptr)
+        return 0;
+    step(*r, DccCvEvent::Op::WRITE_BIT, cv_num, bit_num, bit_val);
+    return ops_queue(r);
+}
+
+
+// The queue checks the arguments; if it doesn't take the job, the request
+// is freed and 0 returned.
+uint32_t DccCvAsync::ops_queue(Req *r)
+{
+    if (!ops_issue(*r)) {
+        r->handle = 0;
+        return 0;
+    }
+    return r->handle;
+}
+
+
+bool DccCvAsync::ops_issue(Req &r)
+{
+    int address = r.ev.address;
+    switch (r.step_op) {
+        case DccCvEvent::Op::READ_CV:
+            return _queue.read_cv(address, r.step_cv, r.handle);
+        case DccCvEvent::Op::WRITE_CV:
+            return _queue.write_cv(address, r.step_cv, r.step_val, r.handle);
+        default:
+            assert(r.step_op == DccCvEvent::Op::WRITE_BIT);
+            return _queue.write_bit(address, r.step_cv, r.step_bit,
+                                    r.step_val, r.handle);
+    }
+}
+
+
+// Called from the queue's loop(). Only note the result here; retrying or
+// calling the operation's callback (which might queue more jobs) is done
+// after the queue's loop() returns.
+void DccCvAsync::job_done(const DccOpsJob &job, void *arg)
+{
+    DccCvAsync *me = static_cast<DccCvAsync *>(arg);
+    Req *r = me->find(job.tag);
+    if (r == nullptr)
+        return; // not ours
+    r->job_done = true;
+    r->job_result = job.result;
+    r->job_val = job.cv_val;
+}
+
+
+void DccCvAsync::ops_loop()
+{
+    for (int i = 0; i < req_max; i++) {
+        Req &r = _reqs[i];
+        if (r.handle == 0 || !r.job_done)
+            continue;
+        r.job_done = false;
+        if (!r.job_result && r.retry < r.retry_max) {
+            r.retry++;
+            r.ev.retries++;
+            if (ops_issue(r))
+                continue;
+        }
+        if (r.job_result)
+            step_next(r, r.job_val);
+        complete(r, r.job_result ? DccCvEvent::Status::OK
+                                 : DccCvEvent::Status::FAILED);
+    }
+}
+
+
+bool DccCvAsync::cancel(uint32_t handle)
+{
+    for (int w = 0; w < _svc_wait_cnt; w++) {
+        Req &r = _reqs[_svc_wait[w]];
+        if (r.handle != handle)
+            continue;
+        for (w++; w < _svc_wait_cnt; w++)
+            _svc_wait[w - 1] = _svc_wait[w];
+        _svc_wait_cnt--;
+        complete(r, DccCvEvent::Status::CANCELLED);
+        return true;
+    }
+    return false;
+}
+
+
+bool DccCvAsync::pending(uint32_t handle) const
+{
+    if (handle == 0)
+        return false;
+    for (int i = 0; i < req_max; i++)
+        if (_reqs[i].handle == handle)
+            return true;
+    return false;
+}
+
+
+int DccCvAsync::pending_cnt() const
+{
+    int cnt = 0;
+    for (int i = 0; i < req_max; i++)
+        if (_reqs[i].handle != 0)
+            cnt++;
+    return cnt;
+}
+
+
+// The request is freed before the callback is called, so the callback can
+// queue another operation in its place.
+void DccCvAsync::complete(Req &r, DccCvEvent::Status status)
+{
+    DccCvEvent ev = r.ev;
+    ev.status = status;
+    ev.cv_num = r.step_cv;
+    ev.bit_num = r.step_bit;
+    ev.done_us = time_us_32();
+
+    done_t *done = r.done;
+    void *arg = r.arg;
+    r.handle = 0;
+
+    if (status == DccCvEvent::Status::OK)
+        _ok_cnt++;
+    else if (status == DccCvEvent::Status::FAILED)
+        _err_cnt++;
+
+    if (done != nullptr)
+        (*done)(ev, arg);
+    else
+        put_event(ev);
+}
+
+
+void DccCvAsync::put_event(const DccCvEvent &ev)
+{
+    if (_event_cnt >= event_max) {
+        // ring full, drop oldest
+        if (++_event_get >= event_max)
+            _event_get = 0;
+        _event_cnt--;
+        _drop_cnt++;
+    }
+
+    _events[_event_put] = ev;
+    if (++_event_put >= event_max)
+        _event_put = 0;
+    _event_cnt++;
+}
+
+
+bool DccCvAsync::get_event(DccCvEvent &ev)
+{
+    if (_event_cnt == 0)
+        return false;
+
+    ev = _events[_event_get];
+    if (++_event_get >= event_max)
+        _event_get = 0;
+    _event_cnt--;
+
+    return true;
+}
+
+
+void DccCvAsync::loop()
+{
+    _queue.loop();
+    ops_loop();
+    svc_loop();
+}
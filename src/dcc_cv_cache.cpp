@@ -0,0 +1,420 @@
+#include "dcc_cv_cache.h"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "dcc_pkt.h"
+#include "pico/types.h" // uint
+
+
+/////////////////////////////////////////////////////////////////////////////
+// RAM store
+/////////////////////////////////////////////////////////////////////////////
+
+
+DccCvStoreRam::DccCvStoreRam(int sector_cnt) :
+    _sector_cnt(sector_cnt),
+    _mem(new uint8_t[sector_cnt * sector_size]),
+    _erase_cnt(0),
+    _program_cnt(0)
+{
+    assert(sector_cnt >= 2);
+    memset(_mem, 0xff, sector_cnt * sector_size);
+}
+
+
+DccCvStoreRam::~DccCvStoreRam()
+{
+    delete[] _mem;
+}
+
+
+void DccCvStoreRam::read(uint32_t off, void *buf, uint32_t len) const
+{
+    assert(off + len <= _sector_cnt * sector_size);
+    memcpy(buf, _mem + off, len);
+}
+
+
+void DccCvStoreRam::erase(uint32_t off)
+{
+    assert((off % sector_size) == 0);
+    assert(off < _sector_cnt * sector_size);
+    memset(_mem + off, 0xff, sector_size);
+    _erase_cnt++;
+}
+
+
+void DccCvStoreRam::program(uint32_t off, const uint8_t *buf)
+{
+    assert((off % page_size) == 0);
+    assert(off < _sector_cnt * sector_size);
+    // like flash, programming can only clear bits
+    for (uint32_t i = 0; i < page_size; i++)
+        _mem[off + i] &= buf[i];
+    _program_cnt++;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Cache
+/////////////////////////////////////////////////////////////////////////////
+
+
+DccCvCache::DccCvCache(DccCvStore *store) :
+    _store(store),
+    _entry_cnt(0),
+    _dirty_cnt(0),
+    _hit_cnt(0),
+    _miss_cnt(0),
+    _sector(-1),
+    _seq(0),
+    _log_off(0),
+    _compact_need(false),
+    _page_off(UINT32_MAX)
+{
+}
+
+
+DccCvCache::~DccCvCache()
+{
+}
+
+
+const char *DccCvCache::trust_name(Trust trust)
+{
+    switch (trust) {
+        case Trust::NONE:
+            return "none";
+        case Trust::DEFAULT:
+            return "default";
+        case Trust::WRITTEN:
+            return "written";
+        case Trust::READ:
+            return "read";
+        default:
+            return "?";
+    }
+}
+
+
+bool DccCvCache::cacheable(int cv_num)
+{
+    if (cv_num < DccPkt::cv_num_min || cv_num > DccPkt::cv_num_max)
+        return false;
+    // indexed cvs (CV31/CV32 page)
+    if (257 <= cv_num && cv_num <= 512)
+        return false;
+    return true;
+}
+
+
+DccCvCache::Entry *DccCvCache::find(int address, int mfg, int cv_num)
+{
+    for (int i = 0; i < _entry_cnt; i++) {
+        Entry &e = _entries[i];
+        if (e.address == address && e.mfg == mfg && e.cv_num == cv_num)
+            return &e;
+    }
+    return nullptr;
+}
+
+
+const DccCvCache::Entry *DccCvCache::find(int address, int mfg,
+                                          int cv_num) const
+{
+    return const_cast<DccCvCache *>(this)->find(address, mfg, cv_num);
+}
+
+
+bool DccCvCache::get(int address, int mfg, int cv_num, uint8_t &val,
+                     Trust &trust) const
+{
+    const Entry *e = find(address, mfg, cv_num);
+    if (e == nullptr)
+        return false;
+    val = e->val;
+    trust = e->trust;
+    return true;
+}
+
+
+bool DccCvCache::lookup(int address, int mfg, int cv_num, uint8_t &val)
+{
+    const Entry *e = find(address, mfg, cv_num);
+    if (e == nullptr || e->trust < Trust::WRITTEN) {
+        _miss_cnt++;
+        return false;
+    }
+    val = e->val;
+    _hit_cnt++;
+    return true;
+}
+
+
+bool DccCvCache::write_needed(int address, int mfg, int cv_num,
+                              uint8_t val) const
+{
+    if (cv_num == 8)
+        return true; // decoder reset, not a value
+    const Entry *e = find(address, mfg, cv_num);
+    return e == nullptr || e->trust < Trust::WRITTEN || e->val != val;
+}
+
+
+bool DccCvCache::set(int address, int mfg, int cv_num, uint8_t val,
+                     Trust trust)
+{
+    if (address < 0 || address > DccPkt::address_max)
+        return false;
+    if (mfg < 0 || mfg > 255)
+        return false;
+    if (!cacheable(cv_num))
+        return false;
+
+    if (trust == Trust::NONE) {
+        forget(address, mfg, cv_num);
+        return true;
+    }
+
+    if (cv_num == 8 && trust == Trust::WRITTEN) {
+        // decoder reset; everything it had is back to defaults
+        forget(address, mfg);
+        return true;
+    }
+
+    Entry *e = find(address, mfg, cv_num);
+
+    if (e == nullptr) {
+        if (_entry_cnt >= entry_max)
+            return false;
+        e = &_entries[_entry_cnt++];
+        e->address = address;
+        e->mfg = mfg;
+        e->cv_num = cv_num;
+        e->dirty = false;
+        e->stored = false;
+    } else if (trust == Trust::DEFAULT && e->trust > Trust::DEFAULT) {
+        return true; // an assumption doesn't replace what is known
+    } else if (e->trust == trust && e->val == val) {
+        return true; // no change
+    }
+
+    e->trust = trust;
+    e->val = val;
+    if (!e->dirty) {
+        e->dirty = true;
+        _dirty_cnt++;
+    }
+
+    return true;
+}
+
+
+void DccCvCache::remove(int idx)
+{
+    assert(0 <= idx && idx < _entry_cnt);
+    if (_entries[idx].dirty)
+        _dirty_cnt--;
+    if (_entries[idx].stored)
+        _compact_need = true; // else load() would bring it back
+    _entries[idx] = _entries[--_entry_cnt];
+}
+
+
+void DccCvCache::forget(int address, int mfg, int cv_num)
+{
+    int i = 0;
+    while (i < _entry_cnt) {
+        Entry &e = _entries[i];
+        if (e.address == address && e.mfg == mfg &&
+            (cv_num < 0 || e.cv_num == cv_num))
+            remove(i); // moves the last one to i
+        else
+            i++;
+    }
+}
+
+
+uint8_t DccCvCache::check(const Record &rec)
+{
+    const uint8_t *b = (const uint8_t *)&rec;
+    uint8_t c = 0xa5;
+    for (unsigned i = 0; i < sizeof(rec) - 1; i++)
+        c ^= b[i];
+    return c;
+}
+
+
+bool DccCvCache::load()
+{
+    _entry_cnt = 0;
+    _dirty_cnt = 0;
+    _sector = -1;
+    _compact_need = false;
+    _page_off = UINT32_MAX;
+
+    if (_store == nullptr)
+        return false;
+
+    // find the sector with the newest header
+    for (int s = 0; s < _store->sector_cnt(); s++) {
+        Header hdr;
+        _store->read(s * DccCvStore::sector_size, &hdr, sizeof(hdr));
+        if (hdr.magic != magic)
+            continue;
+        if (_sector < 0 || int32_t(hdr.seq - _seq) > 0) {
+            _sector = s;
+            _seq = hdr.seq;
+        }
+    }
+
+    if (_sector < 0)
+        return false;
+
+    // replay its records
+    uint32_t base = _sector * DccCvStore::sector_size;
+    uint32_t end = base + DccCvStore::sector_size;
+    _log_off = base + sizeof(Header);
+    while (_log_off < end) {
+        Record rec;
+        _store->read(_log_off, &rec, sizeof(rec));
+        const uint8_t *b = (const uint8_t *)&rec;
+        unsigned i;
+        for (i = 0; i < sizeof(rec) && b[i] == 0xff; i++)
+            ;
+        if (i == sizeof(rec))
+            break; // end of log
+        _log_off += sizeof(rec);
+        if (rec.check != check(rec) || rec.trust > uint8_t(Trust::READ))
+            continue; // interrupted program?
+        set(rec.address, rec.mfg, rec.cv_num, rec.val, Trust(rec.trust));
+    }
+
+    // everything just loaded is in the store
+    for (int i = 0; i < _entry_cnt; i++) {
+        _entries[i].dirty = false;
+        _entries[i].stored = true;
+    }
+    _dirty_cnt = 0;
+    _compact_need = false;
+
+    return true;
+}
+
+
+// Add a record at _log_off. Records are collected in _page and programmed a
+// page at a time; bytes of the page not being written are left 0xff so they
+// don't change what's already there.
+void DccCvCache::append(const Record &rec)
+{
+    uint32_t page_off = _log_off & ~(DccCvStore::page_size - 1);
+    if (page_off != _page_off) {
+        append_done();
+        memset(_page, 0xff, sizeof(_page));
+        _page_off = page_off;
+    }
+    memcpy(_page + (_log_off - page_off), &rec, sizeof(rec));
+    _log_off += sizeof(rec);
+}
+
+
+void DccCvCache::append_done()
+{
+    if (_page_off == UINT32_MAX)
+        return;
+    _store->program(_page_off, _page);
+    _page_off = UINT32_MAX;
+}
+
+
+// Write the whole cache to the next sector. The header goes last, so if this
+// is interrupted the old sector is still the newest valid one.
+void DccCvCache::compact()
+{
+    int sector = (_sector < 0) ? 0 : (_sector + 1) % _store->sector_cnt();
+    uint32_t base = sector * DccCvStore::sector_size;
+
+    _store->erase(base);
+
+    _log_off = base + sizeof(Header);
+    for (int i = 0; i < _entry_cnt; i++) {
+        Entry &e = _entries[i];
+        Record rec = {e.address, e.cv_num, e.mfg, uint8_t(e.trust), e.val, 0};
+        rec.check = check(rec);
+        append(rec);
+        e.dirty = false;
+        e.stored = true;
+    }
+    append_done();
+
+    Header hdr = {magic, _seq + 1};
+    memset(_page, 0xff, sizeof(_page));
+    memcpy(_page, &hdr, sizeof(hdr));
+    _store->program(base, _page);
+
+    _sector = sector;
+    _seq = hdr.seq;
+    _dirty_cnt = 0;
+    _compact_need = false;
+}
+
+
+bool DccCvCache::flush()
+{
+    if (_store == nullptr)
+        return false;
+
+    if (!dirty())
+        return true;
+
+    uint32_t end = (_sector + 1) * DccCvStore::sector_size;
+
+    if (_sector < 0 || _compact_need ||
+        (_log_off + _dirty_cnt * sizeof(Record)) > end) {
+        compact();
+        return true;
+    }
+
+    for (int i = 0; i < _entry_cnt; i++) {
+        Entry &e = _entries[i];
+        if (!e.dirty)
+            continue;
+        Record rec = {e.address, e.cv_num, e.mfg, uint8_t(e.trust), e.val, 0};
+        rec.check = check(rec);
+        append(rec);
+        e.dirty = false;
+        e.stored = true;
+    }
+    append_done();
+    _dirty_cnt = 0;
+
+    return true;
+}
+
+
+void DccCvCache::show(int address, int mfg) const
+{
+    int cnt = 0;
+    for (int i = 0; i < _entry_cnt; i++) {
+        const Entry &e = _entries[i];
+        if (address >= 0 && (e.address != address || e.mfg != mfg))
+            continue;
+        printf("%u/%u cv %u = %u (%s)%s\n", uint(e.address), uint(e.mfg),
+               uint(e.cv_num), uint(e.val), trust_name(e.trust),
+               e.dirty ? " *" : "");
+        cnt++;
+    }
+    printf("%d cvs, %d of %d entries used, %lu hits, %lu misses", cnt,
+           _entry_cnt, entry_max, _hit_cnt, _miss_cnt);
+    if (_store != nullptr) {
+        if (_sector >= 0)
+            printf(", log sector %d seq %lu at %lu", _sector, _seq,
+                   _log_off - _sector * DccCvStore::sector_size);
+        else
+            printf(", log empty");
+    }
+    printf("\n");
+}
@@ -0,0 +1,46 @@
+#include "dcc_cv_cache.h"
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+
+// DccCvStoreFlash is here, apart from the rest of the cache, so the cache
+// and DccCvStoreRam build without the SDK (see host/).
+
+
+DccCvStoreFlash::DccCvStoreFlash(uint32_t flash_off, int sector_cnt) :
+    _flash_off(flash_off),
+    _sector_cnt(sector_cnt)
+{
+    static_assert(sector_size == FLASH_SECTOR_SIZE);
+    static_assert(page_size == FLASH_PAGE_SIZE);
+    assert((flash_off % sector_size) == 0);
+    assert(sector_cnt >= 2);
+}
+
+
+void DccCvStoreFlash::read(uint32_t off, void *buf, uint32_t len) const
+{
+    memcpy(buf, (const void *)(uintptr_t(XIP_BASE) + _flash_off + off), len);
+}
+
+
+void DccCvStoreFlash::erase(uint32_t off)
+{
+    assert((off % sector_size) == 0);
+    uint32_t irq = save_and_disable_interrupts();
+    flash_range_erase(_flash_off + off, sector_size);
+    restore_interrupts(irq);
+}
+
+
+void DccCvStoreFlash::program(uint32_t off, const uint8_t *buf)
+{
+    assert((off % page_size) == 0);
+    uint32_t irq = save_and_disable_interrupts();
+    flash_range_program(_flash_off + off, buf, page_size);
+    restore_interrupts(irq);
+}
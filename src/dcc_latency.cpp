@@ -0,0 +1,115 @@
+#include "dcc_latency.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "dcc_spec.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/systick.h"
+
+
+uint32_t DccLatency::_hist[path_cnt][bucket_cnt];
+uint32_t DccLatency::_max[path_cnt];
+uint32_t DccLatency::_over[path_cnt];
+uint32_t DccLatency::_over_cyc = UINT32_MAX;
+uint32_t DccLatency::_cyc_per_us = 0;
+
+
+void DccLatency::init()
+{
+    _cyc_per_us = clock_get_hz(clk_sys) / 1000000;
+    _over_cyc = DccSpec::t1_nom_us * _cyc_per_us;
+
+    if ((systick_hw->csr & 1) == 0) {
+        systick_hw->rvr = 0x00ffffff;
+        systick_hw->cvr = 0;
+        systick_hw->csr = 0x5; // enable, processor clock, no interrupt
+    }
+}
+
+
+void DccLatency::reset()
+{
+    memset(_hist, 0, sizeof(_hist));
+    memset(_max, 0, sizeof(_max));
+    memset(_over, 0, sizeof(_over));
+}
+
+
+uint32_t DccLatency::cnt(Path path)
+{
+    uint32_t n = 0;
+    for (int b = 0; b < bucket_cnt; b++)
+        n += _hist[path][b];
+    return n;
+}
+
+
+uint32_t DccLatency::percentile(Path path, int pct)
+{
+    uint32_t n = cnt(path);
+    if (n == 0)
+        return 0;
+
+    // runs at or under the answer: at least pct percent, rounded up
+    uint64_t want = (uint64_t(n) * pct + 99) / 100;
+    uint64_t sum = 0;
+    for (int b = 0; b < bucket_cnt; b++) {
+        sum += _hist[path][b];
+        if (sum >= want) {
+            uint32_t top = (b == 0) ? 0 : ((1u << b) - 1);
+            // the max is exact, and might be under the top of its bucket
+            return (top < _max[path]) ? top : _max[path];
+        }
+    }
+    return _max[path];
+}
+
+
+const char *DccLatency::name(Path path)
+{
+    switch (path) {
+        case NEXT_BIT:
+            return "next_bit";
+        case GET_PACKET:
+            return "get_packet";
+        case RAILCOM_READ:
+            return "railcom_read";
+        case RAILCOM_PARSE:
+            return "railcom_parse";
+        case THROTTLE_RAILCOM:
+            return "throttle_railcom";
+        case ADC_LOOP:
+            return "adc_loop";
+        default:
+            return "?";
+    }
+}
+
+
+void DccLatency::show()
+{
+#ifndef INCLUDE_LATENCY
+    printf("latency probes not compiled in\n");
+#endif
+
+    printf("%-16s %9s %7s %7s %7s %6s  (cycles, %lu/us; over is > %lu)\n",
+           "path", "runs", "p50", "p99", "max", "over", _cyc_per_us,
+           _over_cyc);
+    for (int p = 0; p < path_cnt; p++) {
+        Path path = Path(p);
+        printf("%-16s %9lu %7lu %7lu %7lu %6lu%s\n", name(path), cnt(path),
+               percentile(path, 50), percentile(path, 99), _max[p], _over[p],
+               (_over[p] != 0) ? "  OVER" : "");
+    }
+
+    // histograms, buckets that have anything
+    for (int p = 0; p < path_cnt; p++) {
+        printf("%s:", name(Path(p)));
+        for (int b = 0; b < bucket_cnt; b++)
+            if (_hist[p][b] != 0)
+                printf(" <%lu:%lu", 1ul << b, _hist[p][b]);
+        printf("\n");
+    }
+}
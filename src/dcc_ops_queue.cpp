@@ -0,0 +1,264 @@
+#include "dcc_ops_queue.h"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+
+#include "dcc_command.h"
+#include "dcc_pkt.h"
+#include "dcc_throttle.h"
+#include "hardware/timer.h"
+
+
+DccOpsQueue::DccOpsQueue(DccCommand &command) :
+    _command(command),
+    _wait_cnt(0),
+    _act_cnt(0),
+    _done_put(0),
+    _done_get(0),
+    _done_cnt(0),
+    _job_done(nullptr),
+    _job_done_arg(nullptr)
+{
+    reset_stats();
+}
+
+
+DccOpsQueue::~DccOpsQueue()
+{
+}
+
+
+bool DccOpsQueue::read_cv(int address, int cv_num, uint32_t tag)
+{
+    if (cv_num < DccPkt::cv_num_min || cv_num > DccPkt::cv_num_max)
+        return false;
+
+    DccOpsJob job;
+    job.op = DccOpsJob::Op::READ_CV;
+    job.address = address;
+    job.cv_num = cv_num;
+    job.bit_num = 0;
+    job.cv_val = 0;
+    job.tag = tag;
+    return queue(job);
+}
+
+
+bool DccOpsQueue::write_cv(int address, int cv_num, uint8_t cv_val,
+                           uint32_t tag)
+{
+    if (cv_num < DccPkt::cv_num_min || cv_num > DccPkt::cv_num_max)
+        return false;
+
+    DccOpsJob job;
+    job.op = DccOpsJob::Op::WRITE_CV;
+    job.address = address;
+    job.cv_num = cv_num;
+    job.bit_num = 0;
+    job.cv_val = cv_val;
+    job.tag = tag;
+    return queue(job);
+}
+
+
+bool DccOpsQueue::write_bit(int address, int cv_num, int bit_num, int bit_val,
+                            uint32_t tag)
+{
+    if (cv_num < DccPkt::cv_num_min || cv_num > DccPkt::cv_num_max)
+        return false;
+
+    if (bit_num < 0 || bit_num > 7 || bit_val < 0 || bit_val > 1)
+        return false;
+
+    DccOpsJob job;
+    job.op = DccOpsJob::Op::WRITE_BIT;
+    job.address = address;
+    job.cv_num = cv_num;
+    job.bit_num = bit_num;
+    job.cv_val = uint8_t(bit_val);
+    job.tag = tag;
+    return queue(job);
+}
+
+
+bool DccOpsQueue::queue(const DccOpsJob &job)
+{
+    if (job.address < DccPkt::address_min || job.address > DccPkt::address_max)
+        return false;
+
+    if (_wait_cnt >= wait_max)
+        return false;
+
+    DccOpsJob &j = _wait[_wait_cnt++];
+    j = job;
+    j.result = false;
+    j.queued_us = time_us_32();
+    j.done_us = 0;
+
+    if (!_timing) {
+        _first_us = j.queued_us;
+        _timing = true;
+    }
+
+    return true;
+}
+
+
+bool DccOpsQueue::get_done(DccOpsJob &job)
+{
+    if (_done_cnt == 0)
+        return false;
+
+    job = _done[_done_get];
+    if (++_done_get >= done_max)
+        _done_get = 0;
+    _done_cnt--;
+
+    return true;
+}
+
+
+// true if there is an active job for the address
+bool DccOpsQueue::busy(int address) const
+{
+    for (int i = 0; i < _act_cnt; i++)
+        if (_act[i].address == address)
+            return true;
+    return false;
+}
+
+
+void DccOpsQueue::start(DccOpsJob &job)
+{
+    DccThrottle *throttle = _command.find_throttle(job.address);
+    assert(throttle != nullptr);
+
+    if (job.op == DccOpsJob::Op::READ_CV) {
+        throttle->read_cv(job.cv_num);
+    } else if (job.op == DccOpsJob::Op::WRITE_CV) {
+        throttle->write_cv(job.cv_num, job.cv_val);
+    } else {
+        assert(job.op == DccOpsJob::Op::WRITE_BIT);
+        throttle->write_bit(job.cv_num, job.bit_num, job.cv_val);
+    }
+}
+
+
+void DccOpsQueue::finish(DccOpsJob &job, bool result, uint8_t cv_val)
+{
+    job.result = result;
+    if (result)
+        job.cv_val = cv_val;
+    job.done_us = time_us_32();
+
+    if (result)
+        _ok_cnt++;
+    else
+        _err_cnt++;
+
+    uint32_t job_us = job.done_us - job.queued_us;
+    if (job_us > _max_us)
+        _max_us = job_us;
+    _last_us = job.done_us;
+
+    if (_job_done != nullptr) {
+        (*_job_done)(job, _job_done_arg);
+        return;
+    }
+
+    if (_done_cnt >= done_max) {
+        // ring full, drop oldest
+        if (++_done_get >= done_max)
+            _done_get = 0;
+        _done_cnt--;
+        _drop_cnt++;
+    }
+
+    _done[_done_put] = job;
+    if (++_done_put >= done_max)
+        _done_put = 0;
+    _done_cnt++;
+}
+
+
+void DccOpsQueue::loop()
+{
+    // check active jobs for completion
+    for (int i = 0; i < _act_cnt; /* no increment */) {
+        DccOpsJob &job = _act[i];
+        DccThrottle *throttle = _command.find_throttle(job.address);
+        bool result = false;
+        uint8_t cv_val = 0;
+        if (throttle == nullptr || throttle->ops_done(result, cv_val)) {
+            // done (or throttle deleted)
+            finish(job, result, cv_val);
+            _act[i] = _act[--_act_cnt];
+        } else {
+            i++;
+        }
+    }
+
+    // Start waiting jobs whose loco is idle. A job that has to wait keeps
+    // later jobs for the same loco waiting too, since busy() only clears
+    // when the earlier one is done.
+    int w = 0;
+    for (int i = 0; i < _wait_cnt; i++) {
+        DccOpsJob &job = _wait[i];
+        DccThrottle *throttle = _command.find_throttle(job.address);
+        if (throttle == nullptr) {
+            finish(job, false, 0);
+        } else if (_act_cnt < active_max && !busy(job.address) &&
+                   !throttle->ops_busy()) {
+            _act[_act_cnt] = job;
+            start(_act[_act_cnt]);
+            _act_cnt++;
+        } else {
+            if (w != i)
+                _wait[w] = job;
+            w++;
+        }
+    }
+    _wait_cnt = w;
+}
+
+
+int DccOpsQueue::ops_per_sec_x10() const
+{
+    uint32_t cnt = _ok_cnt + _err_cnt;
+    if (cnt == 0)
+        return 0;
+
+    uint32_t us = _last_us - _first_us;
+    if (us == 0)
+        return 0;
+
+    return int((uint64_t(cnt) * 10000000) / us);
+}
+
+
+void DccOpsQueue::reset_stats()
+{
+    _ok_cnt = 0;
+    _err_cnt = 0;
+    _drop_cnt = 0;
+    _max_us = 0;
+    _first_us = 0;
+    _last_us = 0;
+    // restart timing with the next job queued, or now if jobs are in flight
+    _timing = !idle();
+    if (_timing)
+        _first_us = time_us_32();
+}
+
+
+char *DccOpsQueue::show(char *buf, int buf_len) const
+{
+    int ops_x10 = ops_per_sec_x10();
+    snprintf(buf, buf_len,
+             "wait=%d active=%d ok=%lu err=%lu drop=%lu max=%lu ms "
+             "%d.%d ops/s",
+             _wait_cnt, _act_cnt, _ok_cnt, _err_cnt, _drop_cnt,
+             (_max_us + 500) / 1000, ops_x10 / 10, ops_x10 % 10);
+    return buf;
+}
@@ -320,6 +320,26 @@ bool DccPkt::decode_func_29(int *f) const // int f[8] is f29..f36
 }
 #endif
 
+bool DccPkt::decode_binstate(int &num, bool &on) const
+{
+    // multi-function decoder address only
+    if (_msg_len < 1 || _msg[0] == 0 || (128 <= _msg[0] && _msg[0] < 192) ||
+        _msg[0] >= 232) {
+        return false;
+    }
+    // address (1 or 2 bytes), instruction, DLLLLLLL, [HHHHHHHH], xor
+    int idx = get_address_size();
+    if (_msg_len == idx + 3 && _msg[idx] == DccPktBinState::inst_short) {
+        num = _msg[idx + 1] & 0x7f;
+    } else if (_msg_len == idx + 4 && _msg[idx] == DccPktBinState::inst_long) {
+        num = (int(_msg[idx + 2]) << 7) | (_msg[idx + 1] & 0x7f);
+    } else {
+        return false;
+    }
+    on = (_msg[idx + 1] & 0x80) != 0;
+    return true;
+}
+
 char *DccPkt::dump(char *buf, int buf_len) const
 {
     assert(buf != nullptr);
@@ -401,6 +421,13 @@ char *DccPkt::show(char *buf, int buf_len) const
             if (!check_len_is(b, e, idx + 1))
                 return buf;
 
+        } else if (adrs == 0 && (instr & 0xce) == 0x40) {
+            // broadcast stop, 01DC000S
+            b += snprintf(b, e - b, "%s", (instr & 0x01) ? "estop" : "stop");
+
+            if (!check_len_is(b, e, idx + 1))
+                return buf;
+
         } else if (instr == 0x3f) {
             if (!check_len_min(b, e, idx + 2))
                 return buf;
@@ -433,8 +460,11 @@ char *DccPkt::show(char *buf, int buf_len) const
                 return buf;
 
         } else if ((instr & 0xf0) == 0xe0) {
-            // ops mode cv access
-            show_cv_access(b, e, instr, idx);
+            // ops mode cv access, long form or xpom
+            if (_msg_len >= idx + 4)
+                show_xpom_access(b, e, instr, idx);
+            else
+                show_cv_access(b, e, instr, idx);
 
         } else if (instr == DccPktFunc13::inst_byte) {
             if (!check_len_min(b, e, idx + 2))
@@ -496,6 +526,24 @@ char *DccPkt::show(char *buf, int buf_len) const
             if (!check_len_is(b, e, idx + 1))
                 return buf;
 #endif
+
+        } else if (instr == DccPktBinState::inst_short) {
+            if (!check_len_min(b, e, idx + 2))
+                return buf;
+            uint8_t dl = _msg[idx++];
+            b += snprintf(b, e - b, "bs%d=%d", dl & 0x7f, dl >> 7);
+            if (!check_len_is(b, e, idx + 1))
+                return buf;
+
+        } else if (instr == DccPktBinState::inst_long) {
+            if (!check_len_min(b, e, idx + 3))
+                return buf;
+            uint8_t dl = _msg[idx++];
+            uint8_t h = _msg[idx++];
+            b += snprintf(b, e - b, "bs%d=%d", (int(h) << 7) | (dl & 0x7f),
+                          dl >> 7);
+            if (!check_len_is(b, e, idx + 1))
+                return buf;
         }
 
     } else if (128 <= b0 && b0 < 192) {
@@ -649,6 +697,34 @@ void DccPkt::show_cv_access(char *&b, char *e, uint8_t instr, int idx) const
 
 //----------------------------------------------------------------------------
 
+void DccPkt::show_xpom_access(char *&b, char *e, uint8_t instr, int idx) const
+{
+    // instr is 1110_GGSS
+    // GG is the operation
+    // SS is the sequence number
+    assert((instr & 0xf0) == 0xe0);
+
+    int op = (instr & 0x0c) >> 2;
+    int ss = instr & 0x03;
+    int cv = (int(_msg[idx]) << 16) | (int(_msg[idx + 1]) << 8) | _msg[idx + 2];
+    idx += 3;
+    cv++; // by convention, cv number starts at 1
+
+    if (op == 1) {
+        // read 4 bytes
+        b += snprintf(b, e - b, "cv%d+3? ss=%d", cv, ss);
+    } else {
+        // write byte(s) or bit, data bytes not shown
+        b += snprintf(b, e - b, "xpom op=%d cv%d ss=%d", op, cv, ss);
+        idx = _msg_len - 1;
+    }
+
+    (void)check_len_is(b, e, idx + 1);
+
+} // DccPkt::show_xpom_access
+
+//----------------------------------------------------------------------------
+
 DccPktIdle::DccPktIdle()
 {
     _msg[0] = 0xff;
@@ -669,6 +745,16 @@ DccPktReset::DccPktReset()
 
 //----------------------------------------------------------------------------
 
+DccPktEStop::DccPktEStop()
+{
+    _msg[0] = 0x00;
+    _msg[1] = 0x71; // 01DC000S, D=1 C=1 S=1
+    _msg_len = 3;
+    set_xor();
+}
+
+//----------------------------------------------------------------------------
+
 DccPktSpeed128::DccPktSpeed128(int adrs, int speed)
 {
     assert(address_min <= adrs && adrs <= address_max);
@@ -965,6 +1051,112 @@ uint8_t DccPktFunc9::get_funcs() const
 
 //----------------------------------------------------------------------------
 
+DccPktFuncGroup::DccPktFuncGroup(int adrs)
+{
+    assert(address_min <= adrs && adrs <= address_max);
+
+    (void)DccPkt::set_address(adrs);
+    set_group(0, 0);
+}
+
+int DccPktFuncGroup::set_address(int adrs)
+{
+    assert(address_min <= adrs && adrs <= address_max);
+
+    // keep instruction and data bytes, which might move
+    int idx = get_address_size();
+    uint8_t inst[2] = {_msg[idx], _msg[idx + 1]};
+    int inst_len = _msg_len - idx - 1;
+
+    idx = DccPkt::set_address(adrs); // 1 or 2 bytes
+    for (int i = 0; i < inst_len; i++)
+        _msg[idx++] = inst[i];
+    _msg_len = idx + 1;
+    set_xor();
+    return get_address_size();
+}
+
+void DccPktFuncGroup::set_group(int g, uint32_t funcs) // called in interrupt context
+{
+    assert(0 <= g && g < group_max);
+
+    const Group &grp = group[g];
+    funcs &= (1 << grp.f_cnt) - 1;
+
+    int idx = get_address_size(); // skip address (1 or 2 bytes)
+    if (g == 0) {
+        // f0 is above f4 in the instruction
+        _msg[idx++] = grp.inst | ((funcs & 1) << 4) | (funcs >> 1);
+    } else if (grp.len == 1) {
+        _msg[idx++] = grp.inst | funcs;
+    } else {
+        _msg[idx++] = grp.inst;
+        _msg[idx++] = funcs;
+    }
+    _msg_len = idx + 1; // 3...5
+    set_xor();
+}
+
+//----------------------------------------------------------------------------
+
+DccPktBinState::DccPktBinState(int adrs, int num, bool on)
+{
+    assert(address_min <= adrs && adrs <= address_max);
+
+    refresh(adrs, num, on);
+}
+
+int DccPktBinState::set_address(int adrs)
+{
+    assert(address_min <= adrs && adrs <= address_max);
+
+    refresh(adrs, get_num(), get_on());
+    return get_address_size();
+}
+
+// set state number and value in message
+void DccPktBinState::set_state(int num, bool on)
+{
+    assert(num_min <= num && num <= num_max);
+
+    int idx = get_address_size(); // skip address (1 or 2 bytes)
+    uint8_t dl = (on ? 0x80 : 0x00) | (num & 0x7f);
+    if (1 <= num && num <= num_short_max) {
+        _msg[idx++] = inst_short; // 11011101
+        _msg[idx++] = dl;         // DLLLLLLL
+    } else {
+        _msg[idx++] = inst_long;  // 11000000
+        _msg[idx++] = dl;         // DLLLLLLL
+        _msg[idx++] = num >> 7;   // HHHHHHHH
+    }
+    _msg_len = idx + 1; // total (with xor) 4...6 bytes
+    set_xor();
+}
+
+// update message where bytes in address (1 or 2) might be changing
+void DccPktBinState::refresh(int adrs, int num, bool on)
+{
+    (void)DccPkt::set_address(adrs); // insert address (1 or 2 bytes)
+    set_state(num, on);              // insert everything else
+}
+
+int DccPktBinState::get_num() const
+{
+    int idx = get_address_size(); // skip address (1 or 2 bytes)
+    int num = _msg[idx + 1] & 0x7f;
+    if (_msg[idx] == inst_long)
+        num |= int(_msg[idx + 2]) << 7;
+    return num;
+}
+
+bool DccPktBinState::get_on() const
+{
+    int idx = get_address_size(); // skip address (1 or 2 bytes)
+    return (_msg[idx + 1] & 0x80) != 0;
+}
+
+//----------------------------------------------------------------------------
+
 DccPktOpsReadCv::DccPktOpsReadCv(int adrs, int cv_num)
 {
     assert(address_min <= adrs && adrs <= address_max);
@@ -1013,6 +1205,62 @@ int DccPktOpsReadCv::get_cv_num() const
 
 //----------------------------------------------------------------------------
 
+DccPktOpsRead4Cv::DccPktOpsRead4Cv(int adrs, int cv_num, int seq)
+{
+    assert(address_min <= adrs && adrs <= address_max);
+    assert(cv_num_min <= cv_num && cv_num <= cv_num_max);
+    assert(0 <= seq && seq < seq_max);
+
+    refresh(adrs, cv_num, seq);
+}
+
+int DccPktOpsRead4Cv::set_address(int adrs)
+{
+    assert(address_min <= adrs && adrs <= address_max);
+
+    refresh(adrs, get_cv_num(), get_seq());
+    return get_address_size();
+}
+
+void DccPktOpsRead4Cv::set_cv(int cv_num, int seq)
+{
+    assert(cv_num_min <= cv_num && cv_num <= cv_num_max); // 1..1024
+    assert(0 <= seq && seq < seq_max);
+
+    cv_num--;                     // cv_num is encoded in messages as 0..1023
+    int idx = get_address_size(); // skip address (1 or 2 bytes)
+    _msg[idx++] = 0xe4 | seq;     // 111001ss
+    _msg[idx++] = cv_num >> 16;   // vvvvvvvv (24-bit cv address)
+    _msg[idx++] = cv_num >> 8;    // vvvvvvvv
+    _msg[idx++] = cv_num;         // vvvvvvvv
+    _msg_len = idx + 1;           // total (with xor) 6 or 7 bytes
+    set_xor();
+}
+
+void DccPktOpsRead4Cv::refresh(int adrs, int cv_num, int seq)
+{
+    assert(address_min <= adrs && adrs <= address_max);
+    assert(cv_num_min <= cv_num && cv_num <= cv_num_max); // 1..1024
+
+    (void)DccPkt::set_address(adrs); // insert address (1 or 2 bytes)
+    set_cv(cv_num, seq);             // insert everything else
+}
+
+int DccPktOpsRead4Cv::get_cv_num() const
+{
+    int idx = get_address_size() + 1; // skip address and instruction
+    int cv_num = (int(_msg[idx]) << 16) | (int(_msg[idx + 1]) << 8) | _msg[idx + 2];
+    return cv_num + 1; // cv_num is 0..1023 in message, return 1..1024
+}
+
+int DccPktOpsRead4Cv::get_seq() const
+{
+    int idx = get_address_size(); // skip address
+    return _msg[idx] & 0x03;      // return lo 2 bits
+}
+
+//----------------------------------------------------------------------------
+
 DccPktOpsWriteCv::DccPktOpsWriteCv(int adrs, int cv_num, uint8_t cv_val)
 {
     assert(address_min <= adrs && adrs <= address_max);
@@ -1138,6 +1386,85 @@ int DccPktOpsWriteBit::get_bit_val() const
 
 //----------------------------------------------------------------------------
 
+// The 11-bit address is the 9-bit decoder address and the 2-bit output pair;
+// in the packet, the upper 3 bits of the decoder address are inverted.
+static void acc_address_put(uint8_t *msg, int acc_adrs)
+{
+    int adrs = acc_adrs + 3;
+    int dec = adrs >> 2;
+    msg[0] = 0x80 | (dec & 0x3f); // 10AAAAAA
+    msg[1] = ((~dec >> 2) & 0x70) | ((adrs & 0x03) << 1); // xAAAxAAx
+}
+
+static int acc_address_get(const uint8_t *msg)
+{
+    int adrs = (int(msg[0] & 0x3f) << 2) | (int(~msg[1] & 0x70) << 4) |
+               (int(msg[1] & 0x06) >> 1);
+    return adrs - 3;
+}
+
+DccPktAccBasic::DccPktAccBasic(int acc_adrs, int out, bool on)
+{
+    set(acc_adrs, out, on);
+}
+
+void DccPktAccBasic::set(int acc_adrs, int out, bool on)
+{
+    assert(acc_address_min <= acc_adrs && acc_adrs <= acc_address_max);
+    assert(out == 0 || out == 1);
+
+    acc_address_put(_msg, acc_adrs);
+    _msg[1] |= 0x80 | (on ? 0x08 : 0x00) | out; // 1AAACDDR
+    _msg_len = 3;
+    set_xor();
+}
+
+int DccPktAccBasic::get_acc_address() const
+{
+    return acc_address_get(_msg);
+}
+
+int DccPktAccBasic::get_out() const
+{
+    return _msg[1] & 0x01;
+}
+
+bool DccPktAccBasic::get_on() const
+{
+    return (_msg[1] & 0x08) != 0;
+}
+
+//----------------------------------------------------------------------------
+
+DccPktAccExt::DccPktAccExt(int acc_adrs, int aspect)
+{
+    set(acc_adrs, aspect);
+}
+
+void DccPktAccExt::set(int acc_adrs, int aspect)
+{
+    assert(acc_address_min <= acc_adrs && acc_adrs <= acc_address_max);
+    assert(aspect_min <= aspect && aspect <= aspect_max);
+
+    acc_address_put(_msg, acc_adrs);
+    _msg[1] |= 0x01; // 0AAA0AA1
+    _msg[2] = aspect;
+    _msg_len = 4;
+    set_xor();
+}
+
+int DccPktAccExt::get_acc_address() const
+{
+    return acc_address_get(_msg);
+}
+
+int DccPktAccExt::get_aspect() const
+{
+    return _msg[2];
+}
+
+//----------------------------------------------------------------------------
+
 DccPktSvcWriteCv::DccPktSvcWriteCv(int cv_num, uint8_t cv_val)
 {
     assert(cv_num_min <= cv_num && cv_num <= cv_num_max); // 1..1024
@@ -1284,6 +1611,8 @@ DccPkt::PktType DccPkt::decode_type(const uint8_t *msg, int msg_len)
     if (b0 == 0) {
         if (msg_len == 3 && msg[1] == 0 && msg[2] == 0) {
             return Reset;
+        } else if (msg_len == 3 && (msg[1] & 0xce) == 0x40) {
+            return BroadcastStop;
         } else {
             return Invalid;
         }
@@ -1380,6 +1709,10 @@ DccPkt::PktType DccPkt::decode_payload(const uint8_t *pay, int pay_len)
         } else if (ggggg == (DccPktFunc61::inst_byte & 0x1f) && pay_len == 3) {
             return Func61;
 #endif
+        } else if (ggggg == (DccPktBinState::inst_short & 0x1f) && pay_len == 3) {
+            return BinState;
+        } else if (ggggg == (DccPktBinState::inst_long & 0x1f) && pay_len == 4) {
+            return BinState;
         } else {
             return Unimplemented;
         }
@@ -1401,6 +1734,9 @@ DccPkt::PktType DccPkt::decode_payload(const uint8_t *pay, int pay_len)
                 } else { // (gg == 3)
                     return OpsWriteCv;
                 }
+            } else if (pay_len == 5 && ((p0 >> 2) & 0x3) == 1) {
+                // XPOM read four bytes
+                return OpsRead4Cv;
             } else {
                 return Unimplemented; // fancier xpom
             }
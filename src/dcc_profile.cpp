@@ -0,0 +1,167 @@
+#include "dcc_profile.h"
+
+#include <cstdint>
+#include <cstdio>
+
+#include "dcc_adc.h"
+#include "hardware/sync.h"
+
+
+DccProfile::DccProfile(DccAdc &adc) :
+    _adc(adc),
+    _enabled(false),
+    _mark_put(0),
+    _mark_get(0),
+    _idx(0),
+    _address(-1),
+    _cutout(false),
+    _stats_cnt(0),
+    _drop_cnt(0)
+{
+}
+
+
+DccProfile::~DccProfile()
+{
+}
+
+
+void DccProfile::enable(bool en)
+{
+    if (en && !_enabled) {
+        // start from now
+        _mark_get = _mark_put;
+        _idx = _adc.sample_cnt();
+        _address = -1;
+        _cutout = false;
+    }
+    _enabled = en;
+}
+
+
+void DccProfile::reset()
+{
+    _stats_cnt = 0;
+    _drop_cnt = 0;
+}
+
+
+void DccProfile::mark_add(MarkType type, int address) // called in interrupt context
+{
+    uint32_t put = _mark_put;
+    if ((put - _mark_get) >= mark_max)
+        return; // full; loop() will notice the gap in samples
+    Mark &m = _marks[put % mark_max];
+    m.idx = _adc.sample_cnt();
+    m.address = int16_t(address);
+    m.type = type;
+    __compiler_memory_barrier();
+    _mark_put = put + 1;
+}
+
+
+DccProfile::Stats *DccProfile::find(int address)
+{
+    for (int i = 0; i < _stats_cnt; i++)
+        if (_stats[i].address == address)
+            return &_stats[i];
+
+    if (_stats_cnt >= stats_max)
+        return nullptr;
+
+    Stats *s = &_stats[_stats_cnt++];
+    s->address = address;
+    s->pkt_cnt = 0;
+    s->pkt_sum_ma = 0;
+    s->pkt_max_ma = 0;
+    s->cut_cnt = 0;
+    s->cut_sum_ma = 0;
+    s->cut_max_ma = 0;
+    return s;
+}
+
+
+void DccProfile::loop()
+{
+    if (!_enabled)
+        return;
+
+    // Get the sample count before looking at marks. Any mark made after this
+    // has an index of at least cnt, so it can't apply to the samples we are
+    // about to look at.
+    uint32_t cnt = _adc.sample_cnt();
+
+    Stats *s = (_address >= 0) ? find(_address) : nullptr;
+
+    while (_idx != cnt) {
+
+        // apply any marks up to and including this sample
+        while (_mark_get != _mark_put) {
+            const Mark &m = _marks[_mark_get % mark_max];
+            if (int32_t(m.idx - _idx) > 0)
+                break; // mark is for a later sample
+            if (m.type == MarkType::PACKET) {
+                _address = m.address;
+                _cutout = false;
+            } else if (m.type == MarkType::CUTOUT_START) {
+                _address = m.address;
+                _cutout = true;
+            } else {
+                _cutout = false;
+            }
+            _mark_get = _mark_get + 1;
+            s = (_address >= 0) ? find(_address) : nullptr;
+        }
+
+        uint16_t raw;
+        bool ok = _adc.sample(_idx, raw);
+        _idx++;
+
+        if (!ok || (_address >= 0 && s == nullptr)) {
+            _drop_cnt++;
+            continue;
+        }
+
+        if (s == nullptr)
+            continue; // not a loco packet (e.g. idle)
+
+        uint16_t ma = DccAdc::raw_to_ma(raw);
+        if (_cutout) {
+            s->cut_cnt++;
+            s->cut_sum_ma += ma;
+            if (ma > s->cut_max_ma)
+                s->cut_max_ma = ma;
+        } else {
+            s->pkt_cnt++;
+            s->pkt_sum_ma += ma;
+            if (ma > s->pkt_max_ma)
+                s->pkt_max_ma = ma;
+        }
+    }
+}
+
+
+bool DccProfile::stats(int n, Stats &s) const
+{
+    if (n < 0 || n >= _stats_cnt)
+        return false;
+
+    s = _stats[n];
+    return true;
+}
+
+
+void DccProfile::show() const
+{
+    printf("adrs  samples   avg   max  cutout   avg   max\n");
+    //      ----  -------  ----  ----  ------  ----  ----
+    for (int i = 0; i < _stats_cnt; i++) {
+        const Stats &s = _stats[i];
+        uint32_t pkt_avg = s.pkt_cnt > 0 ? uint32_t(s.pkt_sum_ma / s.pkt_cnt) : 0;
+        uint32_t cut_avg = s.cut_cnt > 0 ? uint32_t(s.cut_sum_ma / s.cut_cnt) : 0;
+        printf("%4d  %7lu  %4lu  %4u  %6lu  %4lu  %4u\n", s.address,
+               s.pkt_cnt, pkt_avg, uint(s.pkt_max_ma), s.cut_cnt, cut_avg,
+               uint(s.cut_max_ma));
+    }
+    printf("dropped %lu samples\n", _drop_cnt);
+}
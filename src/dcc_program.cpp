@@ -0,0 +1,371 @@
+#include "dcc_program.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+
+#include "dcc_command.h"
+#include "dcc_cv.h"
+#include "dcc_cv_index.h"
+#include "dcc_cv_cache.h"
+#include "dcc_pkt.h"
+#include "dcc_throttle.h"
+#include "hardware/timer.h"
+
+
+DccProgram::DccProgram(DccCommand &command, DccCvCache *cache) :
+    _command(command),
+    _cache(cache),
+    _cache_address(-1),
+    _cache_mfg(-1),
+    _throttle(nullptr),
+    _verify(true),
+    _item_cnt(0),
+    _item(0),
+    _step(Step::IDLE),
+    _stop(false),
+    _retry(0),
+    _progress(nullptr),
+    _progress_arg(nullptr),
+    _written_cnt(0),
+    _skip_cnt(0),
+    _fail_cnt(0),
+    _read_cnt(0),
+    _write_cnt(0),
+    _index_write_base(0),
+    _svc_pkt_cnt(0),
+    _start_us(0),
+    _done_us(0)
+{
+}
+
+
+DccProgram::~DccProgram()
+{
+}
+
+
+const char *DccProgram::status_name(Status status)
+{
+    switch (status) {
+        case Status::PENDING:
+            return "pending";
+        case Status::EARLIER:
+            return "earlier";
+        case Status::SKIPPED:
+            return "skipped";
+        case Status::WRITTEN:
+            return "written";
+        case Status::FAILED:
+            return "failed";
+        default:
+            return "?";
+    }
+}
+
+
+bool DccProgram::start_svc(const Item *items, int item_cnt, int first,
+                           bool verify)
+{
+    if (_command.mode() != DccCommand::Mode::OFF && !_command.svc_session())
+        return false;
+
+    _throttle = nullptr;
+    _verify = verify;
+    return start(items, item_cnt, first);
+}
+
+
+bool DccProgram::start_ops(DccThrottle *throttle, const Item *items,
+                           int item_cnt, int first, bool verify)
+{
+    if (_command.mode() != DccCommand::Mode::OPS || throttle == nullptr)
+        return false;
+
+    _throttle = throttle;
+    _verify = verify;
+    return start(items, item_cnt, first);
+}
+
+
+bool DccProgram::start(const Item *items, int item_cnt, int first)
+{
+    if (busy())
+        return false;
+
+    if (item_cnt < 0 || item_cnt > item_max || first < 0 || first > item_cnt)
+        return false;
+
+    for (int i = 0; i < item_cnt; i++) {
+        const Item &it = items[i];
+        if (it.cv_num < DccPkt::cv_num_min || it.cv_num > DccPkt::cv_num_max)
+            return false;
+        if (it.cv_num == DccCv::mfg_id || it.cv_num == DccCv::index_hi ||
+            it.cv_num == DccCv::index_lo)
+            return false;
+        if (it.index >= 0 && (it.cv_num < 257 || it.cv_num > 512))
+            return false;
+        if (it.index > DccCv::index(255, 255))
+            return false;
+    }
+
+    std::copy(items, items + item_cnt, _items);
+    _item_cnt = item_cnt;
+
+    // non-indexed first (index -1), then by page
+    std::stable_sort(_items, _items + _item_cnt,
+                     [](const Item &a, const Item &b) {
+                         if (a.index != b.index)
+                             return a.index < b.index;
+                         return a.cv_num < b.cv_num;
+                     });
+
+    for (int i = 0; i < _item_cnt; i++)
+        _status[i] = (i < first) ? Status::EARLIER : Status::PENDING;
+
+    _item = first;
+    _stop = false;
+    _written_cnt = 0;
+    _skip_cnt = 0;
+    _fail_cnt = 0;
+    _read_cnt = 0;
+    _write_cnt = 0;
+    _svc_pkt_cnt = 0;
+    _index_write_base = cv_index().write_cnt();
+    _start_us = time_us_32();
+    _done_us = _start_us;
+
+    item_start();
+
+    return true;
+}
+
+
+// The operation in progress is allowed to finish (busy() stays true until
+// then), but nothing else is started.
+void DccProgram::stop()
+{
+    if (busy())
+        _stop = true;
+}
+
+
+bool DccProgram::item(int n, Item &item, Status &status) const
+{
+    if (n < 0 || n >= _item_cnt)
+        return false;
+    item = _items[n];
+    status = _status[n];
+    return true;
+}
+
+
+uint32_t DccProgram::elapsed_ms() const
+{
+    uint32_t end_us = busy() ? time_us_32() : _done_us;
+    return (end_us - _start_us) / 1000;
+}
+
+
+int DccProgram::naive_write_cnt() const
+{
+    int cnt = 0;
+    for (int i = 0; i < _item_cnt; i++)
+        cnt += (_items[i].index >= 0) ? 3 : 1;
+    return cnt;
+}
+
+
+void DccProgram::op_read(const Item &it)
+{
+    _read_cnt++;
+    if (_throttle == nullptr) {
+        if (it.index >= 0)
+            _command.read_cv_indexed(it.index, it.cv_num, true, it.cv_val);
+        else
+            _command.read_cv(it.cv_num, true, it.cv_val);
+    } else {
+        if (it.index >= 0)
+            _throttle->read_cv_indexed(it.index, it.cv_num);
+        else
+            _throttle->read_cv(it.cv_num);
+    }
+}
+
+
+void DccProgram::op_write(const Item &it)
+{
+    _write_cnt++;
+    if (_throttle == nullptr) {
+        if (it.index >= 0)
+            _command.write_cv_indexed(it.index, it.cv_num, it.cv_val);
+        else
+            _command.write_cv(it.cv_num, it.cv_val);
+    } else {
+        if (it.index >= 0)
+            _throttle->write_cv_indexed(it.index, it.cv_num, it.cv_val);
+        else
+            _throttle->write_cv(it.cv_num, it.cv_val);
+    }
+}
+
+
+bool DccProgram::op_done(bool &result, uint8_t &val)
+{
+    if (_throttle == nullptr) {
+        if (!_command.svc_done(result, val))
+            return false;
+        _svc_pkt_cnt += _command.svc_pkt_cnt();
+        return true;
+    }
+    return _throttle->ops_done(result, val);
+}
+
+
+const DccCvIndex &DccProgram::cv_index() const
+{
+    if (_throttle == nullptr)
+        return _command.svc_index();
+    else
+        return _throttle->cv_index();
+}
+
+
+int DccProgram::index_write_cnt() const
+{
+    return cv_index().write_cnt() - _index_write_base;
+}
+
+
+// Start the next item that is not already known to be right.
+void DccProgram::item_start()
+{
+    while (_item < _item_cnt) {
+        const Item &it = _items[_item];
+        uint8_t val;
+        if (_cache == nullptr || _cache_address < 0 ||
+            !_cache->lookup(_cache_address, _cache_mfg, it.cv_num, val) ||
+            val != it.cv_val)
+            break;
+        item_done(Status::SKIPPED);
+    }
+
+    if (_item >= _item_cnt) {
+        _step = Step::DONE;
+        _done_us = time_us_32();
+        return;
+    }
+
+    const Item &it = _items[_item];
+    _retry = 0;
+
+    // For indexed cvs, the command or throttle selects the page first if it
+    // is not already selected. Since items are sorted by page, that's once
+    // per page.
+    if (_verify) {
+        op_read(it);
+        _step = Step::READ;
+    } else {
+        op_write(it);
+        _step = Step::WRITE;
+    }
+}
+
+
+void DccProgram::item_done(Status status)
+{
+    assert(_item < _item_cnt);
+
+    _status[_item] = status;
+
+    if (status == Status::WRITTEN)
+        _written_cnt++;
+    else if (status == Status::SKIPPED)
+        _skip_cnt++;
+    else if (status == Status::FAILED)
+        _fail_cnt++;
+
+    int n = _item++;
+
+    if (_progress != nullptr)
+        (*_progress)(*this, n, _progress_arg);
+}
+
+
+void DccProgram::loop()
+{
+    if (!busy())
+        return;
+
+    bool result;
+    uint8_t val;
+    if (!op_done(result, val))
+        return;
+
+    if (_stop) {
+        _step = Step::DONE;
+        _done_us = time_us_32();
+        return;
+    }
+
+    const Item &it = _items[_item];
+    bool use_cache = _cache != nullptr && _cache_address >= 0;
+
+    if (_step == Step::READ) {
+        if (result && use_cache)
+            _cache->set(_cache_address, _cache_mfg, it.cv_num, val,
+                        DccCvCache::Trust::READ);
+        if (result && val == it.cv_val) {
+            item_done(Status::SKIPPED);
+            item_start();
+            return;
+        }
+        // different, or could not read it
+        _retry = 0;
+        op_write(it);
+        _step = Step::WRITE;
+        return;
+    }
+
+    assert(_step == Step::WRITE);
+
+    if (!result && _retry++ < retry_max) {
+        op_write(it);
+        return;
+    }
+
+    if (use_cache) {
+        if (result)
+            _cache->set(_cache_address, _cache_mfg, it.cv_num, it.cv_val,
+                        DccCvCache::Trust::WRITTEN);
+        else
+            _cache->forget(_cache_address, _cache_mfg, it.cv_num);
+    }
+
+    item_done(result ? Status::WRITTEN : Status::FAILED);
+    item_start();
+}
+
+
+void DccProgram::show() const
+{
+    for (int i = 0; i < _item_cnt; i++) {
+        const Item &it = _items[i];
+        if (it.index >= 0)
+            printf("%3d: cv %d (%d/%d) = %u %s\n", i, it.cv_num,
+                   it.index >> 8, it.index & 0xff, uint(it.cv_val),
+                   status_name(_status[i]));
+        else
+            printf("%3d: cv %d = %u %s\n", i, it.cv_num, uint(it.cv_val),
+                   status_name(_status[i]));
+    }
+    printf("%s %d of %d: %d written, %d skipped, %d failed; "
+           "%d reads, %d writes (%d index) in %lu ms",
+           busy() ? "running" : "done", _item, _item_cnt, _written_cnt,
+           _skip_cnt, _fail_cnt, _read_cnt,
+           _write_cnt + index_write_cnt(), index_write_cnt(), elapsed_ms());
+    if (_throttle == nullptr)
+        printf(", %d packets", _svc_pkt_cnt);
+    printf("; write-all would be %d writes\n", naive_write_cnt());
+}
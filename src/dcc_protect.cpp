@@ -0,0 +1,220 @@
+#include "dcc_protect.h"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+
+#include "buf_log.h"
+#include "dcc_adc.h"
+#include "dcc_bitstream.h"
+#include "hardware/timer.h"
+
+
+DccProtect::DccProtect(DccAdc &adc, DccBitstream &bitstream) :
+    _adc(adc),
+    _bitstream(bitstream),
+    _enabled(true),
+    _trip_ma(trip_ma_default),
+    _trip_samples(1),
+    _running(false),
+    _tripped(false),
+    _retry_us(0),
+    _retry_ms(retry_min_ms),
+    _power_us(0),
+    _idx(0),
+    _over_cnt(0),
+    _peak_ma(0),
+    _trip_cnt(0),
+    _event_idx(0),
+    _event_cnt(0)
+{
+    config(trip_ma_default, trip_us_default);
+}
+
+
+DccProtect::~DccProtect()
+{
+    stop();
+}
+
+
+void DccProtect::config(uint16_t trip_ma, uint32_t trip_us)
+{
+    uint32_t sample_us = DccAdc::sample_us();
+    int samples = (trip_us + sample_us - 1) / sample_us;
+    if (samples < 1)
+        samples = 1;
+    _trip_samples = samples;
+    _trip_ma = trip_ma;
+}
+
+
+uint32_t DccProtect::trip_us() const
+{
+    return _trip_samples * DccAdc::sample_us();
+}
+
+
+void DccProtect::start()
+{
+    _tripped = false;
+    _retry_ms = retry_min_ms;
+    _power_us = time_us_32();
+    _idx = _adc.sample_cnt();
+    _over_cnt = 0;
+    _peak_ma = 0;
+    _running = true;
+}
+
+
+void DccProtect::stop()
+{
+    _running = false;
+    if (_tripped) {
+        _bitstream.power_restore(); // give the gpio back to the pwm
+        _tripped = false;
+    }
+}
+
+
+void DccProtect::check() // called in interrupt context
+{
+    if (!_running)
+        return;
+
+    uint32_t now_us = time_us_32();
+
+    if (_tripped) {
+        if (int32_t(now_us - _retry_us) >= 0) {
+            // try again
+            _bitstream.power_restore();
+            _tripped = false;
+            _power_us = now_us;
+            // don't look at samples from while power was off
+            _idx = _adc.sample_cnt();
+            _over_cnt = 0;
+            _peak_ma = 0;
+        }
+        return;
+    }
+
+    if (_retry_ms > retry_min_ms && (now_us - _power_us) >= good_ms * 1000)
+        _retry_ms = retry_min_ms; // been good long enough
+
+    if (!_enabled) {
+        _idx = _adc.sample_cnt();
+        return;
+    }
+
+    uint32_t cnt = _adc.sample_cnt();
+
+    while (_idx != cnt) {
+        uint16_t raw;
+        if (!_adc.sample(_idx, raw)) {
+            // fell behind; skip to what is still there
+            _idx++;
+            _over_cnt = 0;
+            continue;
+        }
+        _idx++;
+        uint16_t ma = DccAdc::raw_to_ma(raw);
+        if (ma >= _trip_ma) {
+            _over_cnt++;
+            if (ma > _peak_ma)
+                _peak_ma = ma;
+            if (_over_cnt >= _trip_samples) {
+                trip(now_us);
+                return;
+            }
+        } else {
+            _over_cnt = 0;
+            _peak_ma = 0;
+        }
+    }
+}
+
+
+// The sample that met the trip condition is _idx - 1.
+void DccProtect::trip(uint32_t now_us) // called in interrupt context
+{
+    // power off first, bookkeeping after
+    _bitstream.power_cut();
+    uint32_t cut_us = time_us_32();
+
+    _tripped = true;
+    _trip_cnt++;
+
+    // The trip sample was captured (sample_cnt() - _idx) sample periods
+    // before now_us, give or take a sample period.
+    uint32_t age = _adc.sample_cnt() - (_idx - 1);
+    uint32_t latency_us = age * DccAdc::sample_us() + (cut_us - now_us);
+
+    TripEvent &ev = _events[_event_idx];
+    ev.time_us = cut_us;
+    ev.latency_us = latency_us;
+    ev.retry_ms = _retry_ms;
+    ev.peak_ma = _peak_ma;
+    for (int i = 0; i < trace_len; i++) {
+        uint16_t raw;
+        uint32_t idx = _idx - trace_len + i;
+        if (_adc.sample(idx, raw))
+            ev.trace_ma[i] = DccAdc::raw_to_ma(raw);
+        else
+            ev.trace_ma[i] = 0;
+    }
+    if (++_event_idx >= event_max)
+        _event_idx = 0;
+    if (_event_cnt < event_max)
+        _event_cnt++;
+
+    char *b = BufLog::write_line_get();
+    if (b != nullptr) {
+        snprintf(b, BufLog::line_len,
+                 "track trip: %u ma, latency %lu us, retry in %lu ms",
+                 uint(_peak_ma), latency_us, _retry_ms);
+        BufLog::write_line_put();
+    }
+
+    _retry_us = cut_us + _retry_ms * 1000;
+    _retry_ms *= 2;
+    if (_retry_ms > retry_max_ms)
+        _retry_ms = retry_max_ms;
+
+    _over_cnt = 0;
+    _peak_ma = 0;
+}
+
+
+bool DccProtect::event(int n, TripEvent &ev) const
+{
+    if (n < 0 || n >= _event_cnt)
+        return false;
+
+    int i = _event_idx - 1 - n;
+    if (i < 0)
+        i += event_max;
+    ev = _events[i];
+
+    return true;
+}
+
+
+void DccProtect::show() const
+{
+    printf("protect %s: trip at %u ma for %lu us; %s; %lu trips\n",
+           _enabled ? "on" : "off", uint(_trip_ma), trip_us(),
+           _tripped ? "tripped" : "ok", _trip_cnt);
+
+    uint32_t now_us = time_us_32();
+
+    TripEvent ev;
+    for (int n = 0; event(n, ev); n++) {
+        printf("%lu ms ago: peak %u ma, latency %lu us, retry %lu ms\n",
+               (now_us - ev.time_us) / 1000, uint(ev.peak_ma), ev.latency_us,
+               ev.retry_ms);
+        printf("   ");
+        for (int i = 0; i < trace_len; i++)
+            printf(" %u", uint(ev.trace_ma[i]));
+        printf("\n");
+    }
+}
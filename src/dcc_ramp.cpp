@@ -0,0 +1,264 @@
+#include "dcc_ramp.h"
+
+#include <cstdint>
+#include <cstdio>
+
+#include "dcc_pkt.h"
+#include "dcc_throttle.h"
+#include "hardware/timer.h"
+
+
+DccRamp::DccRamp(uint32_t tick_us) :
+    _tick_us(tick_us),
+    _tick_next_us(0),
+    _ticking(false),
+    _ramp_cnt(0)
+{
+    reset_stats();
+}
+
+
+DccRamp::~DccRamp()
+{
+}
+
+
+// S-9.2.2: stop to full speed in cv * 0.896 sec, so one of 128 steps takes
+// cv * 896000 / 128 = cv * 7000 usec.
+int32_t DccRamp::cv_to_rate(int cv) const
+{
+    if (cv <= 0)
+        return 0;
+
+    int32_t rate = int32_t((uint64_t(_tick_us) * one) / (uint32_t(cv) * 7000));
+    if (rate == 0)
+        rate = 1;
+    return rate;
+}
+
+
+DccRamp::Ramp *DccRamp::find(const DccThrottle *throttle)
+{
+    for (int i = 0; i < _ramp_cnt; i++)
+        if (_ramps[i].throttle == throttle)
+            return &_ramps[i];
+    return nullptr;
+}
+
+
+const DccRamp::Ramp *DccRamp::find(const DccThrottle *throttle) const
+{
+    for (int i = 0; i < _ramp_cnt; i++)
+        if (_ramps[i].throttle == throttle)
+            return &_ramps[i];
+    return nullptr;
+}
+
+
+bool DccRamp::add(DccThrottle *throttle, int accel_cv, int decel_cv)
+{
+    if (throttle == nullptr)
+        return false;
+
+    Ramp *r = find(throttle);
+    if (r == nullptr) {
+        if (_ramp_cnt >= ramp_max)
+            return false;
+        r = &_ramps[_ramp_cnt++];
+        r->throttle = throttle;
+        r->speed_set = throttle->get_speed();
+        r->speed = r->speed_set * one;
+        r->target = r->speed;
+        r->estop_cnt = throttle->estop_cnt();
+    }
+
+    r->accel_cv = accel_cv;
+    r->decel_cv = decel_cv;
+    r->accel = cv_to_rate(accel_cv);
+    r->decel = cv_to_rate(decel_cv);
+
+    return true;
+}
+
+
+void DccRamp::remove(DccThrottle *throttle)
+{
+    Ramp *r = find(throttle);
+    if (r != nullptr)
+        *r = _ramps[--_ramp_cnt];
+}
+
+
+bool DccRamp::has(const DccThrottle *throttle) const
+{
+    return find(throttle) != nullptr;
+}
+
+
+bool DccRamp::set_target(DccThrottle *throttle, int speed)
+{
+    if (speed < DccPkt::speed_min || speed > DccPkt::speed_max)
+        return false;
+
+    Ramp *r = find(throttle);
+    if (r == nullptr)
+        return false;
+
+    r->target = speed * one;
+    return true;
+}
+
+
+int DccRamp::get_target(const DccThrottle *throttle) const
+{
+    const Ramp *r = find(throttle);
+    if (r == nullptr)
+        return DccPkt::speed_inv;
+    return r->target / one;
+}
+
+
+bool DccRamp::stop(DccThrottle *throttle)
+{
+    Ramp *r = find(throttle);
+    if (r == nullptr)
+        return false;
+
+    r->speed = 0;
+    r->target = 0;
+    if (r->speed_set != 0) {
+        r->throttle->set_speed(0);
+        r->speed_set = 0;
+        _set_cnt++;
+    }
+    return true;
+}
+
+
+void DccRamp::stop_all()
+{
+    for (int i = 0; i < _ramp_cnt; i++)
+        stop(_ramps[i].throttle);
+}
+
+
+int DccRamp::active_cnt() const
+{
+    int cnt = 0;
+    for (int i = 0; i < _ramp_cnt; i++)
+        if (_ramps[i].speed != _ramps[i].target)
+            cnt++;
+    return cnt;
+}
+
+
+void DccRamp::tick()
+{
+    uint32_t start_us = time_us_32();
+
+    for (int i = 0; i < _ramp_cnt; i++) {
+        Ramp &r = _ramps[i];
+
+        uint32_t estop_cnt = r.throttle->estop_cnt();
+        if (estop_cnt != r.estop_cnt) {
+            // the throttle zeroes its speed itself; don't ramp it back up
+            r.estop_cnt = estop_cnt;
+            r.speed = 0;
+            r.target = 0;
+            r.speed_set = 0;
+            continue;
+        }
+
+        int32_t speed = r.speed;
+        int32_t target = r.target;
+        if (speed == target)
+            continue;
+
+        // Going away from zero is accelerating; toward zero (or through it
+        // to the other direction) is decelerating, and stops at zero first.
+        int32_t limit = target;
+        int32_t rate;
+        bool accel =
+            (speed >= 0 && target > speed) || (speed <= 0 && target < speed);
+        if (accel) {
+            rate = r.accel;
+        } else {
+            rate = r.decel;
+            if ((speed > 0 && target < 0) || (speed < 0 && target > 0))
+                limit = 0;
+        }
+
+        if (rate == 0) {
+            speed = target;
+        } else if (limit > speed) {
+            speed += rate;
+            if (speed > limit)
+                speed = limit;
+        } else {
+            speed -= rate;
+            if (speed < limit)
+                speed = limit;
+        }
+        r.speed = speed;
+
+        // Whole steps, rounded toward zero. 128-step speed 1 is e-stop, so
+        // it is skipped: 2 on the way up, 0 on the way down.
+        int speed_set = speed / one;
+        if (speed_set == 1 || speed_set == -1)
+            speed_set = accel ? (2 * speed_set) : 0;
+        if (speed_set != r.speed_set) {
+            r.throttle->set_speed(speed_set);
+            r.speed_set = speed_set;
+            _set_cnt++;
+        }
+    }
+
+    uint32_t tick_us = time_us_32() - start_us;
+    if (tick_us > _tick_max_us)
+        _tick_max_us = tick_us;
+    _tick_cnt++;
+}
+
+
+void DccRamp::loop()
+{
+    uint32_t now_us = time_us_32();
+
+    if (!_ticking) {
+        _tick_next_us = now_us + _tick_us;
+        _ticking = true;
+        return;
+    }
+
+    // Catch up on ticks missed if the main loop was busy, but not forever
+    // (e.g. after flash writes with interrupts off).
+    for (int n = 0; n < 10 && int32_t(now_us - _tick_next_us) >= 0; n++) {
+        tick();
+        _tick_next_us += _tick_us;
+    }
+
+    if (int32_t(now_us - _tick_next_us) >= 0)
+        _tick_next_us = now_us + _tick_us;
+}
+
+
+void DccRamp::reset_stats()
+{
+    _tick_cnt = 0;
+    _set_cnt = 0;
+    _tick_max_us = 0;
+}
+
+
+void DccRamp::show() const
+{
+    for (int i = 0; i < _ramp_cnt; i++) {
+        const Ramp &r = _ramps[i];
+        printf("%4d: speed %d target %d accel %d decel %d\n",
+               r.throttle->get_address(), r.speed_set, r.target / one,
+               r.accel_cv, r.decel_cv);
+    }
+    printf("%d ramping of %d; %lu ticks, %lu speed changes, "
+           "max %lu us/tick\n",
+           active_cnt(), _ramp_cnt, _tick_cnt, _set_cnt, _tick_max_us);
+}
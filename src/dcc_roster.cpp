@@ -0,0 +1,325 @@
+#include "dcc_roster.h"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "dcc_pkt.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+
+
+DccRoster::DccRoster() :
+    _cnt(0),
+    _dirty_next(0),
+    _moving_next(0),
+    _parked_next(0),
+    _refresh_cnt(0),
+    _parked_ms(1000),
+    _parked_every(4)
+{
+    memset(_address, 0, sizeof(_address));
+    memset(_speed, 0, sizeof(_speed));
+    memset(_funcs, 0, sizeof(_funcs));
+    memset(_dirty, 0, sizeof(_dirty));
+    memset(_seq, 0, sizeof(_seq));
+    memset(_sent_ms, 0, sizeof(_sent_ms));
+    memset(_moving_map, 0, sizeof(_moving_map));
+    memset(_parked_map, 0, sizeof(_parked_map));
+    memset(_dirty_map, 0, sizeof(_dirty_map));
+    reset_stats();
+}
+
+
+DccRoster::~DccRoster()
+{
+}
+
+
+bool DccRoster::slot_ok(int slot) const
+{
+    return 0 <= slot && slot < slot_max && _address[slot] != 0;
+}
+
+
+void DccRoster::map_set(uint32_t *map, int slot, bool on)
+{
+    uint32_t bit = 1u << (slot % 32);
+    if (on)
+        map[slot / 32] |= bit;
+    else
+        map[slot / 32] &= ~bit;
+}
+
+
+// First slot at or after 'from' (wrapping) with its bit set, or -1.
+int DccRoster::map_next(const uint32_t *map, int from) // called in interrupt context
+{
+    int w = from / 32;
+    uint32_t bits = map[w] & (~0u << (from % 32));
+    for (int n = 0; n <= map_words; n++) {
+        if (bits != 0)
+            return w * 32 + __builtin_ctz(bits);
+        if (++w >= map_words)
+            w = 0;
+        bits = map[w];
+    }
+    return -1;
+}
+
+
+int DccRoster::find(int address) const
+{
+    if (address < DccPkt::address_min || address > DccPkt::address_max)
+        return -1;
+
+    for (int s = 0; s < slot_max; s++)
+        if (_address[s] == address)
+            return s;
+    return -1;
+}
+
+
+int DccRoster::add(int address)
+{
+    if (address < DccPkt::address_min || address > DccPkt::address_max)
+        return -1;
+
+    int slot = find(address);
+    if (slot >= 0)
+        return slot;
+
+    for (slot = 0; slot < slot_max; slot++)
+        if (_address[slot] == 0)
+            break;
+    if (slot >= slot_max)
+        return -1;
+
+    uint32_t save = save_and_disable_interrupts();
+    _address[slot] = address;
+    _speed[slot] = 0;
+    _funcs[slot] = 0;
+    _seq[slot] = 0;
+    _sent_ms[slot] = 0;
+    map_set(_parked_map, slot, true);
+    _cnt++;
+    restore_interrupts(save);
+
+    // decoder might have anything; send speed and f0 group first
+    mark(slot, 0);
+    mark(slot, 1);
+
+    return slot;
+}
+
+
+bool DccRoster::remove(int slot)
+{
+    if (!slot_ok(slot))
+        return false;
+
+    uint32_t save = save_and_disable_interrupts();
+    _address[slot] = 0;
+    _dirty[slot] = 0;
+    map_set(_moving_map, slot, false);
+    map_set(_parked_map, slot, false);
+    map_set(_dirty_map, slot, false);
+    _cnt--;
+    restore_interrupts(save);
+
+    return true;
+}
+
+
+int DccRoster::moving_cnt() const
+{
+    int cnt = 0;
+    for (int w = 0; w < map_words; w++)
+        cnt += __builtin_popcount(_moving_map[w]);
+    return cnt;
+}
+
+
+int DccRoster::get_address(int slot) const
+{
+    if (!slot_ok(slot))
+        return DccPkt::address_inv;
+    return _address[slot];
+}
+
+
+void DccRoster::mark(int slot, int dirty_bit)
+{
+    uint32_t save = save_and_disable_interrupts();
+    _dirty[slot] |= (1 << dirty_bit);
+    map_set(_dirty_map, slot, true);
+    restore_interrupts(save);
+}
+
+
+bool DccRoster::set_speed(int slot, int speed)
+{
+    if (!slot_ok(slot) || speed < DccPkt::speed_min || speed > DccPkt::speed_max)
+        return false;
+
+    uint32_t save = save_and_disable_interrupts();
+    _speed[slot] = speed;
+    map_set(_moving_map, slot, speed != 0);
+    map_set(_parked_map, slot, speed == 0);
+    _dirty[slot] |= 0x01;
+    map_set(_dirty_map, slot, true);
+    restore_interrupts(save);
+
+    return true;
+}
+
+
+// Only moving locos need anything done. Interrupts are disabled so this
+// doesn't land in the middle of a main loop change.
+void DccRoster::estop() // called in any context
+{
+    uint32_t save = save_and_disable_interrupts();
+    for (int w = 0; w < map_words; w++) {
+        uint32_t bits = _moving_map[w];
+        while (bits != 0) {
+            int slot = w * 32 + __builtin_ctz(bits);
+            bits &= bits - 1;
+            _speed[slot] = 0;
+            map_set(_parked_map, slot, true);
+            _dirty[slot] |= 0x01;
+            map_set(_dirty_map, slot, true);
+        }
+        _moving_map[w] = 0;
+    }
+    restore_interrupts(save);
+}
+
+
+int DccRoster::get_speed(int slot) const
+{
+    if (!slot_ok(slot))
+        return DccPkt::speed_inv;
+    return _speed[slot];
+}
+
+
+bool DccRoster::set_function(int slot, int func, bool on)
+{
+    if (!slot_ok(slot) || func < DccPkt::function_min || func > func_max)
+        return false;
+
+    uint32_t save = save_and_disable_interrupts();
+    if (on)
+        _funcs[slot] |= (1u << func);
+    else
+        _funcs[slot] &= ~(1u << func);
+    _dirty[slot] |= (1 << (1 + DccPktFuncGroup::group_of(func)));
+    map_set(_dirty_map, slot, true);
+    restore_interrupts(save);
+
+    return true;
+}
+
+
+bool DccRoster::get_function(int slot, int func) const
+{
+    if (!slot_ok(slot) || func < DccPkt::function_min || func > func_max)
+        return false;
+    return (_funcs[slot] & (1u << func)) != 0;
+}
+
+
+// seq even is speed; odd is function group seq/2
+void DccRoster::build(DccPkt &pkt, int slot, int seq) // called in interrupt context
+{
+    if ((seq & 1) == 0) {
+        _pkt_speed.set_address(_address[slot]);
+        _pkt_speed.set_speed(_speed[slot]);
+        pkt = _pkt_speed;
+    } else {
+        const DccPktFuncGroup::Group &grp = DccPktFuncGroup::group[seq >> 1];
+        _pkt_func.set_address(_address[slot]);
+        _pkt_func.set_group(seq >> 1, _funcs[slot] >> grp.f_min);
+        pkt = _pkt_func;
+    }
+}
+
+
+bool DccRoster::next_packet(DccPkt &pkt) // called in interrupt context
+{
+    uint16_t now_ms = time_us_32() / 1000;
+
+    // changes first
+    int slot = map_next(_dirty_map, _dirty_next);
+    if (slot >= 0) {
+        uint8_t dirty = _dirty[slot];
+        int bit = __builtin_ctz(dirty);
+        dirty &= ~(1 << bit);
+        _dirty[slot] = dirty;
+        if (dirty == 0) {
+            map_set(_dirty_map, slot, false);
+            _dirty_next = (slot + 1) % slot_max;
+        }
+        build(pkt, slot, (bit == 0) ? 0 : (2 * (bit - 1) + 1));
+        _sent_ms[slot] = now_ms;
+        _dirty_pkt_cnt++;
+        return true;
+    }
+
+    bool parked_turn = false;
+    if (++_refresh_cnt >= _parked_every) {
+        _refresh_cnt = 0;
+        parked_turn = true;
+    }
+
+    int moving = map_next(_moving_map, _moving_next);
+
+    if (parked_turn || moving < 0) {
+        // The one at the cursor is the one sent longest ago (unless a change
+        // was sent since), so if it's not due, the rest aren't either.
+        slot = map_next(_parked_map, _parked_next);
+        if (slot >= 0 && uint16_t(now_ms - _sent_ms[slot]) >= _parked_ms) {
+            int seq = _seq[slot];
+            _seq[slot] = (seq + 1) % seq_max;
+            build(pkt, slot, seq);
+            _sent_ms[slot] = now_ms;
+            _parked_next = (slot + 1) % slot_max;
+            _parked_pkt_cnt++;
+            return true;
+        }
+    }
+
+    if (moving < 0)
+        return false;
+
+    int seq = _seq[moving];
+    _seq[moving] = (seq + 1) % seq_max;
+    build(pkt, moving, seq);
+    _sent_ms[moving] = now_ms;
+    _moving_next = (moving + 1) % slot_max;
+    _moving_pkt_cnt++;
+    return true;
+}
+
+
+void DccRoster::reset_stats()
+{
+    _dirty_pkt_cnt = 0;
+    _moving_pkt_cnt = 0;
+    _parked_pkt_cnt = 0;
+}
+
+
+void DccRoster::show() const
+{
+    for (int s = 0; s < slot_max; s++) {
+        if (_address[s] == 0)
+            continue;
+        printf("%4d: %4d speed %d funcs %08lx%s\n", s, int(_address[s]),
+               int(_speed[s]), _funcs[s], (_dirty[s] != 0) ? " dirty" : "");
+    }
+    printf("%d locos, %d moving; %lu change, %lu moving, %lu parked packets\n",
+           _cnt, moving_cnt(), _dirty_pkt_cnt, _moving_pkt_cnt,
+           _parked_pkt_cnt);
+}
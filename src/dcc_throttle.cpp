@@ -6,24 +6,52 @@
 #include <cstring>
 
 #include "buf_log.h"
+#include "dcc_latency.h"
 #include "dcc_pkt.h"
+#include "hardware/sync.h"
 #include "hardware/timer.h"
 #include "railcom_msg.h"
 
-DccThrottle::DccThrottle(int address) :
+DccThrottle::DccThrottle(int address, int func_max) :
+    _func_max(func_max),
+    _seq_max(2 * DccPktFuncGroup::group_cnt(func_max)),
     _seq(0),
+    _speed_refresh(true),
+    _consist_next(nullptr),
     _pkt_last(nullptr),
+    _upd_seq(0),
+    _held_cnt(0),
+    _estop_cnt(0),
+    _estop_done(0),
     _read_cv_cnt(0),
+    _cvs_val(nullptr),
+    _cvs_num(0),
+    _cvs_cnt(0),
+    _cvs_need(0),
+    _cvs_quad(0),
+    _cvs_round(0),
+    _cvs_done(false),
+    _bs_cnt(0),
+    _bs_left(0),
     _write_cv_cnt(0),
     _write_bit_cnt(0),
     _ops_cv_done(false),
     _ops_cv_status(false),
     _ops_cv_val(0),
+    _idx_op(IndexOp::NONE),
+    _idx_cv(0),
+    _idx_val(0),
+    _idx_cv_num(0),
+    _idx_cv_val(0),
     _rc_speed(0),
     _rc_speed_us(UINT64_MAX),
     _show_rc_speed(false)
 {
+    assert(DccPkt::function_min <= func_max &&
+           func_max <= DccPkt::function_max);
+    memset(_funcs, 0, sizeof(_funcs));
     set_address(address);
+    _pkt_hold = _pkt_speed;
 }
 
 DccThrottle::~DccThrottle()
@@ -35,35 +63,31 @@ int DccThrottle::get_address() const
     return _pkt_speed.get_address();
 }
 
+void DccThrottle::update_begin()
+{
+    _upd_seq = _upd_seq + 1; // odd
+    __dmb();
+}
+
+void DccThrottle::update_end()
+{
+    __dmb();
+    _upd_seq = _upd_seq + 1; // even
+}
+
 void DccThrottle::set_address(int address)
 {
+    update_begin();
+    _index.forget(); // different decoder
     _pkt_speed.set_address(address);
-    _pkt_func_0.set_address(address);
-    _pkt_func_5.set_address(address);
-    _pkt_func_9.set_address(address);
-    _pkt_func_13.set_address(address);
-#if (DCC_FUNC_MAX >= 21)
-    _pkt_func_21.set_address(address);
-#endif
-#if (DCC_FUNC_MAX >= 29)
-    _pkt_func_29.set_address(address);
-#endif
-#if (DCC_FUNC_MAX >= 37)
-    _pkt_func_37.set_address(address);
-#endif
-#if (DCC_FUNC_MAX >= 45)
-    _pkt_func_45.set_address(address);
-#endif
-#if (DCC_FUNC_MAX >= 53)
-    _pkt_func_53.set_address(address);
-#endif
-#if (DCC_FUNC_MAX >= 61)
-    _pkt_func_61.set_address(address);
-#endif
+    _pkt_func.set_address(address);
+    _pkt_binstate.set_address(address);
     _pkt_read_cv.set_address(address);
+    _pkt_read_cv4.set_address(address);
     _pkt_write_cv.set_address(address);
     _pkt_write_bit.set_address(address);
     _seq = 0;
+    update_end();
 }
 
 int DccThrottle::get_speed() const
@@ -73,133 +97,157 @@ int DccThrottle::get_speed() const
 
 void DccThrottle::set_speed(int speed)
 {
+    update_begin();
+    _estop_done = _estop_cnt; // an earlier estop() is superseded
     _pkt_speed.set_speed(speed);
     _seq &= ~1; // back up one if a function packet is next
+    update_end();
+}
+
+// Called from next_packet() and speed_packet() when no change is in progress.
+void DccThrottle::estop_apply() // called in interrupt context
+{
+    uint32_t cnt = _estop_cnt;
+    if (cnt == _estop_done)
+        return;
+    _estop_done = cnt;
+    _pkt_speed.set_speed(0);
+    _seq &= ~1;
 }
 
 bool DccThrottle::get_function(int num) const
 {
     assert(DccPkt::function_min <= num && num <= DccPkt::function_max);
 
-    if (num <= 4) {
-        return _pkt_func_0.get_f(num);
-    } else if (num <= 8) {
-        return _pkt_func_5.get_f(num);
-    } else if (num <= 12) {
-        return _pkt_func_9.get_f(num);
-    } else if (num <= 20) {
-        return _pkt_func_13.get_f(num);
-#if (DCC_FUNC_MAX >= 21)
-    } else if (num <= 28) {
-        return _pkt_func_21.get_f(num);
-#endif
-#if (DCC_FUNC_MAX >= 29)
-    } else if (num <= 36) {
-        return _pkt_func_29.get_f(num);
-#endif
-#if (DCC_FUNC_MAX >= 37)
-    } else if (num <= 44) {
-        return _pkt_func_37.get_f(num);
-#endif
-#if (DCC_FUNC_MAX >= 45)
-    } else if (num <= 52) {
-        return _pkt_func_45.get_f(num);
-#endif
-#if (DCC_FUNC_MAX >= 53)
-    } else if (num <= 60) {
-        return _pkt_func_53.get_f(num);
-#endif
-#if (DCC_FUNC_MAX >= 61)
-    } else if (num <= 68) {
-        return _pkt_func_61.get_f(num);
-#endif
-    } else {
-        assert(false);
-        return false;
-    }
+    return (_funcs[num / 32] & (1u << (num % 32))) != 0;
 }
 
 void DccThrottle::set_function(int num, bool on)
 {
     assert(DccPkt::function_min <= num && num <= DccPkt::function_max);
 
-    if (num <= 4) {
-        _pkt_func_0.set_f(num, on);
-        _seq = 1;
-    } else if (num <= 8) {
-        _pkt_func_5.set_f(num, on);
-        _seq = 3;
-    } else if (num <= 12) {
-        _pkt_func_9.set_f(num, on);
-        _seq = 5;
-    } else if (num <= 20) {
-        _pkt_func_13.set_f(num, on);
-        _seq = 7;
-#if (DCC_FUNC_MAX >= 21)
-    } else if (num <= 28) {
-        _pkt_func_21.set_f(num, on);
-        _seq = 9;
-#endif
-#if (DCC_FUNC_MAX >= 29)
-    } else if (num <= 36) {
-        _pkt_func_29.set_f(num, on);
-        _seq = 11;
-#endif
-#if (DCC_FUNC_MAX >= 37)
-    } else if (num <= 44) {
-        _pkt_func_37.set_f(num, on);
-        _seq = 13;
-#endif
-#if (DCC_FUNC_MAX >= 45)
-    } else if (num <= 52) {
-        _pkt_func_45.set_f(num, on);
-        _seq = 15;
-#endif
-#if (DCC_FUNC_MAX >= 53)
-    } else if (num <= 60) {
-        _pkt_func_53.set_f(num, on);
-        _seq = 17;
-#endif
-#if (DCC_FUNC_MAX >= 61)
-    } else if (num <= 68) {
-        _pkt_func_61.set_f(num, on);
-        _seq = 19;
-#endif
-    } else {
-        assert(false);
-    }
+    update_begin();
+
+    if (on)
+        _funcs[num / 32] |= (1u << (num % 32));
+    else
+        _funcs[num / 32] &= ~(1u << (num % 32));
+
+    // send its group next
+    int g = DccPktFuncGroup::group_of(num);
+    if (num <= _func_max)
+        _seq = 2 * g + 1;
+
+    update_end();
+}
+
+// function states for group g, f_min in bit 0
+uint32_t DccThrottle::func_bits(int g) const // called in interrupt context
+{
+    int f_min = DccPktFuncGroup::group[g].f_min;
+    int w = f_min / 32;
+    int b = f_min % 32;
+    uint32_t bits = _funcs[w] >> b;
+    // a group of 8 can straddle two words
+    if (b > 32 - 8 && w + 1 < func_words)
+        bits |= _funcs[w + 1] << (32 - b);
+    return bits;
 }
 
 // ops mode cv access
 
 void DccThrottle::read_cv(int cv_num)
 {
+    update_begin();
     _pkt_read_cv.set_cv(cv_num);
     _ops_cv_done = false;
     _ops_cv_status = false;
     // +1 because when it decrements to zero it's an error
     _read_cv_cnt = read_cv_send_cnt + 1;
+    update_end();
 }
 
 void DccThrottle::write_cv(int cv_num, uint8_t cv_val)
 {
+    _index.written(cv_num, false, cv_val); // not known until it's done
+    update_begin();
     _pkt_write_cv.set_cv(cv_num, cv_val);
     _ops_cv_done = false;
     _ops_cv_status = false;
-    _write_cv_cnt = write_cv_send_cnt;
+    // +1 because when it decrements to zero it's an error (no railcom reply)
+    _write_cv_cnt = write_cv_send_cnt + 1;
+    update_end();
 }
 
 void DccThrottle::write_bit(int cv_num, int bit_num, int bit_val)
 {
+    _index.written(cv_num, false, 0);
+    update_begin();
     _pkt_write_bit.set_cv_bit(cv_num, bit_num, bit_val);
     _ops_cv_done = false;
     _ops_cv_status = false;
-    _write_bit_cnt = write_bit_send_cnt;
+    // +1 because when it decrements to zero it's an error (no railcom reply)
+    _write_bit_cnt = write_bit_send_cnt + 1;
+    update_end();
+}
+
+void DccThrottle::write_cv_indexed(int index, int cv_num, uint8_t cv_val)
+{
+    _index.want(index);
+    _idx_op = IndexOp::WRITE_CV;
+    _idx_cv_num = cv_num;
+    _idx_cv_val = cv_val;
+    index_step();
+}
+
+void DccThrottle::read_cv_indexed(int index, int cv_num)
+{
+    _index.want(index);
+    _idx_op = IndexOp::READ_CV;
+    _idx_cv_num = cv_num;
+    index_step();
+}
+
+// Start the next operation of an indexed access: an index cv write, or the
+// operation itself.
+void DccThrottle::index_step()
+{
+    _idx_cv = _index.next(_idx_val);
+    if (_idx_cv != 0)
+        write_cv(_idx_cv, _idx_val);
+    else if (_idx_op == IndexOp::WRITE_CV)
+        write_cv(_idx_cv_num, _idx_cv_val);
+    else
+        read_cv(_idx_cv_num);
+}
+
+// Called from ops_done() when an operation is done. If it was an index cv
+// write of an indexed access, and railcom confirmed it, start the next step
+// and return true. Otherwise the indexed access is over.
+bool DccThrottle::index_next()
+{
+    if (_idx_op == IndexOp::NONE)
+        return false;
+
+    if (_idx_cv == 0) {
+        // the operation itself finished
+        _idx_op = IndexOp::NONE;
+        return false;
+    }
+
+    _index.written(_idx_cv, _ops_cv_status, _idx_val);
+    if (!_ops_cv_status) {
+        _idx_op = IndexOp::NONE;
+        return false;
+    }
+
+    index_step();
+    return true;
 }
 
 bool DccThrottle::ops_done(bool &result, uint8_t &value)
 {
-    if (!_ops_cv_done)
+    if (!_ops_cv_done || index_next())
         return false;
 
     result = _ops_cv_status;
@@ -208,6 +256,119 @@ bool DccThrottle::ops_done(bool &result, uint8_t &value)
     return true;
 }
 
+void DccThrottle::read_cvs(int cv_num, int cv_cnt, uint8_t *cv_val)
+{
+    assert(DccPkt::cv_num_min <= cv_num);
+    assert(0 < cv_cnt && cv_cnt <= read_cvs_max);
+    assert((cv_num + cv_cnt - 1) <= DccPkt::cv_num_max);
+    assert(cv_val != nullptr);
+
+    int quad_cnt = (cv_cnt + 3) / 4;
+
+    update_begin();
+    _cvs_val = nullptr; // not reading while setting up
+    _cvs_num = cv_num;
+    _cvs_cnt = cv_cnt;
+    _cvs_need = (quad_cnt == 64) ? UINT64_MAX : ((uint64_t(1) << quad_cnt) - 1);
+    _cvs_quad = 0;
+    _cvs_round = 0;
+    for (int s = 0; s < DccPktOpsRead4Cv::seq_max; s++)
+        _cvs_sent[s] = -1;
+    _cvs_done = false;
+    _cvs_val = cv_val; // start
+    update_end();
+}
+
+bool DccThrottle::read_cvs_done(int &cv_ok_cnt, uint64_t *cv_ok) const
+{
+    if (!_cvs_done)
+        return false;
+
+    int quad_cnt = (_cvs_cnt + 3) / 4;
+
+    cv_ok_cnt = 0;
+    for (int q = 0; q < quad_cnt; q++) {
+        if ((_cvs_need & (uint64_t(1) << q)) == 0) {
+            // quad was read; the last one might be partial
+            int cvs = _cvs_cnt - q * 4;
+            cv_ok_cnt += (cvs < 4 ? cvs : 4);
+        }
+    }
+
+    if (cv_ok != nullptr)
+        *cv_ok = ~_cvs_need;
+
+    return true;
+}
+
+// Return the next quad that still needs reading, or -1 if the read is done
+// (all read, or out of retries).
+int DccThrottle::cvs_next_quad() // called in interrupt context
+{
+    int quad_cnt = (_cvs_cnt + 3) / 4;
+
+    while (_cvs_need != 0) {
+        if (_cvs_quad >= quad_cnt) {
+            // end of a pass, start over with whatever is still missing
+            _cvs_quad = 0;
+            if (++_cvs_round >= read_cvs_round_max)
+                return -1;
+        }
+        int quad = _cvs_quad++;
+        if ((_cvs_need & (uint64_t(1) << quad)) != 0)
+            return quad;
+    }
+
+    return -1;
+}
+
+bool DccThrottle::set_binstate(int num, bool on)
+{
+    if (num < DccPktBinState::num_min || num > DccPktBinState::num_max)
+        return false;
+
+    bool ok = true;
+
+    // next_packet() takes them from interrupt context
+    uint32_t save = save_and_disable_interrupts();
+
+    int i;
+    for (i = 0; i < _bs_cnt; i++)
+        if (_bs[i].num == num)
+            break;
+
+    if (i < _bs_cnt) {
+        _bs[i].on = on;
+        if (i == 0)
+            _bs_left = 0; // being sent; start over with the new value
+    } else if (_bs_cnt < binstate_max) {
+        _bs[_bs_cnt].num = num;
+        _bs[_bs_cnt].on = on;
+        _bs_cnt++;
+    } else {
+        ok = false;
+    }
+
+    restore_interrupts(save);
+
+    return ok;
+}
+
+DccPkt DccThrottle::next_packet() // called in interrupt context
+{
+    if ((_upd_seq & 1) == 0) {
+        estop_apply();
+        _pkt_hold = packet_next();
+        return _pkt_hold;
+    }
+
+    // A change is in progress, so packets might be half changed. The last
+    // one is whole.
+    _held_cnt++;
+    _pkt_last = nullptr;
+    return _pkt_hold;
+}
+
 //  0. Speed     1. F0-F4
 //  2. Speed     3. F5-F8
 //  4. Speed     5. F9-F12
@@ -218,9 +379,9 @@ bool DccThrottle::ops_done(bool &result, uint8_t &value)
 // 14. Speed    15. F45-F52
 // 16. Speed    17. F53-F60
 // 18. Speed    19. F61-F68
-DccPkt DccThrottle::next_packet()
+DccPkt DccThrottle::packet_next() // called in interrupt context
 {
-    assert(0 <= _seq && _seq < seq_max);
+    assert(0 <= _seq && _seq < _seq_max);
 
     if (_read_cv_cnt > 0) {
         _read_cv_cnt--;
@@ -238,69 +399,99 @@ DccPkt DccThrottle::next_packet()
 
     if (_write_cv_cnt > 0) {
         _write_cv_cnt--;
-        _pkt_last = &_pkt_write_cv;
-        return _pkt_write_cv;
+        if (_write_cv_cnt == 0) {
+            // No response. The write may well have worked, but without
+            // railcom there is no way to know.
+            _ops_cv_done = true;
+            _ops_cv_status = false;
+            // continue on below to return a different packet
+        } else {
+            _pkt_last = &_pkt_write_cv;
+            return _pkt_write_cv;
+        }
     }
 
     if (_write_bit_cnt > 0) {
         _write_bit_cnt--;
-        _pkt_last = &_pkt_write_bit;
-        return _pkt_write_bit;
+        if (_write_bit_cnt == 0) {
+            // No response (same as write_cv)
+            _ops_cv_done = true;
+            _ops_cv_status = false;
+            // continue on below to return a different packet
+        } else {
+            _pkt_last = &_pkt_write_bit;
+            return _pkt_write_bit;
+        }
+    }
+
+    if (_cvs_val != nullptr) {
+        // Any reply to the previous quad has already been handled by
+        // railcom(), so if nothing is left the read is done.
+        int quad = cvs_next_quad();
+        if (quad >= 0) {
+            int seq = quad % DccPktOpsRead4Cv::seq_max;
+            _pkt_read_cv4.set_cv(_cvs_num + quad * 4, seq);
+            _cvs_sent[seq] = quad;
+            _pkt_last = &_pkt_read_cv4;
+            return _pkt_read_cv4;
+        }
+        _cvs_val = nullptr;
+        _cvs_done = true;
+        // continue on below to return a different packet
+    }
+
+    if (_bs_cnt > 0) {
+        if (_bs_left == 0) {
+            _pkt_binstate.set_state(_bs[0].num, _bs[0].on);
+            _bs_left = binstate_send_cnt;
+        }
+        if (--_bs_left == 0) {
+            // last time for this one
+            for (int i = 1; i < _bs_cnt; i++)
+                _bs[i - 1] = _bs[i];
+            _bs_cnt--;
+        }
+        _pkt_last = &_pkt_binstate;
+        return _pkt_binstate;
     }
 
     int seq = _seq;
 
-    if (++_seq >= seq_max)
+    if (++_seq >= _seq_max)
         _seq = 0;
 
+    if ((seq & 1) == 0 && !_speed_refresh) {
+        // speed is sent some other way; next function packet instead
+        seq++;
+        if (++_seq >= _seq_max)
+            _seq = 0;
+    }
+
     if ((seq & 1) == 0) { // if _seq even
         _pkt_last = &_pkt_speed;
         return _pkt_speed;
-    } else if (seq == 1) {
-        _pkt_last = &_pkt_func_0;
-        return _pkt_func_0;
-    } else if (seq == 3) {
-        _pkt_last = &_pkt_func_5;
-        return _pkt_func_5;
-    } else if (seq == 5) {
-        _pkt_last = &_pkt_func_9;
-        return _pkt_func_9;
-    } else if (seq == 7) {
-        _pkt_last = &_pkt_func_13;
-        return _pkt_func_13;
-#if (DCC_FUNC_MAX >= 21)
-    } else if (seq == 9) {
-        _pkt_last = &_pkt_func_21;
-        return _pkt_func_21;
-#endif
-#if (DCC_FUNC_MAX >= 29)
-    } else if (seq == 11) {
-        _pkt_last = &_pkt_func_29;
-        return _pkt_func_29;
-#endif
-#if (DCC_FUNC_MAX >= 37)
-    } else if (seq == 13) {
-        _pkt_last = &_pkt_func_37;
-        return _pkt_func_37;
-#endif
-#if (DCC_FUNC_MAX >= 45)
-    } else if (seq == 15) {
-        _pkt_last = &_pkt_func_45;
-        return _pkt_func_45;
-#endif
-#if (DCC_FUNC_MAX >= 53)
-    } else if (seq == 17) {
-        _pkt_last = &_pkt_func_53;
-        return _pkt_func_53;
-#endif
-#if (DCC_FUNC_MAX >= 61)
-    } else if (seq == 19) {
-        _pkt_last = &_pkt_func_61;
-        return _pkt_func_61;
-#endif
-    } else {
-        __builtin_unreachable();
     }
+
+    int g = seq >> 1;
+    _pkt_func.set_group(g, func_bits(g));
+    _pkt_last = &_pkt_func;
+    return _pkt_func;
+}
+
+// For a station consist, the members' speed packets are sent right after the
+// first member's.
+DccPkt DccThrottle::speed_packet() // called in interrupt context
+{
+    if ((_upd_seq & 1) == 0) {
+        estop_apply();
+        _pkt_last = &_pkt_speed;
+        _pkt_hold = _pkt_speed;
+        return _pkt_hold;
+    }
+
+    _held_cnt++;
+    _pkt_last = nullptr;
+    return _pkt_hold;
 }
 
 // This is called (at interrupt level) if any railcom channel2 messages are
@@ -308,6 +499,8 @@ DccPkt DccThrottle::next_packet()
 
 void DccThrottle::railcom(const RailComMsg *const msg, int msg_cnt) // called in interrupt context
 {
+    DccLatency::Probe l(DccLatency::THROTTLE_RAILCOM);
+
     constexpr int verbosity = 0;
 
     // verbosity 9: print all dcc sent and railcom received
@@ -388,6 +581,19 @@ void DccThrottle::railcom(const RailComMsg *const msg, int msg_cnt) // called in
                 _ops_cv_val = msg[i].pom.val;
                 _write_bit_cnt = 0;
             }
+        } else if (msg[i].id == RailComMsg::MsgId::xpom) {
+            if (_cvs_val != nullptr && _pkt_last == &_pkt_read_cv4) {
+                // The sequence number says which quad this is a reply to.
+                int quad = _cvs_sent[msg[i].xpom.ss];
+                if (quad >= 0 && (_cvs_need & (uint64_t(1) << quad)) != 0) {
+                    for (int j = 0; j < 4; j++) {
+                        int idx = quad * 4 + j;
+                        if (idx < _cvs_cnt)
+                            _cvs_val[idx] = msg[i].xpom.val[j];
+                    }
+                    _cvs_need &= ~(uint64_t(1) << quad);
+                }
+            }
         } else if (msg[i].id == RailComMsg::MsgId::dyn) {
             if (msg[i].dyn.id == RailComSpec::DynId::dyn_speed_1) {
                 if (msg[i].dyn.val != _rc_speed) {
@@ -413,26 +619,9 @@ void DccThrottle::show()
 {
     char buf[80];
     printf("%s\n", _pkt_speed.show(buf, sizeof(buf)));
-    printf("%s\n", _pkt_func_0.show(buf, sizeof(buf)));
-    printf("%s\n", _pkt_func_5.show(buf, sizeof(buf)));
-    printf("%s\n", _pkt_func_9.show(buf, sizeof(buf)));
-    printf("%s\n", _pkt_func_13.show(buf, sizeof(buf)));
-#if (DCC_FUNC_MAX >= 21)
-    printf("%s\n", _pkt_func_21.show(buf, sizeof(buf)));
-#endif
-#if (DCC_FUNC_MAX >= 29)
-    printf("%s\n", _pkt_func_29.show(buf, sizeof(buf)));
-#endif
-#if (DCC_FUNC_MAX >= 37)
-    printf("%s\n", _pkt_func_37.show(buf, sizeof(buf)));
-#endif
-#if (DCC_FUNC_MAX >= 45)
-    printf("%s\n", _pkt_func_45.show(buf, sizeof(buf)));
-#endif
-#if (DCC_FUNC_MAX >= 53)
-    printf("%s\n", _pkt_func_53.show(buf, sizeof(buf)));
-#endif
-#if (DCC_FUNC_MAX >= 61)
-    printf("%s\n", _pkt_func_61.show(buf, sizeof(buf)));
-#endif
+    DccPktFuncGroup pkt(get_address());
+    for (int g = 0; g < _seq_max / 2; g++) {
+        pkt.set_group(g, func_bits(g));
+        printf("%s\n", pkt.show(buf, sizeof(buf)));
+    }
 }
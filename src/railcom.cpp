@@ -7,6 +7,7 @@
 #include <cstring>
 
 #include "dbg_gpio.h"
+#include "dcc_latency.h"
 #include "hardware/gpio.h"
 #include "hardware/uart.h"
 
@@ -20,6 +21,7 @@ RailCom::RailCom(uart_inst_t *uart, int rx_gpio) :
     _uart(uart),
     _rx_gpio(rx_gpio),
     _pkt_len(0),
+    _inv_cnt(0),
     _ch1_msg_cnt(0),
     _ch2_msg_cnt(0),
     _parsed_all(false)
@@ -44,8 +46,10 @@ void RailCom::dbg_init()
 void RailCom::read() // called in interrupt context
 {
     DbgGpio d(dbg_read);
+    DccLatency::Probe l(DccLatency::RAILCOM_READ);
 
     _pkt_len = 0;
+    _inv_cnt = 0;
     _ch1_msg_cnt = 0;
     _ch2_msg_cnt = 0;
     _parsed_all = false;
@@ -53,11 +57,14 @@ void RailCom::read() // called in interrupt context
     for (_pkt_len = 0; _pkt_len < pkt_max && uart_is_readable(_uart); _pkt_len++) {
         _enc[_pkt_len] = uart_getc(_uart);
         _dec[_pkt_len] = RailComSpec::decode[_enc[_pkt_len]];
-        // debug: trigger on invalid data received
-        if (dbg_junk >= 0 && _dec[_pkt_len] == RailComSpec::DecId::dec_inv) {
-            DbgGpio d(dbg_junk);
-            // XXX this seems to be needed to force construction of DbgGpio
-            [[maybe_unused]] volatile int i = 0;
+        if (_dec[_pkt_len] == RailComSpec::DecId::dec_inv) {
+            _inv_cnt++;
+            // debug: trigger on invalid data received
+            if (dbg_junk >= 0) {
+                DbgGpio d(dbg_junk);
+                // XXX this seems to be needed to force construction of DbgGpio
+                [[maybe_unused]] volatile int i = 0;
+            }
         }
     } // for (_pkt_len...)
 
@@ -105,6 +112,8 @@ void RailCom::read() // called in interrupt context
 
 void RailCom::parse() // called in interrupt context
 {
+    DccLatency::Probe l(DccLatency::RAILCOM_PARSE);
+
     const uint8_t *d = _dec;
     const uint8_t *d_end = d + _pkt_len;
 
@@ -0,0 +1,90 @@
+#include "railcom_stats.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "railcom.h"
+#include "railcom_msg.h"
+
+
+void RailComStats::reset()
+{
+    _cutout_cnt = 0;
+    _reply_cnt = 0;
+    _inv_cnt = 0;
+    _short_cnt = 0;
+    _partial_cnt = 0;
+    _pom_cnt = 0;
+    _dyn_cnt = 0;
+
+    _reply_rate = 0;
+    _inv_rate = 0;
+    _short_rate = 0;
+    _partial_rate = 0;
+    _good_rate = 0;
+}
+
+
+void RailComStats::update(const RailCom &railcom) // called in interrupt context
+{
+    _cutout_cnt++;
+
+    int pkt_len = railcom.pkt_len();
+    int inv_cnt = railcom.inv_cnt();
+
+    bool reply = (pkt_len > 0);
+    // Note that a decoder with channel 1 disabled always looks short.
+    bool is_short = (reply && pkt_len < RailCom::pkt_max);
+    bool partial = (reply && !railcom.parsed_all());
+
+    const RailComMsg *msg;
+    int msg_cnt = railcom.get_ch2_msgs(msg);
+
+    bool good = false;
+    for (int i = 0; i < msg_cnt; i++) {
+        if (msg[i].id == RailComMsg::MsgId::pom) {
+            _pom_cnt++;
+            good = true;
+        } else if (msg[i].id == RailComMsg::MsgId::dyn) {
+            _dyn_cnt++;
+            good = true;
+        }
+    }
+
+    if (reply)
+        _reply_cnt++;
+    _inv_cnt += inv_cnt;
+    if (is_short)
+        _short_cnt++;
+    if (partial)
+        _partial_cnt++;
+
+    rate_update(_reply_rate, reply);
+    rate_update(_inv_rate, inv_cnt > 0);
+    rate_update(_short_rate, is_short);
+    rate_update(_partial_rate, partial);
+    rate_update(_good_rate, good);
+
+} // RailComStats::update
+
+
+const char *RailComStats::show_hdr()
+{
+    return "  cutout   reply     inv   short    part     pom     dyn  "
+           "rep% inv% sho% par% gd%";
+}
+
+
+// return argument buf so it can (e.g.) be a printf argument
+char *RailComStats::show(char *buf, int buf_len) const
+{
+    memset(buf, '\0', buf_len);
+
+    snprintf(buf, buf_len, "%8lu%8lu%8lu%8lu%8lu%8lu%8lu  %4d %4d %4d %4d %3d",
+             _cutout_cnt, _reply_cnt, _inv_cnt, _short_cnt, _partial_cnt,
+             _pom_cnt, _dyn_cnt, reply_pct(), inv_pct(), short_pct(),
+             partial_pct(), good_pct());
+
+    return buf;
+}